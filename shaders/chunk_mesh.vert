@@ -33,6 +33,10 @@ void main() {
     uint ix = in_low >> 28;
     uint iy = (in_low >> 24) & 15;
     uint iz = (in_low >> 20) & 15;
+    // 5th bit of the voxel coordinates (only set with 32x32x32 chunks)
+    ix |= ((in_high >> 19) & 1) << 4;
+    iy |= ((in_high >> 18) & 1) << 4;
+    iz |= ((in_high >> 17) & 1) << 4;
 
     uint inormalized_x = (in_low >> 12) & 255;
     uint inormalized_y = (in_low >> 4) & 255;
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <log.hpp>
+#include <math.hpp>
+#include <time.hpp>
+#include <tools.hpp>
+#include <stdint.h>
+
+namespace vkph {
+
+struct state_t;
+struct chunk_t;
+
+}
+
+namespace bench {
+
+/*
+  Creates a state with the given map loaded (from assets/maps/). Every
+  benchmark that needs a realistic world uses this.
+*/
+vkph::state_t *create_state_with_map(const char *map_path);
+
+// Time elapsed since start in nanoseconds, divided by the amount of iterations
+inline float ns_per_iteration(time_stamp_t start, uint32_t iterations) {
+    return time_difference(current_time(), start) * 1e9f / (float)iterations;
+}
+
+// The times of single runs are quite noisy, so the benchmarks take the fastest of a few runs
+constexpr uint32_t RUN_COUNT = 3;
+
+// Fastest of RUN_COUNT calls to run (which returns the time it took)
+template <typename T>
+float time_best_run(T run) {
+    float best = run();
+    for (uint32_t r = 1; r < RUN_COUNT; ++r) {
+        best = MIN(best, run());
+    }
+
+    return best;
+}
+
+// Xorshift32: the benchmarks work on the same random data every time they run
+inline uint32_t xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Between 0 and 1
+inline float random_float(uint32_t *state) {
+    return (float)(xorshift(state) & 0xFFFF) / (float)0xFFFF;
+}
+
+inline float random_float(uint32_t *state, float min, float max) {
+    return min + (max - min) * (float)(xorshift(state) & 0xFFFF) / (float)0xFFFF;
+}
+
+/*
+  The chunks of the state which contain the surface (to flfree), which is
+  where the benchmarks that need spots on the terrain pick them.
+*/
+vkph::chunk_t **get_surface_chunks(vkph::state_t *state, uint32_t *count);
+
+/*
+  Voxel coordinate of a random solid voxel in one of the surface chunks
+  (with air right above it if on_top is set).
+*/
+ivector3_t pick_surface_voxel(vkph::chunk_t **surface_chunks, uint32_t surface_chunk_count, uint32_t *seed, bool on_top);
+
+/*
+  Counts hardware cache misses of the calling thread (perf_event_open on
+  Linux). available is 0 if the counter couldn't be opened (other platforms,
+  virtual machines, perf_event_paranoid...).
+*/
+struct cache_miss_counter_t {
+    int32_t fd;
+    bool available;
+
+    void init();
+    void destroy();
+
+    void start();
+    // Misses since start()
+    uint64_t stop();
+};
+
+void run_chunk_index();
+void run_voxel_layout();
+void run_chunk_size();
+void run_voxel_order();
+void run_terraform();
+void run_generation();
+void run_map_format();
+void run_map_stream();
+void run_map_journal();
+void run_map_snapshot();
+void run_map_reset();
+void run_terrain_mips();
+void run_modification_tracker();
+void run_terrain_generation();
+void run_collision_mesh();
+void run_sphere_sweep();
+void run_terrain_rays();
+
+}
@@ -0,0 +1,169 @@
+#include "bench.hpp"
+
+#include <containers.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_chunk_index.hpp>
+
+namespace bench {
+
+/*
+  The table which was used before chunk_index_t (packs each coordinate
+  component into 10 bits).
+*/
+typedef hash_table_t<uint32_t, 1500, 30, 10> old_chunk_table_t;
+
+static constexpr uint32_t OLD_BUCKET_COUNT = 1500;
+static constexpr uint32_t OLD_BUCKET_SIZE = 30;
+
+static uint32_t s_old_hash_chunk_coord(const ivector3_t &coord) {
+    struct {
+        union {
+            struct {
+                uint32_t padding: 2;
+                uint32_t x: 10;
+                uint32_t y: 10;
+                uint32_t z: 10;
+            };
+            uint32_t value;
+        };
+    } hasher;
+
+    hasher.value = 0;
+
+    hasher.x = *(uint32_t *)(&coord.x);
+    hasher.y = *(uint32_t *)(&coord.y);
+    hasher.z = *(uint32_t *)(&coord.z);
+
+    return (uint32_t)hasher.value;
+}
+
+static constexpr uint32_t LOOKUP_COUNT = 4000000;
+
+static void s_bench_world(const char *world_name, const ivector3_t *coords, uint32_t count) {
+    LOG_INFOV("World \"%s\": %d chunks\n", world_name, count);
+
+    // Lookups happen in a random order (like physics / netcode would)
+    uint32_t *order = flmalloc<uint32_t>(LOOKUP_COUNT);
+    uint32_t seed = 0x1234567;
+    for (uint32_t i = 0; i < LOOKUP_COUNT; ++i) {
+        order[i] = xorshift(&seed) % count;
+    }
+
+    { // Old table
+        old_chunk_table_t *table = flmalloc<old_chunk_table_t>();
+        table->init();
+
+        uint32_t bucket_usage[OLD_BUCKET_COUNT] = {};
+        uint32_t dropped = 0;
+        bool *inserted = flmalloc<bool>(count);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t hash = s_old_hash_chunk_coord(coords[i]);
+            uint32_t *usage = &bucket_usage[hash % OLD_BUCKET_COUNT];
+
+            // The old table asserts when a bucket is full
+            if (*usage < OLD_BUCKET_SIZE && !table->get(hash)) {
+                table->insert(hash, i);
+                ++(*usage);
+                inserted[i] = 1;
+            }
+            else {
+                ++dropped;
+            }
+        }
+
+        volatile uint32_t sink = 0;
+
+        time_stamp_t start = current_time();
+        for (uint32_t i = 0; i < LOOKUP_COUNT; ++i) {
+            // Looking up chunks in full buckets would just spam errors
+            if (inserted[order[i]]) {
+                sink += *table->get(s_old_hash_chunk_coord(coords[order[i]]));
+            }
+        }
+        float hit_ns = ns_per_iteration(start, LOOKUP_COUNT);
+
+        LOG_INFOV("    hash_table_t<1500, 30>: %.2f ns / hit, %d chunks couldn't be inserted (full bucket or aliased coordinate)\n",
+                  hit_ns, dropped);
+
+        flfree(inserted);
+        flfree(table);
+    }
+
+    { // chunk_index_t
+        vkph::chunk_index_t index = {};
+        index.init(vkph::CHUNK_INITIAL_LOADED_COUNT * 2);
+
+        time_stamp_t start = current_time();
+        for (uint32_t i = 0; i < count; ++i) {
+            index.insert(coords[i], i);
+        }
+        float insert_ns = ns_per_iteration(start, count);
+
+        uint32_t wrong = 0;
+        volatile uint32_t sink = 0;
+
+        start = current_time();
+        for (uint32_t i = 0; i < LOOKUP_COUNT; ++i) {
+            uint32_t *found = index.get(coords[order[i]]);
+            sink += *found;
+            wrong += (*found != order[i]);
+        }
+        float hit_ns = ns_per_iteration(start, LOOKUP_COUNT);
+
+        // Misses: chunks right above the world (like neighbour lookups at the edge of the map)
+        start = current_time();
+        for (uint32_t i = 0; i < LOOKUP_COUNT; ++i) {
+            ivector3_t coord = coords[order[i]] + ivector3_t(0, 1 << 20, 0);
+            sink += (index.get(coord) != NULL);
+        }
+        float miss_ns = ns_per_iteration(start, LOOKUP_COUNT);
+
+        LOG_INFOV("    chunk_index_t: %.2f ns / insert, %.2f ns / hit, %.2f ns / miss, capacity %d, max probe length %d, %d wrong lookups\n",
+                  insert_ns, hit_ns, miss_ns, index.capacity, index.max_probe_length, wrong);
+
+        index.destroy();
+    }
+
+    flfree(order);
+}
+
+void run_chunk_index() {
+    { // Chunks of ice.map
+        vkph::state_t *state = create_state_with_map("ice.map");
+
+        uint32_t count = 0;
+        vkph::chunk_t **chunks = state->get_active_chunks(&count);
+
+        ivector3_t *coords = flmalloc<ivector3_t>(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            coords[i] = chunks[i]->chunk_coord;
+        }
+
+        s_bench_world("ice.map", coords, count);
+
+        flfree(coords);
+    }
+
+    { // 50k chunk world (37^3 cube centered on the origin)
+        static constexpr int32_t EDGE = 37;
+        uint32_t count = EDGE * EDGE * EDGE;
+        ivector3_t *coords = flmalloc<ivector3_t>(count);
+
+        uint32_t i = 0;
+        for (int32_t z = 0; z < EDGE; ++z) {
+            for (int32_t y = 0; y < EDGE; ++y) {
+                for (int32_t x = 0; x < EDGE; ++x) {
+                    coords[i++] = ivector3_t(x, y, z) - ivector3_t(EDGE / 2);
+                }
+            }
+        }
+
+        s_bench_world("50k chunks", coords, count);
+
+        flfree(coords);
+    }
+}
+
+}
@@ -0,0 +1,253 @@
+#include "bench.hpp"
+
+#include <string.h>
+#include <allocators.hpp>
+#include <serialiser.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_physics.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_terraform.hpp>
+#include <net_context.hpp>
+
+/*
+  Compares chunk sizes: build once with the default VKPH_CHUNK_EDGE_LENGTH
+  (16) and once with -DVKPH_CHUNK_EDGE_LENGTH=32, and run this in both.
+ */
+
+namespace bench {
+
+static void s_print_world_info(vkph::state_t *state) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    uint32_t dense_count = 0, surface_count = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        if (!chunks[i]) {
+            continue;
+        }
+
+        dense_count += !chunks[i]->flags.uniform;
+        surface_count += chunks[i]->occupancy.contains_surface;
+    }
+
+    LOG_INFOV("    %d chunks (%d dense, %d with surface), %.2f MB of voxels\n",
+              chunk_count, dense_count, surface_count,
+              (float)(dense_count * vkph::CHUNK_BYTE_SIZE) / (float)megabytes(1));
+}
+
+static constexpr uint32_t COLLISION_COUNT = 100000;
+
+/*
+  Every chunk a collision query overlaps is a chunk lookup (the smaller the
+  chunks, the more often queries straddle chunk borders).
+ */
+static void s_bench_collision(vkph::state_t *state) {
+    uint32_t surface_chunk_count = 0;
+    vkph::chunk_t **surface_chunks = get_surface_chunks(state, &surface_chunk_count);
+
+    uint32_t seed = 0xC0FFEE;
+    uint32_t chunks_overlapped = 0;
+    float total_ns = 0.0f;
+
+    static constexpr uint32_t BATCH_SIZE = 1000;
+
+    for (uint32_t batch = 0; batch < COLLISION_COUNT / BATCH_SIZE; ++batch) {
+        vkph::terrain_collision_t *collisions = lnmalloc<vkph::terrain_collision_t>(BATCH_SIZE);
+
+        for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+            vkph::chunk_t *c = surface_chunks[xorshift(&seed) % surface_chunk_count];
+
+            vector3_t ws_position = vector3_t(c->xs_bottom_corner) + vector3_t(
+                random_float(&seed),
+                random_float(&seed),
+                random_float(&seed)) * (float)vkph::CHUNK_EDGE_LENGTH;
+
+            vector3_t ws_velocity = vector3_t(
+                random_float(&seed) - 0.5f,
+                random_float(&seed) - 0.5f,
+                random_float(&seed) - 0.5f);
+
+            vkph::terrain_collision_t *collision = &collisions[i];
+            memset(collision, 0, sizeof(vkph::terrain_collision_t));
+            collision->ws_size = vector3_t(vkph::PLAYER_SCALE);
+            collision->ws_position = ws_position;
+            collision->ws_velocity = ws_velocity;
+            collision->es_position = collision->ws_position / collision->ws_size;
+            collision->es_velocity = collision->ws_velocity / collision->ws_size;
+
+            vector3_t ws_min = glm::min(ws_position, ws_position + ws_velocity) - collision->ws_size;
+            vector3_t ws_max = glm::max(ws_position, ws_position + ws_velocity) + collision->ws_size;
+            ivector3_t diff =
+                vkph::space_voxel_to_chunk(vkph::space_world_to_voxel(ws_max)) -
+                vkph::space_voxel_to_chunk(vkph::space_world_to_voxel(ws_min)) + ivector3_t(1);
+
+            chunks_overlapped += diff.x * diff.y * diff.z;
+        }
+
+        time_stamp_t start = current_time();
+        for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+            vkph::collide_and_slide(&collisions[i], state);
+        }
+        total_ns += time_difference(current_time(), start) * 1e9f;
+
+        lnclear();
+    }
+
+    LOG_INFOV("    collision: %.3f chunk lookups / query, collide_and_slide %.2f ns / call\n",
+              (float)chunks_overlapped / (float)COLLISION_COUNT, total_ns / (float)COLLISION_COUNT);
+
+    flfree(surface_chunks);
+}
+
+static constexpr uint32_t MESH_PASS_COUNT = 20;
+
+// Same voxel pass as in the voxel_layout benchmark, but reported per cell
+static void s_bench_mesh(vkph::state_t *state) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    uint32_t surface_cell_count = 0;
+    uint32_t cell_count = 0;
+
+    time_stamp_t start = current_time();
+
+    for (uint32_t pass = 0; pass < MESH_PASS_COUNT; ++pass) {
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            const vkph::chunk_t *c = chunks[i];
+            if (!c) {
+                continue;
+            }
+
+            for (uint32_t z = 0; z < vkph::CHUNK_EDGE_LENGTH - 1; ++z) {
+                for (uint32_t y = 0; y < vkph::CHUNK_EDGE_LENGTH - 1; ++y) {
+                    for (uint32_t x = 0; x < vkph::CHUNK_EDGE_LENGTH - 1; ++x) {
+                        ++cell_count;
+
+                        if (c->can_skip_cell(x, y, z)) {
+                            continue;
+                        }
+
+                        uint8_t bit_combination = 0;
+                        bit_combination |= (uint8_t)((c->values[vkph::get_voxel_index(x, y, z)] > vkph::CHUNK_SURFACE_LEVEL) << 0);
+                        bit_combination |= (uint8_t)((c->values[vkph::get_voxel_index(x + 1, y, z)] > vkph::CHUNK_SURFACE_LEVEL) << 1);
+                        bit_combination |= (uint8_t)((c->values[vkph::get_voxel_index(x + 1, y, z + 1)] > vkph::CHUNK_SURFACE_LEVEL) << 2);
+                        bit_combination |= (uint8_t)((c->values[vkph::get_voxel_index(x, y, z + 1)] > vkph::CHUNK_SURFACE_LEVEL) << 3);
+                        bit_combination |= (uint8_t)((c->values[vkph::get_voxel_index(x, y + 1, z)] > vkph::CHUNK_SURFACE_LEVEL) << 4);
+                        bit_combination |= (uint8_t)((c->values[vkph::get_voxel_index(x + 1, y + 1, z)] > vkph::CHUNK_SURFACE_LEVEL) << 5);
+                        bit_combination |= (uint8_t)((c->values[vkph::get_voxel_index(x + 1, y + 1, z + 1)] > vkph::CHUNK_SURFACE_LEVEL) << 6);
+                        bit_combination |= (uint8_t)((c->values[vkph::get_voxel_index(x, y + 1, z + 1)] > vkph::CHUNK_SURFACE_LEVEL) << 7);
+
+                        surface_cell_count += (bit_combination != 0 && bit_combination != 0xFF);
+                    }
+                }
+            }
+        }
+    }
+
+    float ns = ns_per_iteration(start, cell_count);
+
+    LOG_INFOV("    mesh voxel pass: %.2f ns / cell, %.2f ms / world (%d surface cells)\n",
+              ns, ns * (float)(cell_count / MESH_PASS_COUNT) / 1e6f, surface_cell_count / MESH_PASS_COUNT);
+}
+
+static constexpr uint32_t PACK_PASS_COUNT = 10;
+
+/*
+  Packs the world the way the server does when a client joins
+  (PT_CHUNK_VOXELS packets, see srv_net.cpp).
+ */
+static void s_bench_network_packing(vkph::state_t *state) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    uint32_t chunk_size = 3 * sizeof(int16_t) + vkph::CHUNK_BYTE_SIZE;
+    uint32_t chunks_per_packet = MAX(1u, (net::NET_MAX_MESSAGE_SIZE - net::NET_CHUNK_PACKET_OVERHEAD) / chunk_size);
+    uint32_t packet_size = net::NET_CHUNK_PACKET_OVERHEAD + chunks_per_packet * chunk_size;
+
+    serialiser_t serialiser = {};
+    serialiser.init(packet_size);
+
+    uint32_t packet_count = 0, total_bytes = 0, sent_chunks = 0;
+
+    time_stamp_t start = current_time();
+
+    for (uint32_t pass = 0; pass < PACK_PASS_COUNT; ++pass) {
+        serialiser.data_buffer_head = net::NET_CHUNK_PACKET_OVERHEAD;
+
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            const vkph::chunk_t *c = chunks[i];
+            if (!c || c->occupancy.max_value == 0) {
+                continue;
+            }
+
+            uint32_t before_chunk_ptr = serialiser.data_buffer_head;
+
+            serialiser.serialise_int16(c->chunk_coord.x);
+            serialiser.serialise_int16(c->chunk_coord.y);
+            serialiser.serialise_int16(c->chunk_coord.z);
+
+            if (vkph::serialise_chunk_voxels(&serialiser, c->values, c->colors)) {
+                ++sent_chunks;
+            }
+            else {
+                serialiser.data_buffer_head = before_chunk_ptr;
+            }
+
+            if (serialiser.data_buffer_head + chunk_size > serialiser.data_buffer_size) {
+                total_bytes += serialiser.data_buffer_head;
+                ++packet_count;
+                serialiser.data_buffer_head = net::NET_CHUNK_PACKET_OVERHEAD;
+            }
+        }
+
+        if (serialiser.data_buffer_head > net::NET_CHUNK_PACKET_OVERHEAD) {
+            total_bytes += serialiser.data_buffer_head;
+            ++packet_count;
+        }
+    }
+
+    float us = time_difference(current_time(), start) * 1e6f / (float)PACK_PASS_COUNT;
+
+    LOG_INFOV("    network packing: %.2f us, %d chunks in %d packets (max %d chunks / packet), %d bytes\n",
+              us, sent_chunks / PACK_PASS_COUNT, packet_count / PACK_PASS_COUNT,
+              chunks_per_packet, total_bytes / PACK_PASS_COUNT);
+
+    // (The serialiser's buffer is from the linear allocator)
+    lnclear();
+}
+
+static void s_bench_world(vkph::state_t *state) {
+    s_print_world_info(state);
+    s_bench_collision(state);
+    s_bench_mesh(state);
+    s_bench_network_packing(state);
+}
+
+void run_chunk_size() {
+    LOG_INFOV("Chunk edge length: %d\n", vkph::CHUNK_EDGE_LENGTH);
+
+    {
+        LOG_INFO("World \"ice.map\":\n");
+        vkph::state_t *state = create_state_with_map("ice.map");
+        s_bench_world(state);
+    }
+
+    {
+        LOG_INFO("World \"sphere (radius 80)\":\n");
+        vkph::state_t *state = flmalloc<vkph::state_t>();
+        state->prepare();
+
+        vkph::sphere_create_info_t info = {};
+        info.color = 0x30;
+        info.max_value = 140;
+        info.type = vkph::GT_ADDITIVE;
+        info.ws_center = vector3_t(0.0f);
+        info.ws_radius = 80.0f;
+        state->generate_sphere(&info);
+
+        s_bench_world(state);
+    }
+}
+
+}
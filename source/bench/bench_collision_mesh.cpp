@@ -0,0 +1,253 @@
+#include "bench.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <allocators.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_player.hpp>
+#include <vkph_physics.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_collision_mesh.hpp>
+
+/*
+  Server ticks with 50 players on ice.map: half of them run around throwing
+  rocks, the other half run around digging (or just running around, to see
+  what the cache does when the terrain doesn't change). Runs the same ticks
+  with the collision queries running marching cubes on the cells every time
+  (what they used to do), then with the cached collision meshes, and then
+  with the triangles culled against the swept spheres too. The players have
+  to end up at the same positions.
+ */
+
+namespace bench {
+
+static constexpr uint32_t PLAYER_COUNT = 50;
+static constexpr uint32_t TICK_COUNT = 300;
+static constexpr float TICK_DT = 1.0f / 60.0f;
+
+// Solid voxels with air right above them, in chunks which contain the surface
+static void s_pick_spawn_positions(vkph::state_t *state, vector3_t *positions) {
+    uint32_t surface_chunk_count = 0;
+    vkph::chunk_t **surface_chunks = get_surface_chunks(state, &surface_chunk_count);
+
+    uint32_t seed = 0x5AFE5EED;
+
+    for (uint32_t i = 0; i < PLAYER_COUNT; ++i) {
+        positions[i] = vector3_t(pick_surface_voxel(surface_chunks, surface_chunk_count, &seed, 1)) + vector3_t(0.5f, 2.0f, 0.5f);
+    }
+
+    flfree(surface_chunks);
+}
+
+static void s_add_players(vkph::state_t *state, const vector3_t *positions) {
+    for (uint32_t i = 0; i < PLAYER_COUNT; ++i) {
+        float angle = (float)i * 2.39996f;
+        // The diggers look at the ground in front of them
+        float down = (i % 2) ? -0.6f : -0.1f;
+
+        vkph::player_init_info_t info = {};
+        info.client_name = "bench";
+        info.client_id = (uint16_t)i;
+        info.ws_position = positions[i];
+        info.ws_view_direction = glm::normalize(vector3_t(cosf(angle), down, sinf(angle)));
+        info.ws_up_vector = vector3_t(0.0f, 1.0f, 0.0f);
+        info.default_speed = 10.0f;
+
+        vkph::player_flags_t flags = {};
+        flags.is_alive = 1;
+        flags.interaction_mode = vkph::PIM_STANDING;
+        info.flags = flags.u32;
+
+        vkph::player_t *player = state->add_player();
+        player->init(&info, state->client_to_local_id_map);
+        player->selected_weapon = i % 2;
+    }
+}
+
+// Same as tick_game() on the server (without the lag compensated player hits)
+static void s_tick(vkph::state_t *state, bool digging) {
+    for (uint32_t i = 0; i < state->players.data_count; ++i) {
+        vkph::player_t *player = state->get_player(i);
+
+        if (player && player->flags.is_alive) {
+            vkph::player_action_t action = {};
+            action.move_forward = 1;
+            // Odd players have the terraformer
+            action.trigger_left = digging || (i % 2 == 0);
+            action.dt = TICK_DT;
+            action.accumulated_dt = TICK_DT;
+
+            player->execute_action(&action, state);
+        }
+    }
+
+    for (uint32_t i = 0; i < state->rocks.list.data_count; ++i) {
+        vkph::rock_t *rock = &state->rocks.list[i];
+
+        if (rock->flags.active) {
+            bool collided_with_terrain = vkph::check_projectile_terrain_collision(rock, state);
+
+            // Rocks which missed everything get dropped once they are far away from the map
+            if (collided_with_terrain || glm::length(rock->position) > 1000.0f) {
+                vkph::player_t *p = state->get_player(state->get_local_id(rock->client_id));
+                p->weapons[rock->flags.ref_idx_weapon].active_projs[rock->flags.ref_idx_obj].initialised = 0;
+                p->weapons[rock->flags.ref_idx_weapon].active_projs.remove(rock->flags.ref_idx_obj);
+
+                rock->flags.active = 0;
+                state->rocks.list.remove(i);
+            }
+
+            rock->tick(TICK_DT);
+        }
+    }
+
+    state->rocks.clear_recent();
+}
+
+struct tick_result_t {
+    float average_ms;
+    float worst_ms;
+    uint32_t alive_count;
+    vector3_t *positions;
+    vkph::collision_stats_t stats;
+};
+
+struct collision_config_t {
+    const char *name;
+    bool caching;
+    bool culling;
+};
+
+static tick_result_t s_run_ticks(const collision_config_t &config, bool digging) {
+    vkph::set_collision_mesh_caching(config.caching);
+    vkph::set_swept_sphere_culling(config.culling);
+
+    vkph::state_t *state = create_state_with_map("ice.map");
+    state->delta_time = TICK_DT;
+
+    vector3_t spawn_positions[PLAYER_COUNT];
+    s_pick_spawn_positions(state, spawn_positions);
+    s_add_players(state, spawn_positions);
+
+    tick_result_t result = {};
+    float total_ms = 0.0f;
+
+    for (uint32_t t = 0; t < TICK_COUNT; ++t) {
+        time_stamp_t start = current_time();
+        s_tick(state, digging);
+        float ms = time_difference(current_time(), start) * 1000.0f;
+
+        // The collision queries allocate their triangles from the linear allocator (the server clears it every frame)
+        lnclear();
+
+        total_ms += ms;
+        result.worst_ms = MAX(result.worst_ms, ms);
+    }
+
+    result.average_ms = total_ms / (float)TICK_COUNT;
+    result.positions = flmalloc<vector3_t>(PLAYER_COUNT);
+
+    for (uint32_t i = 0; i < PLAYER_COUNT; ++i) {
+        vkph::player_t *player = state->get_player(i);
+        result.positions[i] = player->ws_position;
+        result.alive_count += player->flags.is_alive ? 1 : 0;
+    }
+
+    result.stats = state->collision_stats;
+
+    state->clear_chunks();
+
+    return result;
+}
+
+static tick_result_t s_run_best(const collision_config_t &config, bool digging) {
+    tick_result_t best = s_run_ticks(config, digging);
+
+    for (uint32_t r = 1; r < RUN_COUNT; ++r) {
+        tick_result_t result = s_run_ticks(config, digging);
+
+        if (result.average_ms < best.average_ms) {
+            flfree(best.positions);
+            best = result;
+        }
+        else {
+            flfree(result.positions);
+        }
+    }
+
+    return best;
+}
+
+static float s_average_us(uint64_t total_ns, uint64_t count) {
+    return count ? (float)total_ns / (float)count / 1000.0f : 0.0f;
+}
+
+static void s_print_stats(const vkph::collision_stats_t *stats) {
+    LOG_INFOV("        per tick: %.1f sweeps (+%.1f recursions), %.1f ray tests, %.1f terrain rays\n",
+              (float)stats->sweep_count / (float)TICK_COUNT,
+              (float)stats->sweep_recursion_count / (float)TICK_COUNT,
+              (float)stats->ray_test_count / (float)TICK_COUNT,
+              (float)stats->terrain_ray_count / (float)TICK_COUNT);
+
+    LOG_INFOV("        %llu triangles gathered, %llu tested (%.1f%%)\n",
+              (unsigned long long)stats->gathered_triangle_count,
+              (unsigned long long)stats->tested_triangle_count,
+              100.0f * (float)stats->tested_triangle_count / (float)MAX(stats->gathered_triangle_count, 1ull));
+
+    LOG_INFOV("        terrain rays went through %.1f cells each, %.1f which can cross the surface\n",
+              (float)stats->terrain_ray_cell_count / (float)MAX(stats->terrain_ray_count, 1ull),
+              (float)stats->terrain_ray_surface_cell_count / (float)MAX(stats->terrain_ray_count, 1ull));
+
+    LOG_INFOV("        sweep %.2f us (worst %.2f us), ray test %.2f us (worst %.2f us), terrain ray %.2f us (worst %.2f us)\n",
+              s_average_us(stats->sweep_ns, stats->sweep_count), (float)stats->max_sweep_ns / 1000.0f,
+              s_average_us(stats->ray_test_ns, stats->ray_test_count), (float)stats->max_ray_test_ns / 1000.0f,
+              s_average_us(stats->terrain_ray_ns, stats->terrain_ray_count), (float)stats->max_terrain_ray_ns / 1000.0f);
+}
+
+void run_collision_mesh() {
+    bool default_caching = vkph::get_collision_mesh_caching();
+    bool default_culling = vkph::get_swept_sphere_culling();
+
+    static const collision_config_t CONFIGS[] = {
+        { "marching cubes every query", 0, 0 },
+        { "cached collision meshes", 1, 0 },
+        { "cached + swept sphere culling", 1, 1 },
+    };
+
+    static const uint32_t CONFIG_COUNT = sizeof(CONFIGS) / sizeof(CONFIGS[0]);
+
+    LOG_INFOV("%d players, %d ticks on ice.map\n", PLAYER_COUNT, TICK_COUNT);
+
+    for (uint32_t digging = 0; digging < 2; ++digging) {
+        LOG_INFOV("    %s\n", digging ? "Half of the players digging every tick:" : "Nobody digging:");
+
+        tick_result_t results[CONFIG_COUNT];
+        bool same = 1;
+
+        for (uint32_t c = 0; c < CONFIG_COUNT; ++c) {
+            results[c] = s_run_best(CONFIGS[c], digging);
+            same &= !memcmp(results[0].positions, results[c].positions, sizeof(vector3_t) * PLAYER_COUNT);
+
+            LOG_INFOV("      %s: %7.3f ms / tick (worst %7.3f ms), %d alive, %.2fx\n",
+                      CONFIGS[c].name,
+                      results[c].average_ms,
+                      results[c].worst_ms,
+                      results[c].alive_count,
+                      results[0].average_ms / results[c].average_ms);
+
+            s_print_stats(&results[c].stats);
+        }
+
+        LOG_INFOV("      %s\n", same ? "Players ended up at the same positions" : "PLAYERS ENDED UP AT DIFFERENT POSITIONS");
+
+        for (uint32_t c = 0; c < CONFIG_COUNT; ++c) {
+            flfree(results[c].positions);
+        }
+    }
+
+    vkph::set_collision_mesh_caching(default_caching);
+    vkph::set_swept_sphere_culling(default_culling);
+}
+
+}
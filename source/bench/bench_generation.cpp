@@ -0,0 +1,163 @@
+#include "bench.hpp"
+
+#include <math.h>
+#include <thread>
+#include <allocators.hpp>
+#include <worker_pool.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_terraform.hpp>
+
+/*
+  Generates the same world with different amounts of workers in the pool.
+  The generators split the work by chunk, so the world has to come out the
+  same whatever the amount of threads.
+ */
+
+namespace bench {
+
+// Same as s_bumps in srv_game.cpp
+static float s_bumps(float x, float y, float z) {
+    float right = sin(0.1f * x) * cos(0.1f * y)  * 10.0f;
+
+    float dist = fabs(right - z);
+
+    if (dist < 4.0f) {
+        return 1.0f - (dist / 4.0f);
+    }
+    else {
+        return 0.0f;
+    }
+}
+
+static uint64_t s_world_checksum(vkph::state_t *state) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    // Depends on the order of the chunks too (the order in which they got created)
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        const vkph::chunk_t *c = chunks[i];
+        if (!c) {
+            continue;
+        }
+
+        checksum = checksum * 1000003 + (uint64_t)(c->chunk_coord.x * 73856093 ^ c->chunk_coord.y * 19349663 ^ c->chunk_coord.z * 83492791);
+        for (uint32_t v = 0; v < vkph::CHUNK_VOXEL_COUNT; ++v) {
+            checksum = checksum * 31 + c->values[v] * 257 + c->colors[v];
+        }
+    }
+
+    return checksum;
+}
+
+struct generation_result_t {
+    float equation_ms;
+    float sphere_ms;
+    float hollow_sphere_ms;
+    uint32_t chunk_count;
+    uint64_t checksum;
+};
+
+static void s_count_progress_calls(uint32_t, uint32_t, void *data) {
+    ++*(uint32_t *)data;
+}
+
+static generation_result_t s_generate_world(vkph::state_t *state, uint32_t *progress_call_count) {
+    state->clear_chunks();
+
+    generation_result_t result = {};
+
+    {
+        vkph::math_equation_create_info_t info = {};
+        info.ws_center = vector3_t(0.0f);
+        info.ws_extent = vector3_t(320.0f, 64.0f, 320.0f);
+        info.equation = &s_bumps;
+        info.type = vkph::GT_ADDITIVE;
+        info.color = 0x20;
+        info.progress = &s_count_progress_calls;
+        info.progress_data = progress_call_count;
+
+        time_stamp_t start = current_time();
+        state->generate_math_equation(&info);
+        result.equation_ms = time_difference(current_time(), start) * 1000.0f;
+    }
+
+    {
+        vkph::sphere_create_info_t info = {};
+        info.ws_center = vector3_t(40.0f, 30.0f, -20.0f);
+        info.ws_radius = 80.0f;
+        info.max_value = 140;
+        info.type = vkph::GT_ADDITIVE;
+        info.color = 0x30;
+        info.progress = &s_count_progress_calls;
+        info.progress_data = progress_call_count;
+
+        time_stamp_t start = current_time();
+        state->generate_sphere(&info);
+        result.sphere_ms = time_difference(current_time(), start) * 1000.0f;
+    }
+
+    {
+        vkph::sphere_create_info_t info = {};
+        info.ws_center = vector3_t(-100.0f, 0.0f, 60.0f);
+        info.ws_radius = 70.0f;
+        info.max_value = 250;
+        info.type = vkph::GT_ADDITIVE;
+        info.color = 0x40;
+        info.progress = &s_count_progress_calls;
+        info.progress_data = progress_call_count;
+
+        time_stamp_t start = current_time();
+        state->generate_hollow_sphere(&info);
+        result.hollow_sphere_ms = time_difference(current_time(), start) * 1000.0f;
+    }
+
+    state->get_active_chunks(&result.chunk_count);
+    result.checksum = s_world_checksum(state);
+
+    return result;
+}
+
+void run_generation() {
+    uint32_t hardware_thread_count = std::thread::hardware_concurrency();
+    LOG_INFOV("%d hardware threads\n", hardware_thread_count);
+
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+
+    worker_pool_t *pool = get_worker_pool();
+    uint32_t default_worker_count = pool->worker_count;
+
+    static const uint32_t WORKER_COUNTS[] = { 0, 1, 3, 7, 15 };
+    generation_result_t reference = {};
+
+    for (uint32_t i = 0; i < sizeof(WORKER_COUNTS) / sizeof(WORKER_COUNTS[0]); ++i) {
+        pool->destroy();
+        pool->init(WORKER_COUNTS[i]);
+
+        uint32_t progress_call_count = 0;
+        generation_result_t result = s_generate_world(state, &progress_call_count);
+
+        if (i == 0) {
+            reference = result;
+        }
+
+        LOG_INFOV("    %d threads: equation %.2f ms, sphere %.2f ms, hollow sphere %.2f ms (%.2fx), %d chunks, %d progress calls, %s\n",
+                  WORKER_COUNTS[i] + 1,
+                  result.equation_ms,
+                  result.sphere_ms,
+                  result.hollow_sphere_ms,
+                  (reference.equation_ms + reference.sphere_ms + reference.hollow_sphere_ms) /
+                  (result.equation_ms + result.sphere_ms + result.hollow_sphere_ms),
+                  result.chunk_count,
+                  progress_call_count,
+                  result.checksum == reference.checksum ? "same world" : "DIFFERENT WORLD");
+    }
+
+    pool->destroy();
+    pool->init(default_worker_count);
+}
+
+}
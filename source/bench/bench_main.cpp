@@ -0,0 +1,182 @@
+#include "bench.hpp"
+
+#include <string.h>
+#include <files.hpp>
+#include <allocators.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace bench {
+
+vkph::state_t *create_state_with_map(const char *map_path) {
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+    state->load_map(map_path);
+
+    return state;
+}
+
+vkph::chunk_t **get_surface_chunks(vkph::state_t *state, uint32_t *count) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    vkph::chunk_t **surface_chunks = flmalloc<vkph::chunk_t *>(MAX(chunk_count, 1u));
+    *count = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        if (chunks[i] && chunks[i]->occupancy.contains_surface) {
+            surface_chunks[(*count)++] = chunks[i];
+        }
+    }
+
+    return surface_chunks;
+}
+
+ivector3_t pick_surface_voxel(vkph::chunk_t **surface_chunks, uint32_t surface_chunk_count, uint32_t *seed, bool on_top) {
+    // The voxel above has to be in the same chunk
+    uint32_t y_range = on_top ? vkph::CHUNK_EDGE_LENGTH - 1 : vkph::CHUNK_EDGE_LENGTH;
+
+    for (;;) {
+        vkph::chunk_t *c = surface_chunks[xorshift(seed) % surface_chunk_count];
+        uint32_t rnd = xorshift(seed);
+        uint32_t x = rnd % vkph::CHUNK_EDGE_LENGTH;
+        uint32_t y = (rnd >> 8) % y_range;
+        uint32_t z = (rnd >> 16) % vkph::CHUNK_EDGE_LENGTH;
+
+        if (c->values[vkph::get_voxel_index(x, y, z)] > vkph::CHUNK_SURFACE_LEVEL &&
+            (!on_top || c->values[vkph::get_voxel_index(x, y + 1, z)] <= vkph::CHUNK_SURFACE_LEVEL)) {
+            return c->xs_bottom_corner + ivector3_t(x, y, z);
+        }
+    }
+}
+
+void cache_miss_counter_t::init() {
+    fd = -1;
+    available = 0;
+
+#if defined(__linux__)
+    perf_event_attr attributes = {};
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.size = sizeof(perf_event_attr);
+    attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+    attributes.disabled = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    fd = (int32_t)syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+    available = (fd >= 0);
+#endif
+}
+
+void cache_miss_counter_t::destroy() {
+#if defined(__linux__)
+    if (available) {
+        close(fd);
+    }
+#endif
+
+    fd = -1;
+    available = 0;
+}
+
+void cache_miss_counter_t::start() {
+#if defined(__linux__)
+    if (available) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+uint64_t cache_miss_counter_t::stop() {
+    uint64_t count = 0;
+
+#if defined(__linux__)
+    if (available) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+            count = 0;
+        }
+    }
+#endif
+
+    return count;
+}
+
+struct benchmark_t {
+    const char *name;
+    void (* proc)();
+};
+
+static benchmark_t benchmarks[] = {
+    { "chunk_index", &run_chunk_index },
+    { "voxel_layout", &run_voxel_layout },
+    { "chunk_size", &run_chunk_size },
+    { "voxel_order", &run_voxel_order },
+    { "terraform", &run_terraform },
+    { "generation", &run_generation },
+    { "map_format", &run_map_format },
+    { "map_stream", &run_map_stream },
+    { "map_journal", &run_map_journal },
+    { "map_snapshot", &run_map_snapshot },
+    { "map_reset", &run_map_reset },
+    { "terrain_mips", &run_terrain_mips },
+    { "modification_tracker", &run_modification_tracker },
+    { "terrain_generation", &run_terrain_generation },
+    { "collision_mesh", &run_collision_mesh },
+    { "sphere_sweep", &run_sphere_sweep },
+    { "terrain_rays", &run_terrain_rays },
+};
+
+static constexpr uint32_t BENCHMARK_COUNT = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+static int32_t s_run(int32_t argc, char *argv[]) {
+    global_linear_allocator_init((uint32_t)megabytes(30));
+    files_init();
+
+    bool ran_any = 0;
+
+    for (uint32_t i = 0; i < BENCHMARK_COUNT; ++i) {
+        bool requested = (argc < 2);
+
+        for (int32_t a = 1; a < argc; ++a) {
+            if (!strcmp(argv[a], benchmarks[i].name)) {
+                requested = 1;
+            }
+        }
+
+        if (requested) {
+            LOG_INFOV("Running benchmark: %s\n", benchmarks[i].name);
+            benchmarks[i].proc();
+            ran_any = 1;
+
+            lnclear();
+        }
+    }
+
+    if (!ran_any) {
+        LOG_ERROR("No benchmark matched - available benchmarks:\n");
+        for (uint32_t i = 0; i < BENCHMARK_COUNT; ++i) {
+            printf("    %s\n", benchmarks[i].name);
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+}
+
+// Entry point for the benchmarks (pass benchmark names to only run those)
+int32_t main(
+    int32_t argc,
+    char *argv[]) {
+    return bench::s_run(argc, argv);
+}
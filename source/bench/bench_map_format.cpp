@@ -0,0 +1,531 @@
+#include "bench.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <files.hpp>
+#include <allocators.hpp>
+#include <vkph_map.hpp>
+#include <vkph_map_stream.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_terraform.hpp>
+
+/*
+  Map files: version 1 (what the maps in assets/maps are in) against
+  version 2 (compressed blocks with a directory, read through mmap),
+  load_map() against stream_map(), saving the whole map against only
+  saving the changes to the journal, how long the game stops for when
+  the map gets saved (save_map()) or snapshotted (save_map_in_background()),
+  and resetting the map from its baseline against loading it again.
+  The files are in the page cache after the first run, so this measures
+  decompression and chunk creation, not the disk.
+ */
+
+namespace bench {
+
+// Loads / saves are short, so these take the fastest of more runs than RUN_COUNT
+static constexpr uint32_t MAP_RUN_COUNT = 20;
+
+static uint64_t s_world_checksum(vkph::state_t *state) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    // Order independent, so that it doesn't depend on the order chunks got created in
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        const vkph::chunk_t *c = chunks[i];
+        // Empty chunks don't get saved
+        if (!c || c->occupancy.max_value == 0) {
+            continue;
+        }
+
+        uint64_t chunk_checksum = (uint64_t)(c->chunk_coord.x * 73856093 ^ c->chunk_coord.y * 19349663 ^ c->chunk_coord.z * 83492791);
+        for (uint32_t v = 0; v < vkph::CHUNK_VOXEL_COUNT; ++v) {
+            chunk_checksum = chunk_checksum * 31 + c->values[v] * 257 + c->colors[v];
+        }
+
+        checksum += chunk_checksum;
+    }
+
+    return checksum;
+}
+
+static float s_time_load(vkph::state_t *state, const char *map_path) {
+    float best_ms = 1e9f;
+
+    for (uint32_t i = 0; i < MAP_RUN_COUNT; ++i) {
+        state->clear_chunks();
+
+        time_stamp_t start = current_time();
+        state->load_map(map_path);
+        best_ms = MIN(best_ms, time_difference(current_time(), start) * 1000.0f);
+
+        lnclear();
+    }
+
+    return best_ms;
+}
+
+static float s_time_save(vkph::state_t *state, const char *map_path) {
+    vkph::map_t map = state->current_map_data;
+    map.path = map_path;
+
+    float best_ms = 1e9f;
+
+    for (uint32_t i = 0; i < MAP_RUN_COUNT; ++i) {
+        // Always writes the whole map, even if it is the one which got loaded (see run_map_journal)
+        state->flags.chunks_match_map_file = 0;
+
+        time_stamp_t start = current_time();
+        state->save_map(&map);
+        best_ms = MIN(best_ms, time_difference(current_time(), start) * 1000.0f);
+
+        lnclear();
+    }
+
+    return best_ms;
+}
+
+// Only opening the file and decompressing the blocks (no chunks), in uncompressed MB / s
+static float s_decode_throughput(const char *map_path) {
+    uint8_t values[vkph::MAP_CHUNK_VOXEL_COUNT];
+    vkph::voxel_color_t colors[vkph::MAP_CHUNK_VOXEL_COUNT];
+
+    float best_s = 1e9f;
+    uint32_t block_count = 0;
+
+    for (uint32_t i = 0; i < MAP_RUN_COUNT; ++i) {
+        time_stamp_t start = current_time();
+
+        vkph::map_file_t file = {};
+        file.open(map_path);
+
+        for (uint32_t b = 0; b < file.block_count; ++b) {
+            file.read_block(b, values, colors);
+        }
+
+        block_count = file.block_count;
+        file.close();
+
+        best_s = MIN(best_s, time_difference(current_time(), start));
+    }
+
+    return (float)block_count * (float)vkph::MAP_BLOCK_BYTE_SIZE / best_s / (1024.0f * 1024.0f);
+}
+
+static uint32_t s_file_size(const char *map_path) {
+    char full_path[100] = {};
+    snprintf(full_path, sizeof(full_path), "assets/maps/%s", map_path);
+
+    file_mapping_t mapping = map_file(full_path);
+    uint32_t size = mapping.size;
+    unmap_file(mapping);
+
+    return size;
+}
+
+static void s_remove_map(const char *map_path) {
+    char full_path[100] = {};
+    snprintf(full_path, sizeof(full_path), "assets/maps/%s", map_path);
+
+    delete_file(full_path);
+
+    snprintf(full_path, sizeof(full_path), "assets/maps/%s.journal", map_path);
+    delete_file(full_path);
+}
+
+// Same as s_bumps in srv_game.cpp
+static float s_bumps(float x, float y, float z) {
+    float right = sin(0.1f * x) * cos(0.1f * y)  * 10.0f;
+
+    float dist = fabs(right - z);
+
+    if (dist < 4.0f) {
+        return 1.0f - (dist / 4.0f);
+    }
+    else {
+        return 0.0f;
+    }
+}
+
+// A world a lot bigger than ice.map (like the ones the map creator can make)
+static void s_generate_big_world(vkph::state_t *state) {
+    state->clear_chunks();
+
+    vkph::math_equation_create_info_t equation_info = {};
+    equation_info.ws_center = vector3_t(0.0f);
+    equation_info.ws_extent = vector3_t(320.0f, 64.0f, 320.0f);
+    equation_info.equation = &s_bumps;
+    equation_info.type = vkph::GT_ADDITIVE;
+    equation_info.color = 0x20;
+    state->generate_math_equation(&equation_info);
+
+    vkph::sphere_create_info_t sphere_info = {};
+    sphere_info.ws_center = vector3_t(40.0f, 30.0f, -20.0f);
+    sphere_info.ws_radius = 80.0f;
+    sphere_info.max_value = 140;
+    sphere_info.type = vkph::GT_ADDITIVE;
+    sphere_info.color = 0x30;
+    state->generate_sphere(&sphere_info);
+
+    state->current_map_data.name = "Big world";
+    state->current_map_data.view_info = {};
+}
+
+void run_map_format() {
+    static const char *V2_PATH = "bench_map_format.map";
+
+    { // ice.map
+        vkph::state_t *state = create_state_with_map("ice.map");
+        uint64_t v1_checksum = s_world_checksum(state);
+
+        vkph::convert_map_file("ice.map", V2_PATH);
+
+        float v1_load_ms = s_time_load(state, "ice.map");
+        float v2_load_ms = s_time_load(state, V2_PATH);
+        uint64_t v2_checksum = s_world_checksum(state);
+
+        float v2_save_ms = s_time_save(state, V2_PATH);
+
+        LOG_INFOV("World \"ice.map\" (%d blocks):\n", state->current_map_data.chunk_count);
+        LOG_INFOV("    version 1: %d bytes, load %.3f ms, decode %.1f MB/s\n",
+                  s_file_size("ice.map"), v1_load_ms, s_decode_throughput("ice.map"));
+        LOG_INFOV("    version 2: %d bytes, load %.3f ms (%.2fx), decode %.1f MB/s, save %.3f ms, %s\n",
+                  s_file_size(V2_PATH), v2_load_ms, v1_load_ms / v2_load_ms, s_decode_throughput(V2_PATH),
+                  v2_save_ms,
+                  v1_checksum == v2_checksum ? "same world" : "DIFFERENT WORLD");
+    }
+
+    { // Generated world
+        vkph::state_t *state = flmalloc<vkph::state_t>();
+        state->prepare();
+
+        s_generate_big_world(state);
+        uint64_t checksum = s_world_checksum(state);
+
+        float save_ms = s_time_save(state, V2_PATH);
+        uint32_t file_size = s_file_size(V2_PATH);
+        float load_ms = s_time_load(state, V2_PATH);
+
+        LOG_INFOV("Generated world (%d blocks):\n", state->current_map_data.chunk_count);
+        LOG_INFOV("    version 2: %d bytes, save %.3f ms, load %.3f ms, decode %.1f MB/s, %s\n",
+                  file_size, save_ms, load_ms, s_decode_throughput(V2_PATH),
+                  checksum == s_world_checksum(state) ? "same world" : "DIFFERENT WORLD");
+    }
+
+    s_remove_map(V2_PATH);
+}
+
+struct stream_timings_t {
+    time_stamp_t start;
+    float first_publish_ms;
+    uint32_t first_publish_count;
+};
+
+static void s_record_first_publish(uint32_t published_count, uint32_t, void *data) {
+    stream_timings_t *timings = (stream_timings_t *)data;
+
+    if (timings->first_publish_count == 0) {
+        timings->first_publish_ms = time_difference(current_time(), timings->start) * 1000.0f;
+        timings->first_publish_count = published_count;
+    }
+}
+
+void run_map_stream() {
+    static const char *MAP_PATH = "bench_map_stream.map";
+
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+
+    s_generate_big_world(state);
+    state->current_map_data.path = MAP_PATH;
+    state->save_map(NULL);
+
+    float load_ms = s_time_load(state, MAP_PATH);
+    uint64_t checksum = s_world_checksum(state);
+
+    LOG_INFOV("Generated world (%d blocks), load_map: %.3f ms\n", state->current_map_data.chunk_count, load_ms);
+
+    // Where players would be
+    vector3_t ws_focus = vector3_t(0.0f, 20.0f, 0.0f);
+
+    for (uint32_t run = 0; run < 3; ++run) {
+        state->clear_chunks();
+        lnclear();
+
+        stream_timings_t timings = {};
+        timings.start = current_time();
+
+        state->stream_map(MAP_PATH, &ws_focus, &s_record_first_publish, &timings);
+        float return_ms = time_difference(current_time(), timings.start) * 1000.0f;
+
+        // Ticks as fast as possible (the server sleeps in between)
+        uint32_t tick_count = 0;
+        float longest_tick_ms = 0.0f;
+
+        while (state->is_streaming_map()) {
+            time_stamp_t tick_start = current_time();
+            state->timestep_begin(1.0f / 100.0f);
+            longest_tick_ms = MAX(longest_tick_ms, time_difference(current_time(), tick_start) * 1000.0f);
+
+            ++tick_count;
+        }
+
+        float total_ms = time_difference(current_time(), timings.start) * 1000.0f;
+
+        LOG_INFOV("    stream_map: returns after %.3f ms, first %d blocks (closest to the focus) after %.3f ms, all after %.3f ms (%d ticks, longest %.3f ms), %s\n",
+                  return_ms, timings.first_publish_count, timings.first_publish_ms, total_ms,
+                  tick_count, longest_tick_ms,
+                  checksum == s_world_checksum(state) ? "same world" : "DIFFERENT WORLD");
+    }
+
+    s_remove_map(MAP_PATH);
+}
+
+// A brush stroke, like in the map creator
+static void s_brush_stroke(vkph::state_t *state, const vector3_t &ws_position) {
+    vkph::terraform_package_t package = {};
+    package.ray_hit_terrain = 1;
+    package.ws_position = ws_position;
+    package.color = 0x40;
+
+    vkph::terraform_info_t info = {};
+    info.type = vkph::TT_BUILD;
+    info.package = &package;
+    info.radius = 3.0f;
+    info.speed = 300.0f;
+    info.dt = 1.0f / 60.0f;
+
+    state->terraform(&info);
+    state->reset_modification_tracker();
+}
+
+void run_map_journal() {
+    static const char *MAP_PATH = "bench_map_journal.map";
+    static const char *FULL_MAP_PATH = "bench_map_journal_full.map";
+
+    char journal_path[100] = {};
+    snprintf(journal_path, sizeof(journal_path), "%s.journal", MAP_PATH);
+
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+
+    s_generate_big_world(state);
+    state->current_map_data.path = MAP_PATH;
+
+    float full_save_ms = s_time_save(state, FULL_MAP_PATH);
+    state->save_map(NULL);
+
+    uint32_t map_size = s_file_size(MAP_PATH);
+
+    state->clear_chunks();
+    lnclear();
+    state->load_map(MAP_PATH);
+
+    float stroke_save_ms = 1e9f;
+    uint32_t max_entry_size = 0;
+    uint32_t stroke_count = 0;
+
+    for (uint32_t i = 0; i < MAP_RUN_COUNT; ++i) {
+        s_brush_stroke(state, vector3_t(-100.0f + 10.0f * (float)i, 0.0f, 5.0f));
+
+        uint32_t journal_size = s_file_size(journal_path);
+
+        time_stamp_t start = current_time();
+        state->save_map(NULL);
+        stroke_save_ms = MIN(stroke_save_ms, time_difference(current_time(), start) * 1000.0f);
+
+        uint32_t new_journal_size = s_file_size(journal_path);
+
+        if (new_journal_size > journal_size) {
+            // (Otherwise, the journal got compacted)
+            max_entry_size = MAX(max_entry_size, new_journal_size - journal_size);
+            ++stroke_count;
+        }
+
+        lnclear();
+    }
+
+    uint64_t checksum = s_world_checksum(state);
+    uint32_t journal_size = s_file_size(journal_path);
+
+    float journal_load_ms = s_time_load(state, MAP_PATH);
+
+    LOG_INFOV("Generated world (%d blocks, %d bytes):\n", state->current_map_data.chunk_count, map_size);
+    LOG_INFOV("    whole map: save %.3f ms\n", full_save_ms);
+    LOG_INFOV("    one brush stroke: save %.3f ms, up to %d bytes (%d strokes in the journal, %d bytes, load %.3f ms), %s\n",
+              stroke_save_ms, max_entry_size, stroke_count, journal_size, journal_load_ms,
+              checksum == s_world_checksum(state) ? "same world" : "DIFFERENT WORLD");
+
+    s_remove_map(MAP_PATH);
+    s_remove_map(FULL_MAP_PATH);
+}
+
+// Ticks with a brush stroke each (at the server's 100 ticks per second), until the background save is done
+struct snapshot_ticks_t {
+    uint32_t count;
+    float max_ms;
+    float total_ms;
+};
+
+static snapshot_ticks_t s_tick_while_saving(vkph::state_t *state, uint32_t first_stroke) {
+    snapshot_ticks_t ticks = {};
+
+    for (uint32_t i = first_stroke; state->is_saving_map(); ++i) {
+        time_stamp_t start = current_time();
+
+        s_brush_stroke(state, vector3_t(-150.0f + 3.0f * (float)(i % 100), 0.0f, -50.0f + (float)(i / 100)));
+        state->timestep_begin(1.0f / 60.0f);
+
+        float ms = time_difference(current_time(), start) * 1000.0f;
+        ticks.max_ms = MAX(ticks.max_ms, ms);
+        ticks.total_ms += ms;
+        ++ticks.count;
+
+        lnclear();
+
+        if (ms < 10.0f) {
+            sleep_seconds((10.0f - ms) / 1000.0f);
+        }
+    }
+
+    return ticks;
+}
+
+void run_map_snapshot() {
+    static const char *MAP_PATH = "bench_map_snapshot.map";
+
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+
+    s_generate_big_world(state);
+    state->current_map_data.path = MAP_PATH;
+
+    float sync_ms = s_time_save(state, MAP_PATH);
+
+    // The whole map (the chunks don't match the file)
+    float freeze_ms = 1e9f;
+    float write_ms = 0.0f;
+    snapshot_ticks_t ticks = {};
+    bool same_world = 1;
+
+    for (uint32_t i = 0; i < MAP_RUN_COUNT; ++i) {
+        state->flags.chunks_match_map_file = 0;
+        uint64_t checksum = s_world_checksum(state);
+
+        time_stamp_t start = current_time();
+        state->save_map_in_background(NULL);
+        freeze_ms = MIN(freeze_ms, time_difference(current_time(), start) * 1000.0f);
+
+        snapshot_ticks_t run_ticks = s_tick_while_saving(state, i * 7);
+        write_ms += time_difference(current_time(), start) * 1000.0f;
+
+        ticks.count += run_ticks.count;
+        ticks.max_ms = MAX(ticks.max_ms, run_ticks.max_ms);
+        ticks.total_ms += run_ticks.total_ms;
+
+        if (i == 0) {
+            // The file has the world from when it got frozen, not the strokes which came after
+            vkph::state_t *check = flmalloc<vkph::state_t>();
+            check->prepare();
+            check->load_map(MAP_PATH);
+            same_world = (s_world_checksum(check) == checksum);
+            check->clear_chunks();
+            flfree(check);
+            lnclear();
+        }
+    }
+
+    // Brush strokes without a snapshot (no copies on write)
+    float stroke_ms = 0.0f;
+    for (uint32_t i = 0; i < ticks.count; ++i) {
+        time_stamp_t start = current_time();
+        s_brush_stroke(state, vector3_t(-150.0f + 3.0f * (float)(i % 100), 0.0f, 50.0f));
+        state->timestep_begin(1.0f / 60.0f);
+        stroke_ms += time_difference(current_time(), start) * 1000.0f;
+
+        lnclear();
+    }
+
+    // Only the chunks which changed since the last save
+    float changes_freeze_ms = 1e9f;
+    for (uint32_t i = 0; i < MAP_RUN_COUNT; ++i) {
+        s_brush_stroke(state, vector3_t(-100.0f + 10.0f * (float)i, 0.0f, 5.0f));
+
+        time_stamp_t start = current_time();
+        state->save_map_in_background(NULL);
+        changes_freeze_ms = MIN(changes_freeze_ms, time_difference(current_time(), start) * 1000.0f);
+
+        state->finish_map_snapshot();
+        lnclear();
+    }
+
+    uint32_t chunk_count = 0;
+    state->get_active_chunks(&chunk_count);
+
+    LOG_INFOV("Generated world (%d chunks):\n", chunk_count);
+    LOG_INFOV("    save_map(): game stops for %.3f ms\n", sync_ms);
+    LOG_INFOV("    save_map_in_background(): game stops for %.3f ms, written in %.3f ms (average), %s\n",
+              freeze_ms, write_ms / (float)MAP_RUN_COUNT, same_world ? "file has the frozen world" : "FILE HAS A DIFFERENT WORLD");
+    LOG_INFOV("    ticks with a brush stroke while writing: %d, average %.3f ms (%.3f ms without a snapshot), max %.3f ms\n",
+              ticks.count, ticks.total_ms / (float)MAX(ticks.count, 1u), stroke_ms / (float)MAX(ticks.count, 1u), ticks.max_ms);
+    LOG_INFOV("    changes since the last save: game stops for %.3f ms\n", changes_freeze_ms);
+
+    state->clear_chunks();
+    s_remove_map(MAP_PATH);
+}
+
+void run_map_reset() {
+    static const char *MAP_PATH = "bench_map_reset.map";
+
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+
+    s_generate_big_world(state);
+    state->current_map_data.path = MAP_PATH;
+    state->save_map(NULL);
+
+    float load_ms = s_time_load(state, MAP_PATH);
+    uint64_t checksum = s_world_checksum(state);
+
+    uint32_t chunk_count = 0;
+    state->get_active_chunks(&chunk_count);
+
+    state->capture_baseline();
+
+    LOG_INFOV("Generated world (%d chunks): clear_chunks() + load_map() %.3f ms\n", chunk_count, load_ms);
+
+    static const uint32_t STROKE_COUNTS[] = { 1, 10, 100, 1000 };
+
+    for (uint32_t s = 0; s < sizeof(STROKE_COUNTS) / sizeof(STROKE_COUNTS[0]); ++s) {
+        float reset_ms = 1e9f;
+        uint32_t reverted_count = 0;
+        bool same_world = 1;
+
+        for (uint32_t i = 0; i < MAP_RUN_COUNT; ++i) {
+            for (uint32_t stroke = 0; stroke < STROKE_COUNTS[s]; ++stroke) {
+                // Spread around the whole world, like players fighting all over the map
+                uint32_t cell = (stroke * 7919 + i * 104729) % 4096;
+                s_brush_stroke(state, vector3_t(-150.0f + (float)(cell % 64) * 4.7f, 0.0f, -150.0f + (float)(cell / 64) * 4.7f));
+            }
+
+            time_stamp_t start = current_time();
+            reverted_count = state->reset_to_baseline();
+            reset_ms = MIN(reset_ms, time_difference(current_time(), start) * 1000.0f);
+
+            same_world &= (s_world_checksum(state) == checksum);
+
+            lnclear();
+        }
+
+        LOG_INFOV("    %d brush strokes: reset_to_baseline() %.3f ms (%d chunks reverted, %.1fx faster), %s\n",
+                  STROKE_COUNTS[s], reset_ms, reverted_count, load_ms / reset_ms,
+                  same_world ? "same world" : "DIFFERENT WORLD");
+    }
+
+    state->clear_chunks();
+    s_remove_map(MAP_PATH);
+}
+
+}
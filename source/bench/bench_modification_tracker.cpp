@@ -0,0 +1,109 @@
+#include "bench.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <allocators.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_terraform.hpp>
+
+/*
+  Lots of players terraforming at once: each interval (between two game
+  state snapshots on the server) has more and more brush strokes, spread
+  over a big floor, and then the modification tracker gets reset like the
+  server does after sending a snapshot. The busiest intervals modify more
+  chunks than the modified chunk list could initially hold.
+ */
+
+namespace bench {
+
+// Like s_bumps in srv_game.cpp, but as a floor (bumps going up along y)
+static float s_floor(float x, float y, float z) {
+    float height = sin(0.1f * x) * cos(0.1f * z) * 10.0f;
+
+    float dist = fabs(height - y);
+
+    if (dist < 4.0f) {
+        return 1.0f - (dist / 4.0f);
+    }
+    else {
+        return 0.0f;
+    }
+}
+
+static constexpr uint32_t INTERVAL_COUNT = 20;
+
+void run_modification_tracker() {
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+
+    vkph::math_equation_create_info_t equation_info = {};
+    equation_info.ws_center = vector3_t(0.0f);
+    equation_info.ws_extent = vector3_t(640.0f, 32.0f, 640.0f);
+    equation_info.equation = &s_floor;
+    equation_info.type = vkph::GT_ADDITIVE;
+    equation_info.color = 0x20;
+    state->generate_math_equation(&equation_info);
+
+    state->flags.track_history = 1;
+    state->reset_modification_tracker();
+
+    uint32_t chunk_count = 0;
+    state->get_active_chunks(&chunk_count);
+    LOG_INFOV("Generated world (%d chunks)\n", chunk_count);
+
+    static const uint32_t STROKE_COUNTS[] = { 1, 16, 64, 256, 1024 };
+    uint32_t seed = 0x5EED1234;
+
+    for (uint32_t i = 0; i < sizeof(STROKE_COUNTS) / sizeof(STROKE_COUNTS[0]); ++i) {
+        float terraform_ms = 0.0f, reset_ms = 0.0f;
+        memset(&state->modification_stats, 0, sizeof(state->modification_stats));
+
+        for (uint32_t interval = 0; interval < INTERVAL_COUNT; ++interval) {
+            time_stamp_t start = current_time();
+
+            for (uint32_t s = 0; s < STROKE_COUNTS[i]; ++s) {
+                // Anywhere on the floor
+                vector3_t ws_position = vector3_t(
+                    (float)(xorshift(&seed) % 620) - 310.0f,
+                    0.0f,
+                    (float)(xorshift(&seed) % 620) - 310.0f);
+                ws_position.y = sin(0.1f * ws_position.x) * cos(0.1f * ws_position.z) * 10.0f;
+
+                vkph::terraform_package_t package = {};
+                package.ray_hit_terrain = 1;
+                package.ws_position = ws_position;
+                package.color = (vkph::voxel_color_t)s;
+
+                vkph::terraform_info_t info = {};
+                info.type = (s & 1) ? vkph::TT_BUILD : vkph::TT_DESTROY;
+                info.package = &package;
+                info.radius = 3.0f;
+                info.speed = vkph::PLAYER_TERRAFORMING_SPEED;
+                info.dt = 1.0f / 60.0f;
+
+                state->terraform(&info);
+            }
+
+            terraform_ms += time_difference(current_time(), start) * 1000.0f;
+
+            start = current_time();
+            state->reset_modification_tracker();
+            reset_ms += time_difference(current_time(), start) * 1000.0f;
+        }
+
+        const vkph::modification_stats_t *stats = &state->modification_stats;
+        LOG_INFOV("    %4d strokes per interval: %5d chunks, %6d voxels modified (average per interval, max %d chunks), terraform %.3f ms, reset %.3f ms\n",
+                  STROKE_COUNTS[i],
+                  (uint32_t)(stats->total_chunk_count / stats->interval_count),
+                  (uint32_t)(stats->total_voxel_count / stats->interval_count),
+                  stats->max_chunk_count,
+                  terraform_ms / (float)INTERVAL_COUNT,
+                  reset_ms / (float)INTERVAL_COUNT);
+    }
+
+    state->clear_chunks();
+}
+
+}
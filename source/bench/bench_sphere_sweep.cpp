@@ -0,0 +1,211 @@
+#include "bench.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <allocators.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_sphere_sweep.hpp>
+
+/*
+  Captures the triangles around spheres sweeping near the surface of
+  ice.map (what collide_and_slide() gathers), then sweeps the spheres
+  against them with each kernel. Every kernel has to find the exact same
+  hits as the scalar one.
+ */
+
+namespace bench {
+
+static const char *s_kernel_name(vkph::terraform_kernel_t kernel) {
+    switch (kernel) {
+    case vkph::TK_SCALAR: return "scalar";
+    case vkph::TK_SSE2: return "SSE2";
+    case vkph::TK_AVX2: return "AVX2";
+    default: return "?";
+    }
+}
+
+static constexpr uint32_t QUERY_COUNT = 4096;
+static constexpr uint32_t PASS_COUNT = 20;
+
+struct sweep_query_t {
+    vkph::terrain_collision_t collision;
+    uint32_t first_triangle;
+    uint32_t triangle_count;
+};
+
+struct triangle_soups_t {
+    sweep_query_t *queries;
+    vkph::collision_triangle_t *es_triangles;
+    uint32_t triangle_count;
+};
+
+/*
+  Spheres of radius ws_radius a bit above the surface, moving up to
+  max_distance in a random direction. The triangles are the ones in the
+  same box as in collide_and_slide(), in ellipsoid space.
+ */
+static triangle_soups_t s_capture_soups(vkph::state_t *state, float ws_radius, float max_distance) {
+    uint32_t surface_chunk_count = 0;
+    vkph::chunk_t **surface_chunks = get_surface_chunks(state, &surface_chunk_count);
+
+    // Same estimate as in collide_and_slide() (the box is at most 2 * radius + 2 voxels wide)
+    ivector3_t box_range = ivector3_t(2 * (int32_t)ceilf(ws_radius) + 2);
+    uint32_t max_query_triangle_count = 5 * (uint32_t)glm::dot(vector3_t(box_range), vector3_t(box_range)) / 2;
+
+    triangle_soups_t soups = {};
+    soups.queries = flmalloc<sweep_query_t>(QUERY_COUNT);
+    soups.es_triangles = flmalloc<vkph::collision_triangle_t>(QUERY_COUNT * max_query_triangle_count);
+
+    uint32_t seed = 0x5EE9C0DE;
+
+    for (uint32_t q = 0; q < QUERY_COUNT; ++q) {
+        // On top of the surface
+        vector3_t ws_position = vector3_t(pick_surface_voxel(surface_chunks, surface_chunk_count, &seed, 1)) + vector3_t(0.5f, 1.0f, 0.5f);
+        ws_position.y += random_float(&seed, 0.0f, ws_radius);
+
+        vector3_t direction = vector3_t(random_float(&seed, -1.0f, 1.0f), random_float(&seed, -1.0f, 0.5f), random_float(&seed, -1.0f, 1.0f));
+        if (glm::dot(direction, direction) == 0.0f) {
+            direction = vector3_t(0.0f, -1.0f, 0.0f);
+        }
+
+        vector3_t ws_velocity = glm::normalize(direction) * random_float(&seed, 0.01f, max_distance);
+        vector3_t ws_size = vector3_t(ws_radius);
+
+        sweep_query_t *query = &soups.queries[q];
+        query->collision.ws_size = ws_size;
+        query->collision.ws_position = ws_position;
+        query->collision.ws_velocity = ws_velocity;
+        query->collision.es_position = ws_position / ws_size;
+        query->collision.es_velocity = ws_velocity / ws_size;
+        query->collision.es_normalised_velocity = glm::normalize(query->collision.es_velocity);
+        query->collision.es_nearest_distance = 1000.0f;
+
+        query->first_triangle = soups.triangle_count;
+        query->triangle_count = vkph::gather_collision_triangles(
+            state,
+            ivector3_t(glm::floor(ws_position - ws_size)),
+            ivector3_t(glm::ceil(ws_position + ws_size)),
+            soups.es_triangles + soups.triangle_count,
+            max_query_triangle_count);
+
+        for (uint32_t i = 0; i < query->triangle_count; ++i) {
+            for (uint32_t v = 0; v < 3; ++v) {
+                soups.es_triangles[soups.triangle_count + i].vertices[v] /= ws_size;
+            }
+        }
+
+        soups.triangle_count += query->triangle_count;
+    }
+
+    flfree(surface_chunks);
+
+    return soups;
+}
+
+struct sweep_result_t {
+    float ns_per_triangle;
+    uint32_t hit_count;
+    vkph::terrain_collision_t *collisions;
+};
+
+static sweep_result_t s_sweep(const triangle_soups_t *soups) {
+    sweep_result_t result = {};
+    result.collisions = flmalloc<vkph::terrain_collision_t>(QUERY_COUNT);
+
+    result.ns_per_triangle = time_best_run([&] {
+        time_stamp_t start = current_time();
+
+        for (uint32_t p = 0; p < PASS_COUNT; ++p) {
+            for (uint32_t q = 0; q < QUERY_COUNT; ++q) {
+                const sweep_query_t *query = &soups->queries[q];
+                result.collisions[q] = query->collision;
+
+                vkph::sweep_sphere_triangles(
+                    &result.collisions[q],
+                    soups->es_triangles + query->first_triangle,
+                    query->triangle_count);
+            }
+        }
+
+        return ns_per_iteration(start, PASS_COUNT * soups->triangle_count);
+    });
+
+    for (uint32_t q = 0; q < QUERY_COUNT; ++q) {
+        result.hit_count += result.collisions[q].detected;
+    }
+
+    return result;
+}
+
+static bool s_same_hits(const vkph::terrain_collision_t *a, const vkph::terrain_collision_t *b) {
+    for (uint32_t q = 0; q < QUERY_COUNT; ++q) {
+        if (a[q].flags != b[q].flags ||
+            memcmp(&a[q].es_nearest_distance, &b[q].es_nearest_distance, sizeof(float)) ||
+            memcmp(&a[q].es_contact_point, &b[q].es_contact_point, sizeof(vector3_t)) ||
+            memcmp(&a[q].es_surface_normal, &b[q].es_surface_normal, sizeof(vector3_t))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void run_sphere_sweep() {
+    vkph::state_t *state = create_state_with_map("ice.map");
+    vkph::terraform_kernel_t default_kernel = vkph::get_sweep_kernel();
+
+    struct soup_config_t {
+        const char *name;
+        float ws_radius;
+        float max_distance;
+    };
+
+    static const soup_config_t CONFIGS[] = {
+        { "player sized spheres (radius 0.5, up to 0.3 per sweep)", vkph::PLAYER_SCALE, 0.3f },
+        { "big spheres (radius 2, up to 1 per sweep)", 2.0f, 1.0f },
+    };
+
+    for (uint32_t c = 0; c < sizeof(CONFIGS) / sizeof(CONFIGS[0]); ++c) {
+        triangle_soups_t soups = s_capture_soups(state, CONFIGS[c].ws_radius, CONFIGS[c].max_distance);
+
+        LOG_INFOV("%s: %d sweeps, %.1f triangles each\n",
+                  CONFIGS[c].name,
+                  QUERY_COUNT,
+                  (float)soups.triangle_count / (float)QUERY_COUNT);
+
+        sweep_result_t reference = {};
+
+        for (uint32_t k = vkph::TK_SCALAR; k <= (uint32_t)vkph::get_best_terraform_kernel(); ++k) {
+            vkph::set_sweep_kernel((vkph::terraform_kernel_t)k);
+            sweep_result_t result = s_sweep(&soups);
+
+            if (k == vkph::TK_SCALAR) {
+                reference = result;
+            }
+
+            LOG_INFOV("    %6s kernel: %6.2f ns / triangle, %7.1f M triangles/s, %d hits, %.2fx, %s\n",
+                      s_kernel_name((vkph::terraform_kernel_t)k),
+                      result.ns_per_triangle,
+                      1000.0f / result.ns_per_triangle,
+                      result.hit_count,
+                      reference.ns_per_triangle / result.ns_per_triangle,
+                      s_same_hits(reference.collisions, result.collisions) ? "same hits" : "DIFFERENT HITS");
+
+            if (k != vkph::TK_SCALAR) {
+                flfree(result.collisions);
+            }
+        }
+
+        flfree(reference.collisions);
+        flfree(soups.queries);
+        flfree(soups.es_triangles);
+    }
+
+    vkph::set_sweep_kernel(default_kernel);
+
+    state->clear_chunks();
+}
+
+}
@@ -0,0 +1,243 @@
+#include "bench.hpp"
+
+#include <allocators.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_terraform.hpp>
+
+/*
+  Runs the same brushes on ice.map with each terraform kernel. The scalar
+  kernel is the loop terraform() used before the SIMD ones, and all kernels
+  need to end up with the same world (and the same history).
+ */
+
+namespace bench {
+
+static constexpr uint32_t BRUSH_COUNT = 1000;
+
+// Solid voxels in chunks which contain the surface (where players terraform)
+static vector3_t *s_pick_brush_positions(vkph::state_t *state) {
+    uint32_t surface_chunk_count = 0;
+    vkph::chunk_t **surface_chunks = get_surface_chunks(state, &surface_chunk_count);
+
+    vector3_t *positions = flmalloc<vector3_t>(BRUSH_COUNT);
+    uint32_t seed = 0xB105F00D;
+
+    for (uint32_t i = 0; i < BRUSH_COUNT; ++i) {
+        positions[i] = vector3_t(pick_surface_voxel(surface_chunks, surface_chunk_count, &seed, 0)) + vector3_t(0.5f);
+    }
+
+    flfree(surface_chunks);
+
+    return positions;
+}
+
+static uint64_t s_world_checksum(vkph::state_t *state) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    // Order independent, so that it doesn't depend on the order chunks got created in
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        const vkph::chunk_t *c = chunks[i];
+        if (!c) {
+            continue;
+        }
+
+        uint64_t chunk_checksum = (uint64_t)(c->chunk_coord.x * 73856093 ^ c->chunk_coord.y * 19349663 ^ c->chunk_coord.z * 83492791);
+        for (uint32_t v = 0; v < vkph::CHUNK_VOXEL_COUNT; ++v) {
+            chunk_checksum = chunk_checksum * 31 + c->values[v] * 257 + c->colors[v];
+        }
+
+        checksum += chunk_checksum;
+    }
+
+    return checksum;
+}
+
+static uint64_t s_history_checksum(vkph::state_t *state) {
+    uint32_t modified_count = 0;
+    vkph::chunk_t **modified = state->get_modified_chunks(&modified_count);
+
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < modified_count; ++i) {
+        const vkph::chunk_history_t *history = modified[i]->history;
+
+        uint64_t chunk_checksum = (uint64_t)(modified[i]->chunk_coord.x * 73856093 ^ modified[i]->chunk_coord.y * 19349663 ^ modified[i]->chunk_coord.z * 83492791);
+        for (int32_t m = 0; m < history->modification_count; ++m) {
+            uint32_t index = (uint16_t)history->modification_stack[m];
+            chunk_checksum = chunk_checksum * 31 + index * 257 + history->modification_pool[index];
+        }
+
+        checksum += chunk_checksum;
+    }
+
+    return checksum;
+}
+
+struct terraform_result_t {
+    float us_per_brush;
+    uint64_t world_checksum;
+    uint64_t history_checksum;
+};
+
+static terraform_result_t s_run_brushes(
+    vkph::state_t *state,
+    const vector3_t *positions,
+    float radius,
+    bool track_history) {
+    state->clear_chunks();
+    state->load_map("ice.map");
+    state->reset_modification_tracker();
+    state->flags.track_history = track_history;
+
+    terraform_result_t result = {};
+    float total_us = 0.0f;
+
+    for (uint32_t i = 0; i < BRUSH_COUNT; ++i) {
+        vkph::terraform_package_t package = {};
+        package.ray_hit_terrain = 1;
+        package.ws_position = positions[i];
+        package.color = (vkph::voxel_color_t)i;
+
+        vkph::terraform_info_t info = {};
+        info.package = &package;
+        info.type = (i & 1) ? vkph::TT_BUILD : vkph::TT_DESTROY;
+        info.radius = radius;
+        info.speed = vkph::PLAYER_TERRAFORMING_SPEED;
+        info.dt = 1.0f / 60.0f;
+
+        time_stamp_t start = current_time();
+        state->terraform(&info);
+        total_us += time_difference(current_time(), start) * 1e6f;
+
+        if (track_history) {
+            // Like the server does every tick (the history can't hold more than half a chunk)
+            result.history_checksum = result.history_checksum * 31 + s_history_checksum(state);
+            state->reset_modification_tracker();
+        }
+    }
+
+    state->flags.track_history = 0;
+
+    result.us_per_brush = total_us / (float)BRUSH_COUNT;
+    result.world_checksum = s_world_checksum(state);
+
+    lnclear();
+
+    return result;
+}
+
+static constexpr uint32_t KERNEL_ITERATION_COUNT = 20000;
+
+/*
+  Only the kernel (no chunk lookups, occupancy updates...): a brush in the
+  middle of a chunk, alternating between building and destroying.
+ */
+static float s_bench_kernel_only(vkph::chunk_t *chunk, float radius) {
+    int32_t half_edge = (int32_t)vkph::CHUNK_EDGE_LENGTH / 2;
+    int32_t extent = MIN((int32_t)radius, half_edge - 1);
+
+    vkph::chunk_span_t span = {};
+    span.chunk_coord = chunk->chunk_coord;
+    span.vs_origin = chunk->xs_bottom_corner;
+    span.local_min = ivector3_t(half_edge - extent);
+    span.local_max = ivector3_t(half_edge + extent);
+
+    vkph::terraform_brush_t brush = {};
+    brush.vs_center = vector3_t(span.vs_origin + ivector3_t(half_edge));
+    brush.radius_squared = radius * radius;
+    brush.dt = 1.0f / 60.0f;
+    brush.speed = vkph::PLAYER_TERRAFORMING_SPEED;
+
+    time_stamp_t start = current_time();
+
+    for (uint32_t i = 0; i < KERNEL_ITERATION_COUNT; ++i) {
+        brush.coeff = (i & 1) ? 1.0f : -1.0f;
+        brush.color = (vkph::voxel_color_t)i;
+        vkph::apply_terraform_brush(&brush, chunk, span, NULL);
+    }
+
+    return ns_per_iteration(start, KERNEL_ITERATION_COUNT);
+}
+
+void run_terraform() {
+    static const char *KERNEL_NAMES[] = { "scalar", "sse2", "avx2" };
+    // Player brush, and the bigger ones the map creator can use
+    static const float RADII[] = { vkph::PLAYER_TERRAFORMING_RADIUS, 8.0f, 16.0f, 32.0f };
+
+    vkph::terraform_kernel_t best = vkph::get_best_terraform_kernel();
+    LOG_INFOV("Best kernel on this CPU: %s\n", KERNEL_NAMES[best]);
+
+    vkph::state_t *state = create_state_with_map("ice.map");
+    vector3_t *positions = s_pick_brush_positions(state);
+
+    for (uint32_t r = 0; r < sizeof(RADII) / sizeof(RADII[0]); ++r) {
+        for (uint32_t h = 0; h < 2; ++h) {
+            bool track_history = !h;
+
+            /*
+              Only players' brushes go in the history (the map creator doesn't
+              track it), and bigger ones could change more voxels of a chunk
+              than the modification stack can hold.
+             */
+            if (track_history && RADII[r] > vkph::PLAYER_TERRAFORMING_RADIUS) {
+                continue;
+            }
+
+            LOG_INFOV("Radius %.0f, %s history:\n", RADII[r], track_history ? "with" : "without");
+
+            terraform_result_t reference = {};
+
+            for (uint32_t k = vkph::TK_SCALAR; k <= (uint32_t)best; ++k) {
+                vkph::set_terraform_kernel((vkph::terraform_kernel_t)k);
+
+                terraform_result_t result = s_run_brushes(state, positions, RADII[r], track_history);
+                for (uint32_t run = 1; run < RUN_COUNT; ++run) {
+                    terraform_result_t other = s_run_brushes(state, positions, RADII[r], track_history);
+                    result.us_per_brush = MIN(result.us_per_brush, other.us_per_brush);
+                }
+
+                if (k == vkph::TK_SCALAR) {
+                    reference = result;
+                }
+
+                bool same = result.world_checksum == reference.world_checksum &&
+                    result.history_checksum == reference.history_checksum;
+
+                LOG_INFOV("    %s: %.2f us / brush (%.2fx) %s\n",
+                          KERNEL_NAMES[k], result.us_per_brush,
+                          reference.us_per_brush / result.us_per_brush,
+                          same ? "same result as scalar" : "DIFFERENT RESULT FROM SCALAR");
+            }
+        }
+    }
+
+    LOG_INFO("Kernel only:\n");
+    static const float KERNEL_RADII[] = { vkph::PLAYER_TERRAFORMING_RADIUS, 5.0f, 7.0f };
+
+    for (uint32_t r = 0; r < sizeof(KERNEL_RADII) / sizeof(KERNEL_RADII[0]); ++r) {
+        vkph::chunk_t *chunk = state->get_chunk(ivector3_t(0, 100, 0));
+
+        float scalar_ns = 0.0f;
+        for (uint32_t k = vkph::TK_SCALAR; k <= (uint32_t)best; ++k) {
+            vkph::set_terraform_kernel((vkph::terraform_kernel_t)k);
+
+            float ns = time_best_run([&] { return s_bench_kernel_only(chunk, KERNEL_RADII[r]); });
+
+            if (k == vkph::TK_SCALAR) {
+                scalar_ns = ns;
+            }
+
+            LOG_INFOV("    radius %.0f, %s: %.2f ns / brush (%.2fx)\n",
+                      KERNEL_RADII[r], KERNEL_NAMES[k], ns, scalar_ns / ns);
+        }
+    }
+
+    vkph::set_terraform_kernel(best);
+
+    flfree(positions);
+}
+
+}
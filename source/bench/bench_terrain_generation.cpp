@@ -0,0 +1,143 @@
+#include "bench.hpp"
+
+#include <allocators.hpp>
+#include <worker_pool.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_terraform.hpp>
+#include <vkph_terrain_generator.hpp>
+
+/*
+  Generates the same procedural terrain with each kernel, and then with
+  different amounts of workers in the pool. The terrain has to come out
+  exactly the same every time (clients could generate it from the seed).
+ */
+
+namespace bench {
+
+static const char *s_kernel_name(vkph::terraform_kernel_t kernel) {
+    switch (kernel) {
+    case vkph::TK_SCALAR: return "scalar";
+    case vkph::TK_SSE2: return "SSE2";
+    case vkph::TK_AVX2: return "AVX2";
+    default: return "?";
+    }
+}
+
+// Same as in bench_generation.cpp
+static uint64_t s_world_checksum(vkph::state_t *state) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        const vkph::chunk_t *c = chunks[i];
+        if (!c) {
+            continue;
+        }
+
+        checksum = checksum * 1000003 + (uint64_t)(c->chunk_coord.x * 73856093 ^ c->chunk_coord.y * 19349663 ^ c->chunk_coord.z * 83492791);
+        for (uint32_t v = 0; v < vkph::CHUNK_VOXEL_COUNT; ++v) {
+            checksum = checksum * 31 + c->values[v] * 257 + c->colors[v];
+        }
+    }
+
+    return checksum;
+}
+
+struct terrain_result_t {
+    float ms;
+    uint32_t chunk_count;
+    uint64_t checksum;
+};
+
+static terrain_result_t s_generate(vkph::state_t *state, const vkph::terrain_create_info_t *info) {
+    state->clear_chunks();
+
+    terrain_result_t result = {};
+
+    time_stamp_t start = current_time();
+    state->generate_terrain(info);
+    result.ms = time_difference(current_time(), start) * 1000.0f;
+
+    state->get_active_chunks(&result.chunk_count);
+    result.checksum = s_world_checksum(state);
+
+    return result;
+}
+
+void run_terrain_generation() {
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+
+    vkph::terrain_create_info_t info = vkph::get_default_terrain_info(0x5EED);
+    // Smaller than a whole match's world, so that the scalar kernel doesn't take forever
+    info.ws_extent = vector3_t(256.0f, 128.0f, 256.0f);
+
+    ivector3_t chunk_box = (ivector3_t)info.ws_extent / vkph::CHUNK_EDGE_LENGTH;
+    uint32_t box_chunk_count = chunk_box.x * chunk_box.y * chunk_box.z;
+
+    worker_pool_t *pool = get_worker_pool();
+    uint32_t default_worker_count = pool->worker_count;
+    vkph::terraform_kernel_t default_kernel = vkph::get_terrain_kernel();
+
+    LOG_INFOV("Box of %d chunks, %d workers (+ the calling thread)\n", box_chunk_count, default_worker_count);
+
+    terrain_result_t reference = {};
+    bool same = 1;
+
+    for (uint32_t k = vkph::TK_SCALAR; k <= (uint32_t)vkph::get_best_terraform_kernel(); ++k) {
+        vkph::set_terrain_kernel((vkph::terraform_kernel_t)k);
+        terrain_result_t result = s_generate(state, &info);
+
+        if (k == vkph::TK_SCALAR) {
+            reference = result;
+        }
+
+        same &= (result.checksum == reference.checksum);
+
+        LOG_INFOV("    %6s kernel: %8.2f ms, %7.1f chunks/s (%d chunks created), %.2fx, %s\n",
+                  s_kernel_name((vkph::terraform_kernel_t)k),
+                  result.ms,
+                  (float)box_chunk_count / (result.ms / 1000.0f),
+                  result.chunk_count,
+                  reference.ms / result.ms,
+                  result.checksum == reference.checksum ? "same terrain" : "DIFFERENT TERRAIN");
+    }
+
+    vkph::set_terrain_kernel(default_kernel);
+
+    static const uint32_t WORKER_COUNTS[] = { 0, 1, 3, 7, 15 };
+    float single_thread_ms = 0.0f;
+
+    for (uint32_t i = 0; i < sizeof(WORKER_COUNTS) / sizeof(WORKER_COUNTS[0]); ++i) {
+        pool->destroy();
+        pool->init(WORKER_COUNTS[i]);
+
+        terrain_result_t result = s_generate(state, &info);
+
+        if (i == 0) {
+            single_thread_ms = result.ms;
+        }
+
+        same &= (result.checksum == reference.checksum);
+
+        LOG_INFOV("    %2d threads (%s): %8.2f ms, %7.1f chunks/s, %.2fx, %s\n",
+                  WORKER_COUNTS[i] + 1,
+                  s_kernel_name(default_kernel),
+                  result.ms,
+                  (float)box_chunk_count / (result.ms / 1000.0f),
+                  single_thread_ms / result.ms,
+                  result.checksum == reference.checksum ? "same terrain" : "DIFFERENT TERRAIN");
+    }
+
+    pool->destroy();
+    pool->init(default_worker_count);
+
+    LOG_INFOV("    %s\n", same ? "Every run generated the same terrain" : "SOME RUNS GENERATED A DIFFERENT TERRAIN");
+
+    state->clear_chunks();
+}
+
+}
@@ -0,0 +1,192 @@
+#include "bench.hpp"
+
+#include <math.h>
+#include <allocators.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_constant.hpp>
+#include <vkph_terraform.hpp>
+
+/*
+  Measures what keeping the mip levels of the chunks (chunk_mips_t) costs
+  (building them, edits, and bringing them up to date after the edits), and
+  air tests over big boxes with them (compared to reading every voxel of
+  the box).
+ */
+
+namespace bench {
+
+// Same as s_bumps in srv_game.cpp
+static float s_bumps(float x, float y, float z) {
+    float right = sin(0.1f * x) * cos(0.1f * y)  * 10.0f;
+
+    float dist = fabs(right - z);
+
+    if (dist < 4.0f) {
+        return 1.0f - (dist / 4.0f);
+    }
+    else {
+        return 0.0f;
+    }
+}
+
+// A wall of bumps (on the x-y plane) and a big sphere, with a lot of open space around them
+static void s_generate_world(vkph::state_t *state) {
+    state->clear_chunks();
+
+    vkph::math_equation_create_info_t equation_info = {};
+    equation_info.ws_center = vector3_t(0.0f);
+    equation_info.ws_extent = vector3_t(320.0f, 64.0f, 320.0f);
+    equation_info.equation = &s_bumps;
+    equation_info.type = vkph::GT_ADDITIVE;
+    equation_info.color = 0x20;
+    state->generate_math_equation(&equation_info);
+
+    vkph::sphere_create_info_t sphere_info = {};
+    sphere_info.ws_center = vector3_t(40.0f, 30.0f, -20.0f);
+    sphere_info.ws_radius = 80.0f;
+    sphere_info.max_value = 140;
+    sphere_info.type = vkph::GT_ADDITIVE;
+    sphere_info.color = 0x30;
+    state->generate_sphere(&sphere_info);
+}
+
+// What the queries did before the mip levels: look at every voxel
+static bool s_is_region_air_per_voxel(const vkph::state_t *state, const ivector3_t &vs_min, const ivector3_t &vs_max) {
+    const vkph::chunk_t *previous_chunk = NULL;
+
+    for (int32_t z = vs_min.z; z <= vs_max.z; ++z) {
+        for (int32_t y = vs_min.y; y <= vs_max.y; ++y) {
+            for (int32_t x = vs_min.x; x <= vs_max.x; ++x) {
+                ivector3_t vs_position = ivector3_t(x, y, z);
+                const vkph::chunk_t *chunk = state->access_chunk(vkph::space_voxel_to_chunk(vs_position), previous_chunk);
+
+                if (chunk) {
+                    previous_chunk = chunk;
+
+                    ivector3_t local = vkph::space_voxel_to_local_chunk(vs_position);
+                    if (chunk->values[vkph::get_voxel_index(local.x, local.y, local.z)] > vkph::CHUNK_SURFACE_LEVEL) {
+                        return 0;
+                    }
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+static constexpr uint32_t UPDATE_RUN_COUNT = 20;
+static constexpr uint32_t BOX_COUNT = 2000;
+
+void run_terrain_mips() {
+    vkph::state_t *state = flmalloc<vkph::state_t>();
+    state->prepare();
+    s_generate_world(state);
+
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    uint32_t dense_count = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        if (chunks[i] && !chunks[i]->flags.uniform) {
+            ++dense_count;
+        }
+    }
+
+    { // Building them the first time a query needs them
+        time_stamp_t start = current_time();
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            if (chunks[i]) {
+                chunks[i]->get_mips();
+            }
+        }
+        float build_us = ns_per_iteration(start, dense_count) / 1000.0f;
+
+        LOG_INFOV("Generated world (%d chunks, %d which aren't uniform: %d KB of mip levels once they all got queried, built in %.3f us each)\n",
+                  chunk_count, dense_count, dense_count * (uint32_t)sizeof(vkph::chunk_mips_t) / 1024, build_us);
+    }
+
+    { // Updates
+        float whole_us = 1e9f, brick_us = 1e9f, whole_query_us = 1e9f, brick_query_us = 1e9f;
+
+        for (uint32_t run = 0; run < UPDATE_RUN_COUNT; ++run) {
+            time_stamp_t start = current_time();
+            for (uint32_t i = 0; i < chunk_count; ++i) {
+                if (chunks[i] && !chunks[i]->flags.uniform) {
+                    chunks[i]->update_occupancy();
+                }
+            }
+            whole_us = MIN(whole_us, ns_per_iteration(start, dense_count) / 1000.0f);
+
+            start = current_time();
+            for (uint32_t i = 0; i < chunk_count; ++i) {
+                if (chunks[i] && !chunks[i]->flags.uniform) {
+                    chunks[i]->get_mips();
+                }
+            }
+            whole_query_us = MIN(whole_query_us, ns_per_iteration(start, dense_count) / 1000.0f);
+
+            // Like a small brush (a few voxels)
+            start = current_time();
+            for (uint32_t i = 0; i < chunk_count; ++i) {
+                if (chunks[i] && !chunks[i]->flags.uniform) {
+                    chunks[i]->update_occupancy(ivector3_t(5), ivector3_t(8));
+                }
+            }
+            brick_us = MIN(brick_us, ns_per_iteration(start, dense_count) / 1000.0f);
+
+            start = current_time();
+            for (uint32_t i = 0; i < chunk_count; ++i) {
+                if (chunks[i] && !chunks[i]->flags.uniform) {
+                    chunks[i]->get_mips();
+                }
+            }
+            brick_query_us = MIN(brick_query_us, ns_per_iteration(start, dense_count) / 1000.0f);
+        }
+
+        LOG_INFOV("    update_occupancy(): whole chunk %.3f us, 4^3 voxels %.3f us\n", whole_us, brick_us);
+        LOG_INFOV("    next query bringing the mip levels up to date: whole chunk %.3f us, 4^3 voxels %.3f us\n", whole_query_us, brick_query_us);
+    }
+
+    uint32_t seed = 0xC0FFEE11;
+
+    { // Boxes
+        ivector3_t *box_min = flmalloc<ivector3_t>(BOX_COUNT);
+        ivector3_t *box_max = flmalloc<ivector3_t>(BOX_COUNT);
+
+        for (uint32_t i = 0; i < BOX_COUNT; ++i) {
+            int32_t edge_length = 8 + (int32_t)(xorshift(&seed) % 57);
+            // Around the wall and the sphere
+            box_min[i] = ivector3_t(
+                (int32_t)(xorshift(&seed) % 320) - 160,
+                (int32_t)(xorshift(&seed) % 176) - 64,
+                (int32_t)(xorshift(&seed) % 160) - 100) - ivector3_t(edge_length / 2);
+            box_max[i] = box_min[i] + ivector3_t(edge_length - 1);
+        }
+
+        uint32_t air_count = 0, mismatch_count = 0;
+        time_stamp_t start = current_time();
+        for (uint32_t i = 0; i < BOX_COUNT; ++i) {
+            air_count += state->is_region_air(box_min[i], box_max[i]);
+        }
+        float mips_us = ns_per_iteration(start, BOX_COUNT) / 1000.0f;
+
+        start = current_time();
+        for (uint32_t i = 0; i < BOX_COUNT; ++i) {
+            mismatch_count += (s_is_region_air_per_voxel(state, box_min[i], box_max[i]) != state->is_region_air(box_min[i], box_max[i]));
+        }
+        float voxels_us = ns_per_iteration(start, BOX_COUNT) / 1000.0f - mips_us;
+
+        LOG_INFOV("    is_region_air() on boxes of 8^3 to 64^3 voxels (%d/%d air): %.3f us with the mip levels, %.3f us per voxel (%.1fx), %s\n",
+                  air_count, BOX_COUNT, mips_us, voxels_us, voxels_us / mips_us,
+                  mismatch_count ? "DIFFERENT RESULTS" : "same results");
+
+        flfree(box_min);
+        flfree(box_max);
+    }
+
+    state->clear_chunks();
+}
+
+}
@@ -0,0 +1,169 @@
+#include "bench.hpp"
+
+#include <string.h>
+#include <allocators.hpp>
+#include <worker_pool.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_physics.hpp>
+#include <vkph_constant.hpp>
+
+/*
+  Casts line of sight rays between random spots on the surface of ice.map
+  and short rays like the ones players aim the terraformer with, one
+  cast_terrain_ray() after the other, then with cast_terrain_rays() and
+  different amounts of workers in the pool. The batches have to find the
+  exact same hits as the single rays.
+ */
+
+namespace bench {
+
+static constexpr uint32_t LINE_OF_SIGHT_RAY_COUNT = 65536;
+static constexpr uint32_t AIM_RAY_COUNT = 65536;
+static constexpr uint32_t RAY_COUNT = LINE_OF_SIGHT_RAY_COUNT + AIM_RAY_COUNT;
+
+/*
+  Line of sight rays go from the eyes of a player standing somewhere to the
+  eyes of another one up to 64 voxels away, aim rays go from the eyes in a
+  random direction (mostly down) up to the terraformer's reach.
+ */
+static void s_make_rays(vkph::state_t *state, vkph::terrain_ray_t *rays) {
+    uint32_t surface_chunk_count = 0;
+    vkph::chunk_t **surface_chunks = get_surface_chunks(state, &surface_chunk_count);
+
+    uint32_t seed = 0x0CC1DE5;
+    // Eyes of a player standing on top of the voxel
+    vector3_t eye_offset = vector3_t(0.5f, 2.5f, 0.5f);
+
+    for (uint32_t i = 0; i < LINE_OF_SIGHT_RAY_COUNT;) {
+        vector3_t ws_from = vector3_t(pick_surface_voxel(surface_chunks, surface_chunk_count, &seed, 1)) + eye_offset;
+        vector3_t ws_to = vector3_t(pick_surface_voxel(surface_chunks, surface_chunk_count, &seed, 1)) + eye_offset;
+        vector3_t ws_difference = ws_to - ws_from;
+        float distance = glm::length(ws_difference);
+
+        if (distance > 1.0f && distance < 64.0f) {
+            rays[i].ws_start = ws_from;
+            rays[i].ws_direction = ws_difference / distance;
+            rays[i].max_reach = distance;
+            ++i;
+        }
+    }
+
+    for (uint32_t i = LINE_OF_SIGHT_RAY_COUNT; i < RAY_COUNT; ++i) {
+        vector3_t direction = vector3_t(random_float(&seed, -1.0f, 1.0f), random_float(&seed, -1.0f, 0.3f), random_float(&seed, -1.0f, 1.0f));
+        if (glm::dot(direction, direction) == 0.0f) {
+            direction = vector3_t(0.0f, -1.0f, 0.0f);
+        }
+
+        rays[i].ws_start = vector3_t(pick_surface_voxel(surface_chunks, surface_chunk_count, &seed, 1)) + eye_offset;
+        rays[i].ws_direction = glm::normalize(direction);
+        rays[i].max_reach = 10.0f;
+    }
+
+    flfree(surface_chunks);
+}
+
+static float s_cast_serial(vkph::state_t *state, const vkph::terrain_ray_t *rays, vkph::terraform_package_t *packages) {
+    time_stamp_t start = current_time();
+
+    for (uint32_t i = 0; i < RAY_COUNT; ++i) {
+        packages[i] = vkph::cast_terrain_ray(rays[i].ws_start, rays[i].ws_direction, rays[i].max_reach, 0, state);
+    }
+
+    return time_difference(current_time(), start);
+}
+
+static float s_cast_batch(vkph::state_t *state, const vkph::terrain_ray_t *rays, vkph::terraform_package_t *packages) {
+    time_stamp_t start = current_time();
+    vkph::cast_terrain_rays(rays, RAY_COUNT, packages, state);
+    return time_difference(current_time(), start);
+}
+
+static bool s_same_hits(const vkph::terraform_package_t *a, const vkph::terraform_package_t *b) {
+    for (uint32_t i = 0; i < RAY_COUNT; ++i) {
+        if (a[i].ray_hit_terrain != b[i].ray_hit_terrain ||
+            (a[i].ray_hit_terrain && memcmp(&a[i].ws_contact_point, &b[i].ws_contact_point, sizeof(vector3_t)))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void run_terrain_rays() {
+    vkph::state_t *state = create_state_with_map("ice.map");
+
+    vkph::terrain_ray_t *rays = flmalloc<vkph::terrain_ray_t>(RAY_COUNT);
+    s_make_rays(state, rays);
+
+    vkph::terraform_package_t *reference = flmalloc<vkph::terraform_package_t>(RAY_COUNT);
+    vkph::terraform_package_t *packages = flmalloc<vkph::terraform_package_t>(RAY_COUNT);
+
+    // Before any collision mesh got built: the batch runs marching cubes on the cells it goes through
+    float cold_batch_s = s_cast_batch(state, rays, packages);
+
+    // Builds the collision meshes of the cells the rays go through
+    s_cast_serial(state, rays, reference);
+
+    bool same = s_same_hits(reference, packages);
+
+    uint32_t hit_count = 0;
+    for (uint32_t i = 0; i < RAY_COUNT; ++i) {
+        hit_count += reference[i].ray_hit_terrain;
+    }
+
+    state->collision_stats = {};
+
+    float serial_s = time_best_run([&] { return s_cast_serial(state, rays, reference); });
+
+    LOG_INFOV("%d line of sight rays (up to 64 voxels) + %d aim rays (10 voxels) on ice.map, %d hits, %.1f cells each\n",
+              LINE_OF_SIGHT_RAY_COUNT,
+              AIM_RAY_COUNT,
+              hit_count,
+              (float)state->collision_stats.terrain_ray_cell_count / (float)MAX(state->collision_stats.terrain_ray_count, 1ull));
+
+    LOG_INFOV("    cast_terrain_ray() loop: %8.2f ms, %6.2f M rays/s\n",
+              serial_s * 1000.0f,
+              (float)RAY_COUNT / serial_s / 1e6f);
+
+    LOG_INFOV("    cast_terrain_rays() before the collision meshes got built (%d threads): %8.2f ms, %6.2f M rays/s, %s\n",
+              get_worker_pool()->worker_count + 1,
+              cold_batch_s * 1000.0f,
+              (float)RAY_COUNT / cold_batch_s / 1e6f,
+              same ? "same hits" : "DIFFERENT HITS");
+
+    worker_pool_t *pool = get_worker_pool();
+    uint32_t default_worker_count = pool->worker_count;
+
+    static const uint32_t WORKER_COUNTS[] = { 0, 1, 3, 7, 15 };
+
+    for (uint32_t i = 0; i < sizeof(WORKER_COUNTS) / sizeof(WORKER_COUNTS[0]); ++i) {
+        pool->destroy();
+        pool->init(WORKER_COUNTS[i]);
+
+        float batch_s = time_best_run([&] { return s_cast_batch(state, rays, packages); });
+
+        bool same_hits = s_same_hits(reference, packages);
+        same &= same_hits;
+
+        LOG_INFOV("    cast_terrain_rays() %2d threads: %8.2f ms, %6.2f M rays/s, %.2fx, %s\n",
+                  WORKER_COUNTS[i] + 1,
+                  batch_s * 1000.0f,
+                  (float)RAY_COUNT / batch_s / 1e6f,
+                  serial_s / batch_s,
+                  same_hits ? "same hits" : "DIFFERENT HITS");
+    }
+
+    pool->destroy();
+    pool->init(default_worker_count);
+
+    LOG_INFOV("    %s\n", same ? "Every batch found the same hits as the single rays" : "SOME BATCHES FOUND DIFFERENT HITS");
+
+    flfree(rays);
+    flfree(reference);
+    flfree(packages);
+
+    state->clear_chunks();
+}
+
+}
@@ -0,0 +1,182 @@
+#include "bench.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <files.hpp>
+#include <allocators.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_physics.hpp>
+#include <vkph_constant.hpp>
+
+/*
+  Benchmarks the code which goes through chunk voxels the most: terrain
+  collision, meshing and map save / load.
+ */
+
+namespace bench {
+
+static constexpr uint32_t COLLISION_COUNT = 200000;
+
+// Player sized spheres moving around near the terrain surface
+static void s_bench_collide_and_slide(vkph::state_t *state) {
+    uint32_t surface_chunk_count = 0;
+    vkph::chunk_t **surface_chunks = get_surface_chunks(state, &surface_chunk_count);
+
+    uint32_t seed = 0xBEEF;
+    uint32_t detected_count = 0;
+    float total_ns = 0.0f;
+
+    // The collision code allocates its triangles from the linear allocator, which gets cleared every batch
+    static constexpr uint32_t BATCH_SIZE = 1000;
+
+    for (uint32_t batch = 0; batch < COLLISION_COUNT / BATCH_SIZE; ++batch) {
+        vkph::terrain_collision_t *collisions = lnmalloc<vkph::terrain_collision_t>(BATCH_SIZE);
+
+        for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+            vkph::chunk_t *c = surface_chunks[xorshift(&seed) % surface_chunk_count];
+
+            vector3_t ws_position = vector3_t(c->xs_bottom_corner) + vector3_t(
+                random_float(&seed),
+                random_float(&seed),
+                random_float(&seed)) * (float)vkph::CHUNK_EDGE_LENGTH;
+
+            vector3_t ws_velocity = vector3_t(
+                random_float(&seed) - 0.5f,
+                random_float(&seed) - 0.5f,
+                random_float(&seed) - 0.5f);
+
+            vector3_t player_scale = vector3_t(vkph::PLAYER_SCALE);
+
+            vkph::terrain_collision_t *collision = &collisions[i];
+            memset(collision, 0, sizeof(vkph::terrain_collision_t));
+            collision->ws_size = player_scale;
+            collision->ws_position = ws_position;
+            collision->ws_velocity = ws_velocity;
+            collision->es_position = collision->ws_position / collision->ws_size;
+            collision->es_velocity = collision->ws_velocity / collision->ws_size;
+        }
+
+        time_stamp_t start = current_time();
+        for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+            vkph::collide_and_slide(&collisions[i], state);
+            detected_count += collisions[i].detected;
+        }
+        total_ns += time_difference(current_time(), start) * 1e9f;
+
+        lnclear();
+    }
+
+    LOG_INFOV("    collide_and_slide: %.2f ns / call (%d / %d collided)\n",
+              total_ns / (float)COLLISION_COUNT, detected_count, COLLISION_COUNT);
+
+    flfree(surface_chunks);
+}
+
+static constexpr uint32_t MESH_PASS_COUNT = 200;
+
+/*
+  s_generate_chunk_verts lives in the client (which needs Vulkan), so this
+  replicates the part of it which reads voxels: building the cube index of
+  each cell from the values, and fetching a color for the cells which end
+  up producing triangles.
+ */
+static void s_bench_mesh_voxel_pass(vkph::state_t *state) {
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    uint32_t surface_cell_count = 0;
+    uint32_t color_sum = 0;
+    uint32_t cell_count = 0;
+
+    time_stamp_t start = current_time();
+
+    for (uint32_t pass = 0; pass < MESH_PASS_COUNT; ++pass) {
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            const vkph::chunk_t *c = chunks[i];
+            if (!c) {
+                continue;
+            }
+
+            for (uint32_t z = 0; z < vkph::CHUNK_EDGE_LENGTH - 1; ++z) {
+                for (uint32_t y = 0; y < vkph::CHUNK_EDGE_LENGTH - 1; ++y) {
+                    for (uint32_t x = 0; x < vkph::CHUNK_EDGE_LENGTH - 1; ++x) {
+                        uint32_t indices[8] = {
+                            vkph::get_voxel_index(x, y, z),
+                            vkph::get_voxel_index(x + 1, y, z),
+                            vkph::get_voxel_index(x + 1, y, z + 1),
+                            vkph::get_voxel_index(x, y, z + 1),
+                            vkph::get_voxel_index(x, y + 1, z),
+                            vkph::get_voxel_index(x + 1, y + 1, z),
+                            vkph::get_voxel_index(x + 1, y + 1, z + 1),
+                            vkph::get_voxel_index(x, y + 1, z + 1) };
+
+                        uint8_t bit_combination = 0;
+                        for (uint32_t v = 0; v < 8; ++v) {
+                            bit_combination |= (uint8_t)((c->values[indices[v]] > vkph::CHUNK_SURFACE_LEVEL) << v);
+                        }
+
+                        if (bit_combination != 0 && bit_combination != 0xFF) {
+                            ++surface_cell_count;
+
+                            // Like the mesher, the color comes from the voxel with the highest value
+                            uint32_t dominant_voxel = 0;
+                            for (uint32_t v = 1; v < 8; ++v) {
+                                if (c->values[indices[v]] > c->values[indices[dominant_voxel]]) {
+                                    dominant_voxel = v;
+                                }
+                            }
+
+                            color_sum += c->colors[indices[dominant_voxel]];
+                        }
+
+                        ++cell_count;
+                    }
+                }
+            }
+        }
+    }
+
+    float ns = ns_per_iteration(start, MESH_PASS_COUNT * chunk_count);
+
+    LOG_INFOV("    mesh voxel pass: %.2f ns / chunk (%d surface cells out of %d, color checksum %d)\n",
+              ns, surface_cell_count / MESH_PASS_COUNT, cell_count / MESH_PASS_COUNT, color_sum / MESH_PASS_COUNT);
+}
+
+static constexpr uint32_t MAP_IO_COUNT = 50;
+
+static void s_bench_map_io(vkph::state_t *state, const char *map_path) {
+    vkph::map_t map = state->current_map_data;
+    map.path = "bench_voxel_layout.map";
+
+    float save_ns = 0.0f, load_ns = 0.0f;
+
+    for (uint32_t i = 0; i < MAP_IO_COUNT; ++i) {
+        time_stamp_t start = current_time();
+        state->save_map(&map);
+        save_ns += time_difference(current_time(), start) * 1e9f;
+
+        state->clear_chunks();
+
+        start = current_time();
+        state->load_map(map_path);
+        load_ns += time_difference(current_time(), start) * 1e9f;
+
+        lnclear();
+    }
+
+    delete_file("assets/maps/bench_voxel_layout.map");
+
+    LOG_INFOV("    save_map: %.2f us, load_map: %.2f us\n",
+              save_ns / (float)MAP_IO_COUNT / 1000.0f, load_ns / (float)MAP_IO_COUNT / 1000.0f);
+}
+
+void run_voxel_layout() {
+    vkph::state_t *state = create_state_with_map("ice.map");
+
+    s_bench_collide_and_slide(state);
+    s_bench_mesh_voxel_pass(state);
+    s_bench_map_io(state, "ice.map");
+}
+
+}
@@ -0,0 +1,209 @@
+#include "bench.hpp"
+
+#include <string.h>
+#include <allocators.hpp>
+#include <vkph_chunk.hpp>
+#include <vkph_state.hpp>
+#include <vkph_constant.hpp>
+
+/*
+  Compares the voxel layouts (see voxel_layout_t) on the chunks of ice.map.
+  The chunks get copied into planes ordered with each layout, and the same
+  8 corner gather kernels (the ones meshing and collision use) run on all of
+  them, so that a single build can compare the layouts.
+ */
+
+namespace bench {
+
+template <vkph::voxel_layout_t Layout>
+static uint8_t *s_create_planes(vkph::chunk_t **chunks, uint32_t chunk_count) {
+    uint8_t *planes = flmalloc<uint8_t>(chunk_count * vkph::CHUNK_VOXEL_COUNT);
+
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        uint8_t *values = &planes[i * vkph::CHUNK_VOXEL_COUNT];
+
+        for (uint32_t z = 0; z < vkph::CHUNK_EDGE_LENGTH; ++z) {
+            for (uint32_t y = 0; y < vkph::CHUNK_EDGE_LENGTH; ++y) {
+                for (uint32_t x = 0; x < vkph::CHUNK_EDGE_LENGTH; ++x) {
+                    values[vkph::get_voxel_index_in_layout<Layout>(x, y, z)] =
+                        chunks[i]->values[vkph::get_voxel_index(x, y, z)];
+                }
+            }
+        }
+    }
+
+    return planes;
+}
+
+template <vkph::voxel_layout_t Layout>
+static inline uint8_t s_cube_index(const uint8_t *values, uint32_t x, uint32_t y, uint32_t z) {
+    uint8_t bit_combination = 0;
+    bit_combination |= (uint8_t)((values[vkph::get_voxel_index_in_layout<Layout>(x, y, z)] > vkph::CHUNK_SURFACE_LEVEL) << 0);
+    bit_combination |= (uint8_t)((values[vkph::get_voxel_index_in_layout<Layout>(x + 1, y, z)] > vkph::CHUNK_SURFACE_LEVEL) << 1);
+    bit_combination |= (uint8_t)((values[vkph::get_voxel_index_in_layout<Layout>(x + 1, y, z + 1)] > vkph::CHUNK_SURFACE_LEVEL) << 2);
+    bit_combination |= (uint8_t)((values[vkph::get_voxel_index_in_layout<Layout>(x, y, z + 1)] > vkph::CHUNK_SURFACE_LEVEL) << 3);
+    bit_combination |= (uint8_t)((values[vkph::get_voxel_index_in_layout<Layout>(x, y + 1, z)] > vkph::CHUNK_SURFACE_LEVEL) << 4);
+    bit_combination |= (uint8_t)((values[vkph::get_voxel_index_in_layout<Layout>(x + 1, y + 1, z)] > vkph::CHUNK_SURFACE_LEVEL) << 5);
+    bit_combination |= (uint8_t)((values[vkph::get_voxel_index_in_layout<Layout>(x + 1, y + 1, z + 1)] > vkph::CHUNK_SURFACE_LEVEL) << 6);
+    bit_combination |= (uint8_t)((values[vkph::get_voxel_index_in_layout<Layout>(x, y + 1, z + 1)] > vkph::CHUNK_SURFACE_LEVEL) << 7);
+    return bit_combination;
+}
+
+// Average amount of 64 byte cache lines the 8 corners of a cell are spread over
+template <vkph::voxel_layout_t Layout>
+static float s_cache_lines_per_cell() {
+    static constexpr uint32_t CELL_OFFSETS[8][3] = {
+        {0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1},
+        {0, 1, 0}, {1, 1, 0}, {1, 1, 1}, {0, 1, 1} };
+
+    uint32_t line_count = 0, cell_count = 0;
+
+    for (uint32_t z = 0; z < vkph::CHUNK_EDGE_LENGTH - 1; ++z) {
+        for (uint32_t y = 0; y < vkph::CHUNK_EDGE_LENGTH - 1; ++y) {
+            for (uint32_t x = 0; x < vkph::CHUNK_EDGE_LENGTH - 1; ++x) {
+                uint32_t lines[8];
+                uint32_t distinct = 0;
+
+                for (uint32_t v = 0; v < 8; ++v) {
+                    uint32_t line = vkph::get_voxel_index_in_layout<Layout>(
+                        x + CELL_OFFSETS[v][0],
+                        y + CELL_OFFSETS[v][1],
+                        z + CELL_OFFSETS[v][2]) / 64;
+
+                    bool found = 0;
+                    for (uint32_t l = 0; l < distinct; ++l) {
+                        found |= (lines[l] == line);
+                    }
+
+                    if (!found) {
+                        lines[distinct++] = line;
+                    }
+                }
+
+                line_count += distinct;
+                ++cell_count;
+            }
+        }
+    }
+
+    return (float)line_count / (float)cell_count;
+}
+
+static constexpr uint32_t MESH_PASS_COUNT = 50;
+static constexpr uint32_t COLLISION_QUERY_COUNT = 500000;
+// Collision queries gather the cells in a box around the sphere
+static constexpr uint32_t COLLISION_BOX_EDGE = 4;
+
+template <vkph::voxel_layout_t Layout>
+static void s_bench_layout(const char *name, vkph::chunk_t **chunks, uint32_t chunk_count) {
+    uint8_t *planes = s_create_planes<Layout>(chunks, chunk_count);
+
+    cache_miss_counter_t counter;
+    counter.init();
+
+    { // Mesh pass: every cell of every chunk, in order
+        uint32_t surface_cell_count = 0;
+        uint32_t cell_count = 0;
+
+        time_stamp_t start = current_time();
+        counter.start();
+
+        for (uint32_t pass = 0; pass < MESH_PASS_COUNT; ++pass) {
+            for (uint32_t i = 0; i < chunk_count; ++i) {
+                const uint8_t *values = &planes[i * vkph::CHUNK_VOXEL_COUNT];
+
+                for (uint32_t z = 0; z < vkph::CHUNK_EDGE_LENGTH - 1; ++z) {
+                    for (uint32_t y = 0; y < vkph::CHUNK_EDGE_LENGTH - 1; ++y) {
+                        for (uint32_t x = 0; x < vkph::CHUNK_EDGE_LENGTH - 1; ++x) {
+                            uint8_t bit_combination = s_cube_index<Layout>(values, x, y, z);
+                            surface_cell_count += (bit_combination != 0 && bit_combination != 0xFF);
+                            ++cell_count;
+                        }
+                    }
+                }
+            }
+        }
+
+        uint64_t misses = counter.stop();
+        float ns = ns_per_iteration(start, cell_count);
+
+        if (counter.available) {
+            LOG_INFOV("    %s: mesh pass %.2f ns / cell, %.4f cache misses / cell (%d surface cells)\n",
+                      name, ns, (float)misses / (float)cell_count, surface_cell_count / MESH_PASS_COUNT);
+        }
+        else {
+            LOG_INFOV("    %s: mesh pass %.2f ns / cell, cache misses n/a (%d surface cells)\n",
+                      name, ns, surface_cell_count / MESH_PASS_COUNT);
+        }
+    }
+
+    { // Collision: small boxes of cells at random places
+        uint32_t seed = 0xFACADE;
+        uint32_t surface_cell_count = 0;
+        static constexpr uint32_t MAX_START = vkph::CHUNK_EDGE_LENGTH - 1 - COLLISION_BOX_EDGE;
+
+        time_stamp_t start = current_time();
+        counter.start();
+
+        for (uint32_t q = 0; q < COLLISION_QUERY_COUNT; ++q) {
+            const uint8_t *values = &planes[(xorshift(&seed) % chunk_count) * vkph::CHUNK_VOXEL_COUNT];
+            uint32_t rnd = xorshift(&seed);
+            uint32_t x0 = (rnd & 0xFF) % (MAX_START + 1);
+            uint32_t y0 = ((rnd >> 8) & 0xFF) % (MAX_START + 1);
+            uint32_t z0 = ((rnd >> 16) & 0xFF) % (MAX_START + 1);
+
+            for (uint32_t z = z0; z < z0 + COLLISION_BOX_EDGE; ++z) {
+                for (uint32_t y = y0; y < y0 + COLLISION_BOX_EDGE; ++y) {
+                    for (uint32_t x = x0; x < x0 + COLLISION_BOX_EDGE; ++x) {
+                        uint8_t bit_combination = s_cube_index<Layout>(values, x, y, z);
+                        surface_cell_count += (bit_combination != 0 && bit_combination != 0xFF);
+                    }
+                }
+            }
+        }
+
+        uint64_t misses = counter.stop();
+        uint32_t cell_count = COLLISION_QUERY_COUNT * COLLISION_BOX_EDGE * COLLISION_BOX_EDGE * COLLISION_BOX_EDGE;
+        float ns = ns_per_iteration(start, cell_count);
+
+        if (counter.available) {
+            LOG_INFOV("    %s: collision gather %.2f ns / cell, %.4f cache misses / cell (checksum %d)\n",
+                      name, ns, (float)misses / (float)cell_count, surface_cell_count);
+        }
+        else {
+            LOG_INFOV("    %s: collision gather %.2f ns / cell, cache misses n/a (checksum %d)\n",
+                      name, ns, surface_cell_count);
+        }
+    }
+
+    LOG_INFOV("    %s: %.2f cache lines touched / cell\n", name, s_cache_lines_per_cell<Layout>());
+
+    counter.destroy();
+    flfree(planes);
+}
+
+void run_voxel_order() {
+    vkph::state_t *state = create_state_with_map("ice.map");
+
+    uint32_t chunk_count = 0;
+    vkph::chunk_t **active_chunks = state->get_active_chunks(&chunk_count);
+
+    vkph::chunk_t **chunks = flmalloc<vkph::chunk_t *>(chunk_count);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        if (active_chunks[i]) {
+            chunks[count++] = active_chunks[i];
+        }
+    }
+
+    static const char *LAYOUT_NAMES[] = { "linear", "tiled", "morton" };
+    LOG_INFOV("ice.map: %d chunks, compiled layout: %s\n", count, LAYOUT_NAMES[vkph::VOXEL_LAYOUT]);
+
+    s_bench_layout<vkph::VL_LINEAR>(LAYOUT_NAMES[vkph::VL_LINEAR], chunks, count);
+    s_bench_layout<vkph::VL_TILED>(LAYOUT_NAMES[vkph::VL_TILED], chunks, count);
+    s_bench_layout<vkph::VL_MORTON>(LAYOUT_NAMES[vkph::VL_MORTON], chunks, count);
+
+    flfree(chunks);
+}
+
+}
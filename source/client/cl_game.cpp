@@ -178,13 +178,9 @@ void clear_game(vkph::state_t *state) {
             destroy_chunk_render(chunks[i]->render);
             chunks[i]->render = NULL;
         }
-
-        chunks[i]->destroy();
-        flfree(chunks[i]);
-
-        chunks[i] = NULL;
     }
 
+    // Recycles the chunks' memory
     state->clear_chunks();
 }
 
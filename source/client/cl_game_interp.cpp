@@ -25,10 +25,11 @@ void finish_interp_step(vkph::state_t *state) {
         c_ptr->flags.has_to_update_vertices = 1;
         for (uint32_t vm_index = 0; vm_index < cm_ptr->modified_voxels_count; ++vm_index) {
             net::voxel_modification_t *vm_ptr = &cm_ptr->modifications[vm_index];
-            vkph::voxel_t *current_value = &c_ptr->voxels[vm_ptr->index];
-            current_value->value = vm_ptr->final_value;
+            c_ptr->get_writable_values()[vm_ptr->index] = vm_ptr->final_value;
         }
 
+        c_ptr->update_occupancy();
+
         cm_ptr->modified_voxels_count = 0;
     }
 
@@ -51,10 +52,10 @@ void chunks_interp_step(float dt, vkph::state_t *state) {
         for (uint32_t vm_index = 0; vm_index < cm_ptr->modified_voxels_count; ++vm_index) {
             net::voxel_modification_t *vm_ptr = &cm_ptr->modifications[vm_index];
 
-            vkph::voxel_t *current_value = &c_ptr->voxels[vm_ptr->index];
+            uint8_t *current_value = &c_ptr->get_writable_values()[vm_ptr->index];
 
-            current_value->color = cm_ptr->colors[vm_index];
-            float fcurrent_value = (float)(current_value->value);
+            c_ptr->get_writable_colors()[vm_ptr->index] = cm_ptr->colors[vm_index];
+            float fcurrent_value = (float)(*current_value);
             float initial_value = (float)(vm_ptr->initial_value);
             float final_value = (float)(vm_ptr->final_value);
 
@@ -65,8 +66,10 @@ void chunks_interp_step(float dt, vkph::state_t *state) {
             else if (fcurrent_value > 254.0f) {
                 fcurrent_value = 254.0f;
             }
-            current_value->value = (uint8_t)fcurrent_value;
+            *current_value = (uint8_t)fcurrent_value;
         }
+
+        c_ptr->update_occupancy();
     }
 }
 
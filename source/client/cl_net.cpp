@@ -225,6 +225,14 @@ static void s_check_tcp_packets(vkph::state_t *state) {
                 receive_packet_chunk_voxels(&packet.serialiser, state);
             } break;
 
+            case net::PT_REVERT_CHUNKS: {
+                packet.print_info();
+
+                s_complete_streamed_packet(&packet);
+
+                receive_packet_revert_chunks(&packet.serialiser, state);
+            } break;
+
             }
         }
         else {
@@ -411,7 +419,7 @@ void init_net(vkph::state_t *state) {
 
     net::init_socket_api();
 
-    ctx->message_buffer = flmalloc<char>(net::NET_MAX_MESSAGE_SIZE);
+    ctx->message_buffer = flmalloc<char>(net::NET_MESSAGE_BUFFER_SIZE);
 
     init_meta_connection();
 
@@ -154,6 +154,8 @@ static void s_revert_history_instance(
     for (uint32_t cm_index = 0; cm_index < apm_ptr->acc_predicted_chunk_mod_count; ++cm_index) {
         net::chunk_modifications_t *cm_ptr = &apm_ptr->acc_predicted_modifications[cm_index];
         vkph::chunk_t *c_ptr = state->get_chunk(ivector3_t(cm_ptr->x, cm_ptr->y, cm_ptr->z));
+        uint8_t *values = c_ptr->get_writable_values();
+        vkph::voxel_color_t *colors = c_ptr->get_writable_colors();
 
         for (uint32_t vm_index = 0; vm_index < cm_ptr->modified_voxels_count; ++vm_index) {
             net::voxel_modification_t *vm_ptr = &cm_ptr->modifications[vm_index];
@@ -161,10 +163,12 @@ static void s_revert_history_instance(
 #if 0
             LOG_INFOV("(%i %i %i) Set voxel at index %i to %i\n", cm_ptr->x, cm_ptr->y, cm_ptr->z, vm_ptr->index, (int32_t)vm_ptr->initial_value);
 #endif
-            c_ptr->voxels[vm_ptr->index].value = vm_ptr->initial_value;
-            c_ptr->voxels[vm_ptr->index].color = cm_ptr->colors[vm_ptr->index];
+            values[vm_ptr->index] = vm_ptr->initial_value;
+            colors[vm_ptr->index] = cm_ptr->colors[vm_ptr->index];
         }
 
+        c_ptr->update_occupancy();
+
         c_ptr->flags.has_to_update_vertices = 1;
     }
 }
@@ -219,6 +223,7 @@ static void s_correct_chunks(
     for (uint32_t cm_index = 0; cm_index < snapshot->modified_chunk_count; ++cm_index) {
         net::chunk_modifications_t *cm_ptr = &snapshot->chunk_modifications[cm_index];
         vkph::chunk_t *c_ptr = state->get_chunk(ivector3_t(cm_ptr->x, cm_ptr->y, cm_ptr->z));
+        uint8_t *values = c_ptr->get_writable_values();
 
         //LOG_INFOV("Correcting chunk (%i %i %i)\n", cm_ptr->x, cm_ptr->y, cm_ptr->z);
         for (uint32_t vm_index = 0; vm_index < cm_ptr->modified_voxels_count; ++vm_index) {
@@ -226,8 +231,10 @@ static void s_correct_chunks(
 #if 0
             printf("(%i %i %i) Setting (%i) to %i\n", c_ptr->chunk_coord.x, c_ptr->chunk_coord.y, c_ptr->chunk_coord.z, vm_ptr->index, (int32_t)vm_ptr->final_value);
 #endif
-            c_ptr->voxels[vm_ptr->index].value = vm_ptr->final_value;
+            values[vm_ptr->index] = vm_ptr->final_value;
         }
+
+        c_ptr->update_occupancy();
     }
 }
 
@@ -237,12 +244,15 @@ static void s_set_voxels_to_final_interpolated_values(vkph::state_t *state) {
         net::chunk_modifications_t *cm_ptr = &cti_ptr->modifications[cm_index];
 
         vkph::chunk_t *c_ptr = state->get_chunk(ivector3_t(cm_ptr->x, cm_ptr->y, cm_ptr->z));
+        uint8_t *values = c_ptr->get_writable_values();
 
         for (uint32_t vm_index = 0; vm_index < cm_ptr->modified_voxels_count; ++vm_index) {
             net::voxel_modification_t *vm_ptr = &cm_ptr->modifications[vm_index];
-            c_ptr->voxels[vm_ptr->index].value = vm_ptr->final_value;
+            values[vm_ptr->index] = vm_ptr->final_value;
         }
 
+        c_ptr->update_occupancy();
+
         cm_ptr->modified_voxels_count = 0;
     }
 
@@ -296,11 +306,11 @@ static void s_create_voxels_that_need_to_be_interpolated(
             for (uint32_t recv_vm_index = 0; recv_vm_index < recv_cm_ptr->modified_voxels_count; ++recv_vm_index) {
                 net::voxel_modification_t *recv_vm_ptr = &recv_cm_ptr->modifications[recv_vm_index];
                 if (ctx->dummy_voxels[recv_vm_ptr->index] == vkph::CHUNK_SPECIAL_VALUE) {
-                    if (recv_vm_ptr->final_value != c_ptr->voxels[recv_vm_ptr->index].value) {
+                    if (recv_vm_ptr->final_value != c_ptr->values[recv_vm_ptr->index]) {
                         // Was not modified, can push this
                         dst_cm_ptr->modifications[dst_cm_ptr->modified_voxels_count].index = recv_vm_ptr->index;
                         // Initial value is current value of voxel
-                        dst_cm_ptr->modifications[dst_cm_ptr->modified_voxels_count].initial_value = c_ptr->voxels[recv_vm_ptr->index].value;
+                        dst_cm_ptr->modifications[dst_cm_ptr->modified_voxels_count].initial_value = c_ptr->values[recv_vm_ptr->index];
                         dst_cm_ptr->modifications[dst_cm_ptr->modified_voxels_count].final_value = recv_vm_ptr->final_value;
                         dst_cm_ptr->colors[dst_cm_ptr->modified_voxels_count++] = recv_vm_ptr->color;
                         ++count;
@@ -339,7 +349,7 @@ static void s_create_voxels_that_need_to_be_interpolated(
                     net::voxel_modification_t *recv_vm_ptr = &recv_cm_ptr->modifications[vm_index];
                     dst_vm_ptr->index = recv_vm_ptr->index;
                     // The initial value is juste the current local value of the chunk
-                    dst_vm_ptr->initial_value = c_ptr->voxels[recv_vm_ptr->index].value;
+                    dst_vm_ptr->initial_value = c_ptr->values[recv_vm_ptr->index];
                     dst_vm_ptr->final_value = recv_vm_ptr->final_value;
                     *dst_color = recv_vm_ptr->color;
                 }
@@ -454,12 +464,16 @@ static void s_handle_incorrect_state(
             for (uint32_t cm_index = 0; cm_index < modification_count; ++cm_index) {
                 net::chunk_modifications_t *cm_ptr = &modifications[cm_index];
                 vkph::chunk_t *c_ptr = state->get_chunk(ivector3_t(cm_ptr->x, cm_ptr->y, cm_ptr->z));
+                uint8_t *values = c_ptr->get_writable_values();
+                vkph::voxel_color_t *colors = c_ptr->get_writable_colors();
                 for (uint32_t vm_index = 0; vm_index < cm_ptr->modified_voxels_count; ++vm_index) {
                     net::voxel_modification_t *vm_ptr = &cm_ptr->modifications[vm_index];
-                    c_ptr->voxels[vm_ptr->index].value = vm_ptr->final_value;
+                    values[vm_ptr->index] = vm_ptr->final_value;
                     // Color will not be stored in the separate color array
-                    c_ptr->voxels[vm_ptr->index].color = vm_ptr->color;
+                    colors[vm_ptr->index] = vm_ptr->color;
                 }
+
+                c_ptr->update_occupancy();
             }
         }
     }
@@ -472,12 +486,16 @@ static void s_handle_incorrect_state(
         for (uint32_t cm_index = 0; cm_index < packet->modified_chunk_count; ++cm_index) {
             net::chunk_modifications_t *cm_ptr = &packet->chunk_modifications[cm_index];
             vkph::chunk_t *c_ptr = state->get_chunk(ivector3_t(cm_ptr->x, cm_ptr->y, cm_ptr->z));
+            uint8_t *values = c_ptr->get_writable_values();
+            vkph::voxel_color_t *colors = c_ptr->get_writable_colors();
 
             for (uint32_t v_index = 0; v_index < cm_ptr->modified_voxels_count; ++v_index) {
                 net::voxel_modification_t *vm_ptr = &cm_ptr->modifications[v_index];
-                c_ptr->voxels[vm_ptr->index].value = vm_ptr->final_value;
-                c_ptr->voxels[vm_ptr->index].color = vm_ptr->color;
+                values[vm_ptr->index] = vm_ptr->final_value;
+                colors[vm_ptr->index] = vm_ptr->color;
             }
+
+            c_ptr->update_occupancy();
         }
     }
                 
@@ -637,6 +655,9 @@ void receive_packet_chunk_voxels(
     vkph::state_t *state) {
     uint32_t loaded_chunk_count = serialiser->deserialise_uint32();
 
+    // Chunks which the server's map stream published after the handshake come after the ones it announced
+    bool streamed = (chunks_to_receive == 0);
+
     for (uint32_t c = 0; c < loaded_chunk_count; ++c) {
         int16_t x = serialiser->deserialise_int16();
         int16_t y = serialiser->deserialise_int16();
@@ -644,68 +665,41 @@ void receive_packet_chunk_voxels(
 
         vkph::chunk_t *chunk = state->get_chunk(ivector3_t(x, y, z));
         chunk->flags.has_to_update_vertices = 1;
-        
-        for (uint32_t v = 0; v < vkph::CHUNK_EDGE_LENGTH * vkph::CHUNK_EDGE_LENGTH * vkph::CHUNK_EDGE_LENGTH;) {
-            uint32_t debug = v;
-
-            uint8_t current_value = serialiser->deserialise_uint8();
-            uint8_t current_color = serialiser->deserialise_uint8();
-
-            if (current_value == vkph::CHUNK_SPECIAL_VALUE) {
-                chunk->voxels[v].value = 0;
-                chunk->voxels[v].color = 0;
-                ++v;
-
-                // Repeating zeros
-                uint32_t zero_count = serialiser->deserialise_uint32();
-                chunk->voxels[v + 1].value = 0;
-                chunk->voxels[v + 1].color = 0;
-                chunk->voxels[v + 2].value = 0;
-                chunk->voxels[v + 2].color = 0;
-
-                v += 2;
-
-                uint32_t previous_v = v;
-                for (; v < previous_v + zero_count - 3; ++v) {
-                    chunk->voxels[v].value = 0;
-                    chunk->voxels[v].color = 0;
-                }
-            }
-            else {
-                chunk->voxels[v].value = current_value;
-                chunk->voxels[v].color = current_color;
-                ++v;
+
+        vkph::deserialise_chunk_voxels(serialiser, chunk->get_writable_values(), chunk->get_writable_colors());
+
+        chunk->update_occupancy();
+        chunk->compact();
+
+        // The server tells the client to revert chunks to what it got when joining (see receive_packet_revert_chunks())
+        state->set_baseline_chunk(chunk);
+
+        if (streamed) {
+            for (uint32_t n = 0; n < vkph::CHUNK_NEIGHBOUR_COUNT; ++n) {
+                vkph::chunk_t *a = chunk->neighbours[n];
+                if (a) a->flags.has_to_update_vertices = 1;
             }
         }
     }
 
+    if (streamed) {
+        LOG_INFOV("Received %d chunks which the server's map stream published\n", loaded_chunk_count);
+        return;
+    }
+
     uint32_t loaded;
     vkph::chunk_t **chunks = state->get_active_chunks(&loaded);
 
-    chunks_to_receive -= loaded_chunk_count;
+    chunks_to_receive -= MIN(loaded_chunk_count, chunks_to_receive);
 
     if (chunks_to_receive == 0) {
         for (uint32_t i = 0; i < loaded; ++i) {
             vkph::chunk_t *c = state->chunks[i];
-            uint32_t x = c->chunk_coord.x;
-            uint32_t y = c->chunk_coord.y;
-            uint32_t z = c->chunk_coord.z;
-
-            vkph::chunk_t *a = NULL;
-            if ((a = state->access_chunk(ivector3_t(x + 1, y, z)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x - 1, y, z)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x, y + 1, z)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x, y - 1, z)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x, y, z + 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x, y, z - 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x + 1, y + 1, z + 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x + 1, y + 1, z - 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x + 1, y - 1, z + 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x + 1, y - 1, z - 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x - 1, y + 1, z + 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x - 1, y + 1, z - 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x - 1, y - 1, z + 1)))) a->flags.has_to_update_vertices = 1;
-            if ((a = state->access_chunk(ivector3_t(x - 1, y - 1, z - 1)))) a->flags.has_to_update_vertices = 1;
+
+            for (uint32_t n = 0; n < vkph::CHUNK_NEIGHBOUR_COUNT; ++n) {
+                vkph::chunk_t *a = c->neighbours[n];
+                if (a) a->flags.has_to_update_vertices = 1;
+            }
         }
     }
 
@@ -713,6 +707,47 @@ void receive_packet_chunk_voxels(
     LOG_INFOV("Currently there are %d loaded chunks\n", loaded);
 }
 
+// PT_REVERT_CHUNKS
+void receive_packet_revert_chunks(
+    serialiser_t *serialiser,
+    vkph::state_t *state) {
+    uint32_t revert_count = serialiser->deserialise_uint32();
+    ivector3_t *chunk_coords = lnmalloc<ivector3_t>(MAX(revert_count, 1u));
+
+    for (uint32_t i = 0; i < revert_count; ++i) {
+        chunk_coords[i].x = serialiser->deserialise_int16();
+        chunk_coords[i].y = serialiser->deserialise_int16();
+        chunk_coords[i].z = serialiser->deserialise_int16();
+    }
+
+    state->revert_chunks_to_baseline(chunk_coords, revert_count);
+
+    // These had already changed when the client joined, so they aren't in the baseline
+    uint32_t chunk_count = serialiser->deserialise_uint32();
+
+    for (uint32_t c = 0; c < chunk_count; ++c) {
+        int16_t x = serialiser->deserialise_int16();
+        int16_t y = serialiser->deserialise_int16();
+        int16_t z = serialiser->deserialise_int16();
+
+        vkph::chunk_t *chunk = state->get_chunk(ivector3_t(x, y, z));
+
+        vkph::deserialise_chunk_voxels(serialiser, chunk->get_writable_values(), chunk->get_writable_colors());
+
+        chunk->update_occupancy();
+        chunk->compact();
+
+        state->set_baseline_chunk(chunk);
+
+        for (uint32_t n = 0; n < vkph::CHUNK_NEIGHBOUR_COUNT; ++n) {
+            vkph::chunk_t *a = chunk->neighbours[n];
+            if (a) a->flags.has_to_update_vertices = 1;
+        }
+    }
+
+    LOG_INFOV("Reverted %d chunks (%d were sent)\n", revert_count + chunk_count, chunk_count);
+}
+
 void receive_player_team_change(
     serialiser_t *serialiser,
     vkph::state_t *state) {
@@ -39,6 +39,10 @@ void receive_packet_chunk_voxels(
     serialiser_t *serialiser,
     vkph::state_t *state);
 
+void receive_packet_revert_chunks(
+    serialiser_t *serialiser,
+    vkph::state_t *state);
+
 void receive_player_team_change(
     serialiser_t *serialiser,
     vkph::state_t *state);
@@ -140,8 +140,7 @@ static vkph::voxel_t s_chunk_edge_voxel_value(
     int32_t y,
     int32_t z,
     bool *doesnt_exist,
-    ivector3_t chunk_coord,
-    const vkph::state_t *state) {
+    const vkph::chunk_t *chunk) {
     int32_t chunk_coord_offset_x = 0, chunk_coord_offset_y = 0, chunk_coord_offset_z = 0;
     int32_t final_x = x, final_y = y, final_z = z;
 
@@ -158,19 +157,17 @@ static vkph::voxel_t s_chunk_edge_voxel_value(
         chunk_coord_offset_z = 1;
     }
 
-    ivector3_t coord = ivector3_t(
-        chunk_coord.x + chunk_coord_offset_x,
-        chunk_coord.y + chunk_coord_offset_y,
-        chunk_coord.z + chunk_coord_offset_z);
-
-    const vkph::chunk_t *chunk_ptr = state->access_chunk(coord);
+    const vkph::chunk_t *chunk_ptr = chunk->get_neighbour(
+        chunk_coord_offset_x,
+        chunk_coord_offset_y,
+        chunk_coord_offset_z);
     
     *doesnt_exist = (bool)(chunk_ptr == nullptr);
 
     if (*doesnt_exist)
         return { 0, 0 };
     
-    return chunk_ptr->voxels[vkph::get_voxel_index(final_x, final_y, final_z)];
+    return chunk_ptr->get_voxel(vkph::get_voxel_index(final_x, final_y, final_z));
 }
 
 static const vector3_t NORMALIZED_CUBE_VERTICES[8] = {
@@ -222,7 +219,7 @@ static void s_push_vertex_to_triangle_array(
     
     vector3_t vertex = interpolate(vertices[v0].position, vertices[v1].position, interpolated_voxel_values);
 
-    vector3_t floor_of_vertex = glm::min(glm::floor(vertex), vector3_t(15.0f));
+    vector3_t floor_of_vertex = glm::min(glm::floor(vertex), vector3_t((float)(vkph::CHUNK_EDGE_LENGTH - 1)));
     ivector3_t ifloor_of_vertex = ivector3_t(floor_of_vertex);
 
     vector3_t normalized_vertex = (vertex - floor_of_vertex);
@@ -231,15 +228,19 @@ static void s_push_vertex_to_triangle_array(
     uint32_t low = 0;
     uint32_t high = 0;
 
-    low += (ifloor_of_vertex.x << 28);
-    low += (ifloor_of_vertex.y << 24);
-    low += (ifloor_of_vertex.z << 20);
+    low += ((ifloor_of_vertex.x & 15) << 28);
+    low += ((ifloor_of_vertex.y & 15) << 24);
+    low += ((ifloor_of_vertex.z & 15) << 20);
     low += (inormalized_vertex.x << 12);
     low += (inormalized_vertex.y << 4);
     low += inormalized_vertex.z >> 4;
 
     high += inormalized_vertex.z << 28;
     high += color << 20;
+    // 5th bit of the voxel coordinates (only used with 32x32x32 chunks)
+    high += ((ifloor_of_vertex.x >> 4) & 1) << 19;
+    high += ((ifloor_of_vertex.y >> 4) & 1) << 18;
+    high += ((ifloor_of_vertex.z >> 4) & 1) << 17;
 
     mesh_vertices[*(vertex_count)].low = low;
     mesh_vertices[*(vertex_count)].high = high;
@@ -324,9 +325,9 @@ static uint32_t s_generate_chunk_verts(
     const vkph::state_t *state) {
     uint32_t vertex_count = 0;
 
-    const vkph::chunk_t *x_superior = state->access_chunk(ivector3_t(c->chunk_coord.x + 1, c->chunk_coord.y, c->chunk_coord.z));
-    const vkph::chunk_t *y_superior = state->access_chunk(ivector3_t(c->chunk_coord.x, c->chunk_coord.y + 1, c->chunk_coord.z));
-    const vkph::chunk_t *z_superior = state->access_chunk(ivector3_t(c->chunk_coord.x, c->chunk_coord.y, c->chunk_coord.z + 1));
+    const vkph::chunk_t *x_superior = c->get_neighbour(1, 0, 0);
+    const vkph::chunk_t *y_superior = c->get_neighbour(0, 1, 0);
+    const vkph::chunk_t *z_superior = c->get_neighbour(0, 0, 1);
     
     bool doesnt_exist = 0;
     if (x_superior) {
@@ -338,15 +339,15 @@ static uint32_t s_generate_chunk_verts(
                 uint32_t x = vkph::CHUNK_EDGE_LENGTH - 1;
 
                 vkph::voxel_t voxel_values[8] = {
-                    c->voxels[vkph::get_voxel_index(x, y, z)],
-                    s_chunk_edge_voxel_value(x + 1, y, z, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y][z],
-                    s_chunk_edge_voxel_value(x + 1, y, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y][z + 1],
-                    s_chunk_edge_voxel_value(x,     y, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x]    [y][z + 1],
+                    c->get_voxel(vkph::get_voxel_index(x, y, z)),
+                    s_chunk_edge_voxel_value(x + 1, y, z, &doesnt_exist, c),//voxels[x + 1][y][z],
+                    s_chunk_edge_voxel_value(x + 1, y, z + 1, &doesnt_exist, c),//voxels[x + 1][y][z + 1],
+                    s_chunk_edge_voxel_value(x,     y, z + 1, &doesnt_exist, c),//voxels[x]    [y][z + 1],
                     
-                    c->voxels[vkph::get_voxel_index(x, y + 1, z)],
-                    s_chunk_edge_voxel_value(x + 1, y + 1, z,&doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y + 1][z],
-                    s_chunk_edge_voxel_value(x + 1, y + 1, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y + 1][z + 1],
-                    s_chunk_edge_voxel_value(x,     y + 1, z + 1, &doesnt_exist, c->chunk_coord, state) };//voxels[x]    [y + 1][z + 1] };
+                    c->get_voxel(vkph::get_voxel_index(x, y + 1, z)),
+                    s_chunk_edge_voxel_value(x + 1, y + 1, z, &doesnt_exist, c),//voxels[x + 1][y + 1][z],
+                    s_chunk_edge_voxel_value(x + 1, y + 1, z + 1, &doesnt_exist, c),//voxels[x + 1][y + 1][z + 1],
+                    s_chunk_edge_voxel_value(x,     y + 1, z + 1, &doesnt_exist, c) };//voxels[x]    [y + 1][z + 1] };
 
                 if (!doesnt_exist)
                     s_update_chunk_mesh_voxel_pair(voxel_values, x, y, z, surface_level, mesh_vertices, &vertex_count);
@@ -363,15 +364,15 @@ static uint32_t s_generate_chunk_verts(
                 uint32_t y = vkph::CHUNK_EDGE_LENGTH - 1;
 
                 vkph::voxel_t voxel_values[8] = {
-                    c->voxels[vkph::get_voxel_index(x, y, z)],
-                    s_chunk_edge_voxel_value(x + 1, y, z, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y][z],
-                    s_chunk_edge_voxel_value(x + 1, y, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y][z + 1],
-                    s_chunk_edge_voxel_value(x,     y, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x]    [y][z + 1],
+                    c->get_voxel(vkph::get_voxel_index(x, y, z)),
+                    s_chunk_edge_voxel_value(x + 1, y, z, &doesnt_exist, c),//voxels[x + 1][y][z],
+                    s_chunk_edge_voxel_value(x + 1, y, z + 1, &doesnt_exist, c),//voxels[x + 1][y][z + 1],
+                    s_chunk_edge_voxel_value(x,     y, z + 1, &doesnt_exist, c),//voxels[x]    [y][z + 1],
                     
-                    s_chunk_edge_voxel_value(x, y + 1, z, &doesnt_exist, c->chunk_coord, state),
-                    s_chunk_edge_voxel_value(x + 1, y + 1, z, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y + 1][z],
-                    s_chunk_edge_voxel_value(x + 1, y + 1, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y + 1][z + 1],
-                    s_chunk_edge_voxel_value(x,     y + 1, z + 1, &doesnt_exist, c->chunk_coord, state) };//voxels[x]    [y + 1][z + 1] };
+                    s_chunk_edge_voxel_value(x, y + 1, z, &doesnt_exist, c),
+                    s_chunk_edge_voxel_value(x + 1, y + 1, z, &doesnt_exist, c),//voxels[x + 1][y + 1][z],
+                    s_chunk_edge_voxel_value(x + 1, y + 1, z + 1, &doesnt_exist, c),//voxels[x + 1][y + 1][z + 1],
+                    s_chunk_edge_voxel_value(x,     y + 1, z + 1, &doesnt_exist, c) };//voxels[x]    [y + 1][z + 1] };
 
                 if (!doesnt_exist)
                     s_update_chunk_mesh_voxel_pair(voxel_values, x, y, z, surface_level, mesh_vertices, &vertex_count);
@@ -389,15 +390,15 @@ static uint32_t s_generate_chunk_verts(
                 uint32_t z = vkph::CHUNK_EDGE_LENGTH - 1;
 
                 vkph::voxel_t voxel_values[8] = {
-                    c->voxels[vkph::get_voxel_index(x, y, z)],
-                    s_chunk_edge_voxel_value(x + 1, y, z, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y][z],
-                    s_chunk_edge_voxel_value(x + 1, y, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y][z + 1],
-                    s_chunk_edge_voxel_value(x,     y, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x]    [y][z + 1],
+                    c->get_voxel(vkph::get_voxel_index(x, y, z)),
+                    s_chunk_edge_voxel_value(x + 1, y, z, &doesnt_exist, c),//voxels[x + 1][y][z],
+                    s_chunk_edge_voxel_value(x + 1, y, z + 1, &doesnt_exist, c),//voxels[x + 1][y][z + 1],
+                    s_chunk_edge_voxel_value(x,     y, z + 1, &doesnt_exist, c),//voxels[x]    [y][z + 1],
                     
-                    c->voxels[vkph::get_voxel_index(x, y + 1, z)],
-                    s_chunk_edge_voxel_value(x + 1, y + 1, z, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y + 1][z],
-                    s_chunk_edge_voxel_value(x + 1, y + 1, z + 1, &doesnt_exist, c->chunk_coord, state),//voxels[x + 1][y + 1][z + 1],
-                    s_chunk_edge_voxel_value(x,     y + 1, z + 1, &doesnt_exist, c->chunk_coord, state) };//voxels[x]    [y + 1][z + 1] };
+                    c->get_voxel(vkph::get_voxel_index(x, y + 1, z)),
+                    s_chunk_edge_voxel_value(x + 1, y + 1, z, &doesnt_exist, c),//voxels[x + 1][y + 1][z],
+                    s_chunk_edge_voxel_value(x + 1, y + 1, z + 1, &doesnt_exist, c),//voxels[x + 1][y + 1][z + 1],
+                    s_chunk_edge_voxel_value(x,     y + 1, z + 1, &doesnt_exist, c) };//voxels[x]    [y + 1][z + 1] };
 
                 if (!doesnt_exist)
                     s_update_chunk_mesh_voxel_pair(voxel_values, x, y, z, surface_level, mesh_vertices, &vertex_count);
@@ -405,21 +406,53 @@ static uint32_t s_generate_chunk_verts(
         }
     }
     
-    for (uint32_t z = 0; z < vkph::CHUNK_EDGE_LENGTH - 1; ++z) {
-        for (uint32_t y = 0; y < vkph::CHUNK_EDGE_LENGTH - 1; ++y) {
-            for (uint32_t x = 0; x < vkph::CHUNK_EDGE_LENGTH - 1; ++x) {
-                vkph::voxel_t voxel_values[8] = {
-                    c->voxels[vkph::get_voxel_index(x, y, z)],
-                    c->voxels[vkph::get_voxel_index(x + 1, y, z)],
-                    c->voxels[vkph::get_voxel_index(x + 1, y, z + 1)],
-                    c->voxels[vkph::get_voxel_index(x, y, z + 1)],
+    // Only go through the bricks which might cross the surface
+    uint64_t surface_bricks = c->occupancy.surface_bricks;
+
+    while (surface_bricks) {
+        uint32_t brick_index = lowest_bit_index(surface_bricks);
+        surface_bricks &= surface_bricks - 1;
+
+        uint32_t x0 = (brick_index % vkph::CHUNK_BRICKS_PER_EDGE) * vkph::CHUNK_BRICK_EDGE_LENGTH;
+        uint32_t y0 = ((brick_index / vkph::CHUNK_BRICKS_PER_EDGE) % vkph::CHUNK_BRICKS_PER_EDGE) * vkph::CHUNK_BRICK_EDGE_LENGTH;
+        uint32_t z0 = (brick_index / (vkph::CHUNK_BRICKS_PER_EDGE * vkph::CHUNK_BRICKS_PER_EDGE)) * vkph::CHUNK_BRICK_EDGE_LENGTH;
+
+        // The last row / column / layer of cells was done above
+        uint32_t x1 = MIN(x0 + vkph::CHUNK_BRICK_EDGE_LENGTH, vkph::CHUNK_EDGE_LENGTH - 1);
+        uint32_t y1 = MIN(y0 + vkph::CHUNK_BRICK_EDGE_LENGTH, vkph::CHUNK_EDGE_LENGTH - 1);
+        uint32_t z1 = MIN(z0 + vkph::CHUNK_BRICK_EDGE_LENGTH, vkph::CHUNK_EDGE_LENGTH - 1);
+
+        for (uint32_t z = z0; z < z1; ++z) {
+            for (uint32_t y = y0; y < y1; ++y) {
+                for (uint32_t x = x0; x < x1; ++x) {
+                    uint32_t indices[8] = {
+                        vkph::get_voxel_index(x, y, z),
+                        vkph::get_voxel_index(x + 1, y, z),
+                        vkph::get_voxel_index(x + 1, y, z + 1),
+                        vkph::get_voxel_index(x, y, z + 1),
                     
-                    c->voxels[vkph::get_voxel_index(x, y + 1, z)],
-                    c->voxels[vkph::get_voxel_index(x + 1, y + 1, z)],
-                    c->voxels[vkph::get_voxel_index(x + 1, y + 1, z + 1)],
-                    c->voxels[vkph::get_voxel_index(x, y + 1, z + 1)] };
+                        vkph::get_voxel_index(x, y + 1, z),
+                        vkph::get_voxel_index(x + 1, y + 1, z),
+                        vkph::get_voxel_index(x + 1, y + 1, z + 1),
+                        vkph::get_voxel_index(x, y + 1, z + 1) };
+
+                    // Only the values are needed to know whether the cell produces any triangles
+                    uint32_t over_surface_count = 0;
+                    for (uint32_t i = 0; i < 8; ++i) {
+                        over_surface_count += (c->values[indices[i]] > surface_level);
+                    }
+
+                    if (over_surface_count == 0 || over_surface_count == 8) {
+                        continue;
+                    }
+
+                    vkph::voxel_t voxel_values[8];
+                    for (uint32_t i = 0; i < 8; ++i) {
+                        voxel_values[i] = c->get_voxel(indices[i]);
+                    }
 
-                s_update_chunk_mesh_voxel_pair(voxel_values, x, y, z, surface_level, mesh_vertices, &vertex_count);
+                    s_update_chunk_mesh_voxel_pair(voxel_values, x, y, z, surface_level, mesh_vertices, &vertex_count);
+                }
             }
         }
     }
@@ -552,7 +585,7 @@ void chunks_gpu_sync_and_render(
         
             if (c->flags.active_vertices) {
                 // Make sure that the chunk is in the view of the frustum
-                vector3_t chunk_center = vector3_t((c->chunk_coord * 16)) + vector3_t(8.0f);
+                vector3_t chunk_center = vector3_t((c->chunk_coord * vkph::CHUNK_EDGE_LENGTH)) + vector3_t((float)vkph::CHUNK_EDGE_LENGTH / 2.0f);
                 vector3_t diff = chunk_center - eye_info->position;
                 // if (frustum_check_cube(frustum, chunk_center, 8.0f) || glm::dot(diff, diff) < 32.0f * 32.0f) {
                 vk::submit_mesh(
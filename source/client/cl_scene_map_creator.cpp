@@ -5,6 +5,7 @@
 #include <ux_popup.hpp>
 #include <vkph_chunk.hpp>
 #include <vkph_map.hpp>
+#include <vkph_map_stream.hpp>
 #include <app.hpp>
 #include <vk.hpp>
 #include <ux_hud.hpp>
@@ -90,6 +91,30 @@ bool map_creator_scene_t::push_edit_character(char c) {
 enum edit_command_type_t : char { ECT_ADD = '+', ECT_DESTROY = '-', ECT_INVALID = 0 };
 enum edit_shape_type_t : char { EST_SPHERE = 's', EST_HOLLOW_SPHERE = 'h', EST_PLANE = 'p', EST_MATH = 'm', EST_INVALID = 0 };
 
+// The big spheres take a while
+static void s_log_generation_progress(uint32_t finished_count, uint32_t chunk_count, void *data) {
+    uint32_t *last_tenth = (uint32_t *)data;
+    uint32_t tenth = finished_count * 10 / chunk_count;
+
+    if (tenth != *last_tenth) {
+        *last_tenth = tenth;
+        LOG_INFOV("Generated %d / %d chunks\n", finished_count, chunk_count);
+    }
+}
+
+// Big maps take a while to stream in
+static void s_log_map_stream_progress(uint32_t published_count, uint32_t block_count, void *data) {
+    uint32_t *last_tenth = (uint32_t *)data;
+    uint32_t tenth = published_count * 10 / block_count;
+
+    if (tenth != *last_tenth) {
+        *last_tenth = tenth;
+        LOG_INFOV("Loaded %d / %d map blocks\n", published_count, block_count);
+    }
+}
+
+static uint32_t map_stream_last_tenth;
+
 void map_creator_scene_t::parse_and_generate_sphere(
     vkph::generation_type_t type,
     const char *str,
@@ -107,6 +132,11 @@ void map_creator_scene_t::parse_and_generate_sphere(
     info.type = type;
     info.ws_center = spectator->ws_position;
     info.ws_radius = (float)sphere_radius;
+
+    uint32_t last_tenth = 0;
+    info.progress = &s_log_generation_progress;
+    info.progress_data = &last_tenth;
+
     state->generate_sphere(&info);
 }
 
@@ -127,6 +157,11 @@ void map_creator_scene_t::parse_and_generate_hollow_sphere(
     info.type = type;
     info.ws_center = spectator->ws_position;
     info.ws_radius = (float)sphere_radius;
+
+    uint32_t last_tenth = 0;
+    info.progress = &s_log_generation_progress;
+    info.progress_data = &last_tenth;
+
     state->generate_hollow_sphere(&info);
 }
 
@@ -268,6 +303,9 @@ void map_creator_scene_t::handle_input(vkph::state_t *state) {
 void map_creator_scene_t::tick(frame_command_buffers_t *cmdbufs, vkph::state_t *state) {
     handle_input(state);
 
+    // Chunks of the map which is getting loaded
+    state->publish_map_stream(vkph::MAP_STREAM_BLOCKS_PER_TICK);
+
     // The world always gets ticked - when menus get displayed, the world has to keep being simulated
     execute_player_actions(get_spectator(), state);
     tick_game(state);
@@ -307,7 +345,9 @@ void map_creator_scene_t::handle_event(void *object, vkph::event_t *event) {
 
         auto *event_data = (vkph::event_enter_map_creator_t *)event->data;
 
-        map_ = state->load_map(event_data->map_path);
+        // The chunks around the spectator (at the map's view position) get loaded first
+        map_stream_last_tenth = 0;
+        map_ = state->stream_map(event_data->map_path, NULL, &s_log_map_stream_progress, &map_stream_last_tenth);
         map_->name = event_data->map_name;
         
         vkph::player_t *player = get_spectator();
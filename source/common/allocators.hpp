@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string.h>
 #include "tools.hpp"
 
 inline uint64_t kilobytes(uint32_t kb) {
@@ -74,3 +75,141 @@ inline void lnclear() {
 }
 
 extern linear_allocator_t g_linear_allocator;
+
+/*
+  Hands out fixed size blocks (big enough for a T) from pages of
+  BLOCKS_PER_PAGE blocks. Freed blocks go on a free list, and reset() makes
+  every block available again at once, without giving the pages back to the
+  system (so that the memory can be reused when the next map gets loaded).
+  Like with flmalloc, the blocks are zeroed and T's constructor isn't called.
+ */
+template <typename T, uint32_t BLOCKS_PER_PAGE = 256>
+struct slab_allocator_t {
+    union block_t {
+        block_t *next_free;
+        uint8_t bytes[sizeof(T)];
+    };
+
+    struct page_t {
+        page_t *next;
+        block_t blocks[BLOCKS_PER_PAGE];
+    };
+
+    page_t *first_page;
+    // Page which blocks get bumped from when the free list is empty
+    page_t *current_page;
+    uint32_t current_page_used;
+
+    block_t *free_list;
+
+    // Stats
+    uint32_t page_count;
+    // Blocks which are currently allocated
+    uint32_t used_count;
+    // Most blocks ever allocated at the same time
+    uint32_t high_water_mark;
+    // Allocations since init (including the ones which reused a block)
+    uint64_t total_allocation_count;
+
+    void init() {
+        first_page = current_page = NULL;
+        current_page_used = 0;
+        free_list = NULL;
+
+        page_count = 0;
+        used_count = 0;
+        high_water_mark = 0;
+        total_allocation_count = 0;
+    }
+
+    void destroy() {
+        page_t *page = first_page;
+        while (page) {
+            page_t *next = page->next;
+            flfree(page);
+            page = next;
+        }
+
+        init();
+    }
+
+    // Makes sure that there are pages for at least block_count blocks in total
+    void reserve(uint32_t block_count) {
+        uint32_t required_pages = (block_count + BLOCKS_PER_PAGE - 1) / BLOCKS_PER_PAGE;
+
+        page_t *last = first_page;
+        while (last && last->next) {
+            last = last->next;
+        }
+
+        while (page_count < required_pages) {
+            page_t *page = new_page();
+
+            if (last) {
+                last->next = page;
+            }
+            else {
+                first_page = current_page = page;
+            }
+
+            last = page;
+        }
+    }
+
+    T *allocate() {
+        block_t *block = NULL;
+
+        if (free_list) {
+            block = free_list;
+            free_list = block->next_free;
+        }
+        else {
+            if (!current_page) {
+                first_page = current_page = new_page();
+            }
+            else if (current_page_used == BLOCKS_PER_PAGE) {
+                if (!current_page->next) {
+                    current_page->next = new_page();
+                }
+
+                current_page = current_page->next;
+                current_page_used = 0;
+            }
+
+            block = &current_page->blocks[current_page_used++];
+        }
+
+        memset(block, 0, sizeof(block_t));
+
+        ++used_count;
+        ++total_allocation_count;
+        high_water_mark = MAX(high_water_mark, used_count);
+
+        return (T *)block;
+    }
+
+    void free(T *pointer) {
+        block_t *block = (block_t *)pointer;
+        block->next_free = free_list;
+        free_list = block;
+
+        --used_count;
+    }
+
+    // Frees all blocks at once (the pages are kept)
+    void reset() {
+        current_page = first_page;
+        current_page_used = 0;
+        free_list = NULL;
+        used_count = 0;
+    }
+
+private:
+    page_t *new_page() {
+        page_t *page = flmalloc<page_t>();
+        page->next = NULL;
+        ++page_count;
+
+        return page;
+    }
+};
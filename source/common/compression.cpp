@@ -0,0 +1,294 @@
+#include "tools.hpp"
+#include "compression.hpp"
+
+#include <string.h>
+
+// These are the same as LZ4's, so that the output is valid LZ4 block data
+static constexpr uint32_t MIN_MATCH = 4;
+// The last bytes are always literals
+static constexpr uint32_t LAST_LITERALS = 5;
+// Matches can't start in the last bytes
+static constexpr uint32_t MATCH_FIND_LIMIT = 12;
+static constexpr uint32_t MAX_OFFSET = 65535;
+
+static constexpr uint32_t HASH_LOG = 12;
+
+static inline uint32_t s_read32(const uint8_t *p) {
+    // Byte order doesn't matter, this only gets hashed and compared
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t s_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+static uint32_t s_count_matching(const uint8_t *p, const uint8_t *ref, const uint8_t *limit) {
+    const uint8_t *start = p;
+
+    while (p + 8 <= limit) {
+        uint64_t a, b;
+        memcpy(&a, p, sizeof(a));
+        memcpy(&b, ref, sizeof(b));
+
+        if (a != b) {
+            break;
+        }
+
+        p += 8;
+        ref += 8;
+    }
+
+    while (p < limit && *p == *ref) {
+        ++p;
+        ++ref;
+    }
+
+    return (uint32_t)(p - start);
+}
+
+// Lengths which don't fit in the token's 4 bits continue in bytes of 255
+static uint8_t *s_write_length(uint8_t *op, uint32_t length) {
+    for (; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+
+    *op++ = (uint8_t)length;
+
+    return op;
+}
+
+// The last sequence only has literals (offset == 0)
+static uint8_t *s_write_sequence(
+    uint8_t *op,
+    const uint8_t *literals,
+    uint32_t literal_count,
+    uint32_t offset,
+    uint32_t match_length) {
+    uint8_t *token = op++;
+    *token = (uint8_t)(MIN(literal_count, 15u) << 4);
+
+    if (literal_count >= 15) {
+        op = s_write_length(op, literal_count - 15);
+    }
+
+    memcpy(op, literals, literal_count);
+    op += literal_count;
+
+    if (offset) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+
+        uint32_t match_code = match_length - MIN_MATCH;
+        *token |= (uint8_t)MIN(match_code, 15u);
+
+        if (match_code >= 15) {
+            op = s_write_length(op, match_code - 15);
+        }
+    }
+
+    return op;
+}
+
+uint32_t lz_compress(
+    const uint8_t *src,
+    uint32_t src_size,
+    uint8_t *dst) {
+    uint8_t *op = dst;
+    uint32_t anchor = 0;
+
+    // Smaller inputs are just literals
+    if (src_size > MATCH_FIND_LIMIT) {
+        // Last position (+ 1, 0 means none) at which each hashed sequence was seen
+        uint32_t table[1 << HASH_LOG];
+        memset(table, 0, sizeof(table));
+
+        uint32_t match_start_limit = src_size - MATCH_FIND_LIMIT;
+        const uint8_t *match_end_limit = src + src_size - LAST_LITERALS;
+
+        uint32_t ip = 0;
+        // Skips faster through data which doesn't compress
+        uint32_t miss_count = 0;
+
+        while (ip < match_start_limit) {
+            uint32_t sequence = s_read32(src + ip);
+            uint32_t hash = s_hash(sequence);
+            uint32_t candidate = table[hash];
+            table[hash] = ip + 1;
+
+            if (candidate == 0 || ip - (candidate - 1) > MAX_OFFSET || s_read32(src + candidate - 1) != sequence) {
+                ip += 1 + (miss_count++ >> 6);
+                continue;
+            }
+
+            miss_count = 0;
+            uint32_t ref = candidate - 1;
+
+            // The match may have started before
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                --ip;
+                --ref;
+            }
+
+            uint32_t length = MIN_MATCH + s_count_matching(src + ip + MIN_MATCH, src + ref + MIN_MATCH, match_end_limit);
+
+            op = s_write_sequence(op, src + anchor, ip - anchor, ip - ref, length);
+
+            ip += length;
+            anchor = ip;
+        }
+    }
+
+    op = s_write_sequence(op, src + anchor, src_size - anchor, 0, 0);
+
+    return (uint32_t)(op - dst);
+}
+
+// Returns 0 if the length goes past the end of src
+static bool s_read_length(const uint8_t *src_end, const uint8_t **ip, uint32_t *length) {
+    uint8_t byte;
+
+    do {
+        if (*ip >= src_end) {
+            return 0;
+        }
+
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return 1;
+}
+
+bool lz_decompress(
+    const uint8_t *src,
+    uint32_t src_size,
+    uint8_t *dst,
+    uint32_t dst_size) {
+    const uint8_t *ip = src;
+    const uint8_t *src_end = src + src_size;
+    uint8_t *op = dst;
+    uint8_t *dst_end = dst + dst_size;
+
+    while (ip < src_end) {
+        uint32_t token = *ip++;
+        uint32_t literal_count = token >> 4;
+        uint32_t length = token & 15;
+        uint32_t offset;
+
+        if (literal_count < 15 && length < 15 && src_end - ip >= 16 + 2 && dst_end - op >= 32) {
+            /*
+              Most sequences are short: these get copied with fixed sizes
+              (the extra bytes get overwritten by what comes next).
+             */
+            memcpy(op, ip, 16);
+            op += literal_count;
+            ip += literal_count;
+
+            offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+            ip += 2;
+
+            length += MIN_MATCH;
+
+            if (offset >= 8 && offset <= (uint32_t)(op - dst)) {
+                // Every 8 bytes only read what was already written
+                const uint8_t *match = op - offset;
+                memcpy(op, match, 8);
+                memcpy(op + 8, match + 8, 8);
+                memcpy(op + 16, match + 16, 2);
+
+                op += length;
+                continue;
+            }
+        }
+        else {
+            if (literal_count == 15 && !s_read_length(src_end, &ip, &literal_count)) {
+                return 0;
+            }
+
+            if (literal_count > (uint32_t)(src_end - ip) || literal_count > (uint32_t)(dst_end - op)) {
+                return 0;
+            }
+
+            memcpy(op, ip, literal_count);
+            op += literal_count;
+            ip += literal_count;
+
+            if (ip == src_end) {
+                // The last sequence only has literals
+                break;
+            }
+
+            if (src_end - ip < 2) {
+                return 0;
+            }
+
+            offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+            ip += 2;
+
+            if (length == 15 && !s_read_length(src_end, &ip, &length)) {
+                return 0;
+            }
+
+            length += MIN_MATCH;
+        }
+
+        if (offset == 0 || offset > (uint32_t)(op - dst) || length > (uint32_t)(dst_end - op)) {
+            return 0;
+        }
+
+        const uint8_t *match = op - offset;
+
+        if (offset >= length) {
+            memcpy(op, match, length);
+        }
+        else if (offset == 1) {
+            // Runs of the same byte (empty voxels)
+            memset(op, *match, length);
+        }
+        else if (offset >= 8) {
+            // The match overlaps the output, but not within 8 bytes
+            uint32_t i = 0;
+            for (; i + 8 <= length; i += 8) {
+                memcpy(op + i, match + i, 8);
+            }
+            for (; i < length; ++i) {
+                op[i] = match[i];
+            }
+        }
+        else {
+            for (uint32_t i = 0; i < length; ++i) {
+                op[i] = match[i];
+            }
+        }
+
+        op += length;
+    }
+
+    return op == dst_end;
+}
+
+uint32_t checksum_bytes(
+    const uint8_t *data,
+    uint32_t size) {
+    // FNV-1a, a word at a time
+    uint32_t hash = 2166136261u;
+    uint32_t i = 0;
+
+    for (; i + 4 <= size; i += 4) {
+        uint32_t word =
+            (uint32_t)data[i] |
+            ((uint32_t)data[i + 1] << 8) |
+            ((uint32_t)data[i + 2] << 16) |
+            ((uint32_t)data[i + 3] << 24);
+
+        hash = (hash ^ word) * 16777619u;
+    }
+
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+
+    return hash;
+}
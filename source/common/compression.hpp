@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+  Byte compression for data which gets written once and read many times
+  (map files): an LZ77 compressor which writes the LZ4 block format
+  (sequences of literals + (offset, length) matches in a 64 KB window).
+  Compression is greedy and decompression is mostly memcpy, so that
+  decompressing is a lot faster than reading the uncompressed bytes from disk.
+ */
+
+// Size dst needs to have for lz_compress() to never write past it
+inline uint32_t lz_compress_bound(uint32_t size) {
+    return size + size / 255 + 16;
+}
+
+// Returns the size of the compressed data written to dst
+uint32_t lz_compress(
+    const uint8_t *src,
+    uint32_t src_size,
+    uint8_t *dst);
+
+/*
+  Returns 0 if src isn't valid compressed data, or if it doesn't decompress
+  to exactly dst_size bytes. Never reads / writes outside of src / dst.
+ */
+bool lz_decompress(
+    const uint8_t *src,
+    uint32_t src_size,
+    uint8_t *dst,
+    uint32_t dst_size);
+
+// To detect corrupted data (not a cryptographic hash)
+uint32_t checksum_bytes(
+    const uint8_t *data,
+    uint32_t size);
@@ -180,6 +180,24 @@ template <
         }
     }
 
+    // Makes sure that the next call to add() won't go out of bounds
+    void grow_if_full() {
+        if (!removed_count && data_count == max_size) {
+            uint32_t new_max = max_size * 2;
+            T *new_data = flmalloc<T>(new_max);
+            uint32_t *new_removed = flmalloc<uint32_t>(new_max);
+
+            memcpy(new_data, data, sizeof(T) * max_size);
+
+            flfree(data);
+            flfree(removed);
+
+            data = new_data;
+            removed = new_removed;
+            max_size = new_max;
+        }
+    }
+
     T *get(uint32_t index) {
         return &data[index];
     }
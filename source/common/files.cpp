@@ -1,30 +1,58 @@
 #include "files.hpp"
 #include "containers.hpp"
 
+#include <mutex>
 #include <stb_image.h>
 
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 //For now all that file_object_t holds
 struct file_object_t {
     FILE *file;
-    const char *path;
+    char *path;
     uint32_t type;
 };
 
 static stack_container_t<file_object_t> files;
+// Files can get created and freed outside the main thread (e.g. maps getting saved in the background)
+static std::mutex files_mutex;
 
 void files_init() {
     files.init(150);
 }
 
+static void s_fill_real_path(const char *path, char *final_path, uint32_t strlen_path, uint32_t strlen_root) {
+    memcpy(final_path, PROJECT_ROOT, strlen_root);
+    // May need to vary for Windows
+    final_path[strlen_root] = '/';
+    memcpy(final_path + strlen_root + 1, path, strlen_path + 1);
+}
+
 const char *create_real_path(const char *path) {
     uint32_t strlen_path = (uint32_t)strlen(path);
     uint32_t strlen_root = (uint32_t)strlen(PROJECT_ROOT);
     
     char *final_path = lnmalloc<char>(strlen_path + strlen_root + 2);
-    memcpy(final_path, PROJECT_ROOT, strlen_root);
-    // May need to vary for Windows
-    final_path[strlen_root] = '/';
-    memcpy(final_path + strlen_root + 1, path, strlen_path + 1);
+    s_fill_real_path(path, final_path, strlen_path, strlen_root);
+
+    return final_path;
+}
+
+// The linear allocator only belongs to the main thread: this needs to get freed with flfree
+static char *s_create_real_path_copy(const char *path) {
+    uint32_t strlen_path = (uint32_t)strlen(path);
+    uint32_t strlen_root = (uint32_t)strlen(PROJECT_ROOT);
+
+    char *final_path = flmalloc<char>(strlen_path + strlen_root + 2);
+    s_fill_real_path(path, final_path, strlen_path, strlen_root);
 
     return final_path;
 }
@@ -32,10 +60,16 @@ const char *create_real_path(const char *path) {
 file_handle_t create_file(
     const char *file,
     uint32_t type) {
-    file_handle_t handle = files.add();
+    file_handle_t handle;
+
+    {
+        std::lock_guard<std::mutex> lock (files_mutex);
+        handle = files.add();
+    }
+
     file_object_t *object = files.get(handle);
 
-    object->path = create_real_path(file);
+    object->path = s_create_real_path_copy(file);
     object->type = type;
 
     if (type & FLF_IMAGE) {
@@ -46,6 +80,9 @@ file_handle_t create_file(
         if (type & FLF_WRITEABLE) {
             flags[0] = 'w';
         }
+        if (type & FLF_APPEND) {
+            flags[0] = 'a';
+        }
         if (type & FLF_BINARY) {
             flags[1] = 'b';
         }
@@ -59,6 +96,32 @@ file_handle_t create_file(
     return handle;
 }
 
+void delete_file(
+    const char *file) {
+    char *path = s_create_real_path_copy(file);
+    remove(path);
+    flfree(path);
+}
+
+bool replace_file(
+    const char *src,
+    const char *dst) {
+    char *src_path = s_create_real_path_copy(src);
+    char *dst_path = s_create_real_path_copy(dst);
+
+#if defined(_WIN32)
+    // rename() doesn't replace existing files on Windows
+    bool replaced = MoveFileExA(src_path, dst_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool replaced = rename(src_path, dst_path) == 0;
+#endif
+
+    flfree(src_path);
+    flfree(dst_path);
+
+    return replaced;
+}
+
 bool does_file_exist(file_handle_t handle) {
     return files.get(handle)->file != NULL;
 }
@@ -93,13 +156,28 @@ file_contents_t read_file(
     }
 }
 
-void write_file(
+bool write_file(
     file_handle_t handle,
     uint8_t *bytes,
     uint32_t size) {
     file_object_t *object = files.get(handle);
 
-    fwrite(bytes, 1, size, object->file);
+    return fwrite(bytes, 1, size, object->file) == size;
+}
+
+bool flush_file(
+    file_handle_t handle) {
+    file_object_t *object = files.get(handle);
+
+    if (fflush(object->file) != 0) {
+        return 0;
+    }
+
+#if defined(_WIN32)
+    return _commit(_fileno(object->file)) == 0;
+#else
+    return fsync(fileno(object->file)) == 0;
+#endif
 }
 
 void free_file(
@@ -110,6 +188,9 @@ void free_file(
         fclose(object->file);
     }
 
+    flfree(object->path);
+
+    std::lock_guard<std::mutex> lock (files_mutex);
     files.remove(handle);
 }
 
@@ -117,3 +198,78 @@ void free_image(
     file_contents_t contents) {
     stbi_image_free(contents.pixels);
 }
+
+static file_mapping_t s_map_real_file(
+    const char *path) {
+    file_mapping_t mapping = {};
+
+#if !defined(_WIN32)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return mapping;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        void *pages = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (pages != MAP_FAILED) {
+            mapping.data = (uint8_t *)pages;
+            mapping.size = (uint32_t)file_stat.st_size;
+            mapping.mapped = 1;
+        }
+    }
+
+    // The mapping stays valid once the file is closed
+    close(fd);
+
+    if (mapping.mapped) {
+        return mapping;
+    }
+#endif
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return mapping;
+    }
+
+    fseek(f, 0L, SEEK_END);
+    mapping.size = (uint32_t)ftell(f);
+    rewind(f);
+
+    mapping.data = flmalloc<uint8_t>(MAX(mapping.size, 1u));
+    if (fread(mapping.data, 1, mapping.size, f) != mapping.size) {
+        flfree(mapping.data);
+        mapping.data = NULL;
+        mapping.size = 0;
+    }
+
+    fclose(f);
+
+    return mapping;
+}
+
+file_mapping_t map_file(
+    const char *file) {
+    char *path = s_create_real_path_copy(file);
+    file_mapping_t mapping = s_map_real_file(path);
+    flfree(path);
+
+    return mapping;
+}
+
+void unmap_file(
+    file_mapping_t mapping) {
+    if (!mapping.data) {
+        return;
+    }
+
+#if !defined(_WIN32)
+    if (mapping.mapped) {
+        munmap(mapping.data, mapping.size);
+        return;
+    }
+#endif
+
+    flfree(mapping.data);
+}
@@ -19,7 +19,9 @@ enum file_load_flags_t {
     FLF_IMAGE = 1 << 2,
     FLF_WRITEABLE = 1 << 3,
     FLF_OVERWRITE = 1 << 4,
-    FLF_NONE = 1 << 5
+    FLF_NONE = 1 << 5,
+    // Writes go to the end of the file (which gets created if it doesn't exist)
+    FLF_APPEND = 1 << 6
 };
 
 void files_init();
@@ -35,6 +37,15 @@ const char *create_real_path(const char *path);
 void delete_file(
     const char *file);
 
+/*
+  Renames src to dst, replacing dst if it exists (paths have root as project
+  root, like create_file). If this gets interrupted, dst is either the old
+  or the new file, never a mix of both.
+ */
+bool replace_file(
+    const char *src,
+    const char *dst);
+
 bool does_file_exist(file_handle_t handle);
 
 struct file_contents_t {
@@ -57,6 +68,25 @@ struct file_contents_t {
 
 file_contents_t read_file(file_handle_t handle);
 void free_file_contents(file_handle_t file, file_contents_t content);
-void write_file(file_handle_t file, uint8_t *bytes, uint32_t size);
+// Returns 0 if not all the bytes could be written (e.g. the disk is full)
+bool write_file(file_handle_t file, uint8_t *bytes, uint32_t size);
+// Makes sure that what got written is on the disk, not just in the buffers of the C library / OS
+bool flush_file(file_handle_t file);
 void free_file(file_handle_t handle);
 void free_image(file_contents_t contents);
+
+/*
+  Read only view of a whole file (path has root as project root, like
+  create_file). The pages get mapped (mmap) where that's possible, so reading
+  the file doesn't copy it and only touches the parts which get read;
+  otherwise the file gets read into memory allocated with flmalloc.
+  data is NULL if the file couldn't be opened.
+ */
+struct file_mapping_t {
+    uint8_t *data;
+    uint32_t size;
+    bool mapped;
+};
+
+file_mapping_t map_file(const char *file);
+void unmap_file(file_mapping_t mapping);
@@ -37,3 +37,15 @@ inline uint32_t pop_count(
     return __builtin_popcount(bits);
 #endif
 }
+
+// Index of the lowest set bit (bits can't be 0)
+inline uint32_t lowest_bit_index(
+    uint64_t bits) {
+#ifndef __GNUC__
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctzll(bits);
+#endif
+}
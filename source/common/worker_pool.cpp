@@ -0,0 +1,201 @@
+#include "worker_pool.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+
+struct worker_pool_shared_t {
+    std::thread *threads;
+
+    // Only one batch at a time
+    std::mutex run_mutex;
+
+    std::mutex mutex;
+    std::condition_variable batch_ready;
+    std::condition_variable job_finished;
+
+    // Incremented for every batch (and when the pool gets destroyed)
+    uint32_t batch_id;
+    bool quit;
+
+    job_proc_t proc;
+    void *data;
+    uint32_t job_count;
+
+    std::atomic<uint32_t> next_job;
+    std::atomic<uint32_t> finished_count;
+    // Workers which are still looking at the current batch
+    uint32_t busy_count;
+};
+
+static void s_do_jobs(worker_pool_shared_t *shared, job_proc_t proc, void *data, uint32_t job_count) {
+    for (uint32_t job = shared->next_job.fetch_add(1); job < job_count; job = shared->next_job.fetch_add(1)) {
+        proc(job, data);
+        shared->finished_count.fetch_add(1);
+    }
+}
+
+static void s_worker(worker_pool_shared_t *shared) {
+    uint32_t last_batch_id = 0;
+
+    for (;;) {
+        job_proc_t proc;
+        void *data;
+        uint32_t job_count;
+
+        { // Wait for a new batch
+            std::unique_lock<std::mutex> lock (shared->mutex);
+            shared->batch_ready.wait(lock, [shared, last_batch_id] { return shared->batch_id != last_batch_id; });
+
+            if (shared->quit) {
+                return;
+            }
+
+            last_batch_id = shared->batch_id;
+            proc = shared->proc;
+            data = shared->data;
+            job_count = shared->job_count;
+
+            ++shared->busy_count;
+        }
+
+        s_do_jobs(shared, proc, data, job_count);
+
+        {
+            std::unique_lock<std::mutex> lock (shared->mutex);
+            --shared->busy_count;
+        }
+
+        shared->job_finished.notify_one();
+    }
+}
+
+void worker_pool_t::init(uint32_t wc) {
+    worker_count = wc;
+
+    shared = new worker_pool_shared_t;
+    shared->batch_id = 0;
+    shared->quit = 0;
+    shared->proc = NULL;
+    shared->data = NULL;
+    shared->job_count = 0;
+    shared->next_job = 0;
+    shared->finished_count = 0;
+    shared->busy_count = 0;
+
+    shared->threads = new std::thread[worker_count];
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        shared->threads[i] = std::thread(s_worker, shared);
+    }
+}
+
+void worker_pool_t::destroy() {
+    {
+        std::unique_lock<std::mutex> lock (shared->mutex);
+        shared->quit = 1;
+        ++shared->batch_id;
+    }
+
+    shared->batch_ready.notify_all();
+
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        shared->threads[i].join();
+    }
+
+    delete[] shared->threads;
+    delete shared;
+
+    shared = NULL;
+    worker_count = 0;
+}
+
+void worker_pool_t::run(
+    uint32_t job_count,
+    job_proc_t proc,
+    void *data,
+    job_progress_proc_t progress,
+    void *progress_data) {
+    if (job_count == 0) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> run_lock (shared->run_mutex);
+
+    {
+        std::unique_lock<std::mutex> lock (shared->mutex);
+
+        /*
+          A worker which only woke up after the previous batch was finished
+          could still be about to look at next_job.
+         */
+        shared->job_finished.wait(lock, [this] { return shared->busy_count == 0; });
+
+        shared->proc = proc;
+        shared->data = data;
+        shared->job_count = job_count;
+        shared->next_job = 0;
+        shared->finished_count = 0;
+        ++shared->batch_id;
+    }
+
+    shared->batch_ready.notify_all();
+
+    uint32_t reported_count = 0;
+
+    // This thread does jobs too, and reports the progress in between
+    for (uint32_t job = shared->next_job.fetch_add(1); job < job_count; job = shared->next_job.fetch_add(1)) {
+        proc(job, data);
+        shared->finished_count.fetch_add(1);
+
+        uint32_t finished_count = shared->finished_count.load();
+        if (progress && finished_count != reported_count) {
+            progress(finished_count, job_count, progress_data);
+            reported_count = finished_count;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock (shared->mutex);
+
+    // The workers which joined the batch need to be done with it before another batch can start
+    while (shared->finished_count.load() < job_count || shared->busy_count) {
+        if (progress) {
+            // Wakes up from time to time to report the progress
+            shared->job_finished.wait_for(lock, std::chrono::milliseconds(10));
+
+            uint32_t finished_count = shared->finished_count.load();
+            if (finished_count != reported_count) {
+                lock.unlock();
+                progress(finished_count, job_count, progress_data);
+                lock.lock();
+
+                reported_count = finished_count;
+            }
+        }
+        else {
+            shared->job_finished.wait(lock);
+        }
+    }
+
+    lock.unlock();
+
+    // The callers always get to see the batch finish
+    if (progress && reported_count != job_count) {
+        progress(job_count, job_count, progress_data);
+    }
+}
+
+worker_pool_t *get_worker_pool() {
+    // Never gets destroyed (the workers just get killed when the program exits)
+    static worker_pool_t *pool = [] {
+        uint32_t hardware_thread_count = std::thread::hardware_concurrency();
+
+        worker_pool_t *p = new worker_pool_t;
+        p->init(hardware_thread_count > 1 ? hardware_thread_count - 1 : 0);
+
+        return p;
+    } ();
+
+    return pool;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Threads which split a batch of independent jobs between them. The thread
+  which calls run() works on the batch too, and run() only returns once all
+  the jobs are finished.
+  Jobs get picked in whatever order the threads get to them, so for the
+  result to be deterministic, jobs need to write to separate memory.
+ */
+
+typedef void (* job_proc_t)(uint32_t job_index, void *data);
+
+// Called on the thread which called run(), whenever jobs got finished
+typedef void (* job_progress_proc_t)(uint32_t finished_count, uint32_t job_count, void *data);
+
+struct worker_pool_t {
+    // Not counting the thread which calls run()
+    uint32_t worker_count;
+    struct worker_pool_shared_t *shared;
+
+    void init(uint32_t worker_count);
+    void destroy();
+
+    /*
+      Batches from different threads get run one after the other. Jobs can't
+      call run() on the pool which is running them.
+     */
+    void run(
+        uint32_t job_count,
+        job_proc_t proc,
+        void *data,
+        job_progress_proc_t progress = NULL,
+        void *progress_data = NULL);
+
+    // For lambdas: proc(job_index)
+    template <typename T>
+    void run(
+        uint32_t job_count,
+        const T &proc,
+        job_progress_proc_t progress = NULL,
+        void *progress_data = NULL) {
+        run(
+            job_count,
+            [] (uint32_t job_index, void *data) { (*(const T *)data)(job_index); },
+            (void *)&proc,
+            progress,
+            progress_data);
+    }
+};
+
+/*
+  Pool shared by the whole program, created the first time this gets called
+  (with a worker per hardware thread, minus the calling thread).
+ */
+worker_pool_t *get_worker_pool();
@@ -1,33 +1,414 @@
 #include "vkph_chunk.hpp"
 #include "vkph_constant.hpp"
+#include "vkph_map_snapshot.hpp"
+#include "vkph_collision_mesh.hpp"
+
+#include <log.hpp>
+#include <string.h>
+#include <serialiser.hpp>
+#include <allocators.hpp>
 
 namespace vkph {
 
-void chunk_t::init(uint32_t chunk_stack_index, const ivector3_t &cchunk_coord) {
+/*
+  Uniform chunks point to one of these instead of owning their voxels.
+  Air gets its own block because the vast majority of uniform chunks are air
+  (and every new chunk starts out as air).
+*/
+static uint8_t s_air_block[CHUNK_BYTE_SIZE];
+
+static constexpr uint32_t MAX_UNIFORM_BLOCK_COUNT = 32;
+
+static struct {
+    voxel_t voxel;
+    uint8_t *block;
+} s_uniform_blocks[MAX_UNIFORM_BLOCK_COUNT];
+
+static uint32_t s_uniform_block_count = 0;
+
+// Returns NULL if there isn't any space for another shared block
+static const uint8_t *s_get_uniform_block(voxel_t voxel) {
+    if (voxel.value == 0 && voxel.color == 0) {
+        return s_air_block;
+    }
+
+    for (uint32_t i = 0; i < s_uniform_block_count; ++i) {
+        if (s_uniform_blocks[i].voxel.value == voxel.value &&
+            s_uniform_blocks[i].voxel.color == voxel.color) {
+            return s_uniform_blocks[i].block;
+        }
+    }
+
+    if (s_uniform_block_count == MAX_UNIFORM_BLOCK_COUNT) {
+        return NULL;
+    }
+
+    uint8_t *block = flmalloc<uint8_t>(CHUNK_BYTE_SIZE);
+    memset(block, voxel.value, CHUNK_VOXEL_COUNT);
+    memset(block + CHUNK_VOXEL_COUNT, voxel.color, CHUNK_VOXEL_COUNT);
+
+    s_uniform_blocks[s_uniform_block_count].voxel = voxel;
+    s_uniform_blocks[s_uniform_block_count].block = block;
+    ++s_uniform_block_count;
+
+    return block;
+}
+
+// Both voxel planes are in the same block
+static void s_use_voxel_block(chunk_t *chunk, const uint8_t *block) {
+    chunk->values = block;
+    chunk->colors = block + CHUNK_VOXEL_COUNT;
+}
+
+// Blocks which a map snapshot may still be reading get freed by the snapshot
+static void s_free_voxel_block(chunk_t *chunk) {
+    if (!chunk->snapshot_epoch || !retire_snapshot_block(chunk->snapshot_epoch, chunk->values)) {
+        flfree((uint8_t *)chunk->values);
+    }
+
+    chunk->snapshot_epoch = 0;
+}
+
+// Only the main thread creates chunks
+static uint32_t s_chunk_generation = 0;
+
+static void s_free_mips(chunk_t *chunk) {
+    if (chunk->mips) {
+        flfree(chunk->mips);
+        chunk->mips = NULL;
+    }
+}
+
+void chunk_t::init(uint32_t cchunk_stack_index, const ivector3_t &cchunk_coord) {
     xs_bottom_corner = cchunk_coord * CHUNK_EDGE_LENGTH;
     chunk_coord = cchunk_coord;
-    chunk_stack_index = chunk_stack_index;
+    chunk_stack_index = cchunk_stack_index;
 
     flags.made_modification = 0;
     flags.has_to_update_vertices = 0;
     flags.active_vertices = 0;
     flags.modified_marker = 0;
+    flags.uniform = 1;
+    flags.unsaved = 0;
+    flags.changed_since_baseline = 0;
     flags.index_of_modification_struct = 0;
 
-    memset(voxels, 0, sizeof(voxel_t) * CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH);
+    // Starts off as air, doesn't need any voxel memory until something gets written
+    s_use_voxel_block(this, s_air_block);
+    snapshot_epoch = 0;
+
+    history = NULL;
 
-    history.modification_count = 0;
-    memset(history.modification_pool, CHUNK_SPECIAL_VALUE, CHUNK_VOXEL_COUNT);
+    // Air
+    memset(&occupancy, 0, sizeof(occupancy));
+    mips = NULL;
 
     render = NULL;
 
+    collision_mesh = NULL;
+    collision_version = (uint64_t)(++s_chunk_generation) << 32;
+
+    for (uint32_t i = 0; i < CHUNK_NEIGHBOUR_COUNT; ++i) {
+        neighbours[i] = NULL;
+    }
+
+    neighbours[CHUNK_NEIGHBOUR_SELF] = this;
+
     players_in_chunk.init();
 }
 
 void chunk_t::destroy() {
+    for (uint32_t i = 0; i < CHUNK_NEIGHBOUR_COUNT; ++i) {
+        if (i != CHUNK_NEIGHBOUR_SELF && neighbours[i]) {
+            neighbours[i]->neighbours[get_opposite_neighbour_index(i)] = NULL;
+            neighbours[i] = NULL;
+        }
+    }
+
+    if (!flags.uniform) {
+        s_free_voxel_block(this);
+    }
+
+    s_free_mips(this);
+    free_collision_mesh(this);
+
+    values = NULL;
+    colors = NULL;
+
     players_in_chunk.destroy();
 }
 
+void chunk_t::make_dense() {
+    if (flags.uniform) {
+        uint8_t *dense = flmalloc<uint8_t>(CHUNK_BYTE_SIZE);
+        memcpy(dense, values, CHUNK_BYTE_SIZE);
+
+        s_use_voxel_block(this, dense);
+        flags.uniform = 0;
+    }
+    else if (snapshot_epoch) {
+        uint8_t *copy = flmalloc<uint8_t>(CHUNK_BYTE_SIZE);
+        memcpy(copy, values, CHUNK_BYTE_SIZE);
+
+        s_free_voxel_block(this);
+        s_use_voxel_block(this, copy);
+    }
+}
+
+bool chunk_t::compact() {
+    if (flags.uniform) {
+        return 1;
+    }
+
+    voxel_t first = get_voxel(0);
+    for (uint32_t i = 1; i < CHUNK_VOXEL_COUNT; ++i) {
+        if (values[i] != first.value) {
+            return 0;
+        }
+    }
+
+    for (uint32_t i = 1; i < CHUNK_VOXEL_COUNT; ++i) {
+        if (colors[i] != first.color) {
+            return 0;
+        }
+    }
+
+    const uint8_t *block = s_get_uniform_block(first);
+
+    if (block) {
+        s_free_voxel_block(this);
+
+        s_use_voxel_block(this, block);
+        flags.uniform = 1;
+
+        s_free_mips(this);
+
+        return 1;
+    }
+    else {
+        return 0;
+    }
+}
+
+void chunk_history_pool_t::init(uint32_t initial_free_count) {
+    max_free_count = initial_free_count;
+    free_histories = flmalloc<chunk_history_t *>(max_free_count);
+    free_count = 0;
+
+    pool_size = 0;
+    attached_count = 0;
+    high_water_mark = 0;
+}
+
+void chunk_history_pool_t::destroy() {
+    for (uint32_t i = 0; i < free_count; ++i) {
+        flfree(free_histories[i]);
+    }
+
+    flfree(free_histories);
+
+    free_histories = NULL;
+    free_count = 0;
+    max_free_count = 0;
+}
+
+chunk_history_t *chunk_history_pool_t::attach() {
+    chunk_history_t *history = NULL;
+
+    if (free_count) {
+        history = free_histories[--free_count];
+    }
+    else {
+        history = flmalloc<chunk_history_t>();
+        history->modification_count = 0;
+        memset(history->modification_pool, CHUNK_SPECIAL_VALUE, CHUNK_VOXEL_COUNT);
+
+        ++pool_size;
+    }
+
+    ++attached_count;
+    high_water_mark = MAX(high_water_mark, attached_count);
+
+    return history;
+}
+
+void chunk_history_pool_t::release(chunk_history_t *history) {
+    // Only the voxels which were modified need to be reset
+    for (int32_t v = 0; v < history->modification_count; ++v) {
+        history->modification_pool[history->modification_stack[v]] = CHUNK_SPECIAL_VALUE;
+    }
+
+    history->modification_count = 0;
+
+    if (free_count == max_free_count) {
+        uint32_t new_max = MAX(max_free_count * 2, 16);
+        chunk_history_t **new_free_histories = flmalloc<chunk_history_t *>(new_max);
+        memcpy(new_free_histories, free_histories, sizeof(chunk_history_t *) * free_count);
+
+        flfree(free_histories);
+
+        free_histories = new_free_histories;
+        max_free_count = new_max;
+    }
+
+    free_histories[free_count++] = history;
+    --attached_count;
+}
+
+// Recomputes the cells of each mip level which contain the voxels in the box (local coordinates, inclusive)
+static void s_update_mips(const chunk_t *chunk, chunk_mips_t *mips, const ivector3_t &local_min, const ivector3_t &local_max) {
+    for (uint32_t level = 1; level <= CHUNK_MIP_LEVEL_COUNT; ++level) {
+        int32_t cell_edge_length = 1 << level;
+        ivector3_t cell_start = local_min / cell_edge_length;
+        ivector3_t cell_end = local_max / cell_edge_length;
+
+        for (int32_t z = cell_start.z; z <= cell_end.z; ++z) {
+            for (int32_t y = cell_start.y; y <= cell_end.y; ++y) {
+                for (int32_t x = cell_start.x; x <= cell_end.x; ++x) {
+                    // The 8 cells of the previous level which this cell covers
+                    uint32_t sum = 0;
+                    uint8_t hi = 0;
+
+                    for (uint32_t c = 0; c < 8; ++c) {
+                        uint32_t cx = x * 2 + (c & 1);
+                        uint32_t cy = y * 2 + ((c >> 1) & 1);
+                        uint32_t cz = z * 2 + (c >> 2);
+
+                        if (level == 1) {
+                            uint8_t value = chunk->values[get_voxel_index(cx, cy, cz)];
+                            sum += value;
+                            hi = MAX(hi, value);
+                        }
+                        else {
+                            uint32_t previous_index = get_mip_cell_index(level - 1, cx, cy, cz);
+                            sum += mips->average[previous_index];
+                            hi = MAX(hi, mips->maximum[previous_index]);
+                        }
+                    }
+
+                    uint32_t cell_index = get_mip_cell_index(level, x, y, z);
+                    mips->average[cell_index] = (uint8_t)((sum + 4) / 8);
+                    mips->maximum[cell_index] = hi;
+                }
+            }
+        }
+    }
+}
+
+void chunk_t::update_occupancy() {
+    update_occupancy(ivector3_t(0), ivector3_t(CHUNK_EDGE_LENGTH - 1));
+}
+
+void chunk_t::update_occupancy(const ivector3_t &local_min, const ivector3_t &local_max) {
+    invalidate_collision_mesh(this, local_min, local_max);
+
+    ivector3_t brick_start = glm::clamp(local_min, ivector3_t(0), ivector3_t(CHUNK_EDGE_LENGTH - 1)) / (int32_t)CHUNK_BRICK_EDGE_LENGTH;
+    ivector3_t brick_end = glm::clamp(local_max, ivector3_t(0), ivector3_t(CHUNK_EDGE_LENGTH - 1)) / (int32_t)CHUNK_BRICK_EDGE_LENGTH;
+
+    for (int32_t bz = brick_start.z; bz <= brick_end.z; ++bz) {
+        for (int32_t by = brick_start.y; by <= brick_end.y; ++by) {
+            for (int32_t bx = brick_start.x; bx <= brick_end.x; ++bx) {
+                uint32_t x0 = bx * CHUNK_BRICK_EDGE_LENGTH;
+                uint32_t y0 = by * CHUNK_BRICK_EDGE_LENGTH;
+                uint32_t z0 = bz * CHUNK_BRICK_EDGE_LENGTH;
+
+                uint8_t lo = values[get_voxel_index(x0, y0, z0)], hi = lo;
+
+                if (!flags.uniform) {
+                    for (uint32_t z = z0; z < z0 + CHUNK_BRICK_EDGE_LENGTH; ++z) {
+                        for (uint32_t y = y0; y < y0 + CHUNK_BRICK_EDGE_LENGTH; ++y) {
+                            for (uint32_t x = x0; x < x0 + CHUNK_BRICK_EDGE_LENGTH; ++x) {
+                                uint8_t value = values[get_voxel_index(x, y, z)];
+                                lo = MIN(lo, value);
+                                hi = MAX(hi, value);
+                            }
+                        }
+                    }
+                }
+
+                uint32_t brick_index = get_brick_index(x0, y0, z0);
+                occupancy.brick_min[brick_index] = lo;
+                occupancy.brick_max[brick_index] = hi;
+            }
+        }
+    }
+
+    occupancy.min_value = occupancy.brick_min[0];
+    occupancy.max_value = occupancy.brick_max[0];
+    occupancy.surface_bricks = 0;
+
+    for (uint32_t bz = 0; bz < CHUNK_BRICKS_PER_EDGE; ++bz) {
+        for (uint32_t by = 0; by < CHUNK_BRICKS_PER_EDGE; ++by) {
+            for (uint32_t bx = 0; bx < CHUNK_BRICKS_PER_EDGE; ++bx) {
+                uint32_t brick_index = get_brick_index(
+                    bx * CHUNK_BRICK_EDGE_LENGTH,
+                    by * CHUNK_BRICK_EDGE_LENGTH,
+                    bz * CHUNK_BRICK_EDGE_LENGTH);
+
+                occupancy.min_value = MIN(occupancy.min_value, occupancy.brick_min[brick_index]);
+                occupancy.max_value = MAX(occupancy.max_value, occupancy.brick_max[brick_index]);
+
+                /*
+                  The cells on the superior side of the brick have corners in
+                  the next bricks, so take those into account too.
+                */
+                uint8_t lo = 255, hi = 0;
+                for (uint32_t nz = bz; nz <= MIN(bz + 1, CHUNK_BRICKS_PER_EDGE - 1); ++nz) {
+                    for (uint32_t ny = by; ny <= MIN(by + 1, CHUNK_BRICKS_PER_EDGE - 1); ++ny) {
+                        for (uint32_t nx = bx; nx <= MIN(bx + 1, CHUNK_BRICKS_PER_EDGE - 1); ++nx) {
+                            uint32_t neighbour_index = get_brick_index(
+                                nx * CHUNK_BRICK_EDGE_LENGTH,
+                                ny * CHUNK_BRICK_EDGE_LENGTH,
+                                nz * CHUNK_BRICK_EDGE_LENGTH);
+
+                            lo = MIN(lo, occupancy.brick_min[neighbour_index]);
+                            hi = MAX(hi, occupancy.brick_max[neighbour_index]);
+                        }
+                    }
+                }
+
+                if (lo <= CHUNK_SURFACE_LEVEL && hi > CHUNK_SURFACE_LEVEL) {
+                    occupancy.surface_bricks |= 1ull << brick_index;
+                }
+            }
+        }
+    }
+
+    occupancy.contains_surface =
+        occupancy.min_value <= CHUNK_SURFACE_LEVEL &&
+        occupancy.max_value > CHUNK_SURFACE_LEVEL;
+
+    if (flags.uniform) {
+        s_free_mips(this);
+    }
+    else if (mips) {
+        // The next query recomputes the cells (see get_mips())
+        ivector3_t written_min = glm::clamp(local_min, ivector3_t(0), ivector3_t(CHUNK_EDGE_LENGTH - 1));
+        ivector3_t written_max = glm::clamp(local_max, ivector3_t(0), ivector3_t(CHUNK_EDGE_LENGTH - 1));
+
+        mips->dirty_min = mips->dirty ? glm::min(mips->dirty_min, written_min) : written_min;
+        mips->dirty_max = mips->dirty ? glm::max(mips->dirty_max, written_max) : written_max;
+        mips->dirty = 1;
+    }
+}
+
+const chunk_mips_t *chunk_t::get_mips() const {
+    if (flags.uniform) {
+        return NULL;
+    }
+
+    if (!mips) {
+        mips = flmalloc<chunk_mips_t>();
+        s_update_mips(this, mips, ivector3_t(0), ivector3_t(CHUNK_EDGE_LENGTH - 1));
+    }
+    else if (mips->dirty) {
+        s_update_mips(this, mips, mips->dirty_min, mips->dirty_max);
+        mips->dirty = 0;
+    }
+
+    return mips;
+}
+
 ivector3_t space_world_to_voxel(const vector3_t &ws_position) {
     return (ivector3_t)(glm::floor(ws_position));
 }
@@ -49,31 +430,141 @@ ivector3_t space_voxel_to_local_chunk(const ivector3_t &vs_position) {
     return (ivector3_t)(from_origin - xs_sized * (float)CHUNK_EDGE_LENGTH);
 }
 
-uint32_t get_voxel_index(uint32_t x, uint32_t y, uint32_t z) {
-    return z * (CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH) + y * CHUNK_EDGE_LENGTH + x;
+bool serialise_voxels(serialiser_t *serialiser, const uint8_t *values, const voxel_color_t *colors, uint32_t voxel_count) {
+    uint32_t before_voxels_ptr = serialiser->data_buffer_head;
+
+    for (uint32_t v_index = 0; v_index < voxel_count; ++v_index) {
+        if (values[v_index] == 0) {
+            uint32_t before_head = serialiser->data_buffer_head;
+
+            static constexpr uint32_t MAX_ZERO_COUNT_BEFORE_COMPRESSION = 3;
+
+            uint32_t zero_count = 0;
+            for (; v_index < voxel_count && values[v_index] == 0 && zero_count < MAX_ZERO_COUNT_BEFORE_COMPRESSION; ++v_index, ++zero_count) {
+                serialiser->serialise_uint8(0);
+                serialiser->serialise_uint8(0);
+            }
+
+            if (zero_count == MAX_ZERO_COUNT_BEFORE_COMPRESSION) {
+                for (; v_index < voxel_count && values[v_index] == 0; ++v_index, ++zero_count) {}
+
+                if (zero_count >= voxel_count) {
+                    serialiser->data_buffer_head = before_voxels_ptr;
+                    return 0;
+                }
+
+                serialiser->data_buffer_head = before_head;
+                serialiser->serialise_uint8(CHUNK_SPECIAL_VALUE);
+                serialiser->serialise_uint8(CHUNK_SPECIAL_VALUE);
+                serialiser->serialise_uint32(zero_count);
+            }
+
+            v_index -= 1;
+        }
+        else {
+            serialiser->serialise_uint8(values[v_index]);
+            serialiser->serialise_uint8(colors[v_index]);
+        }
+    }
+
+    return 1;
 }
 
-uint32_t hash_chunk_coord(
-    const ivector3_t &coord) {
-    struct {
-        union {
-            struct {
-                uint32_t padding: 2;
-                uint32_t x: 10;
-                uint32_t y: 10;
-                uint32_t z: 10;
-            };
-            uint32_t value;
-        };
-    } hasher;
+void deserialise_voxels(serialiser_t *serialiser, uint8_t *values, voxel_color_t *colors, uint32_t voxel_count) {
+    for (uint32_t v = 0; v < voxel_count;) {
+        uint8_t current_value = serialiser->deserialise_uint8();
+        uint8_t current_color = serialiser->deserialise_uint8();
 
-    hasher.value = 0;
+        if (current_value == CHUNK_SPECIAL_VALUE) {
+            // Repeating zeros (clamped so that a corrupt count can't write past the end)
+            uint32_t zero_count = serialiser->deserialise_uint32();
+            uint32_t end = MIN(v + zero_count, voxel_count);
+
+            memset(values + v, 0, end - v);
+            memset(colors + v, 0, end - v);
+            v = end;
+        }
+        else {
+            values[v] = current_value;
+            colors[v] = current_color;
+            ++v;
+        }
+    }
+}
+
+bool serialise_chunk_voxels(serialiser_t *serialiser, const uint8_t *values, const voxel_color_t *colors) {
+    if (VOXEL_LAYOUT == VL_LINEAR) {
+        return serialise_voxels(serialiser, values, colors, CHUNK_VOXEL_COUNT);
+    }
+    else {
+        uint8_t linear_values[CHUNK_VOXEL_COUNT];
+        voxel_color_t linear_colors[CHUNK_VOXEL_COUNT];
+        copy_voxels_to_linear(values, colors, ivector3_t(0), CHUNK_EDGE_LENGTH, linear_values, linear_colors);
+
+        return serialise_voxels(serialiser, linear_values, linear_colors, CHUNK_VOXEL_COUNT);
+    }
+}
+
+void deserialise_chunk_voxels(serialiser_t *serialiser, uint8_t *values, voxel_color_t *colors) {
+    if (VOXEL_LAYOUT == VL_LINEAR) {
+        deserialise_voxels(serialiser, values, colors, CHUNK_VOXEL_COUNT);
+    }
+    else {
+        uint8_t linear_values[CHUNK_VOXEL_COUNT];
+        voxel_color_t linear_colors[CHUNK_VOXEL_COUNT];
+        deserialise_voxels(serialiser, linear_values, linear_colors, CHUNK_VOXEL_COUNT);
+
+        copy_voxels_from_linear(linear_values, linear_colors, ivector3_t(0), CHUNK_EDGE_LENGTH, values, colors);
+    }
+}
+
+void copy_voxels_to_linear(
+    const uint8_t *values, const voxel_color_t *colors,
+    const ivector3_t &local_min, int32_t edge_length,
+    uint8_t *dst_values, voxel_color_t *dst_colors) {
+    for (int32_t z = 0; z < edge_length; ++z) {
+        for (int32_t y = 0; y < edge_length; ++y) {
+            uint32_t dst = (z * edge_length + y) * edge_length;
+
+            if (VOXEL_LAYOUT == VL_LINEAR) {
+                // Rows are contiguous
+                uint32_t src = get_voxel_index(local_min.x, local_min.y + y, local_min.z + z);
+                memcpy(dst_values + dst, values + src, edge_length);
+                memcpy(dst_colors + dst, colors + src, edge_length);
+            }
+            else {
+                for (int32_t x = 0; x < edge_length; ++x) {
+                    uint32_t src = get_voxel_index(local_min.x + x, local_min.y + y, local_min.z + z);
+                    dst_values[dst + x] = values[src];
+                    dst_colors[dst + x] = colors[src];
+                }
+            }
+        }
+    }
+}
 
-    hasher.x = *(uint32_t *)(&coord.x);
-    hasher.y = *(uint32_t *)(&coord.y);
-    hasher.z = *(uint32_t *)(&coord.z);
+void copy_voxels_from_linear(
+    const uint8_t *src_values, const voxel_color_t *src_colors,
+    const ivector3_t &local_min, int32_t edge_length,
+    uint8_t *values, voxel_color_t *colors) {
+    for (int32_t z = 0; z < edge_length; ++z) {
+        for (int32_t y = 0; y < edge_length; ++y) {
+            uint32_t src = (z * edge_length + y) * edge_length;
 
-    return (uint32_t)hasher.value;
+            if (VOXEL_LAYOUT == VL_LINEAR) {
+                uint32_t dst = get_voxel_index(local_min.x, local_min.y + y, local_min.z + z);
+                memcpy(values + dst, src_values + src, edge_length);
+                memcpy(colors + dst, src_colors + src, edge_length);
+            }
+            else {
+                for (int32_t x = 0; x < edge_length; ++x) {
+                    uint32_t dst = get_voxel_index(local_min.x + x, local_min.y + y, local_min.z + z);
+                    values[dst] = src_values[src + x];
+                    colors[dst] = src_colors[src + x];
+                }
+            }
+        }
+    }
 }
 
 }
@@ -7,6 +7,8 @@
 #include "vkph_voxel.hpp"
 #include "vkph_constant.hpp"
 
+struct serialiser_t;
+
 namespace cl {
 
 /*
@@ -18,6 +20,9 @@ struct chunk_render_t;
 
 namespace vkph {
 
+// See vkph_collision_mesh.hpp
+struct chunk_collision_mesh_t;
+
 struct chunk_history_t {
     /*
       These are all going to be set to 255 by default. If a voxel gets modified, 
@@ -27,10 +32,138 @@ struct chunk_history_t {
     uint8_t modification_pool[CHUNK_VOXEL_COUNT];
 
     int16_t modification_count;
-    // Each int16_t is an index into the voxels array of struct chunk_t
+    // Each int16_t is an index into the voxel planes of struct chunk_t
     int16_t modification_stack[CHUNK_VOXEL_COUNT / 2];
 };
 
+/*
+  Only the chunks which get modified between two calls to
+  state_t::reset_modification_tracker() need a history, so instead of every
+  chunk embedding one, they get attached from here when the chunk first gets
+  modified, and released when the modification tracker gets reset.
+ */
+struct chunk_history_pool_t {
+    // Histories which aren't attached to any chunk
+    chunk_history_t **free_histories;
+    uint32_t free_count;
+    uint32_t max_free_count;
+
+    // Stats
+    // Amount of histories which were ever allocated (attached + free)
+    uint32_t pool_size;
+    uint32_t attached_count;
+    // Most histories ever attached at the same time
+    uint32_t high_water_mark;
+
+    void init(uint32_t initial_free_count);
+    void destroy();
+
+    chunk_history_t *attach();
+    // Resets the history so that it can be attached to another chunk
+    void release(chunk_history_t *history);
+};
+
+/*
+  Chunks keep pointers to the 3x3x3 block of chunks around them (see
+  chunk_t::neighbours). The chunk itself is in the middle.
+ */
+constexpr uint32_t CHUNK_NEIGHBOUR_COUNT = 27;
+constexpr uint32_t CHUNK_NEIGHBOUR_SELF = 13;
+
+// Offsets go from -1 to +1
+inline uint32_t get_neighbour_index(int32_t dx, int32_t dy, int32_t dz) {
+    return (uint32_t)((dz + 1) * 9 + (dy + 1) * 3 + (dx + 1));
+}
+
+// Index of the link which points back (neighbour -> chunk)
+inline uint32_t get_opposite_neighbour_index(uint32_t neighbour_index) {
+    return (CHUNK_NEIGHBOUR_COUNT - 1) - neighbour_index;
+}
+
+/*
+  For the occupancy summary, chunks are split into 4x4x4 bricks.
+ */
+constexpr uint32_t CHUNK_BRICKS_PER_EDGE = 4;
+constexpr uint32_t CHUNK_BRICK_COUNT = CHUNK_BRICKS_PER_EDGE * CHUNK_BRICKS_PER_EDGE * CHUNK_BRICKS_PER_EDGE;
+constexpr uint32_t CHUNK_BRICK_EDGE_LENGTH = CHUNK_EDGE_LENGTH / CHUNK_BRICKS_PER_EDGE;
+
+static_assert(CHUNK_BRICK_COUNT <= 64, "Surface brick mask is a uint64_t");
+
+// Takes voxel coordinates (local to the chunk)
+inline uint32_t get_brick_index(uint32_t x, uint32_t y, uint32_t z) {
+    return
+        (z / CHUNK_BRICK_EDGE_LENGTH) * (CHUNK_BRICKS_PER_EDGE * CHUNK_BRICKS_PER_EDGE) +
+        (y / CHUNK_BRICK_EDGE_LENGTH) * CHUNK_BRICKS_PER_EDGE +
+        (x / CHUNK_BRICK_EDGE_LENGTH);
+}
+
+/*
+  Summary of the voxel values of a chunk, which terrain queries use to skip
+  the parts of a chunk which can't contain any surface. Needs to be updated
+  with chunk_t::update_occupancy() whenever voxels get written.
+ */
+struct chunk_occupancy_t {
+    uint8_t min_value;
+    uint8_t max_value;
+    // min_value <= CHUNK_SURFACE_LEVEL < max_value
+    bool contains_surface;
+
+    /*
+      Bit is set if a cell (marching cube) in the brick might cross the
+      surface. This only covers the cells which have all their 8 corners in
+      the chunk: the ones on the last row / column / layer of the chunk
+      sample the neighbouring chunks, and never get skipped.
+    */
+    uint64_t surface_bricks;
+
+    // Range of the voxel values in each brick
+    uint8_t brick_min[CHUNK_BRICK_COUNT];
+    uint8_t brick_max[CHUNK_BRICK_COUNT];
+};
+
+/*
+  Coarser versions of the voxel values (mip levels), for the queries which
+  don't need the full resolution: far away terrain, broad phase ray and
+  projectile tests... A cell of level l covers 2^l voxels along each axis,
+  so there are (CHUNK_EDGE_LENGTH >> l)^3 cells in the level (8^3, 4^3 and
+  2^3 with 16^3 chunks). Level 0 is the voxels themselves.
+  Only the chunks which get queried need them, so they get built the first
+  time a query needs them (chunk_t::get_mips()). After that,
+  chunk_t::update_occupancy() only records which voxels were written, and
+  the cells which contain them get recomputed by the next query.
+ */
+constexpr uint32_t CHUNK_MIP_LEVEL_COUNT = 3;
+
+constexpr uint32_t get_mip_edge_length(uint32_t level) {
+    return CHUNK_EDGE_LENGTH >> level;
+}
+
+// Index of the first cell of the level in chunk_mips_t (levels start at 1)
+constexpr uint32_t get_mip_offset(uint32_t level) {
+    return level <= 1 ? 0 :
+        get_mip_offset(level - 1) + get_mip_edge_length(level - 1) * get_mip_edge_length(level - 1) * get_mip_edge_length(level - 1);
+}
+
+constexpr uint32_t CHUNK_MIP_CELL_COUNT = get_mip_offset(CHUNK_MIP_LEVEL_COUNT + 1);
+
+// Takes the coordinates of the cell in the level
+inline uint32_t get_mip_cell_index(uint32_t level, uint32_t x, uint32_t y, uint32_t z) {
+    uint32_t edge_length = get_mip_edge_length(level);
+    return get_mip_offset(level) + (z * edge_length + y) * edge_length + x;
+}
+
+struct chunk_mips_t {
+    // Average of the voxel values in the cell
+    uint8_t average[CHUNK_MIP_CELL_COUNT];
+    // Highest voxel value in the cell (the cell is air if it is <= CHUNK_SURFACE_LEVEL)
+    uint8_t maximum[CHUNK_MIP_CELL_COUNT];
+
+    // Box of voxels (local coordinates, inclusive) which were written since the cells were computed
+    bool dirty;
+    ivector3_t dirty_min;
+    ivector3_t dirty_max;
+};
+
 struct chunk_t {
     struct flags_t {
         uint32_t made_modification: 1;
@@ -38,6 +171,12 @@ struct chunk_t {
         uint32_t active_vertices: 1;
         // Flag that is used temporarily
         uint32_t modified_marker: 1;
+        // Every voxel in the chunk is the same (see values)
+        uint32_t uniform: 1;
+        // Edited since the map was loaded / saved (state_t::save_map() only writes these to the journal)
+        uint32_t unsaved: 1;
+        // Changed since the state's baseline got captured (state_t::reset_to_baseline() reverts these)
+        uint32_t changed_since_baseline: 1;
         uint32_t index_of_modification_struct: 10;
     } flags;
     
@@ -45,17 +184,123 @@ struct chunk_t {
     ivector3_t xs_bottom_corner;
     ivector3_t chunk_coord;
 
-    voxel_t voxels[CHUNK_VOXEL_COUNT];
+    /*
+      The voxels are stored as two separate planes: the values (density) and
+      the colors. Collision, meshing and terraforming mostly only look at the
+      values, so they don't have to pull the colors into the cache too.
+      Both planes are in the same CHUNK_BYTE_SIZE block (colors right after
+      the values), and values points to the start of that block.
+
+      If flags.uniform is set, the block is shared and read-only: all the
+      voxels have the same value and color, and the chunk doesn't own any
+      voxel memory. Reading is the same in both cases, but writing has to go
+      through get_writable_values() / get_writable_colors() which copy the
+      shared block into memory owned by the chunk first (copy-on-write).
+      The same goes for blocks which a map snapshot still needs (see
+      vkph_map_snapshot.hpp).
+    */
+    const uint8_t *values;
+    const voxel_color_t *colors;
+
+    // Epoch of the map snapshot which may still be reading the voxel block (0 if there isn't any)
+    uint32_t snapshot_epoch;
+
+    chunk_occupancy_t occupancy;
+
+    // NULL if the chunk is uniform (every cell then has the value of the voxels) or no query needed them yet
+    mutable chunk_mips_t *mips;
 
     // uint8_t because anyway, player index won't go beyond 50
     static_stack_container_t<uint8_t, PLAYER_MAX_COUNT> players_in_chunk;
 
-    chunk_history_t history;
+    // NULL unless the chunk was modified since the last state_t::reset_modification_tracker()
+    chunk_history_t *history;
 
     cl::chunk_render_t *render;
 
+    /*
+      NULL if the neighbour isn't loaded. These get linked when a chunk gets
+      created (state_t::get_chunk()) and unlinked when it gets destroyed, so
+      sampling voxels across chunk borders doesn't need a chunk lookup.
+    */
+    chunk_t *neighbours[CHUNK_NEIGHBOUR_COUNT];
+
+    // Built by the collision queries the first time they need the chunk (see vkph_collision_mesh.hpp)
+    mutable chunk_collision_mesh_t *collision_mesh;
+
+    /*
+      Changes whenever voxels of the first row / column / layer change (which
+      the neighbours' collision meshes sample), and is different for every
+      chunk that gets created, even if it ends up at the same address.
+    */
+    uint64_t collision_version;
+
     void init(uint32_t chunk_stack_index, const ivector3_t &chunk_coord);
     void destroy();
+
+    inline voxel_t get_voxel(uint32_t index) const {
+        voxel_t voxel;
+        voxel.color = colors[index];
+        voxel.value = values[index];
+        return voxel;
+    }
+
+    inline uint8_t *get_writable_values() {
+        if (flags.uniform || snapshot_epoch) {
+            make_dense();
+        }
+
+        return (uint8_t *)values;
+    }
+
+    inline voxel_color_t *get_writable_colors() {
+        if (flags.uniform || snapshot_epoch) {
+            make_dense();
+        }
+
+        return (voxel_color_t *)colors;
+    }
+
+    inline void set_voxel(uint32_t index, uint8_t value, voxel_color_t color) {
+        if (flags.uniform || snapshot_epoch) {
+            make_dense();
+        }
+
+        ((uint8_t *)values)[index] = value;
+        ((voxel_color_t *)colors)[index] = color;
+    }
+
+    inline const chunk_t *get_neighbour(int32_t dx, int32_t dy, int32_t dz) const {
+        return neighbours[get_neighbour_index(dx, dy, dz)];
+    }
+
+    // Gives the chunk its own copy of the voxels (if they are shared)
+    void make_dense();
+    // If all the voxels are the same, free them and point to a shared block instead
+    bool compact();
+
+    void update_occupancy();
+    // Only recomputes the bricks which contain the voxels in the box (local coordinates, inclusive)
+    void update_occupancy(const ivector3_t &local_min, const ivector3_t &local_max);
+
+    /*
+      Builds the mip levels / brings them up to date if they need to be (NULL
+      if the chunk is uniform). Like the collision meshes, this writes to the
+      chunk, so the queries can't run on several threads at once.
+    */
+    const chunk_mips_t *get_mips() const;
+    // Coordinates of the cell in the mip level (level 0 reads the voxels)
+    inline uint8_t get_mip_average(uint32_t level, uint32_t x, uint32_t y, uint32_t z) const;
+    inline uint8_t get_mip_maximum(uint32_t level, uint32_t x, uint32_t y, uint32_t z) const;
+
+    // True if the cell at (x, y, z) (all corners inside the chunk) can't produce any triangles
+    inline bool can_skip_cell(int32_t x, int32_t y, int32_t z) const {
+        return
+            x < CHUNK_EDGE_LENGTH - 1 &&
+            y < CHUNK_EDGE_LENGTH - 1 &&
+            z < CHUNK_EDGE_LENGTH - 1 &&
+            !(occupancy.surface_bricks & (1ull << get_brick_index(x, y, z)));
+    }
 };
 
 /*
@@ -65,7 +310,227 @@ ivector3_t space_world_to_voxel(const vector3_t &ws_position);
 ivector3_t space_voxel_to_chunk(const ivector3_t &vs_position);
 vector3_t space_chunk_to_world(const ivector3_t &chunk_coord);
 ivector3_t space_voxel_to_local_chunk(const ivector3_t &vs_position);
-uint32_t get_voxel_index(uint32_t x, uint32_t y, uint32_t z);
-uint32_t hash_chunk_coord(const ivector3_t &coord);
+
+/*
+  Order of the voxels in the chunk planes (chosen with VKPH_VOXEL_LAYOUT).
+  With the linear layout, the 8 corners of a cell are spread over 3 strides
+  (1, CHUNK_EDGE_LENGTH and CHUNK_EDGE_LENGTH^2), whereas with the tiled and
+  morton layouts, they are mostly in the same cache line.
+  All the voxel accesses go through get_voxel_index(), and map files and
+  packets always store the voxels in linear order.
+ */
+enum voxel_layout_t { VL_LINEAR, VL_TILED, VL_MORTON, VL_INVALID };
+
+constexpr voxel_layout_t VOXEL_LAYOUT = (voxel_layout_t)VKPH_VOXEL_LAYOUT;
+constexpr uint32_t VOXEL_TILE_EDGE_LENGTH = 4;
+constexpr uint32_t VOXEL_TILES_PER_EDGE = CHUNK_EDGE_LENGTH / VOXEL_TILE_EDGE_LENGTH;
+
+static_assert(VOXEL_LAYOUT < VL_INVALID, "VKPH_VOXEL_LAYOUT needs to be 0 (linear), 1 (tiled) or 2 (morton)");
+
+// Puts 2 zero bits between each of the (lowest 10) bits of v
+inline uint32_t morton_spread_bits(uint32_t v) {
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+template <voxel_layout_t Layout>
+inline uint32_t get_voxel_index_in_layout(uint32_t x, uint32_t y, uint32_t z);
+
+template <>
+inline uint32_t get_voxel_index_in_layout<VL_LINEAR>(uint32_t x, uint32_t y, uint32_t z) {
+    return z * (CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH) + y * CHUNK_EDGE_LENGTH + x;
+}
+
+// 4x4x4 tiles (64 bytes of values) stored one after the other, linear inside the tiles
+template <>
+inline uint32_t get_voxel_index_in_layout<VL_TILED>(uint32_t x, uint32_t y, uint32_t z) {
+    uint32_t tile =
+        (z / VOXEL_TILE_EDGE_LENGTH) * (VOXEL_TILES_PER_EDGE * VOXEL_TILES_PER_EDGE) +
+        (y / VOXEL_TILE_EDGE_LENGTH) * VOXEL_TILES_PER_EDGE +
+        (x / VOXEL_TILE_EDGE_LENGTH);
+
+    uint32_t in_tile =
+        (z % VOXEL_TILE_EDGE_LENGTH) * (VOXEL_TILE_EDGE_LENGTH * VOXEL_TILE_EDGE_LENGTH) +
+        (y % VOXEL_TILE_EDGE_LENGTH) * VOXEL_TILE_EDGE_LENGTH +
+        (x % VOXEL_TILE_EDGE_LENGTH);
+
+    return tile * (VOXEL_TILE_EDGE_LENGTH * VOXEL_TILE_EDGE_LENGTH * VOXEL_TILE_EDGE_LENGTH) + in_tile;
+}
+
+template <>
+inline uint32_t get_voxel_index_in_layout<VL_MORTON>(uint32_t x, uint32_t y, uint32_t z) {
+    return morton_spread_bits(x) | (morton_spread_bits(y) << 1) | (morton_spread_bits(z) << 2);
+}
+
+// Inline so that the voxel loops get specialised for the compiled chunk size and layout
+inline uint32_t get_voxel_index(uint32_t x, uint32_t y, uint32_t z) {
+    return get_voxel_index_in_layout<VOXEL_LAYOUT>(x, y, z);
+}
+
+// Inverse of morton_spread_bits()
+inline uint32_t morton_compact_bits(uint32_t v) {
+    v &= 0x09249249;
+    v = (v | (v >> 2)) & 0x030C30C3;
+    v = (v | (v >> 4)) & 0x0300F00F;
+    v = (v | (v >> 8)) & 0x030000FF;
+    v = (v | (v >> 16)) & 0x000003FF;
+    return v;
+}
+
+// Inverse of get_voxel_index()
+inline ivector3_t get_voxel_coord(uint32_t index) {
+    switch (VOXEL_LAYOUT) {
+    case VL_TILED: {
+        uint32_t tile = index / (VOXEL_TILE_EDGE_LENGTH * VOXEL_TILE_EDGE_LENGTH * VOXEL_TILE_EDGE_LENGTH);
+        uint32_t in_tile = index % (VOXEL_TILE_EDGE_LENGTH * VOXEL_TILE_EDGE_LENGTH * VOXEL_TILE_EDGE_LENGTH);
+
+        return ivector3_t(
+            (tile % VOXEL_TILES_PER_EDGE) * VOXEL_TILE_EDGE_LENGTH + in_tile % VOXEL_TILE_EDGE_LENGTH,
+            ((tile / VOXEL_TILES_PER_EDGE) % VOXEL_TILES_PER_EDGE) * VOXEL_TILE_EDGE_LENGTH + (in_tile / VOXEL_TILE_EDGE_LENGTH) % VOXEL_TILE_EDGE_LENGTH,
+            (tile / (VOXEL_TILES_PER_EDGE * VOXEL_TILES_PER_EDGE)) * VOXEL_TILE_EDGE_LENGTH + in_tile / (VOXEL_TILE_EDGE_LENGTH * VOXEL_TILE_EDGE_LENGTH));
+    }
+
+    case VL_MORTON: {
+        return ivector3_t(morton_compact_bits(index), morton_compact_bits(index >> 1), morton_compact_bits(index >> 2));
+    }
+
+    default: {
+        return ivector3_t(
+            index % CHUNK_EDGE_LENGTH,
+            (index / CHUNK_EDGE_LENGTH) % CHUNK_EDGE_LENGTH,
+            index / (CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH));
+    }
+    }
+}
+
+/*
+  The voxel modifications in packets refer to the voxels with their index in
+  the linear layout, so that clients and servers built with different
+  layouts still agree on which voxels changed.
+ */
+inline uint32_t voxel_index_to_linear(uint32_t index) {
+    ivector3_t coord = get_voxel_coord(index);
+    return get_voxel_index_in_layout<VL_LINEAR>(coord.x, coord.y, coord.z);
+}
+
+inline uint32_t voxel_index_from_linear(uint32_t linear_index) {
+    return get_voxel_index(
+        linear_index % CHUNK_EDGE_LENGTH,
+        (linear_index / CHUNK_EDGE_LENGTH) % CHUNK_EDGE_LENGTH,
+        linear_index / (CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH));
+}
+
+inline uint8_t chunk_t::get_mip_average(uint32_t level, uint32_t x, uint32_t y, uint32_t z) const {
+    if (level == 0) {
+        return values[get_voxel_index(x, y, z)];
+    }
+
+    const chunk_mips_t *levels = get_mips();
+    return levels ? levels->average[get_mip_cell_index(level, x, y, z)] : values[0];
+}
+
+inline uint8_t chunk_t::get_mip_maximum(uint32_t level, uint32_t x, uint32_t y, uint32_t z) const {
+    if (level == 0) {
+        return values[get_voxel_index(x, y, z)];
+    }
+
+    const chunk_mips_t *levels = get_mips();
+    return levels ? levels->maximum[get_mip_cell_index(level, x, y, z)] : values[0];
+}
+
+/*
+  Part of a box of voxels which is inside a single chunk (see
+  for_each_chunk_span() and state_t::edit_region()).
+ */
+struct chunk_span_t {
+    ivector3_t chunk_coord;
+    // Voxel space coordinate of the chunk's first voxel
+    ivector3_t vs_origin;
+    // Local to the chunk, inclusive
+    ivector3_t local_min;
+    ivector3_t local_max;
+};
+
+/*
+  Splits a box of voxels (voxel space, inclusive) into the parts which are
+  in each chunk, and calls proc(span) for each of them (z, y, x order).
+  This is just maths, the chunks don't get looked up.
+ */
+template <typename T>
+inline void for_each_chunk_span(const ivector3_t &vs_min, const ivector3_t &vs_max, T proc) {
+    if (vs_max.x < vs_min.x || vs_max.y < vs_min.y || vs_max.z < vs_min.z) {
+        return;
+    }
+
+    ivector3_t chunk_min = space_voxel_to_chunk(vs_min);
+    ivector3_t chunk_max = space_voxel_to_chunk(vs_max);
+
+    for (int32_t cz = chunk_min.z; cz <= chunk_max.z; ++cz) {
+        for (int32_t cy = chunk_min.y; cy <= chunk_max.y; ++cy) {
+            for (int32_t cx = chunk_min.x; cx <= chunk_max.x; ++cx) {
+                chunk_span_t span;
+                span.chunk_coord = ivector3_t(cx, cy, cz);
+                span.vs_origin = span.chunk_coord * CHUNK_EDGE_LENGTH;
+                span.local_min = glm::max(vs_min - span.vs_origin, ivector3_t(0));
+                span.local_max = glm::min(vs_max - span.vs_origin, ivector3_t(CHUNK_EDGE_LENGTH - 1));
+
+                proc(span);
+            }
+        }
+    }
+}
+
+/*
+  Compression used for the voxels in map files and in PT_CHUNK_VOXELS packets:
+  (value, color) pairs, with runs of empty voxels replaced by
+  (CHUNK_SPECIAL_VALUE, CHUNK_SPECIAL_VALUE) followed by a uint32_t count.
+  serialise_voxels() returns 0 (and leaves the serialiser untouched) if all
+  the voxels are empty.
+ */
+bool serialise_voxels(serialiser_t *serialiser, const uint8_t *values, const voxel_color_t *colors, uint32_t voxel_count);
+void deserialise_voxels(serialiser_t *serialiser, uint8_t *values, voxel_color_t *colors, uint32_t voxel_count);
+
+/*
+  Same as above but for entire chunk planes (in VOXEL_LAYOUT order). The
+  serialised voxels are always in linear order.
+ */
+bool serialise_chunk_voxels(serialiser_t *serialiser, const uint8_t *values, const voxel_color_t *colors);
+void deserialise_chunk_voxels(serialiser_t *serialiser, uint8_t *values, voxel_color_t *colors);
+
+/*
+  Copy a box of edge_length^3 voxels starting at local_min between chunk
+  planes (VOXEL_LAYOUT order) and linear arrays.
+ */
+void copy_voxels_to_linear(
+    const uint8_t *values, const voxel_color_t *colors,
+    const ivector3_t &local_min, int32_t edge_length,
+    uint8_t *dst_values, voxel_color_t *dst_colors);
+
+void copy_voxels_from_linear(
+    const uint8_t *src_values, const voxel_color_t *src_colors,
+    const ivector3_t &local_min, int32_t edge_length,
+    uint8_t *values, voxel_color_t *colors);
+
+/*
+  Hashes all 32 bits of every component of the coordinate
+  (used by chunk_index_t).
+ */
+inline uint32_t hash_chunk_coord(const ivector3_t &coord) {
+    uint64_t h = (uint64_t)(uint32_t)coord.x;
+    h = h * 0x9e3779b97f4a7c15ull + (uint64_t)(uint32_t)coord.y;
+    h = h * 0x9e3779b97f4a7c15ull + (uint64_t)(uint32_t)coord.z;
+
+    // Final avalanche (from MurmurHash3's fmix64)
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+
+    return (uint32_t)h;
+}
 
 }
@@ -0,0 +1,133 @@
+#include "vkph_chunk_index.hpp"
+
+#include <log.hpp>
+#include <string.h>
+#include <allocators.hpp>
+
+namespace vkph {
+
+void chunk_index_t::init(uint32_t initial_capacity) {
+    capacity = 16;
+    while (capacity < initial_capacity) {
+        capacity <<= 1;
+    }
+
+    count = 0;
+    max_probe_length = 0;
+    slots = flmalloc<slot_t>(capacity);
+    memset(slots, 0, sizeof(slot_t) * capacity);
+}
+
+void chunk_index_t::destroy() {
+    flfree(slots);
+
+    slots = NULL;
+    capacity = 0;
+    count = 0;
+}
+
+void chunk_index_t::clear() {
+    memset(slots, 0, sizeof(slot_t) * capacity);
+    count = 0;
+    max_probe_length = 0;
+}
+
+void chunk_index_t::insert(const ivector3_t &coord, uint32_t chunk_index) {
+    // Keep the load factor under 7/8
+    if ((count + 1) * 8 > capacity * 7) {
+        grow();
+    }
+
+    uint32_t mask = capacity - 1;
+    uint32_t slot_index = hash_chunk_coord(coord) & mask;
+
+    slot_t to_insert = {coord, chunk_index, 1};
+
+    for (;;) {
+        slot_t *slot = &slots[slot_index];
+
+        if (slot->probe_length == 0) {
+            *slot = to_insert;
+            ++count;
+
+            max_probe_length = MAX(max_probe_length, to_insert.probe_length);
+
+            return;
+        }
+
+        if (slot->coord == to_insert.coord) {
+            // Already in the map, just update the index
+            slot->chunk_index = to_insert.chunk_index;
+            return;
+        }
+
+        if (slot->probe_length < to_insert.probe_length) {
+            // Steal the slot from the "richer" item, and carry on inserting that one
+            slot_t tmp = *slot;
+            *slot = to_insert;
+            max_probe_length = MAX(max_probe_length, to_insert.probe_length);
+            to_insert = tmp;
+        }
+
+        ++to_insert.probe_length;
+        slot_index = (slot_index + 1) & mask;
+    }
+}
+
+void chunk_index_t::remove(const ivector3_t &coord) {
+    uint32_t mask = capacity - 1;
+    uint32_t slot_index = hash_chunk_coord(coord) & mask;
+
+    for (uint32_t probe_length = 1;; ++probe_length) {
+        slot_t *slot = &slots[slot_index];
+
+        if (slot->probe_length < probe_length) {
+            LOG_ERROR("Tried to remove chunk which isn't in the chunk index\n");
+            return;
+        }
+
+        if (slot->coord == coord) {
+            break;
+        }
+
+        slot_index = (slot_index + 1) & mask;
+    }
+
+    // Backward shift deletion - no tombstones needed
+    for (;;) {
+        uint32_t next_index = (slot_index + 1) & mask;
+        slot_t *next = &slots[next_index];
+
+        if (next->probe_length <= 1) {
+            slots[slot_index].probe_length = 0;
+            break;
+        }
+
+        slots[slot_index] = *next;
+        --slots[slot_index].probe_length;
+
+        slot_index = next_index;
+    }
+
+    --count;
+}
+
+void chunk_index_t::grow() {
+    uint32_t old_capacity = capacity;
+    slot_t *old_slots = slots;
+
+    capacity = old_capacity * 2;
+    count = 0;
+    slots = flmalloc<slot_t>(capacity);
+    memset(slots, 0, sizeof(slot_t) * capacity);
+
+    for (uint32_t i = 0; i < old_capacity; ++i) {
+        if (old_slots[i].probe_length) {
+            insert(old_slots[i].coord, old_slots[i].chunk_index);
+        }
+    }
+
+    flfree(old_slots);
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.hpp>
+
+#include "vkph_chunk.hpp"
+
+namespace vkph {
+
+/*
+  Maps a chunk coordinate to the index of the chunk in state_t::chunks.
+  This is an open addressing hash map (Robin Hood probing) keyed on the full
+  3 x int32 coordinate, so chunks which are far apart never alias each other.
+  It grows whenever it gets too full, so there isn't any upper bound on the
+  amount of chunks which can be loaded.
+ */
+struct chunk_index_t {
+    struct slot_t {
+        ivector3_t coord;
+        uint32_t chunk_index;
+        // 0 if the slot is empty, otherwise (distance from the ideal slot + 1)
+        uint32_t probe_length;
+    };
+
+    // Always a power of 2
+    uint32_t capacity;
+    uint32_t count;
+    slot_t *slots;
+
+    // Longest probe sequence the map has ever had (for debugging / stats)
+    uint32_t max_probe_length;
+
+    void init(uint32_t initial_capacity);
+    void destroy();
+    void clear();
+
+    void insert(const ivector3_t &coord, uint32_t chunk_index);
+    void remove(const ivector3_t &coord);
+
+    // Returns NULL if the chunk isn't in the map
+    inline const uint32_t *get(const ivector3_t &coord) const {
+        uint32_t mask = capacity - 1;
+        uint32_t slot_index = hash_chunk_coord(coord) & mask;
+
+        /*
+          With Robin Hood probing, as soon as we hit a slot which is closer to
+          its ideal position than we are to ours, the key can't be in the map.
+        */
+        for (uint32_t probe_length = 1;; ++probe_length) {
+            const slot_t *slot = &slots[slot_index];
+
+            if (slot->probe_length < probe_length) {
+                return NULL;
+            }
+
+            if (slot->coord == coord) {
+                return &slot->chunk_index;
+            }
+
+            slot_index = (slot_index + 1) & mask;
+        }
+    }
+
+    inline uint32_t *get(const ivector3_t &coord) {
+        return const_cast<uint32_t *>(static_cast<const chunk_index_t *>(this)->get(coord));
+    }
+
+private:
+    void grow();
+};
+
+}
@@ -0,0 +1,507 @@
+#include "vkph_collision_mesh.hpp"
+#include "vkph_state.hpp"
+#include "vkph_triangle_table.hpp"
+
+#include <string.h>
+#include <allocators.hpp>
+
+namespace vkph {
+
+static bool s_caching = 1;
+
+void set_collision_mesh_caching(bool enabled) {
+    s_caching = enabled;
+}
+
+bool get_collision_mesh_caching() {
+    return s_caching;
+}
+
+// x, y and z can be CHUNK_EDGE_LENGTH, in which case the voxel gets sampled from the neighbouring chunk
+static uint8_t s_chunk_edge_voxel_value(
+    int32_t x,
+    int32_t y,
+    int32_t z,
+    bool *doesnt_exist,
+    const chunk_t *chunk) {
+    int32_t chunk_coord_offset_x = 0, chunk_coord_offset_y = 0, chunk_coord_offset_z = 0;
+    int32_t final_x = x, final_y = y, final_z = z;
+
+    if (x == CHUNK_EDGE_LENGTH) {
+        final_x = 0;
+        chunk_coord_offset_x = 1;
+    }
+    if (y == CHUNK_EDGE_LENGTH) {
+        final_y = 0;
+        chunk_coord_offset_y = 1;
+    }
+    if (z == CHUNK_EDGE_LENGTH) {
+        final_z = 0;
+        chunk_coord_offset_z = 1;
+    }
+
+    const chunk_t *chunk_ptr = chunk->get_neighbour(
+        chunk_coord_offset_x,
+        chunk_coord_offset_y,
+        chunk_coord_offset_z);
+
+    *doesnt_exist = (bool)(chunk_ptr == nullptr);
+    if (*doesnt_exist) {
+        return 0;
+    }
+
+    return chunk_ptr->values[get_voxel_index(final_x, final_y, final_z)];
+}
+
+static const vector3_t NORMALIZED_CUBE_VERTICES[8] = {
+    vector3_t(-0.5f, -0.5f, -0.5f),
+    vector3_t(+0.5f, -0.5f, -0.5f),
+    vector3_t(+0.5f, -0.5f, +0.5f),
+    vector3_t(-0.5f, -0.5f, +0.5f),
+    vector3_t(-0.5f, +0.5f, -0.5f),
+    vector3_t(+0.5f, +0.5f, -0.5f),
+    vector3_t(+0.5f, +0.5f, +0.5f),
+    vector3_t(-0.5f, +0.5f, +0.5f) };
+
+static void s_push_collision_vertex(
+    uint8_t v0,
+    uint8_t v1,
+    vector3_t *vertices,
+    uint8_t *voxel_values,
+    uint8_t surface_level,
+    collision_triangle_t *dst_triangle,
+    uint32_t vertex_index) {
+    float surface_level_f = (float)surface_level;
+    float voxel_value0 = (float)voxel_values[v0];
+    float voxel_value1 = (float)voxel_values[v1];
+
+    if (voxel_value0 > voxel_value1) {
+        float tmp = voxel_value0;
+        voxel_value0 = voxel_value1;
+        voxel_value1 = tmp;
+
+        uint8_t tmp_v = v0;
+        v0 = v1;
+        v1 = tmp_v;
+    }
+
+    float interpolated_voxel_values = lerp(voxel_value0, voxel_value1, surface_level_f);
+
+    vector3_t vertex = interpolate(vertices[v0], vertices[v1], interpolated_voxel_values);
+
+    dst_triangle->vertices[vertex_index] = vertex;
+}
+
+static void s_push_collision_triangles_vertices(
+    uint8_t *voxel_values,
+    int32_t x,
+    int32_t y,
+    int32_t z,
+    uint8_t surface_level,
+    collision_triangle_t *dst_array,
+    uint32_t *count,
+    uint32_t max) {
+    uint8_t bit_combination = 0;
+    for (uint32_t i = 0; i < 8; ++i) {
+        bool is_over_surface = (voxel_values[i] > surface_level);
+        bit_combination |= is_over_surface << i;
+    }
+
+    const int8_t *triangle_entry = &TRIANGLE_TABLE[bit_combination][0];
+
+    uint32_t edge = 0;
+
+    int8_t edge_pair[3] = {};
+
+    while (triangle_entry[edge] != -1) {
+        if (*count + 3 >= max) {
+            break;
+        }
+
+        int8_t edge_index = triangle_entry[edge];
+        edge_pair[edge % 3] = edge_index;
+
+        if (edge % 3 == 2) {
+            vector3_t vertices[8] = {};
+            for (uint32_t i = 0; i < 8; ++i) {
+                vertices[i] = NORMALIZED_CUBE_VERTICES[i] + vector3_t(0.5f) + vector3_t((float)x, (float)y, (float)z);
+            }
+
+            for (uint32_t i = 0; i < 3; ++i) {
+                switch (edge_pair[i]) {
+                case 0: { s_push_collision_vertex(0, 1, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 1: { s_push_collision_vertex(1, 2, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 2: { s_push_collision_vertex(2, 3, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 3: { s_push_collision_vertex(3, 0, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 4: { s_push_collision_vertex(4, 5, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 5: { s_push_collision_vertex(5, 6, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 6: { s_push_collision_vertex(6, 7, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 7: { s_push_collision_vertex(7, 4, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 8: { s_push_collision_vertex(0, 4, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 9: { s_push_collision_vertex(1, 5, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 10: { s_push_collision_vertex(2, 6, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                case 11: { s_push_collision_vertex(3, 7, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
+                }
+            }
+
+            (*count)++;
+        }
+
+        ++edge;
+    }
+}
+
+// Values of the 8 corners of the cell (local coordinates)
+static void s_get_cell_values(const chunk_t *chunk, const ivector3_t &cs_coord, uint8_t *voxel_values) {
+    if (cs_coord.x < CHUNK_EDGE_LENGTH - 1 && cs_coord.y < CHUNK_EDGE_LENGTH - 1 && cs_coord.z < CHUNK_EDGE_LENGTH - 1) {
+        voxel_values[0] = chunk->values[get_voxel_index(cs_coord.x, cs_coord.y, cs_coord.z)];
+        voxel_values[1] = chunk->values[get_voxel_index(cs_coord.x + 1, cs_coord.y, cs_coord.z)];
+        voxel_values[2] = chunk->values[get_voxel_index(cs_coord.x + 1, cs_coord.y, cs_coord.z + 1)];
+        voxel_values[3] = chunk->values[get_voxel_index(cs_coord.x, cs_coord.y, cs_coord.z + 1)];
+
+        voxel_values[4] = chunk->values[get_voxel_index(cs_coord.x, cs_coord.y + 1, cs_coord.z)];
+        voxel_values[5] = chunk->values[get_voxel_index(cs_coord.x + 1, cs_coord.y + 1, cs_coord.z)];
+        voxel_values[6] = chunk->values[get_voxel_index(cs_coord.x + 1, cs_coord.y + 1, cs_coord.z + 1)];
+        voxel_values[7] = chunk->values[get_voxel_index(cs_coord.x, cs_coord.y + 1, cs_coord.z + 1)];
+    }
+    else {
+        // Neighbours which aren't loaded are air
+        bool doesnt_exist = 0;
+
+        voxel_values[0] = chunk->values[get_voxel_index(cs_coord.x, cs_coord.y, cs_coord.z)];
+        voxel_values[1] = s_chunk_edge_voxel_value(cs_coord.x + 1, cs_coord.y, cs_coord.z, &doesnt_exist, chunk);
+        voxel_values[2] = s_chunk_edge_voxel_value(cs_coord.x + 1, cs_coord.y, cs_coord.z + 1, &doesnt_exist, chunk);
+        voxel_values[3] = s_chunk_edge_voxel_value(cs_coord.x,     cs_coord.y, cs_coord.z + 1, &doesnt_exist, chunk);
+
+        voxel_values[4] = s_chunk_edge_voxel_value(cs_coord.x,     cs_coord.y + 1, cs_coord.z, &doesnt_exist, chunk);
+        voxel_values[5] = s_chunk_edge_voxel_value(cs_coord.x + 1, cs_coord.y + 1, cs_coord.z, &doesnt_exist, chunk);
+        voxel_values[6] = s_chunk_edge_voxel_value(cs_coord.x + 1, cs_coord.y + 1, cs_coord.z + 1, &doesnt_exist, chunk);
+        voxel_values[7] = s_chunk_edge_voxel_value(cs_coord.x,     cs_coord.y + 1, cs_coord.z + 1, &doesnt_exist, chunk);
+    }
+}
+
+static inline uint32_t s_get_cell_index_in_brick(int32_t x, int32_t y, int32_t z) {
+    return
+        ((z % CHUNK_BRICK_EDGE_LENGTH) * CHUNK_BRICK_EDGE_LENGTH +
+         (y % CHUNK_BRICK_EDGE_LENGTH)) * CHUNK_BRICK_EDGE_LENGTH +
+        (x % CHUNK_BRICK_EDGE_LENGTH);
+}
+
+// Cells of bricks which weren't built yet are dirty anyway
+static inline void s_flag_cell(chunk_collision_mesh_t *mesh, int32_t x, int32_t y, int32_t z) {
+    collision_brick_t *brick = mesh->bricks[get_brick_index(x, y, z)];
+
+    if (brick) {
+        uint32_t cell_index = s_get_cell_index_in_brick(x, y, z);
+        brick->dirty_cells[cell_index / 64] |= 1ull << (cell_index % 64);
+    }
+}
+
+// Flags the cells whose corners are in the box (local coordinates, inclusive)
+static void s_flag_cells(chunk_collision_mesh_t *mesh, const ivector3_t &cell_min, const ivector3_t &cell_max) {
+    for (int32_t z = cell_min.z; z <= cell_max.z; ++z) {
+        for (int32_t y = cell_min.y; y <= cell_max.y; ++y) {
+            for (int32_t x = cell_min.x; x <= cell_max.x; ++x) {
+                s_flag_cell(mesh, x, y, z);
+            }
+        }
+    }
+}
+
+/*
+  Flags the cells which sample neighbours which changed (or got loaded /
+  unloaded) since the last check. Only the cells on the last row / column /
+  layer sample the neighbours, so the queries only check when they get to
+  one of those.
+ */
+static void s_check_neighbours(const chunk_t *chunk, chunk_collision_mesh_t *mesh) {
+    for (uint32_t i = 0; i < 7; ++i) {
+        int32_t dx = (i + 1) & 1, dy = ((i + 1) >> 1) & 1, dz = ((i + 1) >> 2) & 1;
+
+        const chunk_t *neighbour = chunk->get_neighbour(dx, dy, dz);
+        uint64_t version = neighbour ? neighbour->collision_version : 0;
+
+        if (neighbour != mesh->neighbours[i] || version != mesh->neighbour_versions[i]) {
+            int32_t last = CHUNK_EDGE_LENGTH - 1;
+
+            s_flag_cells(
+                mesh,
+                ivector3_t(dx ? last : 0, dy ? last : 0, dz ? last : 0),
+                ivector3_t(last));
+
+            mesh->neighbours[i] = neighbour;
+            mesh->neighbour_versions[i] = version;
+        }
+    }
+}
+
+// Whether s_check_neighbours() wouldn't flag anything
+static bool s_neighbours_unchanged(const chunk_t *chunk, const chunk_collision_mesh_t *mesh) {
+    for (uint32_t i = 0; i < 7; ++i) {
+        int32_t dx = (i + 1) & 1, dy = ((i + 1) >> 1) & 1, dz = ((i + 1) >> 2) & 1;
+
+        const chunk_t *neighbour = chunk->get_neighbour(dx, dy, dz);
+        uint64_t version = neighbour ? neighbour->collision_version : 0;
+
+        if (neighbour != mesh->neighbours[i] || version != mesh->neighbour_versions[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static chunk_collision_mesh_t *s_get_mesh(const chunk_t *chunk) {
+    if (!chunk->collision_mesh) {
+        // Zeroed: no bricks, and no neighbours were seen
+        chunk->collision_mesh = flmalloc<chunk_collision_mesh_t>();
+    }
+
+    return chunk->collision_mesh;
+}
+
+static collision_brick_t *s_get_brick(chunk_collision_mesh_t *mesh, uint32_t brick_index) {
+    collision_brick_t *brick = mesh->bricks[brick_index];
+
+    if (!brick) {
+        // Zeroed: no triangles
+        brick = flmalloc<collision_brick_t>();
+        memset(brick->dirty_cells, 0xFF, sizeof(brick->dirty_cells));
+        mesh->bricks[brick_index] = brick;
+    }
+
+    return brick;
+}
+
+// Copies the triangles which still belong to cells to a new array with space for at least extra_count more
+static void s_compact_brick(collision_brick_t *brick, uint32_t extra_count) {
+    uint32_t live_count = brick->triangle_count - brick->dropped_count;
+    uint32_t new_max_count = MAX((live_count + extra_count) * 2, 16u);
+
+    collision_triangle_t *new_triangles = flmalloc<collision_triangle_t>(new_max_count);
+    uint32_t new_count = 0;
+
+    for (uint32_t i = 0; i < CHUNK_BRICK_CELL_COUNT; ++i) {
+        uint32_t cell_count = brick->cell_triangle_counts[i];
+
+        if (cell_count) {
+            memcpy(&new_triangles[new_count], &brick->triangles[brick->cell_offsets[i]], sizeof(collision_triangle_t) * cell_count);
+            brick->cell_offsets[i] = (uint16_t)new_count;
+            new_count += cell_count;
+        }
+    }
+
+    if (brick->triangles) {
+        flfree(brick->triangles);
+    }
+
+    brick->triangles = new_triangles;
+    brick->triangle_count = new_count;
+    brick->max_triangle_count = new_max_count;
+    brick->dropped_count = 0;
+}
+
+static void s_build_cell(const chunk_t *chunk, collision_brick_t *brick, uint32_t cell_index, const ivector3_t &cs_coord) {
+    uint8_t voxel_values[8];
+    s_get_cell_values(chunk, cs_coord, voxel_values);
+
+    ivector3_t vs_coord = chunk->xs_bottom_corner + cs_coord;
+
+    // Big enough for the 5 triangles a cell can have
+    collision_triangle_t cell_triangles[5];
+    uint32_t cell_count = 0;
+    s_push_collision_triangles_vertices(
+        voxel_values,
+        vs_coord.x,
+        vs_coord.y,
+        vs_coord.z,
+        CHUNK_SURFACE_LEVEL,
+        cell_triangles,
+        &cell_count,
+        8);
+
+    uint32_t previous_count = brick->cell_triangle_counts[cell_index];
+
+    if (cell_count <= previous_count) {
+        // Overwrite the previous triangles
+        brick->dropped_count += previous_count - cell_count;
+    }
+    else {
+        brick->dropped_count += previous_count;
+        brick->cell_triangle_counts[cell_index] = 0;
+
+        if (brick->triangle_count + cell_count > brick->max_triangle_count) {
+            s_compact_brick(brick, cell_count);
+        }
+
+        brick->cell_offsets[cell_index] = (uint16_t)brick->triangle_count;
+        brick->triangle_count += cell_count;
+    }
+
+    if (cell_count) {
+        memcpy(&brick->triangles[brick->cell_offsets[cell_index]], cell_triangles, sizeof(collision_triangle_t) * cell_count);
+    }
+
+    brick->cell_triangle_counts[cell_index] = (uint8_t)cell_count;
+    brick->dirty_cells[cell_index / 64] &= ~(1ull << (cell_index % 64));
+}
+
+void invalidate_collision_mesh(chunk_t *chunk, const ivector3_t &local_min, const ivector3_t &local_max) {
+    // The neighbours on the -x, -y, -z sides have cells with corners in the first row / column / layer
+    if (local_min.x <= 0 || local_min.y <= 0 || local_min.z <= 0) {
+        ++chunk->collision_version;
+    }
+
+    if (chunk->collision_mesh) {
+        // Cells whose last corner is in the box start one voxel before it
+        s_flag_cells(
+            chunk->collision_mesh,
+            glm::clamp(local_min - ivector3_t(1), ivector3_t(0), ivector3_t(CHUNK_EDGE_LENGTH - 1)),
+            glm::clamp(local_max, ivector3_t(0), ivector3_t(CHUNK_EDGE_LENGTH - 1)));
+    }
+}
+
+void free_collision_mesh(chunk_t *chunk) {
+    chunk_collision_mesh_t *mesh = chunk->collision_mesh;
+    if (!mesh) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < CHUNK_BRICK_COUNT; ++i) {
+        collision_brick_t *brick = mesh->bricks[i];
+
+        if (brick) {
+            if (brick->triangles) {
+                flfree(brick->triangles);
+            }
+
+            flfree(brick);
+        }
+    }
+
+    flfree(mesh);
+    chunk->collision_mesh = NULL;
+}
+
+uint32_t gather_collision_triangles(
+    const state_t *state,
+    const ivector3_t &vs_min,
+    const ivector3_t &vs_max,
+    collision_triangle_t *triangles,
+    uint32_t max_count) {
+    uint32_t count = 0;
+
+    // Last chunk that was found (its neighbour links get used to find the next chunks)
+    const chunk_t *previous_chunk = NULL;
+
+    // Chunk whose mesh is in mesh
+    const chunk_t *mesh_chunk = NULL;
+    chunk_collision_mesh_t *mesh = NULL;
+    bool checked_neighbours = 0;
+
+    for (int32_t z = vs_min.z; z < vs_max.z; ++z) {
+        for (int32_t y = vs_min.y; y < vs_max.y; ++y) {
+            for (int32_t x = vs_min.x; x < vs_max.x; ++x) {
+                ivector3_t voxel_coord = ivector3_t(x, y, z);
+                const chunk_t *chunk = state->access_chunk(space_voxel_to_chunk(voxel_coord), previous_chunk);
+
+                if (!chunk) {
+                    continue;
+                }
+
+                ivector3_t cs_coord = space_voxel_to_local_chunk(voxel_coord);
+
+                previous_chunk = chunk;
+
+                if (chunk->can_skip_cell(cs_coord.x, cs_coord.y, cs_coord.z)) {
+                    // The cell's brick doesn't cross the surface
+                    continue;
+                }
+
+                if (!s_caching) {
+                    uint8_t voxel_values[8];
+                    s_get_cell_values(chunk, cs_coord, voxel_values);
+                    s_push_collision_triangles_vertices(voxel_values, x, y, z, CHUNK_SURFACE_LEVEL, triangles, &count, max_count);
+
+                    continue;
+                }
+
+                if (chunk != mesh_chunk) {
+                    mesh = s_get_mesh(chunk);
+                    mesh_chunk = chunk;
+                    checked_neighbours = 0;
+                }
+
+                if (!checked_neighbours &&
+                    (cs_coord.x == CHUNK_EDGE_LENGTH - 1 ||
+                     cs_coord.y == CHUNK_EDGE_LENGTH - 1 ||
+                     cs_coord.z == CHUNK_EDGE_LENGTH - 1)) {
+                    s_check_neighbours(chunk, mesh);
+                    checked_neighbours = 1;
+                }
+
+                collision_brick_t *brick = s_get_brick(mesh, get_brick_index(cs_coord.x, cs_coord.y, cs_coord.z));
+                uint32_t cell_index = s_get_cell_index_in_brick(cs_coord.x, cs_coord.y, cs_coord.z);
+
+                if (brick->dirty_cells[cell_index / 64] & (1ull << (cell_index % 64))) {
+                    s_build_cell(chunk, brick, cell_index, cs_coord);
+                }
+
+                const collision_triangle_t *cell_triangles = &brick->triangles[brick->cell_offsets[cell_index]];
+                for (uint32_t t = 0; t < brick->cell_triangle_counts[cell_index]; ++t) {
+                    if (count + 3 >= max_count) {
+                        break;
+                    }
+
+                    triangles[count++] = cell_triangles[t];
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+uint32_t read_cell_collision_triangles(const chunk_t *chunk, const ivector3_t &cs_coord, collision_triangle_t *triangles) {
+    const chunk_collision_mesh_t *mesh = s_caching ? chunk->collision_mesh : NULL;
+    const collision_brick_t *brick = mesh ? mesh->bricks[get_brick_index(cs_coord.x, cs_coord.y, cs_coord.z)] : NULL;
+
+    if (brick) {
+        uint32_t cell_index = s_get_cell_index_in_brick(cs_coord.x, cs_coord.y, cs_coord.z);
+        bool up_to_date = !(brick->dirty_cells[cell_index / 64] & (1ull << (cell_index % 64)));
+
+        if (up_to_date &&
+            (cs_coord.x == CHUNK_EDGE_LENGTH - 1 ||
+             cs_coord.y == CHUNK_EDGE_LENGTH - 1 ||
+             cs_coord.z == CHUNK_EDGE_LENGTH - 1)) {
+            up_to_date = s_neighbours_unchanged(chunk, mesh);
+        }
+
+        if (up_to_date) {
+            uint32_t count = brick->cell_triangle_counts[cell_index];
+            memcpy(triangles, &brick->triangles[brick->cell_offsets[cell_index]], sizeof(collision_triangle_t) * count);
+
+            return count;
+        }
+    }
+
+    uint8_t voxel_values[8];
+    s_get_cell_values(chunk, cs_coord, voxel_values);
+
+    ivector3_t vs_coord = chunk->xs_bottom_corner + cs_coord;
+
+    uint32_t count = 0;
+    s_push_collision_triangles_vertices(
+        voxel_values,
+        vs_coord.x,
+        vs_coord.y,
+        vs_coord.z,
+        CHUNK_SURFACE_LEVEL,
+        triangles,
+        &count,
+        8);
+
+    return count;
+}
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "vkph_chunk.hpp"
+
+namespace vkph {
+
+struct state_t;
+
+struct collision_triangle_t {
+    union {
+        struct {
+            vector3_t a;
+            vector3_t b;
+            vector3_t c;
+        } v;
+        vector3_t vertices[3];
+    };
+};
+
+constexpr uint32_t CHUNK_BRICK_CELL_COUNT = CHUNK_BRICK_EDGE_LENGTH * CHUNK_BRICK_EDGE_LENGTH * CHUNK_BRICK_EDGE_LENGTH;
+constexpr uint32_t CHUNK_BRICK_CELL_MASK_COUNT = (CHUNK_BRICK_CELL_COUNT + 63) / 64;
+
+// Marching cubes gives at most 5 triangles per cell (the array can hold twice the live triangles before it gets compacted)
+static_assert(CHUNK_BRICK_CELL_COUNT * 5 * 2 + 64 <= 0xFFFF, "Cell offsets of the collision bricks are uint16_t");
+
+/*
+  Collision triangles (marching cubes) of the cells of a brick. Cells are in
+  x, then y, then z order. When a cell gets rebuilt, its triangles get
+  overwritten if they fit, and appended otherwise - the triangles it leaves
+  behind get dropped once there are as many of them as live ones.
+ */
+struct collision_brick_t {
+    // Cells which need to be rebuilt before they get used
+    uint64_t dirty_cells[CHUNK_BRICK_CELL_MASK_COUNT];
+
+    uint32_t triangle_count;
+    uint32_t max_triangle_count;
+    // Triangles which don't belong to any cell anymore
+    uint32_t dropped_count;
+    collision_triangle_t *triangles;
+
+    // Triangles of cell i are [cell_offsets[i], cell_offsets[i] + cell_triangle_counts[i])
+    uint16_t cell_offsets[CHUNK_BRICK_CELL_COUNT];
+    uint8_t cell_triangle_counts[CHUNK_BRICK_CELL_COUNT];
+};
+
+/*
+  Collision triangles of a chunk, so that the collision queries don't have
+  to run marching cubes on the cells around the ellipsoid every time (every
+  recursion of collide_and_slide(), every rock, every step of a ray...).
+
+  Bricks get allocated by the first query which needs them, and cells get
+  built (or rebuilt once their voxels changed) by the first query which
+  needs them: chunk_t::update_occupancy() flags the cells it touches, and
+  the cells on the last row / column / layer of the chunk get flagged when
+  one of the neighbours they sample changed (see chunk_t::collision_version).
+
+  The queries build the meshes, so they can't run on several threads at once
+  (read_cell_collision_triangles() can, it only reads them).
+ */
+struct chunk_collision_mesh_t {
+    // Neighbours (+x, +y, +z sides) as they were when the mesh last checked them
+    const chunk_t *neighbours[7];
+    uint64_t neighbour_versions[7];
+
+    // NULL until a query needs the brick
+    collision_brick_t *bricks[CHUNK_BRICK_COUNT];
+};
+
+/*
+  Flags the cells which have a corner in the box (local coordinates,
+  inclusive). Gets called by chunk_t::update_occupancy().
+ */
+void invalidate_collision_mesh(chunk_t *chunk, const ivector3_t &local_min, const ivector3_t &local_max);
+void free_collision_mesh(chunk_t *chunk);
+
+/*
+  Writes the triangles of the cells whose first corner is in [vs_min, vs_max)
+  (voxel space), in z, y, x order of the cells. Like marching cubes on the
+  cells would, it stops adding triangles once count + 3 reaches max_count.
+  Returns the amount of triangles.
+ */
+uint32_t gather_collision_triangles(
+    const state_t *state,
+    const ivector3_t &vs_min,
+    const ivector3_t &vs_max,
+    collision_triangle_t *triangles,
+    uint32_t max_count);
+
+/*
+  Triangles of one cell (local coordinates in the chunk, up to 5 triangles)
+  without building anything: the cached ones if the cell is up to date,
+  otherwise marching cubes on the spot. Several threads can call this at
+  once, as long as nothing writes to the chunks or builds the meshes while
+  they do.
+ */
+uint32_t read_cell_collision_triangles(const chunk_t *chunk, const ivector3_t &cs_coord, collision_triangle_t *triangles);
+
+// Whether gather_collision_triangles() uses the meshes or runs marching cubes on the cells every time (for benchmarks)
+void set_collision_mesh_caching(bool enabled);
+bool get_collision_mesh_caching();
+
+}
@@ -4,11 +4,32 @@
 
 #include "vkph_voxel.hpp"
 
+/*
+  The chunk edge length is chosen at compile time (VKPH_CHUNK_EDGE_LENGTH in
+  CMake), so that all the voxel loops get compiled for that size.
+*/
+#ifndef VKPH_CHUNK_EDGE_LENGTH
+#define VKPH_CHUNK_EDGE_LENGTH 16
+#endif
+
+// See voxel_layout_t (vkph_chunk.hpp)
+#ifndef VKPH_VOXEL_LAYOUT
+#define VKPH_VOXEL_LAYOUT 0
+#endif
+
 namespace vkph {
 
-constexpr int32_t CHUNK_EDGE_LENGTH = 16;
+constexpr int32_t CHUNK_EDGE_LENGTH = VKPH_CHUNK_EDGE_LENGTH;
 constexpr uint32_t CHUNK_VOXEL_COUNT = CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH;
-constexpr uint32_t CHUNK_MAX_LOADED_COUNT = 2000;
+
+/*
+  Map files store voxels in blocks of 16x16x16 whatever the chunk size is, so
+  chunks have to be made of a whole number of those blocks. Voxel indices
+  also need to fit in an int16_t (chunk histories, chunk modification packets).
+*/
+static_assert(CHUNK_EDGE_LENGTH == 16 || CHUNK_EDGE_LENGTH == 32, "Chunk edge length needs to be 16 or 32");
+// The chunk containers grow past this if needed
+constexpr uint32_t CHUNK_INITIAL_LOADED_COUNT = 2000;
 constexpr float CHUNK_MAX_VOXEL_VALUE_F = 254.0f;
 constexpr uint32_t CHUNK_MAX_VERTICES_PER_CHUNK = 5 * (CHUNK_EDGE_LENGTH - 1) * (CHUNK_EDGE_LENGTH - 1) * (CHUNK_EDGE_LENGTH - 1);
 constexpr uint32_t CHUNK_MAX_VOXEL_VALUE_I = 254;
@@ -0,0 +1,728 @@
+#include "vkph_map.hpp"
+#include "vkph_chunk.hpp"
+#include "vkph_constant.hpp"
+#include "vkph_chunk_index.hpp"
+
+#include <log.hpp>
+#include <string.h>
+#include <serialiser.hpp>
+#include <allocators.hpp>
+#include <compression.hpp>
+
+namespace vkph {
+
+// Magic, version, name's null terminator, view info and block count
+static constexpr uint32_t MAP_HEADER_FIXED_SIZE = 4 + 4 + 1 + 3 * 12 + 4;
+// Magic, size and checksum of the map file
+static constexpr uint32_t MAP_JOURNAL_HEADER_SIZE = 4 + 4 + 4;
+// Size and checksum of the entry, name's null terminator, view info and block count
+static constexpr uint32_t MAP_JOURNAL_ENTRY_FIXED_SIZE = 4 + 4 + 1 + 3 * 12 + 4;
+
+static uint32_t s_bytes_left(const serialiser_t *serialiser) {
+    return serialiser->data_buffer_size - serialiser->data_buffer_head;
+}
+
+template <typename T>
+static void s_reserve(T **array, uint32_t *capacity, uint32_t count) {
+    if (count <= *capacity) {
+        return;
+    }
+
+    uint32_t new_capacity = MAX(*capacity * 2, count);
+    T *new_array = flmalloc<T>(new_capacity);
+
+    if (*array) {
+        memcpy(new_array, *array, sizeof(T) * *capacity);
+        flfree(*array);
+    }
+
+    *array = new_array;
+    *capacity = new_capacity;
+}
+
+static void s_get_journal_path(const char *path, char *journal_path, uint32_t size) {
+    snprintf(journal_path, size, "assets/maps/%s.journal", path);
+}
+
+static bool s_read_directory(map_file_t *file, serialiser_t *serialiser) {
+    if (file->block_count > s_bytes_left(serialiser) / MAP_BLOCK_ENTRY_SIZE) {
+        return 0;
+    }
+
+    uint32_t directory_end = serialiser->data_buffer_head + file->block_count * MAP_BLOCK_ENTRY_SIZE;
+
+    for (uint32_t i = 0; i < file->block_count; ++i) {
+        map_block_entry_t *entry = &file->blocks[i];
+        entry->x = serialiser->deserialise_int16();
+        entry->y = serialiser->deserialise_int16();
+        entry->z = serialiser->deserialise_int16();
+        entry->offset = serialiser->deserialise_uint32();
+        entry->size = serialiser->deserialise_uint32();
+        entry->checksum = serialiser->deserialise_uint32();
+
+        if (entry->offset < directory_end ||
+            entry->offset > serialiser->data_buffer_size ||
+            entry->size > serialiser->data_buffer_size - entry->offset) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+  Version 1 files don't have a directory: this finds where the voxels of each
+  block are by going through the (value, color) pairs without decompressing.
+ */
+static bool s_scan_version1_blocks(map_file_t *file, serialiser_t *serialiser) {
+    // Coordinates, and at least one pair
+    if (file->block_count > s_bytes_left(serialiser) / 8) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < file->block_count; ++i) {
+        if (s_bytes_left(serialiser) < 6) {
+            return 0;
+        }
+
+        map_block_entry_t *entry = &file->blocks[i];
+        entry->x = serialiser->deserialise_int16();
+        entry->y = serialiser->deserialise_int16();
+        entry->z = serialiser->deserialise_int16();
+        entry->offset = serialiser->data_buffer_head;
+        entry->checksum = 0;
+
+        for (uint32_t v = 0; v < MAP_CHUNK_VOXEL_COUNT;) {
+            if (s_bytes_left(serialiser) < 2) {
+                return 0;
+            }
+
+            uint8_t value = serialiser->deserialise_uint8();
+            serialiser->deserialise_uint8();
+
+            if (value == CHUNK_SPECIAL_VALUE) {
+                if (s_bytes_left(serialiser) < 4) {
+                    return 0;
+                }
+
+                uint32_t zero_count = serialiser->deserialise_uint32();
+                v += MIN(zero_count, MAP_CHUNK_VOXEL_COUNT);
+            }
+            else {
+                ++v;
+            }
+        }
+
+        entry->size = serialiser->data_buffer_head - entry->offset;
+    }
+
+    return 1;
+}
+
+// The name and view info of the entry replace the map file's, and its blocks get added to the directory
+static bool s_apply_journal_entry(
+    map_file_t *file,
+    serialiser_t *serialiser,
+    chunk_index_t *block_indices,
+    uint32_t *block_capacity) {
+    const uint8_t *name_end = (const uint8_t *)memchr(
+        serialiser->data_buffer + serialiser->data_buffer_head,
+        0,
+        s_bytes_left(serialiser));
+
+    if (!name_end || (uint32_t)(serialiser->data_buffer + serialiser->data_buffer_size - name_end) < 1 + 3 * 12 + 4) {
+        return 0;
+    }
+
+    file->name = (const char *)serialiser->data_buffer + serialiser->data_buffer_head;
+    serialiser->data_buffer_head = (uint32_t)(name_end - serialiser->data_buffer) + 1;
+
+    file->view_info.pos = serialiser->deserialise_vector3();
+    file->view_info.dir = serialiser->deserialise_vector3();
+    file->view_info.up = serialiser->deserialise_vector3();
+
+    uint32_t block_count = serialiser->deserialise_uint32();
+
+    for (uint32_t i = 0; i < block_count; ++i) {
+        if (s_bytes_left(serialiser) < MAP_JOURNAL_BLOCK_HEADER_SIZE) {
+            return 0;
+        }
+
+        ivector3_t block_coord;
+        block_coord.x = serialiser->deserialise_int16();
+        block_coord.y = serialiser->deserialise_int16();
+        block_coord.z = serialiser->deserialise_int16();
+        uint32_t size = serialiser->deserialise_uint32();
+        uint32_t checksum = serialiser->deserialise_uint32();
+
+        if (size > s_bytes_left(serialiser)) {
+            return 0;
+        }
+
+        map_block_entry_t *entry = NULL;
+        uint32_t *index = block_indices->get(block_coord);
+
+        if (index) {
+            entry = &file->blocks[*index];
+        }
+        else if (size > 0) {
+            s_reserve(&file->blocks, block_capacity, file->block_count + 1);
+            block_indices->insert(block_coord, file->block_count);
+
+            entry = &file->blocks[file->block_count++];
+            entry->x = (int16_t)block_coord.x;
+            entry->y = (int16_t)block_coord.y;
+            entry->z = (int16_t)block_coord.z;
+        }
+
+        if (entry) {
+            // A size of 0 marks the block as removed (until a later entry adds it again)
+            entry->offset = serialiser->data_buffer_head;
+            entry->size = size;
+            entry->checksum = checksum;
+            entry->in_journal = 1;
+        }
+
+        serialiser->data_buffer_head += size;
+    }
+
+    return 1;
+}
+
+// Replays the entries of the journal (if there is one) on top of the directory
+static void s_apply_journal(map_file_t *file, const char *path) {
+    char journal_path[100] = {};
+    s_get_journal_path(path, journal_path, sizeof(journal_path));
+
+    file_mapping_t journal = map_file(journal_path);
+    if (!journal.data) {
+        return;
+    }
+
+    serialiser_t serialiser = {};
+    serialiser.data_buffer = journal.data;
+    serialiser.data_buffer_head = sizeof(MAP_JOURNAL_MAGIC);
+    serialiser.data_buffer_size = journal.size;
+
+    bool matches = journal.size >= MAP_JOURNAL_HEADER_SIZE && !memcmp(journal.data, MAP_JOURNAL_MAGIC, sizeof(MAP_JOURNAL_MAGIC));
+    if (matches) {
+        uint32_t map_file_size = serialiser.deserialise_uint32();
+        uint32_t header_checksum = serialiser.deserialise_uint32();
+
+        matches = (map_file_size == file->mapping.size && header_checksum == file->header_checksum);
+    }
+
+    if (!matches) {
+        LOG_INFOV("Journal %s doesn't go with the map file, it was ignored\n", journal_path);
+        unmap_file(journal);
+        return;
+    }
+
+    file->journal = journal;
+    file->journal_valid_size = serialiser.data_buffer_head;
+
+    chunk_index_t block_indices;
+    block_indices.init(file->block_count * 2);
+    for (uint32_t i = 0; i < file->block_count; ++i) {
+        const map_block_entry_t *entry = &file->blocks[i];
+        block_indices.insert(ivector3_t(entry->x, entry->y, entry->z), i);
+    }
+
+    uint32_t block_capacity = MAX(file->block_count, 1u);
+
+    while (s_bytes_left(&serialiser) >= 8) {
+        uint32_t entry_size = serialiser.deserialise_uint32();
+        uint32_t checksum = serialiser.deserialise_uint32();
+
+        // An entry which didn't get completely written (and everything after it) gets ignored
+        if (entry_size > s_bytes_left(&serialiser) ||
+            checksum_bytes(journal.data + serialiser.data_buffer_head, entry_size) != checksum) {
+            break;
+        }
+
+        uint32_t entry_end = serialiser.data_buffer_head + entry_size;
+
+        serialiser_t entry_serialiser = serialiser;
+        entry_serialiser.data_buffer_size = entry_end;
+
+        if (!s_apply_journal_entry(file, &entry_serialiser, &block_indices, &block_capacity)) {
+            break;
+        }
+
+        serialiser.data_buffer_head = entry_end;
+        file->journal_valid_size = entry_end;
+    }
+
+    if (file->journal_valid_size < journal.size) {
+        LOG_ERRORV("Journal %s has an incomplete save (%d bytes), it was ignored\n",
+                   journal_path, journal.size - file->journal_valid_size);
+    }
+
+    // Takes the removed blocks out of the directory
+    uint32_t block_count = 0;
+    for (uint32_t i = 0; i < file->block_count; ++i) {
+        if (file->blocks[i].size > 0) {
+            file->blocks[block_count++] = file->blocks[i];
+        }
+    }
+
+    file->block_count = block_count;
+
+    block_indices.destroy();
+}
+
+bool map_file_t::open(const char *path) {
+    char full_path[100] = {};
+    snprintf(full_path, sizeof(full_path), "assets/maps/%s", path);
+
+    mapping = map_file(full_path);
+    blocks = NULL;
+    block_count = 0;
+    header_checksum = 0;
+    journal = {};
+    journal_valid_size = 0;
+
+    if (!mapping.data) {
+        return 0;
+    }
+
+    serialiser_t serialiser = {};
+    serialiser.data_buffer = mapping.data;
+    serialiser.data_buffer_head = 0;
+    serialiser.data_buffer_size = mapping.size;
+
+    if (mapping.size >= MAP_HEADER_FIXED_SIZE && !memcmp(mapping.data, MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC))) {
+        serialiser.data_buffer_head = sizeof(MAP_FILE_MAGIC);
+        version = serialiser.deserialise_uint32();
+    }
+    else {
+        version = 1;
+    }
+
+    if (version == 0 || version > MAP_FILE_VERSION) {
+        LOG_ERRORV("Map file %s has version %d (latest supported is %d)\n", path, version, MAP_FILE_VERSION);
+        close();
+        return 0;
+    }
+
+    const uint8_t *name_end = (const uint8_t *)memchr(
+        mapping.data + serialiser.data_buffer_head,
+        0,
+        s_bytes_left(&serialiser));
+
+    // The view info and block count need to be there too
+    if (!name_end || (uint32_t)(mapping.data + mapping.size - name_end) < 1 + 3 * 12 + 4) {
+        LOG_ERRORV("Map file %s is corrupted\n", path);
+        close();
+        return 0;
+    }
+
+    name = (const char *)mapping.data + serialiser.data_buffer_head;
+    serialiser.data_buffer_head = (uint32_t)(name_end - mapping.data) + 1;
+
+    view_info.pos = serialiser.deserialise_vector3();
+    view_info.dir = serialiser.deserialise_vector3();
+    view_info.up = serialiser.deserialise_vector3();
+
+    block_count = serialiser.deserialise_uint32();
+
+    bool valid = 0;
+    if (block_count <= s_bytes_left(&serialiser)) {
+        blocks = flmalloc<map_block_entry_t>(MAX(block_count, 1u));
+
+        if (version == 1) {
+            valid = s_scan_version1_blocks(this, &serialiser);
+        }
+        else {
+            valid = s_read_directory(this, &serialiser);
+        }
+    }
+
+    if (!valid) {
+        LOG_ERRORV("Map file %s is corrupted\n", path);
+        close();
+        return 0;
+    }
+
+    if (version == MAP_FILE_VERSION) {
+        header_checksum = checksum_bytes(mapping.data, serialiser.data_buffer_head);
+        s_apply_journal(this, path);
+    }
+
+    return 1;
+}
+
+void map_file_t::close() {
+    if (blocks) {
+        flfree(blocks);
+    }
+
+    unmap_file(mapping);
+
+    if (journal.data) {
+        unmap_file(journal);
+    }
+
+    mapping.data = NULL;
+    mapping.size = 0;
+    journal.data = NULL;
+    journal.size = 0;
+    blocks = NULL;
+    block_count = 0;
+}
+
+bool map_file_t::read_block(uint32_t block_index, uint8_t *values, voxel_color_t *colors) const {
+    const map_block_entry_t *entry = &blocks[block_index];
+    const uint8_t *src = (entry->in_journal ? journal.data : mapping.data) + entry->offset;
+
+    if (version == 1) {
+        // The block was already checked when the file got opened
+        serialiser_t serialiser = {};
+        serialiser.data_buffer = (uint8_t *)src;
+        serialiser.data_buffer_head = 0;
+        serialiser.data_buffer_size = entry->size;
+
+        deserialise_voxels(&serialiser, values, colors, MAP_CHUNK_VOXEL_COUNT);
+
+        return 1;
+    }
+
+    if (checksum_bytes(src, entry->size) != entry->checksum) {
+        return 0;
+    }
+
+    // Chunks have their colors right after their values
+    if (colors == values + MAP_CHUNK_VOXEL_COUNT) {
+        return lz_decompress(src, entry->size, values, MAP_BLOCK_BYTE_SIZE);
+    }
+
+    uint8_t voxels[MAP_BLOCK_BYTE_SIZE];
+    if (!lz_decompress(src, entry->size, voxels, MAP_BLOCK_BYTE_SIZE)) {
+        return 0;
+    }
+
+    memcpy(values, voxels, MAP_CHUNK_VOXEL_COUNT);
+    memcpy(colors, voxels + MAP_CHUNK_VOXEL_COUNT, MAP_CHUNK_VOXEL_COUNT);
+
+    return 1;
+}
+
+void map_file_writer_t::init() {
+    blocks = NULL;
+    block_count = 0;
+    block_capacity = 0;
+
+    data = NULL;
+    data_size = 0;
+    data_capacity = 0;
+}
+
+void map_file_writer_t::destroy() {
+    if (blocks) {
+        flfree(blocks);
+    }
+
+    if (data) {
+        flfree(data);
+    }
+
+    init();
+}
+
+bool map_file_writer_t::add_block(const ivector3_t &block_coord, const uint8_t *values, const voxel_color_t *colors) {
+    bool empty = 1;
+    for (uint32_t v = 0; v < MAP_CHUNK_VOXEL_COUNT && empty; ++v) {
+        empty = (values[v] == 0);
+    }
+
+    if (empty) {
+        return 0;
+    }
+
+    uint8_t voxels[MAP_BLOCK_BYTE_SIZE];
+    memcpy(voxels, values, MAP_CHUNK_VOXEL_COUNT);
+    memcpy(voxels + MAP_CHUNK_VOXEL_COUNT, colors, MAP_CHUNK_VOXEL_COUNT);
+
+    s_reserve(&data, &data_capacity, data_size + lz_compress_bound(MAP_BLOCK_BYTE_SIZE));
+    s_reserve(&blocks, &block_capacity, block_count + 1);
+
+    uint8_t *compressed = data + data_size;
+    uint32_t compressed_size = lz_compress(voxels, MAP_BLOCK_BYTE_SIZE, compressed);
+
+    map_block_entry_t *entry = &blocks[block_count++];
+    entry->x = (int16_t)block_coord.x;
+    entry->y = (int16_t)block_coord.y;
+    entry->z = (int16_t)block_coord.z;
+    // Relative to the start of the blocks until the file gets written
+    entry->offset = data_size;
+    entry->size = compressed_size;
+    entry->checksum = checksum_bytes(compressed, compressed_size);
+    entry->in_journal = 0;
+
+    data_size += compressed_size;
+
+    return 1;
+}
+
+void map_file_writer_t::add_removed_block(const ivector3_t &block_coord) {
+    s_reserve(&blocks, &block_capacity, block_count + 1);
+
+    map_block_entry_t *entry = &blocks[block_count++];
+    entry->x = (int16_t)block_coord.x;
+    entry->y = (int16_t)block_coord.y;
+    entry->z = (int16_t)block_coord.z;
+    entry->offset = data_size;
+    entry->size = 0;
+    entry->checksum = 0;
+    entry->in_journal = 0;
+}
+
+void map_file_writer_t::add_chunk(
+    const ivector3_t &chunk_coord,
+    const uint8_t *chunk_values,
+    const voxel_color_t *chunk_colors,
+    bool journal) {
+    static constexpr int32_t BLOCKS_PER_EDGE = CHUNK_EDGE_LENGTH / MAP_CHUNK_EDGE_LENGTH;
+
+    uint8_t values[MAP_CHUNK_VOXEL_COUNT];
+    voxel_color_t colors[MAP_CHUNK_VOXEL_COUNT];
+
+    for (int32_t bz = 0; bz < BLOCKS_PER_EDGE; ++bz) {
+        for (int32_t by = 0; by < BLOCKS_PER_EDGE; ++by) {
+            for (int32_t bx = 0; bx < BLOCKS_PER_EDGE; ++bx) {
+                ivector3_t offset = ivector3_t(bx, by, bz) * MAP_CHUNK_EDGE_LENGTH;
+
+                copy_voxels_to_linear(
+                    chunk_values, chunk_colors,
+                    offset, MAP_CHUNK_EDGE_LENGTH,
+                    values, colors);
+
+                ivector3_t block_coord = chunk_coord * BLOCKS_PER_EDGE + ivector3_t(bx, by, bz);
+                if (!add_block(block_coord, values, colors) && journal) {
+                    add_removed_block(block_coord);
+                }
+            }
+        }
+    }
+}
+
+void map_file_writer_t::copy_block(const map_file_t &file, uint32_t block_index) {
+    const map_block_entry_t *src_entry = &file.blocks[block_index];
+
+    if (file.version == 1) {
+        uint8_t values[MAP_CHUNK_VOXEL_COUNT];
+        voxel_color_t colors[MAP_CHUNK_VOXEL_COUNT];
+
+        file.read_block(block_index, values, colors);
+        add_block(ivector3_t(src_entry->x, src_entry->y, src_entry->z), values, colors);
+
+        return;
+    }
+
+    s_reserve(&data, &data_capacity, data_size + src_entry->size);
+    s_reserve(&blocks, &block_capacity, block_count + 1);
+
+    const uint8_t *src = (src_entry->in_journal ? file.journal.data : file.mapping.data) + src_entry->offset;
+    memcpy(data + data_size, src, src_entry->size);
+
+    map_block_entry_t *entry = &blocks[block_count++];
+    *entry = *src_entry;
+    entry->offset = data_size;
+    entry->in_journal = 0;
+
+    data_size += src_entry->size;
+}
+
+uint32_t map_file_writer_t::get_journal_entry_size(const char *name) const {
+    return MAP_JOURNAL_ENTRY_FIXED_SIZE + (uint32_t)strlen(name) + block_count * MAP_JOURNAL_BLOCK_HEADER_SIZE + data_size;
+}
+
+uint32_t map_file_writer_t::write(const char *path, const char *name, const map_view_info_t &view_info) {
+    uint32_t header_size = MAP_HEADER_FIXED_SIZE + (uint32_t)strlen(name);
+    uint32_t blocks_offset = header_size + block_count * MAP_BLOCK_ENTRY_SIZE;
+    uint32_t file_size = blocks_offset + data_size;
+
+    serialiser_t serialiser = {};
+    serialiser.data_buffer = flmalloc<uint8_t>(file_size);
+    serialiser.data_buffer_head = 0;
+    serialiser.data_buffer_size = file_size;
+
+    for (uint32_t i = 0; i < sizeof(MAP_FILE_MAGIC); ++i) {
+        serialiser.serialise_uint8(MAP_FILE_MAGIC[i]);
+    }
+
+    serialiser.serialise_uint32(MAP_FILE_VERSION);
+    serialiser.serialise_string(name);
+    serialiser.serialise_vector3(view_info.pos);
+    serialiser.serialise_vector3(view_info.dir);
+    serialiser.serialise_vector3(view_info.up);
+    serialiser.serialise_uint32(block_count);
+
+    for (uint32_t i = 0; i < block_count; ++i) {
+        const map_block_entry_t *entry = &blocks[i];
+        serialiser.serialise_int16(entry->x);
+        serialiser.serialise_int16(entry->y);
+        serialiser.serialise_int16(entry->z);
+        serialiser.serialise_uint32(blocks_offset + entry->offset);
+        serialiser.serialise_uint32(entry->size);
+        serialiser.serialise_uint32(entry->checksum);
+    }
+
+    memcpy(serialiser.grow_data_buffer(data_size), data, data_size);
+
+    char full_path[100] = {};
+    snprintf(full_path, sizeof(full_path), "assets/maps/%s", path);
+
+    /*
+      The new file gets written next to the map and then replaces it, so a
+      save which doesn't finish (crash, full disk...) leaves the old map (and
+      its journal) as they were.
+    */
+    char temporary_path[110] = {};
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", full_path);
+    file_handle_t map_file = create_file(temporary_path, FLF_BINARY | FLF_WRITEABLE);
+
+    bool written =
+        does_file_exist(map_file) &&
+        write_file(map_file, serialiser.data_buffer, file_size) &&
+        flush_file(map_file);
+
+    free_file(map_file);
+    flfree(serialiser.data_buffer);
+
+    if (written && replace_file(temporary_path, full_path)) {
+        // The journal is in the file now (it wouldn't go with the new file anyway)
+        char journal_path[100] = {};
+        s_get_journal_path(path, journal_path, sizeof(journal_path));
+        delete_file(journal_path);
+    }
+    else {
+        LOG_ERRORV("Couldn't write map file %s\n", full_path);
+        delete_file(temporary_path);
+        file_size = 0;
+    }
+
+    return file_size;
+}
+
+uint32_t map_file_writer_t::append_to_journal(
+    const char *path,
+    const char *name,
+    const map_view_info_t &view_info,
+    const map_file_t &base) {
+    bool new_journal = (base.journal.data == NULL);
+
+    uint32_t entry_size = get_journal_entry_size(name);
+    uint32_t size = entry_size + (new_journal ? MAP_JOURNAL_HEADER_SIZE : 0);
+
+    serialiser_t serialiser = {};
+    serialiser.data_buffer = flmalloc<uint8_t>(size);
+    serialiser.data_buffer_head = 0;
+    serialiser.data_buffer_size = size;
+
+    if (new_journal) {
+        for (uint32_t i = 0; i < sizeof(MAP_JOURNAL_MAGIC); ++i) {
+            serialiser.serialise_uint8(MAP_JOURNAL_MAGIC[i]);
+        }
+
+        serialiser.serialise_uint32(base.mapping.size);
+        serialiser.serialise_uint32(base.header_checksum);
+    }
+
+    // Size and checksum get filled in at the end
+    uint32_t entry_start = serialiser.data_buffer_head;
+    serialiser.serialise_uint32(0);
+    serialiser.serialise_uint32(0);
+
+    serialiser.serialise_string(name);
+    serialiser.serialise_vector3(view_info.pos);
+    serialiser.serialise_vector3(view_info.dir);
+    serialiser.serialise_vector3(view_info.up);
+    serialiser.serialise_uint32(block_count);
+
+    for (uint32_t i = 0; i < block_count; ++i) {
+        const map_block_entry_t *entry = &blocks[i];
+        serialiser.serialise_int16(entry->x);
+        serialiser.serialise_int16(entry->y);
+        serialiser.serialise_int16(entry->z);
+        serialiser.serialise_uint32(entry->size);
+        serialiser.serialise_uint32(entry->checksum);
+
+        memcpy(serialiser.grow_data_buffer(entry->size), data + entry->offset, entry->size);
+    }
+
+    uint32_t entry_data_start = entry_start + 8;
+    uint32_t entry_checksum = checksum_bytes(serialiser.data_buffer + entry_data_start, size - entry_data_start);
+
+    serialiser.data_buffer_head = entry_start;
+    serialiser.serialise_uint32(size - entry_data_start);
+    serialiser.serialise_uint32(entry_checksum);
+
+    char journal_path[100] = {};
+    s_get_journal_path(path, journal_path, sizeof(journal_path));
+
+    // A journal which doesn't go with base gets replaced
+    file_handle_t journal_file = create_file(journal_path, FLF_BINARY | (new_journal ? FLF_WRITEABLE : FLF_APPEND));
+
+    // A partly written entry fails its checksum and gets ignored when the map is loaded
+    if (!does_file_exist(journal_file) ||
+        !write_file(journal_file, serialiser.data_buffer, size) ||
+        !flush_file(journal_file)) {
+        LOG_ERRORV("Couldn't write map journal %s\n", journal_path);
+        size = 0;
+    }
+
+    free_file(journal_file);
+    flfree(serialiser.data_buffer);
+
+    return size;
+}
+
+bool convert_map_file(const char *src_path, const char *dst_path) {
+    map_file_t src = {};
+    if (!src.open(src_path)) {
+        return 0;
+    }
+
+    map_file_writer_t writer;
+    writer.init();
+
+    bool valid = 1;
+
+    uint8_t values[MAP_CHUNK_VOXEL_COUNT];
+    voxel_color_t colors[MAP_CHUNK_VOXEL_COUNT];
+
+    for (uint32_t i = 0; i < src.block_count && valid; ++i) {
+        const map_block_entry_t *entry = &src.blocks[i];
+
+        valid = src.read_block(i, values, colors);
+        writer.add_block(ivector3_t(entry->x, entry->y, entry->z), values, colors);
+    }
+
+    // The source gets closed before writing, in case it is the same file
+    uint32_t name_length = (uint32_t)strlen(src.name);
+    char *name = flmalloc<char>(name_length + 1);
+    memcpy(name, src.name, name_length + 1);
+    map_view_info_t view_info = src.view_info;
+    uint32_t src_version = src.version;
+
+    src.close();
+
+    if (valid) {
+        uint32_t size = writer.write(dst_path, name, view_info);
+        valid = (size > 0);
+
+        LOG_INFOV("Converted map %s (version %d) to %s (version %d, %d blocks, %d bytes)\n",
+                  src_path, src_version, dst_path, MAP_FILE_VERSION, writer.block_count, size);
+    }
+    else {
+        LOG_ERRORV("Map file %s has a corrupted block\n", src_path);
+    }
+
+    flfree(name);
+    writer.destroy();
+
+    return valid;
+}
+
+}
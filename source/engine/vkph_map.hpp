@@ -1,10 +1,21 @@
 #pragma once
 
+#include "vkph_voxel.hpp"
+
 #include <stdint.h>
 #include <math.hpp>
+#include <files.hpp>
 
 namespace vkph {
 
+/*
+  Map files always store the voxels in blocks of 16x16x16, whatever
+  CHUNK_EDGE_LENGTH the game was compiled with (so that maps work with all
+  chunk sizes).
+ */
+constexpr int32_t MAP_CHUNK_EDGE_LENGTH = 16;
+constexpr uint32_t MAP_CHUNK_VOXEL_COUNT = MAP_CHUNK_EDGE_LENGTH * MAP_CHUNK_EDGE_LENGTH * MAP_CHUNK_EDGE_LENGTH;
+
 /*
   This is for instance, when in the game menu, there needs to be a place from
   which to view the entire map.
@@ -24,6 +35,144 @@ struct map_t {
     map_view_info_t view_info;
 };
 
+/*
+  Map file format (version 2), every number is little endian:
+
+  - Header: MAP_FILE_MAGIC, version (uint32_t), name (null terminated),
+    view info (3 vector3_t), block count (uint32_t).
+  - Directory: a map_block_entry_t per block (int16_t x, y, z, then uint32_t
+    offset, size, checksum), 18 bytes each, so that a block can be found
+    without reading the ones before it.
+  - Blocks: the 16x16x16 values followed by the 16x16x16 colors (linear
+    order), compressed with lz_compress(). Completely empty blocks aren't
+    in the file.
+
+  The file gets read through map_file() (mmap), so loading only copies the
+  blocks out of the page cache while decompressing them.
+
+  Version 1 files (the original format) have no header: the name, view info
+  and block count, then each block's coordinates followed by its voxels in
+  serialise_voxels() format. They can still be loaded, and save_map() always
+  writes version 2 (see also convert_map_file()).
+
+  Journal (path + ".journal", next to a version 2 map file):
+
+  - Header: MAP_JOURNAL_MAGIC, size of the map file (uint32_t), checksum of
+    the map file's header and directory (uint32_t). A journal which doesn't
+    go with the map file (the map file got rewritten) gets ignored.
+  - Then an entry per save, appended to the end: size and checksum_bytes()
+    of the rest of the entry (uint32_t each), name (null terminated), view
+    info, block count (uint32_t), then per block: int16_t x, y, z, size and
+    checksum (uint32_t each) followed by the compressed block. Blocks with
+    a size of 0 were emptied.
+
+  So saving only writes the blocks which changed. Opening the map file
+  replays the journal on top of its directory (later blocks replace earlier
+  ones), and an entry which didn't get completely written gets dropped as a
+  whole. save_map() rewrites the map file (compaction), which deletes the
+  journal, once the journal gets too big compared to the map file.
+ */
+constexpr uint8_t MAP_FILE_MAGIC[4] = { 0xFF, 'V', 'K', 'M' };
+constexpr uint32_t MAP_FILE_VERSION = 2;
+constexpr uint32_t MAP_BLOCK_ENTRY_SIZE = 18;
+constexpr uint8_t MAP_JOURNAL_MAGIC[4] = { 0xFF, 'V', 'K', 'J' };
+constexpr uint32_t MAP_JOURNAL_BLOCK_HEADER_SIZE = 14;
+// The journal gets compacted once it would get bigger than the map file divided by this
+constexpr uint32_t MAP_JOURNAL_COMPACTION_DIVISOR = 2;
+// Uncompressed size of a block
+constexpr uint32_t MAP_BLOCK_BYTE_SIZE = MAP_CHUNK_VOXEL_COUNT * 2;
+
+struct map_block_entry_t {
+    int16_t x, y, z;
+    // From the start of the file
+    uint32_t offset;
+    uint32_t size;
+    // checksum_bytes() of the compressed block (version 1 blocks don't have one)
+    uint32_t checksum;
+    // Not in the file: the block is in the journal (offset is from the start of the journal)
+    bool in_journal;
+};
+
+/*
+  Map file opened for reading (either version), with its directory (which
+  includes the changes in the journal).
+ */
+struct map_file_t {
+    file_mapping_t mapping;
+    uint32_t version;
+    // checksum_bytes() of the header and directory (version 2), which the journal refers to
+    uint32_t header_checksum;
+
+    // data is NULL if there is no journal (or it doesn't go with this map file)
+    file_mapping_t journal;
+    // Bytes of the journal which were valid (less than journal.size if the last save didn't finish)
+    uint32_t journal_valid_size;
+
+    // Points into the mapping (or into the journal if the name changed)
+    const char *name;
+    map_view_info_t view_info;
+
+    uint32_t block_count;
+    map_block_entry_t *blocks;
+
+    // Path relative to assets/maps. Returns 0 if the file doesn't exist or isn't a valid map file
+    bool open(const char *path);
+    void close();
+
+    /*
+      Decompresses a block into values and colors (MAP_CHUNK_VOXEL_COUNT each,
+      linear order). Returns 0 if the block is corrupted. Blocks can be read
+      from several threads at once.
+     */
+    bool read_block(uint32_t block_index, uint8_t *values, voxel_color_t *colors) const;
+};
+
+/*
+  Builds a version 2 map file block by block (the blocks get compressed as
+  they get added), and writes it in one go.
+ */
+struct map_file_writer_t {
+    map_block_entry_t *blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+
+    // Compressed blocks
+    uint8_t *data;
+    uint32_t data_size;
+    uint32_t data_capacity;
+
+    void init();
+    void destroy();
+
+    // Returns 0 (and doesn't add the block) if all the voxels are empty
+    bool add_block(const ivector3_t &block_coord, const uint8_t *values, const voxel_color_t *colors);
+    // The block was emptied (only for journals)
+    void add_removed_block(const ivector3_t &block_coord);
+    // Splits the voxels of a chunk (in VOXEL_LAYOUT order) into blocks. For journals, empty blocks get added as removed
+    void add_chunk(const ivector3_t &chunk_coord, const uint8_t *values, const voxel_color_t *colors, bool journal);
+    // Copies a block of another map file (without decompressing it, unless it is a version 1 file)
+    void copy_block(const map_file_t &file, uint32_t block_index);
+
+    // Bytes append_to_journal() would write (without the journal's header)
+    uint32_t get_journal_entry_size(const char *name) const;
+
+    // Path relative to assets/maps. Deletes the map's journal. Returns the size of the file
+    uint32_t write(const char *path, const char *name, const map_view_info_t &view_info);
+    /*
+      Appends the blocks as an entry to the journal of base (opened from path),
+      starting a new journal if base doesn't have one. Returns the amount of
+      bytes written (0 if the journal couldn't be written).
+     */
+    uint32_t append_to_journal(const char *path, const char *name, const map_view_info_t &view_info, const map_file_t &base);
+};
+
+/*
+  Rewrites a map file (of any version, with its journal) to the current
+  version. Returns 0 if src_path isn't a valid map file. Converting a map
+  file to itself compacts it.
+ */
+bool convert_map_file(const char *src_path, const char *dst_path);
+
 #define MAX_MAP_COUNT 10
 
 // At the beginning of the game, the maps file gets loaded,
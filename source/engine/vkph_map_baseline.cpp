@@ -0,0 +1,110 @@
+#include "vkph_map_baseline.hpp"
+
+#include <string.h>
+#include <allocators.hpp>
+
+namespace vkph {
+
+void map_baseline_t::init(bool track) {
+    index.init(256);
+
+    block_count = 0;
+    max_block_count = 0;
+    blocks = NULL;
+    owned = NULL;
+
+    track_changes = track;
+
+    changed_count = 0;
+    max_changed_count = 0;
+    changed_chunks = NULL;
+}
+
+void map_baseline_t::destroy() {
+    for (uint32_t i = 0; i < block_count; ++i) {
+        if (owned[i]) {
+            flfree((uint8_t *)blocks[i]);
+        }
+    }
+
+    if (blocks) {
+        flfree(blocks);
+        flfree(owned);
+    }
+
+    if (changed_chunks) {
+        flfree(changed_chunks);
+    }
+
+    index.destroy();
+}
+
+template <typename T>
+static void s_grow(T **array, uint32_t count, uint32_t new_max_count) {
+    T *new_array = flmalloc<T>(new_max_count);
+
+    if (*array) {
+        memcpy(new_array, *array, sizeof(T) * count);
+        flfree(*array);
+    }
+
+    *array = new_array;
+}
+
+void map_baseline_t::set_chunk(const chunk_t *chunk) {
+    uint32_t *block_index = index.get(chunk->chunk_coord);
+    uint32_t i;
+
+    if (block_index) {
+        i = *block_index;
+    }
+    else {
+        if (block_count == max_block_count) {
+            uint32_t new_max_count = MAX(max_block_count * 2, 64u);
+            s_grow(&blocks, block_count, new_max_count);
+            s_grow(&owned, block_count, new_max_count);
+            max_block_count = new_max_count;
+        }
+
+        i = block_count++;
+        index.insert(chunk->chunk_coord, i);
+
+        blocks[i] = NULL;
+        owned[i] = 0;
+    }
+
+    if (chunk->flags.uniform) {
+        if (owned[i]) {
+            flfree((uint8_t *)blocks[i]);
+        }
+
+        // Shared blocks never get freed
+        blocks[i] = chunk->values;
+        owned[i] = 0;
+    }
+    else {
+        if (!owned[i]) {
+            blocks[i] = flmalloc<uint8_t>(CHUNK_BYTE_SIZE);
+            owned[i] = 1;
+        }
+
+        memcpy((uint8_t *)blocks[i], chunk->values, CHUNK_BYTE_SIZE);
+    }
+}
+
+const uint8_t *map_baseline_t::get_voxels(const ivector3_t &chunk_coord) const {
+    const uint32_t *block_index = index.get(chunk_coord);
+    return block_index ? blocks[*block_index] : NULL;
+}
+
+void map_baseline_t::add_changed_chunk(const ivector3_t &chunk_coord) {
+    if (changed_count == max_changed_count) {
+        uint32_t new_max_count = MAX(max_changed_count * 2, 64u);
+        s_grow(&changed_chunks, changed_count, new_max_count);
+        max_changed_count = new_max_count;
+    }
+
+    changed_chunks[changed_count++] = chunk_coord;
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vkph_chunk.hpp"
+#include "vkph_chunk_index.hpp"
+
+namespace vkph {
+
+/*
+  Voxels of the chunks as they were at the start of the match (see
+  state_t::capture_baseline()), so that the match can get reset by copying
+  back the chunks which changed, instead of loading the whole map again.
+
+  Chunks which were uniform share the uniform block (nothing gets copied),
+  and chunks which aren't in the baseline were air.
+ */
+
+struct map_baseline_t {
+    // Chunk coordinate -> index in blocks
+    chunk_index_t index;
+
+    uint32_t block_count;
+    uint32_t max_block_count;
+    const uint8_t **blocks;
+    // Uniform blocks aren't owned by the baseline
+    bool *owned;
+
+    // Only the server needs to know which chunks changed (clients get told which chunks to revert)
+    bool track_changes;
+
+    // Chunks which changed since the baseline got captured, in the order in which they first changed
+    uint32_t changed_count;
+    uint32_t max_changed_count;
+    ivector3_t *changed_chunks;
+
+    void init(bool track_changes);
+    void destroy();
+
+    // Copies the voxels of the chunk (replaces the ones which were there for this chunk)
+    void set_chunk(const chunk_t *chunk);
+    // NULL if the chunk was air
+    const uint8_t *get_voxels(const ivector3_t &chunk_coord) const;
+
+    void add_changed_chunk(const ivector3_t &chunk_coord);
+};
+
+}
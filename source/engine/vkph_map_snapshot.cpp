@@ -0,0 +1,281 @@
+#include "vkph_map_snapshot.hpp"
+#include "vkph_chunk.hpp"
+#include "vkph_chunk_index.hpp"
+
+#include <log.hpp>
+#include <mutex>
+#include <thread>
+#include <string.h>
+#include <allocators.hpp>
+
+namespace vkph {
+
+static constexpr uint32_t MAX_LIVE_SNAPSHOT_COUNT = 8;
+
+// Snapshots which chunks can retire their blocks to
+static struct {
+    std::mutex mutex;
+    uint32_t next_epoch = 1;
+    uint32_t count = 0;
+    map_snapshot_t *snapshots[MAX_LIVE_SNAPSHOT_COUNT];
+} s_live_snapshots;
+
+struct map_snapshot_shared_t {
+    std::thread writer;
+
+    std::mutex mutex;
+    bool written;
+
+    // Blocks which chunks stopped using while the snapshot was alive
+    uint32_t retired_count;
+    uint32_t retired_capacity;
+    const uint8_t **retired_blocks;
+};
+
+static char *s_copy_string(const char *string) {
+    uint32_t length = (uint32_t)strlen(string);
+    char *copy = flmalloc<char>(length + 1);
+    memcpy(copy, string, length + 1);
+
+    return copy;
+}
+
+void map_snapshot_t::init(const map_t *map, bool only_changes, uint32_t max_count, bool copy_on_write) {
+    changes = only_changes;
+
+    chunk_count = 0;
+    max_chunk_count = max_count;
+    chunks = flmalloc<map_snapshot_chunk_t>(MAX(max_chunk_count, 1u));
+
+    path = s_copy_string(map->path);
+    name = s_copy_string(map->name);
+    view_info = map->view_info;
+
+    byte_size = 0;
+    failed = 0;
+
+    shared = new map_snapshot_shared_t;
+    shared->written = 0;
+    shared->retired_count = 0;
+    shared->retired_capacity = 0;
+    shared->retired_blocks = NULL;
+
+    epoch = 0;
+
+    if (copy_on_write) {
+        std::lock_guard<std::mutex> lock (s_live_snapshots.mutex);
+
+        if (s_live_snapshots.count < MAX_LIVE_SNAPSHOT_COUNT) {
+            epoch = s_live_snapshots.next_epoch++;
+            s_live_snapshots.snapshots[s_live_snapshots.count++] = this;
+        }
+        else {
+            LOG_ERROR("Too many map snapshots are getting written at once\n");
+        }
+    }
+}
+
+void map_snapshot_t::destroy() {
+    wait();
+
+    if (epoch) {
+        // After this, chunks free their blocks themselves
+        std::lock_guard<std::mutex> lock (s_live_snapshots.mutex);
+
+        for (uint32_t i = 0; i < s_live_snapshots.count; ++i) {
+            if (s_live_snapshots.snapshots[i] == this) {
+                s_live_snapshots.snapshots[i] = s_live_snapshots.snapshots[--s_live_snapshots.count];
+                break;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < shared->retired_count; ++i) {
+        flfree((uint8_t *)shared->retired_blocks[i]);
+    }
+
+    if (shared->retired_blocks) {
+        flfree(shared->retired_blocks);
+    }
+
+    delete shared;
+    shared = NULL;
+
+    flfree(chunks);
+    flfree(path);
+    flfree(name);
+}
+
+void map_snapshot_t::add_chunk(chunk_t *chunk) {
+    map_snapshot_chunk_t *snapshot_chunk = &chunks[chunk_count++];
+    snapshot_chunk->chunk_coord = chunk->chunk_coord;
+    snapshot_chunk->voxels = chunk->values;
+
+    // Uniform blocks are shared and never get freed
+    if (epoch && !chunk->flags.uniform) {
+        chunk->snapshot_epoch = epoch;
+    }
+}
+
+bool retire_snapshot_block(uint32_t epoch, const uint8_t *block) {
+    std::lock_guard<std::mutex> lock (s_live_snapshots.mutex);
+
+    for (uint32_t i = 0; i < s_live_snapshots.count; ++i) {
+        map_snapshot_shared_t *shared = s_live_snapshots.snapshots[i]->shared;
+
+        if (s_live_snapshots.snapshots[i]->epoch == epoch) {
+            if (shared->retired_count == shared->retired_capacity) {
+                uint32_t new_capacity = MAX(shared->retired_capacity * 2, 16u);
+                const uint8_t **new_blocks = flmalloc<const uint8_t *>(new_capacity);
+
+                if (shared->retired_blocks) {
+                    memcpy(new_blocks, shared->retired_blocks, sizeof(const uint8_t *) * shared->retired_count);
+                    flfree(shared->retired_blocks);
+                }
+
+                shared->retired_blocks = new_blocks;
+                shared->retired_capacity = new_capacity;
+            }
+
+            shared->retired_blocks[shared->retired_count++] = block;
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void s_add_chunks(map_file_writer_t *writer, const map_snapshot_t *snapshot, bool journal) {
+    for (uint32_t i = 0; i < snapshot->chunk_count; ++i) {
+        const map_snapshot_chunk_t *chunk = &snapshot->chunks[i];
+
+        writer->add_chunk(
+            chunk->chunk_coord,
+            chunk->voxels,
+            (const voxel_color_t *)(chunk->voxels + CHUNK_VOXEL_COUNT),
+            journal);
+    }
+}
+
+// Appends the chunks to the journal of base. Returns 0 if the map file needs to get rewritten instead
+static bool s_write_changes_to_journal(map_snapshot_t *snapshot, const map_file_t &base) {
+    // Version 1 files can't have a journal, and new entries can't go after a save which didn't finish
+    if (base.version != MAP_FILE_VERSION || base.journal_valid_size != base.journal.size) {
+        return 0;
+    }
+
+    map_file_writer_t writer;
+    writer.init();
+
+    s_add_chunks(&writer, snapshot, 1);
+
+    bool unchanged =
+        snapshot->chunk_count == 0 &&
+        !strcmp(snapshot->name, base.name) &&
+        !memcmp(&snapshot->view_info, &base.view_info, sizeof(map_view_info_t));
+
+    // Past this, loading would spend too much time on blocks which got replaced
+    uint32_t journal_size = base.journal.size + writer.get_journal_entry_size(snapshot->name);
+    bool can_append = journal_size <= base.mapping.size / MAP_JOURNAL_COMPACTION_DIVISOR;
+
+    if (can_append && unchanged) {
+        LOG_INFO("Map hasn't changed since it was saved\n");
+    }
+    else if (can_append) {
+        snapshot->byte_size = writer.append_to_journal(snapshot->path, snapshot->name, snapshot->view_info, base);
+        snapshot->failed = (snapshot->byte_size == 0);
+
+        LOG_INFOV("Saved map changes (%d chunks, %d blocks) - byte size: %d\n",
+                  snapshot->chunk_count, writer.block_count, snapshot->byte_size);
+    }
+
+    writer.destroy();
+
+    return can_append;
+}
+
+// Rewrites the map file with the chunks of the snapshot replacing the blocks they contain
+static void s_merge_changes(map_snapshot_t *snapshot, map_file_writer_t *writer, const map_file_t &base) {
+    chunk_index_t changed_chunks;
+    changed_chunks.init(snapshot->chunk_count * 2);
+
+    for (uint32_t i = 0; i < snapshot->chunk_count; ++i) {
+        changed_chunks.insert(snapshot->chunks[i].chunk_coord, i);
+    }
+
+    s_add_chunks(writer, snapshot, 0);
+
+    for (uint32_t i = 0; i < base.block_count; ++i) {
+        const map_block_entry_t *entry = &base.blocks[i];
+        ivector3_t vs_block_origin = ivector3_t(entry->x, entry->y, entry->z) * MAP_CHUNK_EDGE_LENGTH;
+
+        if (!changed_chunks.get(space_voxel_to_chunk(vs_block_origin))) {
+            writer->copy_block(base, i);
+        }
+    }
+
+    changed_chunks.destroy();
+}
+
+bool map_snapshot_t::write() {
+    map_file_writer_t writer;
+    writer.init();
+
+    if (changes) {
+        map_file_t base = {};
+        if (!base.open(path)) {
+            // The snapshot doesn't have the chunks which didn't change
+            LOG_ERRORV("Couldn't save changes to map %s: the map file can't be opened\n", path);
+            failed = 1;
+            return 0;
+        }
+
+        if (s_write_changes_to_journal(this, base)) {
+            base.close();
+            writer.destroy();
+
+            return !failed;
+        }
+
+        // The blocks need to get copied before the file gets overwritten
+        s_merge_changes(this, &writer, base);
+        base.close();
+    }
+    else {
+        s_add_chunks(&writer, this, 0);
+    }
+
+    byte_size = writer.write(path, name, view_info);
+    failed = (byte_size == 0);
+
+    LOG_INFOV("Saved map (%d blocks) - byte size: %d\n", writer.block_count, byte_size);
+
+    writer.destroy();
+
+    return !failed;
+}
+
+static void s_write_in_background(map_snapshot_t *snapshot) {
+    snapshot->write();
+
+    std::lock_guard<std::mutex> lock (snapshot->shared->mutex);
+    snapshot->shared->written = 1;
+}
+
+void map_snapshot_t::start_writing_in_background() {
+    shared->writer = std::thread(s_write_in_background, this);
+}
+
+void map_snapshot_t::wait() {
+    if (shared->writer.joinable()) {
+        shared->writer.join();
+    }
+}
+
+bool map_snapshot_t::is_written() {
+    std::lock_guard<std::mutex> lock (shared->mutex);
+    return shared->written;
+}
+
+}
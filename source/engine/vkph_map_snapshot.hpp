@@ -0,0 +1,78 @@
+#pragma once
+
+#include "vkph_map.hpp"
+
+namespace vkph {
+
+struct chunk_t;
+
+/*
+  Copy-on-write snapshot of the chunks, which gets written to a map file
+  (or its journal) while the game keeps modifying the chunks. See
+  state_t::save_map_in_background().
+
+  Freezing only records pointers to the voxel blocks of the chunks which
+  need to get written, and tags these chunks with the snapshot's epoch.
+  The first write to a tagged chunk (chunk_t::make_dense()) gives the chunk
+  a copy of its voxels, and the original block gets retired to the
+  snapshot, which frees it once it has been written. So the voxels of a
+  chunk only get copied if it gets modified while the snapshot is alive.
+  Epochs never get reused: once a snapshot is destroyed, the chunks which
+  are still tagged with its epoch don't need to get untagged.
+ */
+
+struct map_snapshot_chunk_t {
+    ivector3_t chunk_coord;
+    // Values followed by colors (CHUNK_BYTE_SIZE)
+    const uint8_t *voxels;
+};
+
+struct map_snapshot_t {
+    // 0 if the chunks don't get tagged (the snapshot gets written before the chunks can change)
+    uint32_t epoch;
+
+    /*
+      Only the chunks which changed since the map file was written. These
+      get appended to the journal, or merged with the map file if the
+      journal needs to get compacted.
+     */
+    bool changes;
+
+    uint32_t chunk_count;
+    uint32_t max_chunk_count;
+    map_snapshot_chunk_t *chunks;
+
+    // Copies
+    char *path;
+    char *name;
+    map_view_info_t view_info;
+
+    // Bytes which got written
+    uint32_t byte_size;
+    bool failed;
+
+    struct map_snapshot_shared_t *shared;
+
+    // If copy_on_write is 0, the chunks mustn't change until the snapshot gets destroyed
+    void init(const map_t *map, bool changes, uint32_t max_chunk_count, bool copy_on_write);
+    // Waits for the background thread (if there is one)
+    void destroy();
+
+    void add_chunk(chunk_t *chunk);
+
+    // Returns 0 if it failed (the map file doesn't have the chunks then)
+    bool write();
+    void start_writing_in_background();
+    bool is_written();
+    // The results (byte_size, failed) can only be read once the background write finished
+    void wait();
+};
+
+/*
+  Called when a chunk frees or replaces a voxel block tagged with epoch.
+  Returns 0 if the snapshot doesn't exist anymore (the block can get freed
+  straight away).
+ */
+bool retire_snapshot_block(uint32_t epoch, const uint8_t *block);
+
+}
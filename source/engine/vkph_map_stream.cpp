@@ -0,0 +1,195 @@
+#include "vkph_map_stream.hpp"
+
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <condition_variable>
+
+#include <tools.hpp>
+#include <allocators.hpp>
+
+namespace vkph {
+
+struct map_stream_shared_t {
+    std::thread loader;
+
+    std::mutex mutex;
+    // The loader waits on this for free slots, the publishing thread for decoded blocks
+    std::condition_variable changed;
+
+    // Only gets changed by the loader
+    uint32_t decoded_count;
+    // Copy of published_count for the loader
+    uint32_t released_count;
+    bool quit;
+};
+
+static void s_loader(map_stream_t *stream) {
+    map_stream_shared_t *shared = stream->shared;
+    uint32_t block_count = stream->file.block_count;
+
+    for (uint32_t next = 0; next < block_count;) {
+        uint32_t batch_size;
+
+        { // Wait for free slots
+            std::unique_lock<std::mutex> lock (shared->mutex);
+            shared->changed.wait(lock, [shared] {
+                return shared->quit || shared->decoded_count - shared->released_count < MAP_STREAM_SLOT_COUNT;
+            });
+
+            if (shared->quit) {
+                return;
+            }
+
+            uint32_t free_count = MAP_STREAM_SLOT_COUNT - (shared->decoded_count - shared->released_count);
+            batch_size = MIN(MIN(free_count, MAP_STREAM_BATCH_SIZE), block_count - next);
+        }
+
+        // Only the loader changes decoded_count, and the publishing thread doesn't touch these slots
+        uint32_t first_slot = shared->decoded_count;
+
+        get_worker_pool()->run(batch_size, [stream, first_slot, next] (uint32_t job_index) {
+            map_stream_block_t *block = &stream->slots[(first_slot + job_index) % MAP_STREAM_SLOT_COUNT];
+            block->block_index = stream->block_order[next + job_index];
+            block->valid = stream->file.read_block(
+                block->block_index,
+                block->voxels,
+                block->voxels + MAP_CHUNK_VOXEL_COUNT);
+        });
+
+        {
+            std::unique_lock<std::mutex> lock (shared->mutex);
+            shared->decoded_count += batch_size;
+        }
+
+        shared->changed.notify_all();
+
+        next += batch_size;
+    }
+}
+
+static ivector3_t s_get_block_chunk_coord(const map_block_entry_t *entry) {
+    return space_voxel_to_chunk(ivector3_t(entry->x, entry->y, entry->z) * MAP_CHUNK_EDGE_LENGTH);
+}
+
+bool map_stream_t::init(const char *path, const vector3_t *ws_focus) {
+    file = {};
+    if (!file.open(path)) {
+        return 0;
+    }
+
+    focus = ws_focus ? *ws_focus : file.view_info.pos;
+
+    // Squared distances from the focus to the centers of the blocks
+    float *distances = flmalloc<float>(MAX(file.block_count, 1u));
+    block_order = flmalloc<uint32_t>(MAX(file.block_count, 1u));
+    block_distances = flmalloc<float>(MAX(file.block_count, 1u));
+
+    pending_chunks.init(file.block_count);
+
+    for (uint32_t i = 0; i < file.block_count; ++i) {
+        const map_block_entry_t *entry = &file.blocks[i];
+        vector3_t center = vector3_t(entry->x, entry->y, entry->z) * (float)MAP_CHUNK_EDGE_LENGTH + vector3_t(MAP_CHUNK_EDGE_LENGTH / 2);
+        vector3_t diff = center - focus;
+
+        distances[i] = glm::dot(diff, diff);
+        block_order[i] = i;
+
+        ivector3_t chunk_coord = s_get_block_chunk_coord(entry);
+        uint32_t *pending_count = pending_chunks.get(chunk_coord);
+        if (pending_count) {
+            ++(*pending_count);
+        }
+        else {
+            pending_chunks.insert(chunk_coord, 1);
+        }
+    }
+
+    // Blocks at the same distance stay in file order, so that the order is always the same
+    std::stable_sort(block_order, block_order + file.block_count, [distances] (uint32_t a, uint32_t b) {
+        return distances[a] < distances[b];
+    });
+
+    for (uint32_t i = 0; i < file.block_count; ++i) {
+        block_distances[i] = distances[block_order[i]];
+    }
+
+    flfree(distances);
+
+    slots = flmalloc<map_stream_block_t>(MAP_STREAM_SLOT_COUNT);
+    published_count = 0;
+
+    shared = new map_stream_shared_t;
+    shared->decoded_count = 0;
+    shared->released_count = 0;
+    shared->quit = 0;
+    shared->loader = std::thread(s_loader, this);
+
+    return 1;
+}
+
+void map_stream_t::destroy() {
+    {
+        std::unique_lock<std::mutex> lock (shared->mutex);
+        shared->quit = 1;
+    }
+
+    shared->changed.notify_all();
+    shared->loader.join();
+
+    delete shared;
+    shared = NULL;
+
+    flfree(slots);
+    flfree(block_order);
+    flfree(block_distances);
+    pending_chunks.destroy();
+    file.close();
+}
+
+uint32_t map_stream_t::ready_block_count() {
+    std::unique_lock<std::mutex> lock (shared->mutex);
+    return shared->decoded_count - published_count;
+}
+
+const map_stream_block_t *map_stream_t::get_ready_block(uint32_t i) const {
+    return &slots[(published_count + i) % MAP_STREAM_SLOT_COUNT];
+}
+
+void map_stream_t::release_ready_blocks(uint32_t count) {
+    published_count += count;
+
+    {
+        std::unique_lock<std::mutex> lock (shared->mutex);
+        shared->released_count = published_count;
+    }
+
+    shared->changed.notify_all();
+}
+
+void map_stream_t::wait_for_ready_block() {
+    std::unique_lock<std::mutex> lock (shared->mutex);
+    shared->changed.wait(lock, [this] {
+        return shared->decoded_count > published_count || published_count == file.block_count;
+    });
+}
+
+uint32_t map_stream_t::get_block_count_around(const vector3_t &ws_center, float radius) const {
+    // A block can touch the sphere if its center is within radius + half its diagonal of the sphere's center
+    float half_diagonal = (float)MAP_CHUNK_EDGE_LENGTH * 0.5f * sqrtf(3.0f);
+    float max_distance = glm::length(ws_center - focus) + radius + half_diagonal;
+
+    // The blocks get published in order of distance to the focus
+    return (uint32_t)(std::upper_bound(block_distances, block_distances + file.block_count, max_distance * max_distance) - block_distances);
+}
+
+void map_stream_t::remove_pending_block(const map_block_entry_t *entry) {
+    ivector3_t chunk_coord = s_get_block_chunk_coord(entry);
+    uint32_t *pending_count = pending_chunks.get(chunk_coord);
+
+    if (pending_count && --(*pending_count) == 0) {
+        pending_chunks.remove(chunk_coord);
+    }
+}
+
+}
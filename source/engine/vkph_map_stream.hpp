@@ -0,0 +1,85 @@
+#pragma once
+
+#include "vkph_map.hpp"
+#include "vkph_chunk_index.hpp"
+
+#include <worker_pool.hpp>
+
+namespace vkph {
+
+/*
+  Loads a map in the background: a loader thread decompresses the blocks
+  (on the worker pool), closest to a focus point first, and the thread which
+  owns the state_t publishes them (creates the chunks) in batches, at tick
+  boundaries. See state_t::stream_map().
+ */
+
+// Decoded blocks which can wait to get published (1 MB)
+constexpr uint32_t MAP_STREAM_SLOT_COUNT = 128;
+// How many blocks get decoded in one batch on the worker pool
+constexpr uint32_t MAP_STREAM_BATCH_SIZE = 32;
+// How many blocks state_t::timestep_begin() publishes every tick
+constexpr uint32_t MAP_STREAM_BLOCKS_PER_TICK = 128;
+
+struct map_stream_block_t {
+    uint32_t block_index;
+    // 0 if the block was corrupted
+    bool valid;
+    // Values followed by colors (linear order)
+    uint8_t voxels[MAP_BLOCK_BYTE_SIZE];
+};
+
+struct map_stream_t {
+    map_file_t file;
+
+    vector3_t focus;
+    // Indices of the blocks in the order they get decoded in (closest to the focus first)
+    uint32_t *block_order;
+    // Squared distances from the focus to the centers of the blocks (same order)
+    float *block_distances;
+    // Amount of blocks which haven't been published yet, for each chunk which has some
+    chunk_index_t pending_chunks;
+
+    // Ring buffer of decoded blocks
+    map_stream_block_t *slots;
+
+    // Only gets changed by the thread which publishes the blocks
+    uint32_t published_count;
+
+    job_progress_proc_t progress;
+    void *progress_data;
+
+    struct map_stream_shared_t *shared;
+
+    /*
+      The focus is the map's view position if ws_focus is NULL. Returns 0 if
+      the map file couldn't be opened (the loader doesn't get started then).
+     */
+    bool init(const char *path, const vector3_t *ws_focus);
+    // Stops the loader (whether all the blocks got published or not)
+    void destroy();
+
+    // Blocks which got decoded, and haven't been published yet (in order)
+    uint32_t ready_block_count();
+    const map_stream_block_t *get_ready_block(uint32_t i) const;
+    // Frees the slots of the first count ready blocks for the loader
+    void release_ready_blocks(uint32_t count);
+
+    // Blocks until there is at least one ready block (unless they all got published already)
+    void wait_for_ready_block();
+
+    // Which blocks have to be published for all the ones within radius of ws_center to be
+    uint32_t get_block_count_around(const vector3_t &ws_center, float radius) const;
+    // Call it for each published block
+    void remove_pending_block(const map_block_entry_t *entry);
+
+    inline bool is_chunk_pending(const ivector3_t &chunk_coord) const {
+        return pending_chunks.get(chunk_coord) != NULL;
+    }
+
+    inline bool is_finished() const {
+        return published_count == file.block_count;
+    }
+};
+
+}
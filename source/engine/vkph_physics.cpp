@@ -3,8 +3,13 @@
 #include "vkph_chunk.hpp"
 #include "vkph_player.hpp"
 #include "vkph_physics.hpp"
-#include "vkph_triangle_table.hpp"
+#include "vkph_collision_mesh.hpp"
+#include "vkph_sphere_sweep.hpp"
 
+#include <time.hpp>
+#include <float.h>
+#include <string.h>
+#include <worker_pool.hpp>
 #include <glm/gtx/projection.hpp>
 
 namespace vkph {
@@ -167,149 +172,14 @@ void resolve_player_movement(
 
 enum collision_primitive_type_t { CPT_FACE, CPT_EDGE, CPT_VERTEX };
 
-struct collision_triangle_t {
-    union {
-        struct {
-            vector3_t a;
-            vector3_t b;
-            vector3_t c;
-        } v;
-        vector3_t vertices[3];
-    };
-};
-
-static uint8_t s_chunk_edge_voxel_value(
-    int32_t x,
-    int32_t y,
-    int32_t z,
-    bool *doesnt_exist,
-    ivector3_t chunk_coord,
-    const state_t *state) {
-    int32_t chunk_coord_offset_x = 0, chunk_coord_offset_y = 0, chunk_coord_offset_z = 0;
-    int32_t final_x = x, final_y = y, final_z = z;
-
-    if (x == CHUNK_EDGE_LENGTH) {
-        final_x = 0;
-        chunk_coord_offset_x = 1;
-    }
-    if (y == CHUNK_EDGE_LENGTH) {
-        final_y = 0;
-        chunk_coord_offset_y = 1;
-    }
-    if (z == CHUNK_EDGE_LENGTH) {
-        final_z = 0;
-        chunk_coord_offset_z = 1;
-    }
+static bool s_culling = 1;
 
-    const chunk_t *chunk_ptr = state->access_chunk(
-        ivector3_t(chunk_coord.x + chunk_coord_offset_x,
-                   chunk_coord.y + chunk_coord_offset_y,
-                   chunk_coord.z + chunk_coord_offset_z));
-    
-    *doesnt_exist = (bool)(chunk_ptr == nullptr);
-    if (*doesnt_exist) {
-        return 0;
-    }
-    
-    return chunk_ptr->voxels[get_voxel_index(final_x, final_y, final_z)].value;
+void set_swept_sphere_culling(bool enabled) {
+    s_culling = enabled;
 }
 
-static const vector3_t NORMALIZED_CUBE_VERTICES[8] = {
-    vector3_t(-0.5f, -0.5f, -0.5f),
-    vector3_t(+0.5f, -0.5f, -0.5f),
-    vector3_t(+0.5f, -0.5f, +0.5f),
-    vector3_t(-0.5f, -0.5f, +0.5f),
-    vector3_t(-0.5f, +0.5f, -0.5f),
-    vector3_t(+0.5f, +0.5f, -0.5f),
-    vector3_t(+0.5f, +0.5f, +0.5f),
-    vector3_t(-0.5f, +0.5f, +0.5f) };
-
-static void s_push_collision_vertex(
-    uint8_t v0,
-    uint8_t v1,
-    vector3_t *vertices,
-    uint8_t *voxel_values,
-    uint8_t surface_level,
-    collision_triangle_t *dst_triangle,
-    uint32_t vertex_index) {
-    float surface_level_f = (float)surface_level;
-    float voxel_value0 = (float)voxel_values[v0];
-    float voxel_value1 = (float)voxel_values[v1];
-
-    if (voxel_value0 > voxel_value1) {
-        float tmp = voxel_value0;
-        voxel_value0 = voxel_value1;
-        voxel_value1 = tmp;
-
-        uint8_t tmp_v = v0;
-        v0 = v1;
-        v1 = tmp_v;
-    }
-
-    float interpolated_voxel_values = lerp(voxel_value0, voxel_value1, surface_level_f);
-
-    vector3_t vertex = interpolate(vertices[v0], vertices[v1], interpolated_voxel_values);
-
-    dst_triangle->vertices[vertex_index] = vertex;
-}
-
-static void s_push_collision_triangles_vertices(
-    uint8_t *voxel_values,
-    int32_t x,
-    int32_t y,
-    int32_t z,
-    uint8_t surface_level,
-    collision_triangle_t *dst_array,
-    uint32_t *count,
-    uint32_t max) {
-    uint8_t bit_combination = 0;
-    for (uint32_t i = 0; i < 8; ++i) {
-        bool is_over_surface = (voxel_values[i] > surface_level);
-        bit_combination |= is_over_surface << i;
-    }
-
-    const int8_t *triangle_entry = &TRIANGLE_TABLE[bit_combination][0];
-
-    uint32_t edge = 0;
-
-    int8_t edge_pair[3] = {};
-
-    while (triangle_entry[edge] != -1) {
-        if (*count + 3 >= max) {
-            break;
-        }
-
-        int8_t edge_index = triangle_entry[edge];
-        edge_pair[edge % 3] = edge_index;
-
-        if (edge % 3 == 2) {
-            vector3_t vertices[8] = {};
-            for (uint32_t i = 0; i < 8; ++i) {
-                vertices[i] = NORMALIZED_CUBE_VERTICES[i] + vector3_t(0.5f) + vector3_t((float)x, (float)y, (float)z);
-            }
-
-            for (uint32_t i = 0; i < 3; ++i) {
-                switch (edge_pair[i]) {
-                case 0: { s_push_collision_vertex(0, 1, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 1: { s_push_collision_vertex(1, 2, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 2: { s_push_collision_vertex(2, 3, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 3: { s_push_collision_vertex(3, 0, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 4: { s_push_collision_vertex(4, 5, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 5: { s_push_collision_vertex(5, 6, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 6: { s_push_collision_vertex(6, 7, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 7: { s_push_collision_vertex(7, 4, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 8: { s_push_collision_vertex(0, 4, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 9: { s_push_collision_vertex(1, 5, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 10: { s_push_collision_vertex(2, 6, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                case 11: { s_push_collision_vertex(3, 7, vertices, voxel_values, surface_level, &dst_array[*count], i); } break;
-                }
-            }
-
-            (*count)++;
-        }
-
-        ++edge;
-    }
+bool get_swept_sphere_culling() {
+    return s_culling;
 }
 
 static collision_triangle_t *s_get_collision_triangles(
@@ -322,356 +192,97 @@ static collision_triangle_t *s_get_collision_triangles(
     ivector3_t bounding_cube_min = ivector3_t(glm::floor(ws_center - ws_size));
     ivector3_t bounding_cube_range = bounding_cube_max - bounding_cube_min;
 
-    bool is_between_chunks = 0;
-    ivector3_t min_local_coord = space_voxel_to_local_chunk(bounding_cube_min);
-    ivector3_t max_local_coord = space_voxel_to_local_chunk(bounding_cube_max);
-
-    if (max_local_coord.x < min_local_coord.x ||
-        max_local_coord.y < min_local_coord.y ||
-        max_local_coord.z < min_local_coord.z) {
-        is_between_chunks = 1;
-    }
-
-    uint32_t collision_vertex_count = 0;
     // Estimation
     uint32_t max_vertices = 5 * (uint32_t)glm::dot(vector3_t(bounding_cube_range), vector3_t(bounding_cube_range)) / 2;
     collision_triangle_t *triangles = lnmalloc<collision_triangle_t>(max_vertices);
 
-    for (int32_t z = bounding_cube_min.z; z < bounding_cube_max.z; ++z) {
-        for (int32_t y = bounding_cube_min.y; y < bounding_cube_max.y; ++y) {
-            for (int32_t x = bounding_cube_min.x; x < bounding_cube_max.x; ++x) {
-                ivector3_t voxel_coord = ivector3_t(x, y, z);
-                ivector3_t chunk_coord = space_voxel_to_chunk(voxel_coord);
-                const chunk_t *chunk = state->access_chunk(chunk_coord);
-
-                if (chunk) {
-                    bool doesnt_exist = 0;
-                
-                    uint8_t voxel_values[8] = {};
-                    
-                    ivector3_t cs_coord = space_voxel_to_local_chunk(voxel_coord);
-                    
-                    if (is_between_chunks) {
-                        voxel_values[0] = chunk->voxels[get_voxel_index(cs_coord.x, cs_coord.y, cs_coord.z)].value;
-                        voxel_values[1] = s_chunk_edge_voxel_value(cs_coord.x + 1, cs_coord.y, cs_coord.z, &doesnt_exist, chunk_coord, state);
-                        voxel_values[2] = s_chunk_edge_voxel_value(cs_coord.x + 1, cs_coord.y, cs_coord.z + 1, &doesnt_exist, chunk_coord, state);
-                        voxel_values[3] = s_chunk_edge_voxel_value(cs_coord.x,     cs_coord.y, cs_coord.z + 1, &doesnt_exist, chunk_coord, state);
-                        
-                        voxel_values[4] = s_chunk_edge_voxel_value(cs_coord.x,     cs_coord.y + 1, cs_coord.z, &doesnt_exist, chunk_coord, state);
-                        voxel_values[5] = s_chunk_edge_voxel_value(cs_coord.x + 1, cs_coord.y + 1, cs_coord.z, &doesnt_exist, chunk_coord, state);
-                        voxel_values[6] = s_chunk_edge_voxel_value(cs_coord.x + 1, cs_coord.y + 1, cs_coord.z + 1, &doesnt_exist, chunk_coord, state);
-                        voxel_values[7] = s_chunk_edge_voxel_value(cs_coord.x,     cs_coord.y + 1, cs_coord.z + 1, &doesnt_exist, chunk_coord, state);
-                    }
-                    else {
-                        voxel_values[0] = chunk->voxels[get_voxel_index(cs_coord.x, cs_coord.y, cs_coord.z)].value;
-                        voxel_values[1] = chunk->voxels[get_voxel_index(cs_coord.x + 1, cs_coord.y, cs_coord.z)].value;
-                        voxel_values[2] = chunk->voxels[get_voxel_index(cs_coord.x + 1, cs_coord.y, cs_coord.z + 1)].value;
-                        voxel_values[3] = chunk->voxels[get_voxel_index(cs_coord.x, cs_coord.y, cs_coord.z + 1)].value;
-                    
-                        voxel_values[4] = chunk->voxels[get_voxel_index(cs_coord.x, cs_coord.y + 1, cs_coord.z)].value;
-                        voxel_values[5] = chunk->voxels[get_voxel_index(cs_coord.x + 1, cs_coord.y + 1, cs_coord.z)].value;
-                        voxel_values[6] = chunk->voxels[get_voxel_index(cs_coord.x + 1, cs_coord.y + 1, cs_coord.z + 1)].value;
-                        voxel_values[7] = chunk->voxels[get_voxel_index(cs_coord.x, cs_coord.y + 1, cs_coord.z + 1)].value;
-                    }
-
-                    s_push_collision_triangles_vertices(
-                        voxel_values,
-                        x,
-                        y,
-                        z,
-                        CHUNK_SURFACE_LEVEL,
-                        triangles,
-                        &collision_vertex_count,
-                        max_vertices);
-                }
-            }
-        }
-    }
+    uint32_t collision_vertex_count = gather_collision_triangles(
+        state,
+        bounding_cube_min,
+        bounding_cube_max,
+        triangles,
+        max_vertices);
 
     *triangle_count = collision_vertex_count;
 
     return triangles;
 }
 
-// This function solves the quadratic eqation "At^2 + Bt + C = 0" and is found in Kasper Fauerby's paper on collision detection and response
-static bool s_get_smallest_root(
-    float a,
-    float b,
-    float c,
-    float max_r,
-    float *root) {
-    // Check if a solution exists
-    float determinant = b * b - 4.0f * a * c;
-    // If determinant is negative it means no solutions.
-    if (determinant < 0.0f) return false;
-    // calculate the two roots: (if determinant == 0 then
-    // x1==x2 but lets disregard that slight optimization)
-    float sqrt_d = sqrt(determinant);
-    float r1 = (-b - sqrt_d) / (2 * a);
-    float r2 = (-b + sqrt_d) / (2 * a);
-    // Sort so x1 <= x2
-    if (r1 > r2) {
-        float temp = r2;
-        r2 = r1;
-        r1 = temp;
-    }
-    // Get lowest root:
-    if (r1 > 0 && r1 < max_r) {
-        *root = r1;
-        return true;
-    }
-    // It is possible that we want x2 - this can happen
-    // if x1 < 0
-    if (r2 > 0 && r2 < max_r) {
-        *root = r2;
-        return true;
-    }
-
-    // No (valid) solutions
-    return false;
-}
-
-
 static float s_get_plane_constant(
     const vector3_t &plane_point,
     const vector3_t &plane_normal) {
     return -glm::dot(plane_point, plane_normal);
 }
 
-static bool s_facing_triangle(
-    const vector3_t &es_normalised_velocity,
-    const vector3_t &es_normal) {
-    return (glm::dot(es_normalised_velocity, es_normal) <= 0.0f);
-}
-
-static bool s_inside_triangle(
-    const vector3_t &plane_contact_point,
-    collision_triangle_t *triangle) {
-    vector3_t cross0 = glm::cross(triangle->v.c - triangle->v.b, plane_contact_point - triangle->v.b);
-    vector3_t cross1 = glm::cross(triangle->v.c - triangle->v.b, triangle->v.a - triangle->v.b);
-
-    if (glm::dot(cross0, cross1) >= 0.0f) {
-        cross0 = glm::cross(triangle->v.c - triangle->v.a, plane_contact_point - triangle->v.a);
-        cross1 = glm::cross(triangle->v.c - triangle->v.a, triangle->v.b - triangle->v.a);
+static void s_record_query(uint64_t *count, uint64_t *total_ns, uint64_t *max_ns, time_stamp_t start) {
+    uint64_t ns = (uint64_t)(time_difference(current_time(), start) * 1e9f);
 
-        if (glm::dot(cross0, cross1) >= 0.0f) {
-            cross0 = glm::cross(triangle->v.b - triangle->v.a, plane_contact_point - triangle->v.a);
-            cross1 = glm::cross(triangle->v.b - triangle->v.a, triangle->v.c - triangle->v.a);
-
-            if (glm::dot(cross0, cross1) >= 0.0f) {
-                return true;
-            }
-        }
-    }
-
-    return false;
+    ++(*count);
+    *total_ns += ns;
+    *max_ns = MAX(*max_ns, ns);
 }
 
-static bool s_touched_vertex(
-    float a,
-    float *cinstance0,
-    const vector3_t &vertex,
-    terrain_collision_t *collision) {
-    float b = 2.0f * glm::dot(collision->es_velocity, collision->es_position - vertex);
-    float c = glm::dot(vertex - collision->es_position, vertex - collision->es_position) - 1.0f;
+/*
+  The sphere (radius 1 in ellipsoid space) can only touch triangles which
+  overlap the box around it between es_position and es_position + es_velocity.
+  The box is a bit bigger than that, so that rounding can't make it skip a
+  triangle which the sweep would have touched.
+ */
+static void s_get_ws_swept_bounds(const terrain_collision_t *collision, vector3_t *ws_min, vector3_t *ws_max) {
+    static const float ES_RADIUS = 1.01f;
 
-    float new_cinstance;
-    
-    if (s_get_smallest_root(a, b, c, *cinstance0, &new_cinstance)) {
-        *cinstance0 = new_cinstance;
-        return true;
-    }
+    vector3_t es_end = collision->es_position + collision->es_velocity;
 
-    return false;
+    *ws_min = (glm::min(collision->es_position, es_end) - vector3_t(ES_RADIUS)) * collision->ws_size;
+    *ws_max = (glm::max(collision->es_position, es_end) + vector3_t(ES_RADIUS)) * collision->ws_size;
 }
 
-static bool s_touched_edge(
-    float *cinstance0,
-    vector3_t *new_position,
-    const vector3_t &vertex0,
-    const vector3_t &vertex1,
-    terrain_collision_t *collision) {
-    vector3_t edge_vector = vertex1 - vertex0;
-    vector3_t position_to_vertex0 = vertex0 - collision->es_position;
-    float velocity_length2 = glm::dot(collision->es_velocity, collision->es_velocity);
-    float edge_length2 = glm::dot(edge_vector, edge_vector);
-    float edge_dot_velocity = glm::dot(edge_vector, collision->es_velocity);
-    float edge_dot_position_to_vertex0 = glm::dot(edge_vector, position_to_vertex0);
-    float position_to_vertex0_length2 = glm::dot(position_to_vertex0, position_to_vertex0);
-
-    float a = edge_length2 * (-velocity_length2) + (edge_dot_velocity * edge_dot_velocity);
-    float b = edge_length2 * (2.0f * glm::dot(collision->es_velocity, position_to_vertex0)) - (2.0f * edge_dot_velocity * edge_dot_position_to_vertex0);
-    float c = edge_length2 * (1.0f - position_to_vertex0_length2) + (edge_dot_position_to_vertex0 * edge_dot_position_to_vertex0);
-
-    float new_cinstance;
-    
-    if (s_get_smallest_root(a, b, c, *cinstance0, &new_cinstance)) {
-        // Where on the line did the collision happen (did it even happen on the edge, or just on the infinite line of the edge)
-        float proportion = (edge_dot_velocity * new_cinstance - edge_dot_position_to_vertex0) / edge_length2;
-        if (proportion >= 0.0f && proportion <= 1.0f) {
-            *cinstance0 = new_cinstance;
-            *new_position = vertex0 + proportion * edge_vector;
-            return true;
-        }
-    }
+static bool s_overlaps_bounds(const collision_triangle_t *ws_triangle, const vector3_t &ws_min, const vector3_t &ws_max) {
+    vector3_t triangle_min = glm::min(glm::min(ws_triangle->v.a, ws_triangle->v.b), ws_triangle->v.c);
+    vector3_t triangle_max = glm::max(glm::max(ws_triangle->v.a, ws_triangle->v.b), ws_triangle->v.c);
 
-    return false;
+    return
+        triangle_min.x <= ws_max.x && triangle_max.x >= ws_min.x &&
+        triangle_min.y <= ws_max.y && triangle_max.y >= ws_min.y &&
+        triangle_min.z <= ws_max.z && triangle_max.z >= ws_min.z;
 }
 
-static bool s_collided_with_triangle(terrain_collision_t *collision, collision_triangle_t *es_triangle) {
-    vector3_t es_a = es_triangle->v.a;
-    vector3_t es_b = es_triangle->v.b;
-    vector3_t es_c = es_triangle->v.c;
-
-    vector3_t es_plane_normal = glm::normalize(glm::cross(es_b - es_a, es_c - es_a));
-
-    float es_distance_to_plane = 0.0f;
-
-    bool inside_terrain = 0;
-    
-    if (s_facing_triangle(collision->es_normalised_velocity, es_plane_normal)) {
-        // get plane constant
-        float plane_constant = s_get_plane_constant(es_a, es_plane_normal);
-        es_distance_to_plane = glm::dot(collision->es_position, es_plane_normal) + plane_constant;
-        float plane_normal_dot_velocity = glm::dot(es_plane_normal, collision->es_velocity);
-
-        bool sphere_inside_plane = 0;
-
-        float cinstance0 = 0.0f, cinstance1 = 0.0f;
-        
-        if (plane_normal_dot_velocity == 0.0f) {
-            // sphere velocity is parallel to plane surface (& facing plane, as we calculated before)
-            if (glm::abs(es_distance_to_plane) >= 1.0f) {
-                // sphere is not in plane and distance is more than sphere radius, cannot possibly collide
-                return false;
-            }
-            else {
-                sphere_inside_plane = 1;
-            }
-        }
-        else {
-            // sphere velocity is not parallel to plane surface (& facing towards plane)
-            // need to check collision with triangle surface, edges and vertices
-            // collision instance 0 (first time sphere touches plane)
-            cinstance0 = (1.0f - es_distance_to_plane) / plane_normal_dot_velocity;
-            cinstance1 = (-1.0f - es_distance_to_plane) / plane_normal_dot_velocity;
-
-            // The sphere is inside the fricking plane
-            if (cinstance0 < 0.0f) {
-                inside_terrain = 1;
-                //LOG_ERROR("There is problem: sphere is inside the terrain\n");
-            }
-
-            // always make sure that 0 corresponds to closer collision and 1 responds to further
-            if (cinstance0 > cinstance1) {
-                float t = cinstance0;
-                cinstance0 = cinstance1;
-                cinstance1 = t;
-            }
-
-            if (cinstance0 > 1.0f || cinstance1 < 0.0f) {
-                // either triangle plane is behind, or too far (0.0f to 1.0f represents 0.0f to dt, if we cinstance0 > 1.0f, we are trying to go further than we can in this timeframe)
-                return false;
-            }
-
-            if (cinstance0 < 0.0f) cinstance0 = 0.0f;
-            if (cinstance1 > 1.0f) cinstance1 = 1.0f;
-        }
-
-        // point where sphere intersects with plane, not triangle
-        vector3_t plane_contact_point = (collision->es_position + cinstance0 * collision->es_velocity - es_plane_normal);
-
-        bool detected_collision = 0;
-        float cinstance = 1.0f;
-        vector3_t triangle_contact_point;
-
-        if (!sphere_inside_plane) {
-            if (s_inside_triangle(plane_contact_point, es_triangle)) {
-                // sphere collided with triangle
-                detected_collision = 1;
-                cinstance = cinstance0;
-
-                if (inside_terrain) {
-                    
-                    //LOG_ERRORV("We got a problem, cinstance < 0: %f\n", cinstance);
-                }
-
-                if (cinstance < 0.0f) {
-                }
-                
-                triangle_contact_point = plane_contact_point;
-            }
-            else {
-                inside_terrain = 0;
-            }
-        }
-
-        // check triangle edges / vertices
-        if (!detected_collision) {
-            float a; /*, b, c*/
-
-            a = glm::dot(collision->es_velocity, collision->es_velocity);
-
-            if (s_touched_vertex(a, &cinstance, es_triangle->v.a, collision)) {
-                detected_collision = true;
-                triangle_contact_point = es_triangle->v.a;
-            }
-
-            if (s_touched_vertex(a, &cinstance, es_triangle->v.b, collision)) {
-                detected_collision = true;
-                triangle_contact_point = es_triangle->v.b;
-            }
-
-            if (s_touched_vertex(a, &cinstance, es_triangle->v.c, collision)) {
-                detected_collision = true;
-                triangle_contact_point = es_triangle->v.c;
-            }
-
-            vector3_t new_position_on_edge;
+/*
+  Runs the sweep against the triangles (world space). The ones which are left
+  after culling get moved to the front of the array and converted to
+  ellipsoid space in place.
+ */
+static void s_collide_with_triangles(
+    terrain_collision_t *collision,
+    collision_triangle_t *triangles,
+    uint32_t triangle_count,
+    const state_t *state) {
+    vector3_t ws_min, ws_max;
+    s_get_ws_swept_bounds(collision, &ws_min, &ws_max);
 
-            if (s_touched_edge(&cinstance, &new_position_on_edge, es_a, es_b, collision)) {
-                detected_collision = true;
-                triangle_contact_point = new_position_on_edge;
-            }
+    uint32_t tested_count = 0;
 
-            if (s_touched_edge(&cinstance, &new_position_on_edge, es_b, es_c, collision)) {
-                detected_collision = true;
-                triangle_contact_point = new_position_on_edge;
-            }
+    for (uint32_t triangle_index = 0; triangle_index < triangle_count; ++triangle_index) {
+        collision_triangle_t *triangle = &triangles[triangle_index];
 
-            if (s_touched_edge(&cinstance, &new_position_on_edge, es_c, es_a, collision)) {
-                detected_collision = true;
-                triangle_contact_point = new_position_on_edge;
-            }
+        if (s_culling && !s_overlaps_bounds(triangle, ws_min, ws_max)) {
+            continue;
         }
 
-        if (detected_collision) {
-            float distance_to_collision = glm::abs(cinstance) * glm::length(collision->es_velocity);
-
-            if (!collision->detected || distance_to_collision < collision->es_nearest_distance) {
-                if (inside_terrain) {
-                    collision->es_nearest_distance = es_distance_to_plane;
-                }
-                else {
-                    collision->es_nearest_distance = distance_to_collision;
-                }
-                
-                collision->es_contact_point = triangle_contact_point;
-                collision->es_surface_normal = es_plane_normal;
-                collision->detected = 1;
-                collision->under_terrain = inside_terrain;
+        collision_triangle_t *es_triangle = &triangles[tested_count++];
 
-                collision->has_detected_previously = 1;
-
-                return true;
-            }
+        for (uint32_t i = 0; i < 3; ++i) {
+            es_triangle->vertices[i] = triangle->vertices[i] / collision->ws_size;
         }
     }
 
-    return false;
+    sweep_sphere_triangles(collision, triangles, tested_count);
+
+    state->collision_stats.gathered_triangle_count += triangle_count;
+    state->collision_stats.tested_triangle_count += tested_count;
 }
 
-vector3_t collide_and_slide(terrain_collision_t *collision, const state_t *state) {
+static vector3_t s_collide_and_slide(terrain_collision_t *collision, const state_t *state) {
     // Get intersecting triangles
     uint32_t triangle_count = 0;
     collision_triangle_t *triangles = s_get_collision_triangles(&triangle_count, collision->ws_position, collision->ws_size, state);
@@ -690,16 +301,7 @@ vector3_t collide_and_slide(terrain_collision_t *collision, const state_t *state
 
     collision->has_detected_previously = 0;
 
-    for (uint32_t triangle_index = 0; triangle_index < triangle_count; ++triangle_index) {
-        collision_triangle_t *triangle = &triangles[triangle_index];
-
-        for (uint32_t i = 0; i < 3; ++i) {
-            triangle->vertices[i] /= collision->ws_size;
-        }
-
-        // Check collision with this triangle (now is ellipsoid space)
-        s_collided_with_triangle(collision, triangle);
-    }
+    s_collide_with_triangles(collision, triangles, triangle_count, state);
 
     if (!collision->has_detected_previously) {
         // No more collisions, just return position + velocity
@@ -721,7 +323,9 @@ vector3_t collide_and_slide(terrain_collision_t *collision, const state_t *state
         collision->es_position = actual_position;
         collision->es_nearest_distance = 1000.0f;
 
-        return collide_and_slide(collision, state);
+        ++(state->collision_stats.sweep_recursion_count);
+
+        return s_collide_and_slide(collision, state);
     }
     else {
         if (collision->es_nearest_distance >= close_distance) {
@@ -760,24 +364,177 @@ vector3_t collide_and_slide(terrain_collision_t *collision, const state_t *state
             return actual_position;
         }
 
-        return collide_and_slide(collision, state);
+        ++(state->collision_stats.sweep_recursion_count);
+
+        return s_collide_and_slide(collision, state);
     }
 }
 
+vector3_t collide_and_slide(terrain_collision_t *collision, const state_t *state) {
+    time_stamp_t start = current_time();
+
+    vector3_t es_position = s_collide_and_slide(collision, state);
+
+    collision_stats_t *stats = &state->collision_stats;
+    s_record_query(&stats->sweep_count, &stats->sweep_ns, &stats->max_sweep_ns, start);
+
+    return es_position;
+}
+
 void check_ray_terrain_collision(terrain_collision_t *collision, const state_t *state) {
+    time_stamp_t start = current_time();
+
     uint32_t triangle_count = 0;
     collision_triangle_t *triangles = s_get_collision_triangles(&triangle_count, collision->ws_position, collision->ws_size, state);
 
-    for (uint32_t triangle_index = 0; triangle_index < triangle_count; ++triangle_index) {
-        collision_triangle_t *triangle = &triangles[triangle_index];
+    s_collide_with_triangles(collision, triangles, triangle_count, state);
 
-        for (uint32_t i = 0; i < 3; ++i) {
-            triangle->vertices[i] /= collision->ws_size;
+    collision_stats_t *stats = &state->collision_stats;
+    s_record_query(&stats->ray_test_count, &stats->ray_test_ns, &stats->max_ray_test_ns, start);
+}
+
+/*
+  Ray against a collision triangle (Moller-Trumbore). Both sides count, like
+  in the ray tests which don't have a facing direction. *t is the distance
+  along the ray (the direction is normalised).
+ */
+static bool s_intersect_ray_triangle(
+    const vector3_t &ws_origin,
+    const vector3_t &ws_direction,
+    const collision_triangle_t *ws_triangle,
+    float *t) {
+    vector3_t edge1 = ws_triangle->v.b - ws_triangle->v.a;
+    vector3_t edge2 = ws_triangle->v.c - ws_triangle->v.a;
+    vector3_t p = glm::cross(ws_direction, edge2);
+    float determinant = glm::dot(edge1, p);
+
+    // Ray parallel to the triangle (or degenerate triangle)
+    if (determinant == 0.0f) {
+        return false;
+    }
+
+    float inverse_determinant = 1.0f / determinant;
+    vector3_t origin_to_a = ws_origin - ws_triangle->v.a;
+
+    float u = glm::dot(origin_to_a, p) * inverse_determinant;
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+
+    vector3_t q = glm::cross(origin_to_a, edge1);
+
+    float v = glm::dot(ws_direction, q) * inverse_determinant;
+    if (v < 0.0f || u + v > 1.0f) {
+        return false;
+    }
+
+    *t = glm::dot(edge2, q) * inverse_determinant;
+
+    return *t >= 0.0f;
+}
+
+// Cells a ray went through (see collision_stats_t)
+struct ray_cell_counts_t {
+    uint64_t cell_count;
+    uint64_t surface_cell_count;
+};
+
+/*
+  Goes through the cells the ray crosses in order (Amanatides & Woo), and
+  only intersects the ray with the triangles of the cells which can cross
+  the surface. The triangles of a cell are inside the cell, so the first
+  cell with a hit has the nearest one.
+
+  With build_meshes, the triangles come from gather_collision_triangles()
+  (which builds the collision meshes), otherwise they come from
+  read_cell_collision_triangles(), which several threads can call at once.
+ */
+static terraform_package_t s_cast_ray(
+    const vector3_t &ws_ray_start,
+    const vector3_t &ws_ray_direction,
+    float max_reach,
+    bool build_meshes,
+    const state_t *state,
+    ray_cell_counts_t *counts) {
+    terraform_package_t package = {};
+    package.ray_hit_terrain = 0;
+
+    if (glm::dot(ws_ray_direction, ws_ray_direction) == 0.0f) {
+        return package;
+    }
+
+    vector3_t ws_direction = glm::normalize(ws_ray_direction);
+
+    ivector3_t vs_cell = space_world_to_voxel(ws_ray_start);
+    ivector3_t vs_step;
+    // Distance along the ray to the next cell boundary on each axis, and between two boundaries
+    vector3_t t_max, t_delta;
+
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        if (ws_direction[axis] > 0.0f) {
+            vs_step[axis] = 1;
+            t_delta[axis] = 1.0f / ws_direction[axis];
+            t_max[axis] = ((float)(vs_cell[axis] + 1) - ws_ray_start[axis]) / ws_direction[axis];
         }
+        else if (ws_direction[axis] < 0.0f) {
+            vs_step[axis] = -1;
+            t_delta[axis] = -1.0f / ws_direction[axis];
+            t_max[axis] = ((float)vs_cell[axis] - ws_ray_start[axis]) / ws_direction[axis];
+        }
+        else {
+            vs_step[axis] = 0;
+            t_delta[axis] = FLT_MAX;
+            t_max[axis] = FLT_MAX;
+        }
+    }
+
+    const chunk_t *previous_chunk = NULL;
+
+    // A cell has at most 5 triangles (+ 3, see gather_collision_triangles())
+    collision_triangle_t triangles[8];
+
+    for (float t = 0.0f; t <= max_reach;) {
+        ++counts->cell_count;
 
-        // Check collision with this triangle (now is ellipsoid space)
-        s_collided_with_triangle(collision, triangle);
+        const chunk_t *chunk = state->access_chunk(space_voxel_to_chunk(vs_cell), previous_chunk);
+
+        if (chunk) {
+            previous_chunk = chunk;
+            ivector3_t cs_coord = space_voxel_to_local_chunk(vs_cell);
+
+            if (!chunk->can_skip_cell(cs_coord.x, cs_coord.y, cs_coord.z)) {
+                ++counts->surface_cell_count;
+
+                uint32_t triangle_count = build_meshes ?
+                    gather_collision_triangles(state, vs_cell, vs_cell + ivector3_t(1), triangles, 8) :
+                    read_cell_collision_triangles(chunk, cs_coord, triangles);
+
+                float nearest = max_reach;
+
+                for (uint32_t i = 0; i < triangle_count; ++i) {
+                    float t_hit;
+                    if (s_intersect_ray_triangle(ws_ray_start, ws_direction, &triangles[i], &t_hit) && t_hit <= nearest) {
+                        nearest = t_hit;
+                        package.ray_hit_terrain = 1;
+                    }
+                }
+
+                if (package.ray_hit_terrain) {
+                    package.ws_contact_point = ws_ray_start + ws_direction * nearest;
+                    package.ws_position = glm::round(package.ws_contact_point);
+                    break;
+                }
+            }
+        }
+
+        // Step to the next cell through the nearest boundary
+        uint32_t axis = (t_max.x < t_max.y) ? (t_max.x < t_max.z ? 0 : 2) : (t_max.y < t_max.z ? 1 : 2);
+        t = t_max[axis];
+        vs_cell[axis] += vs_step[axis];
+        t_max[axis] += t_delta[axis];
     }
+
+    return package;
 }
 
 terraform_package_t cast_terrain_ray(
@@ -786,47 +543,127 @@ terraform_package_t cast_terrain_ray(
     float max_reach,
     voxel_color_t color,
     const state_t *state) {
-    vector3_t vs_position = ws_ray_start;
-    vector3_t vs_dir = ws_ray_direction;
+    time_stamp_t start = current_time();
 
-    static const float PRECISION = 1.0f / 15.0f;
-    
-    vector3_t vs_step = vs_dir * max_reach * PRECISION;
+    ray_cell_counts_t counts = {};
+    terraform_package_t package = s_cast_ray(ws_ray_start, ws_ray_direction, max_reach, 1, state, &counts);
+    package.color = color;
 
-    float max_reach_squared = max_reach * max_reach;
+    collision_stats_t *stats = &state->collision_stats;
+    stats->terrain_ray_cell_count += counts.cell_count;
+    stats->terrain_ray_surface_cell_count += counts.surface_cell_count;
+    s_record_query(&stats->terrain_ray_count, &stats->terrain_ray_ns, &stats->max_terrain_ray_ns, start);
 
-    terraform_package_t package = {};
-    package.ray_hit_terrain = 0;
-    package.color = color;
+    return package;
+}
 
-    for (; glm::dot(vs_position - ws_ray_start, vs_position - ws_ray_start) < max_reach_squared; vs_position += vs_step) {
-        ivector3_t voxel = space_world_to_voxel(vs_position);
-        ivector3_t chunk_coord = space_voxel_to_chunk(voxel);
-        const chunk_t *chunk = state->access_chunk(chunk_coord);
+static constexpr uint32_t RAYS_PER_JOB = 64;
 
-        if (chunk) {
-            ivector3_t local_voxel_coord = space_voxel_to_local_chunk(voxel);
-            const voxel_t *voxel_ptr = &chunk->voxels[get_voxel_index(local_voxel_coord.x, local_voxel_coord.y, local_voxel_coord.z)];
-
-            terrain_collision_t collision = {};
-            collision.ws_size = vector3_t(0.1f);
-            collision.ws_position = vs_position;
-            collision.ws_velocity = vs_dir;
-            collision.es_position = collision.ws_position / collision.ws_size;
-            collision.es_velocity = collision.ws_velocity / collision.ws_size;
-
-            check_ray_terrain_collision(&collision, state);
-
-            if (collision.detected) {
-                package.ray_hit_terrain = 1;
-                package.ws_contact_point = collision.es_contact_point * collision.ws_size;
-                package.ws_position = glm::round(package.ws_contact_point);
-                break;
-            }
+/*
+  Rays going the same way (octant of the direction) from the same 4x4x4
+  voxels get the same key, and the start blocks are in morton order after
+  that, so that neighbouring keys go through the same chunks.
+ */
+static uint32_t s_get_ray_sort_key(const terrain_ray_t *ray) {
+    ivector3_t vs_block = space_world_to_voxel(ray->ws_start) >> 2;
+
+    uint32_t octant =
+        (ray->ws_direction.x < 0.0f ? 1 : 0) |
+        (ray->ws_direction.y < 0.0f ? 2 : 0) |
+        (ray->ws_direction.z < 0.0f ? 4 : 0);
+
+    uint32_t block =
+        morton_spread_bits((uint32_t)vs_block.x & 511) |
+        (morton_spread_bits((uint32_t)vs_block.y & 511) << 1) |
+        (morton_spread_bits((uint32_t)vs_block.z & 511) << 2);
+
+    return (octant << 27) | block;
+}
+
+// Radix sort of the ray indices by key (3 passes of 10 bits, the keys have 30)
+static void s_sort_rays(uint32_t *keys, uint32_t *indices, uint32_t count) {
+    uint32_t *tmp_keys = flmalloc<uint32_t>(count), *tmp_indices = flmalloc<uint32_t>(count);
+    uint32_t *src_keys = keys, *src_indices = indices;
+    uint32_t *dst_keys = tmp_keys, *dst_indices = tmp_indices;
+
+    for (uint32_t shift = 0; shift < 30; shift += 10) {
+        uint32_t offsets[1024] = {};
+
+        for (uint32_t i = 0; i < count; ++i) {
+            ++offsets[(src_keys[i] >> shift) & 1023];
+        }
+
+        uint32_t total = 0;
+        for (uint32_t d = 0; d < 1024; ++d) {
+            uint32_t digit_count = offsets[d];
+            offsets[d] = total;
+            total += digit_count;
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t dst = offsets[(src_keys[i] >> shift) & 1023]++;
+            dst_keys[dst] = src_keys[i];
+            dst_indices[dst] = src_indices[i];
         }
+
+        uint32_t *tmp = src_keys; src_keys = dst_keys; dst_keys = tmp;
+        tmp = src_indices; src_indices = dst_indices; dst_indices = tmp;
     }
 
-    return package;
+    // Odd amount of passes: the sorted indices are in the other array
+    memcpy(indices, src_indices, sizeof(uint32_t) * count);
+
+    flfree(tmp_keys);
+    flfree(tmp_indices);
+}
+
+void cast_terrain_rays(
+    const terrain_ray_t *rays,
+    uint32_t ray_count,
+    terraform_package_t *packages,
+    const state_t *state) {
+    if (!ray_count) {
+        return;
+    }
+
+    uint32_t *keys = flmalloc<uint32_t>(ray_count);
+    uint32_t *order = flmalloc<uint32_t>(ray_count);
+
+    for (uint32_t i = 0; i < ray_count; ++i) {
+        keys[i] = s_get_ray_sort_key(&rays[i]);
+        order[i] = i;
+    }
+
+    s_sort_rays(keys, order, ray_count);
+
+    uint32_t job_count = (ray_count + RAYS_PER_JOB - 1) / RAYS_PER_JOB;
+    ray_cell_counts_t *job_counts = flmalloc<ray_cell_counts_t>(job_count);
+
+    get_worker_pool()->run(job_count, [&] (uint32_t job_index) {
+        uint32_t first = job_index * RAYS_PER_JOB;
+        uint32_t end = MIN(first + RAYS_PER_JOB, ray_count);
+
+        ray_cell_counts_t counts = {};
+
+        for (uint32_t i = first; i < end; ++i) {
+            const terrain_ray_t *ray = &rays[order[i]];
+            packages[order[i]] = s_cast_ray(ray->ws_start, ray->ws_direction, ray->max_reach, 0, state, &counts);
+        }
+
+        job_counts[job_index] = counts;
+    });
+
+    collision_stats_t *stats = &state->collision_stats;
+    stats->terrain_ray_count += ray_count;
+
+    for (uint32_t i = 0; i < job_count; ++i) {
+        stats->terrain_ray_cell_count += job_counts[i].cell_count;
+        stats->terrain_ray_surface_cell_count += job_counts[i].surface_cell_count;
+    }
+
+    flfree(keys);
+    flfree(order);
+    flfree(job_counts);
 }
 
 bool collide_sphere_with_standing_player(
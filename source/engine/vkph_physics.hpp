@@ -111,6 +111,12 @@ vector3_t collide_and_slide(terrain_collision_t *collision, const state_t *state
 
 void check_ray_terrain_collision(terrain_collision_t *collision, const state_t *state);
 
+/*
+  First point within max_reach where the ray hits the terrain's collision
+  triangles (ws_contact_point is on the triangle, ws_position is the voxel
+  closest to it). Only tests the triangles of the cells the ray crosses
+  which can cross the surface.
+*/
 terraform_package_t cast_terrain_ray(
     const vector3_t &ws_ray_start,
     const vector3_t &ws_ray_direction,
@@ -118,6 +124,39 @@ terraform_package_t cast_terrain_ray(
     voxel_color_t color,
     const state_t *state);
 
+struct terrain_ray_t {
+    vector3_t ws_start;
+    vector3_t ws_direction;
+    float max_reach;
+};
+
+/*
+  cast_terrain_ray() on a whole batch of rays (line of sight checks, bots,
+  audio occlusion, debugging tools...), split between the threads of the
+  worker pool. The rays get sorted so that the rays of a job start close to
+  each other and go the same way (they go through the same chunks), and the
+  hits get written to packages[i] (color is 0).
+
+  Several threads can't build the collision meshes, so the rays use the
+  cells which are built and run marching cubes on the others - the hits are
+  the same as with cast_terrain_ray(). Nothing can write to the chunks
+  while this runs.
+*/
+void cast_terrain_rays(
+    const terrain_ray_t *rays,
+    uint32_t ray_count,
+    terraform_package_t *packages,
+    const state_t *state);
+
+/*
+  Whether the queries skip the triangles whose bounds don't overlap the
+  swept sphere before running the whole face / edge / vertex test on them
+  (for benchmarks - the results are the same either way). The queries count
+  how many triangles they gathered / tested in state_t::collision_stats.
+*/
+void set_swept_sphere_culling(bool enabled);
+bool get_swept_sphere_culling();
+
 /*
   Collision detection with other types of bodies which are not the terrain.
 */
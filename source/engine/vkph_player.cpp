@@ -413,7 +413,7 @@ void player_t::check_player_dead(player_action_t *actions, state_t *state) {
             // Do ray cast to check if there are chunks underneath the player
             uint32_t ray_step_count = 10;
             vector3_t current_ray_position = ws_position;
-            current_ray_position += 16.0f * normalized_velocity;
+            current_ray_position += (float)CHUNK_EDGE_LENGTH * normalized_velocity;
             for (uint32_t i = 0; i < ray_step_count; ++i) {
                 ivector3_t chunk_coord = space_voxel_to_chunk(space_world_to_voxel(current_ray_position));
 
@@ -425,7 +425,7 @@ void player_t::check_player_dead(player_action_t *actions, state_t *state) {
                     break;
                 }
 
-                current_ray_position += 16.0f * normalized_velocity;
+                current_ray_position += (float)CHUNK_EDGE_LENGTH * normalized_velocity;
             }
 
             death_checker += actions->dt;
@@ -0,0 +1,936 @@
+#include "vkph_sphere_sweep.hpp"
+
+#include <string.h>
+#include <tools.hpp>
+
+// Same as in vkph_terraform.cpp
+#if defined(__x86_64__) || defined(_M_X64)
+#define VKPH_SWEEP_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define VKPH_TARGET_AVX2
+#else
+#define VKPH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace vkph {
+
+// This function solves the quadratic eqation "At^2 + Bt + C = 0" and is found in Kasper Fauerby's paper on collision detection and response
+static bool s_get_smallest_root(
+    float a,
+    float b,
+    float c,
+    float max_r,
+    float *root) {
+    // Check if a solution exists
+    float determinant = b * b - 4.0f * a * c;
+    // If determinant is negative it means no solutions.
+    if (determinant < 0.0f) return false;
+    // calculate the two roots: (if determinant == 0 then
+    // x1==x2 but lets disregard that slight optimization)
+    float sqrt_d = sqrt(determinant);
+    float r1 = (-b - sqrt_d) / (2 * a);
+    float r2 = (-b + sqrt_d) / (2 * a);
+    // Sort so x1 <= x2
+    if (r1 > r2) {
+        float temp = r2;
+        r2 = r1;
+        r1 = temp;
+    }
+    // Get lowest root:
+    if (r1 > 0 && r1 < max_r) {
+        *root = r1;
+        return true;
+    }
+    // It is possible that we want x2 - this can happen
+    // if x1 < 0
+    if (r2 > 0 && r2 < max_r) {
+        *root = r2;
+        return true;
+    }
+
+    // No (valid) solutions
+    return false;
+}
+
+static float s_get_plane_constant(
+    const vector3_t &plane_point,
+    const vector3_t &plane_normal) {
+    return -glm::dot(plane_point, plane_normal);
+}
+
+static bool s_facing_triangle(
+    const vector3_t &es_normalised_velocity,
+    const vector3_t &es_normal) {
+    return (glm::dot(es_normalised_velocity, es_normal) <= 0.0f);
+}
+
+static bool s_inside_triangle(
+    const vector3_t &plane_contact_point,
+    const collision_triangle_t *triangle) {
+    vector3_t cross0 = glm::cross(triangle->v.c - triangle->v.b, plane_contact_point - triangle->v.b);
+    vector3_t cross1 = glm::cross(triangle->v.c - triangle->v.b, triangle->v.a - triangle->v.b);
+
+    if (glm::dot(cross0, cross1) >= 0.0f) {
+        cross0 = glm::cross(triangle->v.c - triangle->v.a, plane_contact_point - triangle->v.a);
+        cross1 = glm::cross(triangle->v.c - triangle->v.a, triangle->v.b - triangle->v.a);
+
+        if (glm::dot(cross0, cross1) >= 0.0f) {
+            cross0 = glm::cross(triangle->v.b - triangle->v.a, plane_contact_point - triangle->v.a);
+            cross1 = glm::cross(triangle->v.b - triangle->v.a, triangle->v.c - triangle->v.a);
+
+            if (glm::dot(cross0, cross1) >= 0.0f) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool s_touched_vertex(
+    float a,
+    float *cinstance0,
+    const vector3_t &vertex,
+    terrain_collision_t *collision) {
+    float b = 2.0f * glm::dot(collision->es_velocity, collision->es_position - vertex);
+    float c = glm::dot(vertex - collision->es_position, vertex - collision->es_position) - 1.0f;
+
+    float new_cinstance;
+
+    if (s_get_smallest_root(a, b, c, *cinstance0, &new_cinstance)) {
+        *cinstance0 = new_cinstance;
+        return true;
+    }
+
+    return false;
+}
+
+static bool s_touched_edge(
+    float *cinstance0,
+    vector3_t *new_position,
+    const vector3_t &vertex0,
+    const vector3_t &vertex1,
+    terrain_collision_t *collision) {
+    vector3_t edge_vector = vertex1 - vertex0;
+    vector3_t position_to_vertex0 = vertex0 - collision->es_position;
+    float velocity_length2 = glm::dot(collision->es_velocity, collision->es_velocity);
+    float edge_length2 = glm::dot(edge_vector, edge_vector);
+    float edge_dot_velocity = glm::dot(edge_vector, collision->es_velocity);
+    float edge_dot_position_to_vertex0 = glm::dot(edge_vector, position_to_vertex0);
+    float position_to_vertex0_length2 = glm::dot(position_to_vertex0, position_to_vertex0);
+
+    float a = edge_length2 * (-velocity_length2) + (edge_dot_velocity * edge_dot_velocity);
+    float b = edge_length2 * (2.0f * glm::dot(collision->es_velocity, position_to_vertex0)) - (2.0f * edge_dot_velocity * edge_dot_position_to_vertex0);
+    float c = edge_length2 * (1.0f - position_to_vertex0_length2) + (edge_dot_position_to_vertex0 * edge_dot_position_to_vertex0);
+
+    float new_cinstance;
+
+    if (s_get_smallest_root(a, b, c, *cinstance0, &new_cinstance)) {
+        // Where on the line did the collision happen (did it even happen on the edge, or just on the infinite line of the edge)
+        float proportion = (edge_dot_velocity * new_cinstance - edge_dot_position_to_vertex0) / edge_length2;
+        if (proportion >= 0.0f && proportion <= 1.0f) {
+            *cinstance0 = new_cinstance;
+            *new_position = vertex0 + proportion * edge_vector;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Reference kernel - the SIMD ones need to find the exact same hits as this
+static bool s_collided_with_triangle(terrain_collision_t *collision, const collision_triangle_t *es_triangle) {
+    vector3_t es_a = es_triangle->v.a;
+    vector3_t es_b = es_triangle->v.b;
+    vector3_t es_c = es_triangle->v.c;
+
+    vector3_t es_plane_normal = glm::normalize(glm::cross(es_b - es_a, es_c - es_a));
+
+    float es_distance_to_plane = 0.0f;
+
+    bool inside_terrain = 0;
+
+    if (s_facing_triangle(collision->es_normalised_velocity, es_plane_normal)) {
+        // get plane constant
+        float plane_constant = s_get_plane_constant(es_a, es_plane_normal);
+        es_distance_to_plane = glm::dot(collision->es_position, es_plane_normal) + plane_constant;
+        float plane_normal_dot_velocity = glm::dot(es_plane_normal, collision->es_velocity);
+
+        bool sphere_inside_plane = 0;
+
+        float cinstance0 = 0.0f, cinstance1 = 0.0f;
+
+        if (plane_normal_dot_velocity == 0.0f) {
+            // sphere velocity is parallel to plane surface (& facing plane, as we calculated before)
+            if (glm::abs(es_distance_to_plane) >= 1.0f) {
+                // sphere is not in plane and distance is more than sphere radius, cannot possibly collide
+                return false;
+            }
+            else {
+                sphere_inside_plane = 1;
+            }
+        }
+        else {
+            // sphere velocity is not parallel to plane surface (& facing towards plane)
+            // need to check collision with triangle surface, edges and vertices
+            // collision instance 0 (first time sphere touches plane)
+            cinstance0 = (1.0f - es_distance_to_plane) / plane_normal_dot_velocity;
+            cinstance1 = (-1.0f - es_distance_to_plane) / plane_normal_dot_velocity;
+
+            // The sphere is inside the fricking plane
+            if (cinstance0 < 0.0f) {
+                inside_terrain = 1;
+                //LOG_ERROR("There is problem: sphere is inside the terrain\n");
+            }
+
+            // always make sure that 0 corresponds to closer collision and 1 responds to further
+            if (cinstance0 > cinstance1) {
+                float t = cinstance0;
+                cinstance0 = cinstance1;
+                cinstance1 = t;
+            }
+
+            if (cinstance0 > 1.0f || cinstance1 < 0.0f) {
+                // either triangle plane is behind, or too far (0.0f to 1.0f represents 0.0f to dt, if we cinstance0 > 1.0f, we are trying to go further than we can in this timeframe)
+                return false;
+            }
+
+            if (cinstance0 < 0.0f) cinstance0 = 0.0f;
+            if (cinstance1 > 1.0f) cinstance1 = 1.0f;
+        }
+
+        // point where sphere intersects with plane, not triangle
+        vector3_t plane_contact_point = (collision->es_position + cinstance0 * collision->es_velocity - es_plane_normal);
+
+        bool detected_collision = 0;
+        float cinstance = 1.0f;
+        vector3_t triangle_contact_point;
+
+        if (!sphere_inside_plane) {
+            if (s_inside_triangle(plane_contact_point, es_triangle)) {
+                // sphere collided with triangle
+                detected_collision = 1;
+                cinstance = cinstance0;
+
+                if (inside_terrain) {
+
+                    //LOG_ERRORV("We got a problem, cinstance < 0: %f\n", cinstance);
+                }
+
+                if (cinstance < 0.0f) {
+                }
+
+                triangle_contact_point = plane_contact_point;
+            }
+            else {
+                inside_terrain = 0;
+            }
+        }
+
+        // check triangle edges / vertices
+        if (!detected_collision) {
+            float a; /*, b, c*/
+
+            a = glm::dot(collision->es_velocity, collision->es_velocity);
+
+            if (s_touched_vertex(a, &cinstance, es_triangle->v.a, collision)) {
+                detected_collision = true;
+                triangle_contact_point = es_triangle->v.a;
+            }
+
+            if (s_touched_vertex(a, &cinstance, es_triangle->v.b, collision)) {
+                detected_collision = true;
+                triangle_contact_point = es_triangle->v.b;
+            }
+
+            if (s_touched_vertex(a, &cinstance, es_triangle->v.c, collision)) {
+                detected_collision = true;
+                triangle_contact_point = es_triangle->v.c;
+            }
+
+            vector3_t new_position_on_edge;
+
+            if (s_touched_edge(&cinstance, &new_position_on_edge, es_a, es_b, collision)) {
+                detected_collision = true;
+                triangle_contact_point = new_position_on_edge;
+            }
+
+            if (s_touched_edge(&cinstance, &new_position_on_edge, es_b, es_c, collision)) {
+                detected_collision = true;
+                triangle_contact_point = new_position_on_edge;
+            }
+
+            if (s_touched_edge(&cinstance, &new_position_on_edge, es_c, es_a, collision)) {
+                detected_collision = true;
+                triangle_contact_point = new_position_on_edge;
+            }
+        }
+
+        if (detected_collision) {
+            float distance_to_collision = glm::abs(cinstance) * glm::length(collision->es_velocity);
+
+            if (!collision->detected || distance_to_collision < collision->es_nearest_distance) {
+                if (inside_terrain) {
+                    collision->es_nearest_distance = es_distance_to_plane;
+                }
+                else {
+                    collision->es_nearest_distance = distance_to_collision;
+                }
+
+                collision->es_contact_point = triangle_contact_point;
+                collision->es_surface_normal = es_plane_normal;
+                collision->detected = 1;
+                collision->under_terrain = inside_terrain;
+
+                collision->has_detected_previously = 1;
+
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+#if defined(VKPH_SWEEP_X86)
+
+static constexpr uint32_t BATCH_SIZE = 8;
+
+// Triangles of a batch, x / y / z of each vertex (lanes past the end of the batch are 0)
+struct sweep_batch_t {
+    float a[3][BATCH_SIZE];
+    float b[3][BATCH_SIZE];
+    float c[3][BATCH_SIZE];
+};
+
+/*
+  What s_collided_with_triangle() finds for each triangle of the batch,
+  before it compares it to the nearest hit so far.
+ */
+struct sweep_hits_t {
+    uint32_t detected_mask;
+    uint32_t inside_terrain_mask;
+    float distance[BATCH_SIZE];
+    float distance_to_plane[BATCH_SIZE];
+    float contact_point[3][BATCH_SIZE];
+    float normal[3][BATCH_SIZE];
+};
+
+// Values which are the same for every triangle (the kernels broadcast these)
+struct sweep_constants_t {
+    vector3_t es_position;
+    vector3_t es_velocity;
+    vector3_t es_normalised_velocity;
+    float velocity_length2;
+    float velocity_length;
+};
+
+static void s_fill_batch(sweep_batch_t *batch, const collision_triangle_t *es_triangles, uint32_t count) {
+    if (count < BATCH_SIZE) {
+        memset(batch, 0, sizeof(sweep_batch_t));
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+            batch->a[axis][i] = es_triangles[i].v.a[axis];
+            batch->b[axis][i] = es_triangles[i].v.b[axis];
+            batch->c[axis][i] = es_triangles[i].v.c[axis];
+        }
+    }
+}
+
+// Same comparison as at the end of s_collided_with_triangle(), in the order of the triangles
+static void s_reduce_hits(terrain_collision_t *collision, const sweep_hits_t *hits, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!(hits->detected_mask & (1 << i))) {
+            continue;
+        }
+
+        float distance_to_collision = hits->distance[i];
+
+        if (!collision->detected || distance_to_collision < collision->es_nearest_distance) {
+            bool inside_terrain = hits->inside_terrain_mask & (1 << i);
+
+            collision->es_nearest_distance = inside_terrain ? hits->distance_to_plane[i] : distance_to_collision;
+            collision->es_contact_point = vector3_t(hits->contact_point[0][i], hits->contact_point[1][i], hits->contact_point[2][i]);
+            collision->es_surface_normal = vector3_t(hits->normal[0][i], hits->normal[1][i], hits->normal[2][i]);
+            collision->detected = 1;
+            collision->under_terrain = inside_terrain;
+
+            collision->has_detected_previously = 1;
+        }
+    }
+}
+
+/*
+  SSE2 kernel: 4 triangles at a time. Every branch of the scalar kernel gets
+  computed for all the lanes and the masks pick the results. No FMA here and
+  the operations are in the same order as glm does them (dot is (x + y) + z),
+  so that the rounding is the same as in the scalar kernel.
+ */
+struct vec3_sse2_t {
+    __m128 x;
+    __m128 y;
+    __m128 z;
+};
+
+static inline vec3_sse2_t s_load_sse2(const float v[3][BATCH_SIZE], uint32_t offset) {
+    vec3_sse2_t r = { _mm_loadu_ps(&v[0][offset]), _mm_loadu_ps(&v[1][offset]), _mm_loadu_ps(&v[2][offset]) };
+    return r;
+}
+
+static inline vec3_sse2_t s_set1_sse2(const vector3_t &v) {
+    vec3_sse2_t r = { _mm_set1_ps(v.x), _mm_set1_ps(v.y), _mm_set1_ps(v.z) };
+    return r;
+}
+
+static inline void s_store_sse2(float v[3][BATCH_SIZE], uint32_t offset, const vec3_sse2_t &a) {
+    _mm_storeu_ps(&v[0][offset], a.x);
+    _mm_storeu_ps(&v[1][offset], a.y);
+    _mm_storeu_ps(&v[2][offset], a.z);
+}
+
+static inline vec3_sse2_t s_add_sse2(const vec3_sse2_t &a, const vec3_sse2_t &b) {
+    vec3_sse2_t r = { _mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z) };
+    return r;
+}
+
+static inline vec3_sse2_t s_sub_sse2(const vec3_sse2_t &a, const vec3_sse2_t &b) {
+    vec3_sse2_t r = { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+    return r;
+}
+
+static inline vec3_sse2_t s_scale_sse2(const vec3_sse2_t &a, __m128 s) {
+    vec3_sse2_t r = { _mm_mul_ps(a.x, s), _mm_mul_ps(a.y, s), _mm_mul_ps(a.z, s) };
+    return r;
+}
+
+static inline __m128 s_dot_sse2(const vec3_sse2_t &a, const vec3_sse2_t &b) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+static inline vec3_sse2_t s_cross_sse2(const vec3_sse2_t &a, const vec3_sse2_t &b) {
+    vec3_sse2_t r = {
+        _mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(b.y, a.z)),
+        _mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(b.z, a.x)),
+        _mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(b.x, a.y)) };
+    return r;
+}
+
+// mask ? a : b
+static inline __m128 s_select_sse2(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Negating is flipping the sign bit, like in the scalar version
+static inline __m128 s_negate_sse2(__m128 a) {
+    return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+}
+
+// Same as glm::abs() - x >= 0 ? x : -x, which keeps the sign of -0
+static inline __m128 s_abs_sse2(__m128 a) {
+    return s_select_sse2(_mm_cmpge_ps(a, _mm_setzero_ps()), a, s_negate_sse2(a));
+}
+
+static inline vec3_sse2_t s_select3_sse2(__m128 mask, const vec3_sse2_t &a, const vec3_sse2_t &b) {
+    vec3_sse2_t r = { s_select_sse2(mask, a.x, b.x), s_select_sse2(mask, a.y, b.y), s_select_sse2(mask, a.z, b.z) };
+    return r;
+}
+
+// Returns the lanes which have a root
+static inline __m128 s_get_smallest_root_sse2(__m128 a, __m128 b, __m128 c, __m128 max_r, __m128 *root) {
+    __m128 zero = _mm_setzero_ps();
+
+    __m128 determinant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f), a), c));
+    __m128 sqrt_d = _mm_sqrt_ps(determinant);
+    __m128 negative_b = s_negate_sse2(b);
+    __m128 two_a = _mm_mul_ps(_mm_set1_ps(2.0f), a);
+    __m128 r1 = _mm_div_ps(_mm_sub_ps(negative_b, sqrt_d), two_a);
+    __m128 r2 = _mm_div_ps(_mm_add_ps(negative_b, sqrt_d), two_a);
+
+    __m128 swap = _mm_cmpgt_ps(r1, r2);
+    __m128 first = s_select_sse2(swap, r2, r1);
+    __m128 last = s_select_sse2(swap, r1, r2);
+
+    __m128 first_valid = _mm_and_ps(_mm_cmpgt_ps(first, zero), _mm_cmplt_ps(first, max_r));
+    __m128 last_valid = _mm_and_ps(_mm_cmpgt_ps(last, zero), _mm_cmplt_ps(last, max_r));
+
+    *root = s_select_sse2(first_valid, first, last);
+
+    return _mm_andnot_ps(_mm_cmplt_ps(determinant, zero), _mm_or_ps(first_valid, last_valid));
+}
+
+static inline __m128 s_inside_triangle_sse2(
+    const vec3_sse2_t &p,
+    const vec3_sse2_t &a,
+    const vec3_sse2_t &b,
+    const vec3_sse2_t &c) {
+    __m128 zero = _mm_setzero_ps();
+
+    vec3_sse2_t cb = s_sub_sse2(c, b);
+    __m128 inside = _mm_cmpge_ps(s_dot_sse2(s_cross_sse2(cb, s_sub_sse2(p, b)), s_cross_sse2(cb, s_sub_sse2(a, b))), zero);
+
+    vec3_sse2_t ca = s_sub_sse2(c, a);
+    inside = _mm_and_ps(inside, _mm_cmpge_ps(s_dot_sse2(s_cross_sse2(ca, s_sub_sse2(p, a)), s_cross_sse2(ca, s_sub_sse2(b, a))), zero));
+
+    vec3_sse2_t ba = s_sub_sse2(b, a);
+    inside = _mm_and_ps(inside, _mm_cmpge_ps(s_dot_sse2(s_cross_sse2(ba, s_sub_sse2(p, a)), s_cross_sse2(ba, s_sub_sse2(c, a))), zero));
+
+    return inside;
+}
+
+struct sweep_sse2_t {
+    vec3_sse2_t position;
+    vec3_sse2_t velocity;
+    __m128 velocity_length2;
+    __m128 negative_velocity_length2;
+};
+
+static inline void s_touched_vertex_sse2(
+    const sweep_sse2_t *sweep,
+    const vec3_sse2_t &vertex,
+    __m128 *cinstance,
+    vec3_sse2_t *contact_point,
+    __m128 *touched) {
+    __m128 b = _mm_mul_ps(_mm_set1_ps(2.0f), s_dot_sse2(sweep->velocity, s_sub_sse2(sweep->position, vertex)));
+    vec3_sse2_t position_to_vertex = s_sub_sse2(vertex, sweep->position);
+    __m128 c = _mm_sub_ps(s_dot_sse2(position_to_vertex, position_to_vertex), _mm_set1_ps(1.0f));
+
+    __m128 root;
+    __m128 found = s_get_smallest_root_sse2(sweep->velocity_length2, b, c, *cinstance, &root);
+
+    *cinstance = s_select_sse2(found, root, *cinstance);
+    *contact_point = s_select3_sse2(found, vertex, *contact_point);
+    *touched = _mm_or_ps(*touched, found);
+}
+
+static inline void s_touched_edge_sse2(
+    const sweep_sse2_t *sweep,
+    const vec3_sse2_t &vertex0,
+    const vec3_sse2_t &vertex1,
+    __m128 *cinstance,
+    vec3_sse2_t *contact_point,
+    __m128 *touched) {
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 two = _mm_set1_ps(2.0f);
+
+    vec3_sse2_t edge_vector = s_sub_sse2(vertex1, vertex0);
+    vec3_sse2_t position_to_vertex0 = s_sub_sse2(vertex0, sweep->position);
+    __m128 edge_length2 = s_dot_sse2(edge_vector, edge_vector);
+    __m128 edge_dot_velocity = s_dot_sse2(edge_vector, sweep->velocity);
+    __m128 edge_dot_position_to_vertex0 = s_dot_sse2(edge_vector, position_to_vertex0);
+    __m128 position_to_vertex0_length2 = s_dot_sse2(position_to_vertex0, position_to_vertex0);
+
+    __m128 a = _mm_add_ps(
+        _mm_mul_ps(edge_length2, sweep->negative_velocity_length2),
+        _mm_mul_ps(edge_dot_velocity, edge_dot_velocity));
+    __m128 b = _mm_sub_ps(
+        _mm_mul_ps(edge_length2, _mm_mul_ps(two, s_dot_sse2(sweep->velocity, position_to_vertex0))),
+        _mm_mul_ps(_mm_mul_ps(two, edge_dot_velocity), edge_dot_position_to_vertex0));
+    __m128 c = _mm_add_ps(
+        _mm_mul_ps(edge_length2, _mm_sub_ps(one, position_to_vertex0_length2)),
+        _mm_mul_ps(edge_dot_position_to_vertex0, edge_dot_position_to_vertex0));
+
+    __m128 root;
+    __m128 found = s_get_smallest_root_sse2(a, b, c, *cinstance, &root);
+
+    __m128 proportion = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(edge_dot_velocity, root), edge_dot_position_to_vertex0), edge_length2);
+    __m128 on_edge = _mm_and_ps(found, _mm_and_ps(_mm_cmpge_ps(proportion, _mm_setzero_ps()), _mm_cmple_ps(proportion, one)));
+
+    *cinstance = s_select_sse2(on_edge, root, *cinstance);
+    *contact_point = s_select3_sse2(on_edge, s_add_sse2(vertex0, s_scale_sse2(edge_vector, proportion)), *contact_point);
+    *touched = _mm_or_ps(*touched, on_edge);
+}
+
+// Lanes [offset, offset + 4) of the batch
+static void s_sweep_sse2(const sweep_constants_t *constants, const sweep_batch_t *batch, uint32_t offset, sweep_hits_t *hits) {
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+
+    sweep_sse2_t sweep;
+    sweep.position = s_set1_sse2(constants->es_position);
+    sweep.velocity = s_set1_sse2(constants->es_velocity);
+    sweep.velocity_length2 = _mm_set1_ps(constants->velocity_length2);
+    sweep.negative_velocity_length2 = _mm_set1_ps(-constants->velocity_length2);
+
+    vec3_sse2_t a = s_load_sse2(batch->a, offset);
+    vec3_sse2_t b = s_load_sse2(batch->b, offset);
+    vec3_sse2_t c = s_load_sse2(batch->c, offset);
+
+    vec3_sse2_t normal = s_cross_sse2(s_sub_sse2(b, a), s_sub_sse2(c, a));
+    normal = s_scale_sse2(normal, _mm_div_ps(one, _mm_sqrt_ps(s_dot_sse2(normal, normal))));
+
+    __m128 facing = _mm_cmple_ps(s_dot_sse2(s_set1_sse2(constants->es_normalised_velocity), normal), zero);
+    __m128 plane_constant = s_negate_sse2(s_dot_sse2(a, normal));
+    __m128 distance_to_plane = _mm_add_ps(s_dot_sse2(sweep.position, normal), plane_constant);
+    __m128 normal_dot_velocity = s_dot_sse2(normal, sweep.velocity);
+
+    // Moving parallel to the plane: only lanes where the sphere is in the plane go on (to the vertices / edges)
+    __m128 parallel = _mm_cmpeq_ps(normal_dot_velocity, zero);
+    __m128 missed = _mm_and_ps(parallel, _mm_cmpge_ps(s_abs_sse2(distance_to_plane), one));
+
+    __m128 cinstance0 = _mm_div_ps(_mm_sub_ps(one, distance_to_plane), normal_dot_velocity);
+    __m128 cinstance1 = _mm_div_ps(_mm_sub_ps(_mm_set1_ps(-1.0f), distance_to_plane), normal_dot_velocity);
+    __m128 inside_plane = _mm_cmplt_ps(cinstance0, zero);
+
+    __m128 swap = _mm_cmpgt_ps(cinstance0, cinstance1);
+    __m128 first = s_select_sse2(swap, cinstance1, cinstance0);
+    __m128 last = s_select_sse2(swap, cinstance0, cinstance1);
+
+    missed = _mm_or_ps(missed, _mm_andnot_ps(parallel, _mm_or_ps(_mm_cmpgt_ps(first, one), _mm_cmplt_ps(last, zero))));
+    // 0 if the sphere already touches the plane, and in the parallel lanes
+    first = _mm_andnot_ps(_mm_or_ps(parallel, _mm_cmplt_ps(first, zero)), first);
+
+    __m128 tested = _mm_andnot_ps(missed, facing);
+
+    vec3_sse2_t plane_contact_point = s_sub_sse2(s_add_sse2(sweep.position, s_scale_sse2(sweep.velocity, first)), normal);
+    __m128 face_hit = _mm_and_ps(_mm_andnot_ps(parallel, tested), s_inside_triangle_sse2(plane_contact_point, a, b, c));
+
+    // Only used in the lanes which didn't hit the face
+    __m128 cinstance = one;
+    __m128 touched = zero;
+    vec3_sse2_t contact_point = plane_contact_point;
+
+    s_touched_vertex_sse2(&sweep, a, &cinstance, &contact_point, &touched);
+    s_touched_vertex_sse2(&sweep, b, &cinstance, &contact_point, &touched);
+    s_touched_vertex_sse2(&sweep, c, &cinstance, &contact_point, &touched);
+    s_touched_edge_sse2(&sweep, a, b, &cinstance, &contact_point, &touched);
+    s_touched_edge_sse2(&sweep, b, c, &cinstance, &contact_point, &touched);
+    s_touched_edge_sse2(&sweep, c, a, &cinstance, &contact_point, &touched);
+
+    __m128 detected = _mm_or_ps(face_hit, _mm_and_ps(tested, touched));
+    __m128 inside_terrain = _mm_and_ps(face_hit, inside_plane);
+
+    cinstance = s_select_sse2(face_hit, first, cinstance);
+    contact_point = s_select3_sse2(face_hit, plane_contact_point, contact_point);
+
+    _mm_storeu_ps(&hits->distance[offset], _mm_mul_ps(s_abs_sse2(cinstance), _mm_set1_ps(constants->velocity_length)));
+    _mm_storeu_ps(&hits->distance_to_plane[offset], distance_to_plane);
+    s_store_sse2(hits->contact_point, offset, contact_point);
+    s_store_sse2(hits->normal, offset, normal);
+
+    hits->detected_mask |= (uint32_t)_mm_movemask_ps(detected) << offset;
+    hits->inside_terrain_mask |= (uint32_t)_mm_movemask_ps(inside_terrain) << offset;
+}
+
+/*
+  AVX2 kernel: the same as the SSE2 one, 8 triangles at a time. The
+  comparisons are the ordered ones, like the SSE2 / scalar comparisons.
+ */
+struct vec3_avx2_t {
+    __m256 x;
+    __m256 y;
+    __m256 z;
+};
+
+VKPH_TARGET_AVX2 static inline vec3_avx2_t s_load_avx2(const float v[3][BATCH_SIZE]) {
+    vec3_avx2_t r = { _mm256_loadu_ps(v[0]), _mm256_loadu_ps(v[1]), _mm256_loadu_ps(v[2]) };
+    return r;
+}
+
+VKPH_TARGET_AVX2 static inline vec3_avx2_t s_set1_avx2(const vector3_t &v) {
+    vec3_avx2_t r = { _mm256_set1_ps(v.x), _mm256_set1_ps(v.y), _mm256_set1_ps(v.z) };
+    return r;
+}
+
+VKPH_TARGET_AVX2 static inline void s_store_avx2(float v[3][BATCH_SIZE], const vec3_avx2_t &a) {
+    _mm256_storeu_ps(v[0], a.x);
+    _mm256_storeu_ps(v[1], a.y);
+    _mm256_storeu_ps(v[2], a.z);
+}
+
+VKPH_TARGET_AVX2 static inline vec3_avx2_t s_add_avx2(const vec3_avx2_t &a, const vec3_avx2_t &b) {
+    vec3_avx2_t r = { _mm256_add_ps(a.x, b.x), _mm256_add_ps(a.y, b.y), _mm256_add_ps(a.z, b.z) };
+    return r;
+}
+
+VKPH_TARGET_AVX2 static inline vec3_avx2_t s_sub_avx2(const vec3_avx2_t &a, const vec3_avx2_t &b) {
+    vec3_avx2_t r = { _mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z) };
+    return r;
+}
+
+VKPH_TARGET_AVX2 static inline vec3_avx2_t s_scale_avx2(const vec3_avx2_t &a, __m256 s) {
+    vec3_avx2_t r = { _mm256_mul_ps(a.x, s), _mm256_mul_ps(a.y, s), _mm256_mul_ps(a.z, s) };
+    return r;
+}
+
+VKPH_TARGET_AVX2 static inline __m256 s_dot_avx2(const vec3_avx2_t &a, const vec3_avx2_t &b) {
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)), _mm256_mul_ps(a.z, b.z));
+}
+
+VKPH_TARGET_AVX2 static inline vec3_avx2_t s_cross_avx2(const vec3_avx2_t &a, const vec3_avx2_t &b) {
+    vec3_avx2_t r = {
+        _mm256_sub_ps(_mm256_mul_ps(a.y, b.z), _mm256_mul_ps(b.y, a.z)),
+        _mm256_sub_ps(_mm256_mul_ps(a.z, b.x), _mm256_mul_ps(b.z, a.x)),
+        _mm256_sub_ps(_mm256_mul_ps(a.x, b.y), _mm256_mul_ps(b.x, a.y)) };
+    return r;
+}
+
+// mask ? a : b
+VKPH_TARGET_AVX2 static inline __m256 s_select_avx2(__m256 mask, __m256 a, __m256 b) {
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+VKPH_TARGET_AVX2 static inline __m256 s_negate_avx2(__m256 a) {
+    return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f));
+}
+
+VKPH_TARGET_AVX2 static inline __m256 s_abs_avx2(__m256 a) {
+    return s_select_avx2(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GE_OQ), a, s_negate_avx2(a));
+}
+
+VKPH_TARGET_AVX2 static inline vec3_avx2_t s_select3_avx2(__m256 mask, const vec3_avx2_t &a, const vec3_avx2_t &b) {
+    vec3_avx2_t r = { s_select_avx2(mask, a.x, b.x), s_select_avx2(mask, a.y, b.y), s_select_avx2(mask, a.z, b.z) };
+    return r;
+}
+
+VKPH_TARGET_AVX2 static inline __m256 s_get_smallest_root_avx2(__m256 a, __m256 b, __m256 c, __m256 max_r, __m256 *root) {
+    __m256 zero = _mm256_setzero_ps();
+
+    __m256 determinant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), a), c));
+    __m256 sqrt_d = _mm256_sqrt_ps(determinant);
+    __m256 negative_b = s_negate_avx2(b);
+    __m256 two_a = _mm256_mul_ps(_mm256_set1_ps(2.0f), a);
+    __m256 r1 = _mm256_div_ps(_mm256_sub_ps(negative_b, sqrt_d), two_a);
+    __m256 r2 = _mm256_div_ps(_mm256_add_ps(negative_b, sqrt_d), two_a);
+
+    __m256 swap = _mm256_cmp_ps(r1, r2, _CMP_GT_OQ);
+    __m256 first = s_select_avx2(swap, r2, r1);
+    __m256 last = s_select_avx2(swap, r1, r2);
+
+    __m256 first_valid = _mm256_and_ps(_mm256_cmp_ps(first, zero, _CMP_GT_OQ), _mm256_cmp_ps(first, max_r, _CMP_LT_OQ));
+    __m256 last_valid = _mm256_and_ps(_mm256_cmp_ps(last, zero, _CMP_GT_OQ), _mm256_cmp_ps(last, max_r, _CMP_LT_OQ));
+
+    *root = s_select_avx2(first_valid, first, last);
+
+    return _mm256_andnot_ps(_mm256_cmp_ps(determinant, zero, _CMP_LT_OQ), _mm256_or_ps(first_valid, last_valid));
+}
+
+VKPH_TARGET_AVX2 static inline __m256 s_inside_triangle_avx2(
+    const vec3_avx2_t &p,
+    const vec3_avx2_t &a,
+    const vec3_avx2_t &b,
+    const vec3_avx2_t &c) {
+    __m256 zero = _mm256_setzero_ps();
+
+    vec3_avx2_t cb = s_sub_avx2(c, b);
+    __m256 inside = _mm256_cmp_ps(s_dot_avx2(s_cross_avx2(cb, s_sub_avx2(p, b)), s_cross_avx2(cb, s_sub_avx2(a, b))), zero, _CMP_GE_OQ);
+
+    vec3_avx2_t ca = s_sub_avx2(c, a);
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(s_dot_avx2(s_cross_avx2(ca, s_sub_avx2(p, a)), s_cross_avx2(ca, s_sub_avx2(b, a))), zero, _CMP_GE_OQ));
+
+    vec3_avx2_t ba = s_sub_avx2(b, a);
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(s_dot_avx2(s_cross_avx2(ba, s_sub_avx2(p, a)), s_cross_avx2(ba, s_sub_avx2(c, a))), zero, _CMP_GE_OQ));
+
+    return inside;
+}
+
+struct sweep_avx2_t {
+    vec3_avx2_t position;
+    vec3_avx2_t velocity;
+    __m256 velocity_length2;
+    __m256 negative_velocity_length2;
+};
+
+VKPH_TARGET_AVX2 static inline void s_touched_vertex_avx2(
+    const sweep_avx2_t *sweep,
+    const vec3_avx2_t &vertex,
+    __m256 *cinstance,
+    vec3_avx2_t *contact_point,
+    __m256 *touched) {
+    __m256 b = _mm256_mul_ps(_mm256_set1_ps(2.0f), s_dot_avx2(sweep->velocity, s_sub_avx2(sweep->position, vertex)));
+    vec3_avx2_t position_to_vertex = s_sub_avx2(vertex, sweep->position);
+    __m256 c = _mm256_sub_ps(s_dot_avx2(position_to_vertex, position_to_vertex), _mm256_set1_ps(1.0f));
+
+    __m256 root;
+    __m256 found = s_get_smallest_root_avx2(sweep->velocity_length2, b, c, *cinstance, &root);
+
+    *cinstance = s_select_avx2(found, root, *cinstance);
+    *contact_point = s_select3_avx2(found, vertex, *contact_point);
+    *touched = _mm256_or_ps(*touched, found);
+}
+
+VKPH_TARGET_AVX2 static inline void s_touched_edge_avx2(
+    const sweep_avx2_t *sweep,
+    const vec3_avx2_t &vertex0,
+    const vec3_avx2_t &vertex1,
+    __m256 *cinstance,
+    vec3_avx2_t *contact_point,
+    __m256 *touched) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 two = _mm256_set1_ps(2.0f);
+
+    vec3_avx2_t edge_vector = s_sub_avx2(vertex1, vertex0);
+    vec3_avx2_t position_to_vertex0 = s_sub_avx2(vertex0, sweep->position);
+    __m256 edge_length2 = s_dot_avx2(edge_vector, edge_vector);
+    __m256 edge_dot_velocity = s_dot_avx2(edge_vector, sweep->velocity);
+    __m256 edge_dot_position_to_vertex0 = s_dot_avx2(edge_vector, position_to_vertex0);
+    __m256 position_to_vertex0_length2 = s_dot_avx2(position_to_vertex0, position_to_vertex0);
+
+    __m256 a = _mm256_add_ps(
+        _mm256_mul_ps(edge_length2, sweep->negative_velocity_length2),
+        _mm256_mul_ps(edge_dot_velocity, edge_dot_velocity));
+    __m256 b = _mm256_sub_ps(
+        _mm256_mul_ps(edge_length2, _mm256_mul_ps(two, s_dot_avx2(sweep->velocity, position_to_vertex0))),
+        _mm256_mul_ps(_mm256_mul_ps(two, edge_dot_velocity), edge_dot_position_to_vertex0));
+    __m256 c = _mm256_add_ps(
+        _mm256_mul_ps(edge_length2, _mm256_sub_ps(one, position_to_vertex0_length2)),
+        _mm256_mul_ps(edge_dot_position_to_vertex0, edge_dot_position_to_vertex0));
+
+    __m256 root;
+    __m256 found = s_get_smallest_root_avx2(a, b, c, *cinstance, &root);
+
+    __m256 proportion = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(edge_dot_velocity, root), edge_dot_position_to_vertex0), edge_length2);
+    __m256 on_edge = _mm256_and_ps(found, _mm256_and_ps(
+        _mm256_cmp_ps(proportion, _mm256_setzero_ps(), _CMP_GE_OQ),
+        _mm256_cmp_ps(proportion, one, _CMP_LE_OQ)));
+
+    *cinstance = s_select_avx2(on_edge, root, *cinstance);
+    *contact_point = s_select3_avx2(on_edge, s_add_avx2(vertex0, s_scale_avx2(edge_vector, proportion)), *contact_point);
+    *touched = _mm256_or_ps(*touched, on_edge);
+}
+
+VKPH_TARGET_AVX2 static void s_sweep_avx2(const sweep_constants_t *constants, const sweep_batch_t *batch, sweep_hits_t *hits) {
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1.0f);
+
+    sweep_avx2_t sweep;
+    sweep.position = s_set1_avx2(constants->es_position);
+    sweep.velocity = s_set1_avx2(constants->es_velocity);
+    sweep.velocity_length2 = _mm256_set1_ps(constants->velocity_length2);
+    sweep.negative_velocity_length2 = _mm256_set1_ps(-constants->velocity_length2);
+
+    vec3_avx2_t a = s_load_avx2(batch->a);
+    vec3_avx2_t b = s_load_avx2(batch->b);
+    vec3_avx2_t c = s_load_avx2(batch->c);
+
+    vec3_avx2_t normal = s_cross_avx2(s_sub_avx2(b, a), s_sub_avx2(c, a));
+    normal = s_scale_avx2(normal, _mm256_div_ps(one, _mm256_sqrt_ps(s_dot_avx2(normal, normal))));
+
+    __m256 facing = _mm256_cmp_ps(s_dot_avx2(s_set1_avx2(constants->es_normalised_velocity), normal), zero, _CMP_LE_OQ);
+    __m256 plane_constant = s_negate_avx2(s_dot_avx2(a, normal));
+    __m256 distance_to_plane = _mm256_add_ps(s_dot_avx2(sweep.position, normal), plane_constant);
+    __m256 normal_dot_velocity = s_dot_avx2(normal, sweep.velocity);
+
+    __m256 parallel = _mm256_cmp_ps(normal_dot_velocity, zero, _CMP_EQ_OQ);
+    __m256 missed = _mm256_and_ps(parallel, _mm256_cmp_ps(s_abs_avx2(distance_to_plane), one, _CMP_GE_OQ));
+
+    __m256 cinstance0 = _mm256_div_ps(_mm256_sub_ps(one, distance_to_plane), normal_dot_velocity);
+    __m256 cinstance1 = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(-1.0f), distance_to_plane), normal_dot_velocity);
+    __m256 inside_plane = _mm256_cmp_ps(cinstance0, zero, _CMP_LT_OQ);
+
+    __m256 swap = _mm256_cmp_ps(cinstance0, cinstance1, _CMP_GT_OQ);
+    __m256 first = s_select_avx2(swap, cinstance1, cinstance0);
+    __m256 last = s_select_avx2(swap, cinstance0, cinstance1);
+
+    missed = _mm256_or_ps(missed, _mm256_andnot_ps(parallel, _mm256_or_ps(
+        _mm256_cmp_ps(first, one, _CMP_GT_OQ),
+        _mm256_cmp_ps(last, zero, _CMP_LT_OQ))));
+    first = _mm256_andnot_ps(_mm256_or_ps(parallel, _mm256_cmp_ps(first, zero, _CMP_LT_OQ)), first);
+
+    __m256 tested = _mm256_andnot_ps(missed, facing);
+
+    vec3_avx2_t plane_contact_point = s_sub_avx2(s_add_avx2(sweep.position, s_scale_avx2(sweep.velocity, first)), normal);
+    __m256 face_hit = _mm256_and_ps(_mm256_andnot_ps(parallel, tested), s_inside_triangle_avx2(plane_contact_point, a, b, c));
+
+    __m256 cinstance = one;
+    __m256 touched = zero;
+    vec3_avx2_t contact_point = plane_contact_point;
+
+    s_touched_vertex_avx2(&sweep, a, &cinstance, &contact_point, &touched);
+    s_touched_vertex_avx2(&sweep, b, &cinstance, &contact_point, &touched);
+    s_touched_vertex_avx2(&sweep, c, &cinstance, &contact_point, &touched);
+    s_touched_edge_avx2(&sweep, a, b, &cinstance, &contact_point, &touched);
+    s_touched_edge_avx2(&sweep, b, c, &cinstance, &contact_point, &touched);
+    s_touched_edge_avx2(&sweep, c, a, &cinstance, &contact_point, &touched);
+
+    __m256 detected = _mm256_or_ps(face_hit, _mm256_and_ps(tested, touched));
+    __m256 inside_terrain = _mm256_and_ps(face_hit, inside_plane);
+
+    cinstance = s_select_avx2(face_hit, first, cinstance);
+    contact_point = s_select3_avx2(face_hit, plane_contact_point, contact_point);
+
+    _mm256_storeu_ps(hits->distance, _mm256_mul_ps(s_abs_avx2(cinstance), _mm256_set1_ps(constants->velocity_length)));
+    _mm256_storeu_ps(hits->distance_to_plane, distance_to_plane);
+    s_store_avx2(hits->contact_point, contact_point);
+    s_store_avx2(hits->normal, normal);
+
+    hits->detected_mask = (uint32_t)_mm256_movemask_ps(detected);
+    hits->inside_terrain_mask = (uint32_t)_mm256_movemask_ps(inside_terrain);
+}
+
+static void s_sweep_batches(
+    terrain_collision_t *collision,
+    const collision_triangle_t *es_triangles,
+    uint32_t count,
+    terraform_kernel_t kernel) {
+    sweep_constants_t constants;
+    constants.es_position = collision->es_position;
+    constants.es_velocity = collision->es_velocity;
+    constants.es_normalised_velocity = collision->es_normalised_velocity;
+    constants.velocity_length2 = glm::dot(collision->es_velocity, collision->es_velocity);
+    constants.velocity_length = glm::length(collision->es_velocity);
+
+    sweep_batch_t batch;
+    sweep_hits_t hits;
+
+    for (uint32_t first = 0; first < count; first += BATCH_SIZE) {
+        uint32_t batch_count = MIN(BATCH_SIZE, count - first);
+        s_fill_batch(&batch, es_triangles + first, batch_count);
+
+        if (kernel == TK_AVX2) {
+            s_sweep_avx2(&constants, &batch, &hits);
+        }
+        else {
+            hits.detected_mask = 0;
+            hits.inside_terrain_mask = 0;
+
+            s_sweep_sse2(&constants, &batch, 0, &hits);
+            if (batch_count > 4) {
+                s_sweep_sse2(&constants, &batch, 4, &hits);
+            }
+        }
+
+        s_reduce_hits(collision, &hits, batch_count);
+    }
+}
+
+#endif
+
+static terraform_kernel_t s_kernel = TK_INVALID;
+
+void set_sweep_kernel(terraform_kernel_t kernel) {
+    terraform_kernel_t best = get_best_terraform_kernel();
+    s_kernel = (kernel > best) ? best : kernel;
+}
+
+terraform_kernel_t get_sweep_kernel() {
+    if (s_kernel == TK_INVALID) {
+        s_kernel = get_best_terraform_kernel();
+    }
+
+    return s_kernel;
+}
+
+void sweep_sphere_triangles(
+    terrain_collision_t *collision,
+    const collision_triangle_t *es_triangles,
+    uint32_t count) {
+    terraform_kernel_t kernel = get_sweep_kernel();
+
+    switch (kernel) {
+#if defined(VKPH_SWEEP_X86)
+    case TK_AVX2:
+    case TK_SSE2: s_sweep_batches(collision, es_triangles, count, kernel); break;
+#endif
+    default: {
+        for (uint32_t i = 0; i < count; ++i) {
+            s_collided_with_triangle(collision, &es_triangles[i]);
+        }
+    } break;
+    }
+}
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "vkph_physics.hpp"
+#include "vkph_collision_mesh.hpp"
+
+namespace vkph {
+
+/*
+  Sweeps the sphere (radius 1 in ellipsoid space) from es_position along
+  es_velocity against the triangles (ellipsoid space), and keeps the nearest
+  hit in the collision, like testing the triangles one after the other does.
+
+  The SIMD kernels test 4 / 8 triangles at a time (structure of arrays) with
+  the exact same float operations as the scalar kernel, then go through the
+  hits in the order of the triangles - the result is the same with every
+  kernel, bit for bit (the server replays the movements the clients predict).
+ */
+void sweep_sphere_triangles(
+    terrain_collision_t *collision,
+    const collision_triangle_t *es_triangles,
+    uint32_t count);
+
+// Same kernels as terraforming - changes the kernel which sweep_sphere_triangles() uses (for tests / benchmarks)
+void set_sweep_kernel(terraform_kernel_t kernel);
+terraform_kernel_t get_sweep_kernel();
+
+}
@@ -1,6 +1,9 @@
 #include "vkph_state.hpp"
 #include "vkph_constant.hpp"
 #include "vkph_map.hpp"
+#include "vkph_map_stream.hpp"
+#include "vkph_map_snapshot.hpp"
+#include "vkph_map_baseline.hpp"
 #include "vkph_team.hpp"
 #include "vkph_terraform.hpp"
 #include "vkph_chunk.hpp"
@@ -40,14 +43,21 @@ void state_t::prepare() {
     }
 
     { // Chunks
-        chunk_indices.init();
-        chunks.init(CHUNK_MAX_LOADED_COUNT);
+        chunk_indices.init(CHUNK_INITIAL_LOADED_COUNT * 2);
+        chunks.init(CHUNK_INITIAL_LOADED_COUNT);
+        chunk_allocator.init();
 
-        max_modified_chunks = CHUNK_MAX_LOADED_COUNT / 2;
+        modified_bit_word_count = (chunks.max_size + 63) / 64;
+        modified_chunk_bits = flmalloc<uint64_t>(modified_bit_word_count);
+        max_modified_chunks = CHUNK_INITIAL_LOADED_COUNT / 2;
         modified_chunk_count = 0;
         modified_chunks = flmalloc<chunk_t *>(max_modified_chunks);
+        memset(&modification_stats, 0, sizeof(modification_stats));
+        memset(&collision_stats, 0, sizeof(collision_stats));
+        history_pool.init(64);
 
         flags.track_history = 1;
+        flags.chunks_match_map_file = 0;
     }
 
     { // Projectiles
@@ -57,6 +67,11 @@ void state_t::prepare() {
 
     { // Maps
         load_map_names();
+        map_stream = NULL;
+        map_snapshot = NULL;
+        flags.generate_terrain = 0;
+        flags.has_map_focus = 0;
+        baseline = NULL;
     }
 }
 
@@ -64,8 +79,18 @@ void state_t::configure_game_mode(game_mode_t mode) {
     game_mode = mode;
 }
 
-void state_t::configure_map(const char *map_path) {
+void state_t::configure_map(const char *map_path, const vector3_t *ws_focus) {
     current_map_path = map_path;
+
+    flags.has_map_focus = (ws_focus != NULL);
+    if (ws_focus) {
+        map_focus = *ws_focus;
+    }
+}
+
+void state_t::configure_terrain(const terrain_create_info_t *info) {
+    terrain_info = *info;
+    flags.generate_terrain = 1;
 }
 
 void state_t::configure_team_count(uint32_t count) {
@@ -85,8 +110,25 @@ void state_t::configure_team(
 }
 
 void state_t::start_session() {
-    if (current_map_path)
-        current_map_data = *load_map(current_map_path);
+    if (flags.generate_terrain) {
+        generate_terrain(&terrain_info);
+
+        // Doesn't exist as a file until it gets saved
+        current_map_data.path = current_map_path;
+        current_map_data.is_new = 1;
+        current_map_data.name = "Generated terrain";
+        current_map_data.chunk_count = chunks.data_count;
+
+        // Above the hills, looking over them
+        float view_height = terrain_info.ground_height + terrain_info.hill_height * 2.0f;
+        current_map_data.view_info.pos = vector3_t(terrain_info.ws_center.x, view_height, terrain_info.ws_center.z);
+        current_map_data.view_info.dir = glm::normalize(vector3_t(1.0f, -0.3f, 1.0f));
+        current_map_data.view_info.up = vector3_t(0.0f, 1.0f, 0.0f);
+    }
+    // The game can start ticking while the map loads
+    else if (current_map_path) {
+        current_map_data = *stream_map(current_map_path, flags.has_map_focus ? &map_focus : NULL);
+    }
 
     current_tick = 0;
 }
@@ -96,6 +138,8 @@ void state_t::stop_session() {
     game_mode = game_mode_t::INVALID;
     team_count = 0;
     flfree(teams);
+
+    clear_chunks();
 }
 
 void state_t::set_teams(
@@ -168,6 +212,14 @@ bool state_t::check_team_joinable(team_color_t color) const {
 
 void state_t::timestep_begin(float dt_in) {
     delta_time = dt_in;
+
+    if (map_stream) {
+        publish_map_stream(MAP_STREAM_BLOCKS_PER_TICK);
+    }
+
+    if (map_snapshot && map_snapshot->is_written()) {
+        finish_map_snapshot();
+    }
 }
 
 void state_t::timestep_end() {
@@ -233,37 +285,96 @@ const player_t *state_t::get_player(int32_t local_id) const {
     }
 }
 
+static void s_drop_baseline(state_t *state) {
+    if (state->baseline) {
+        state->baseline->destroy();
+        flfree(state->baseline);
+        state->baseline = NULL;
+    }
+}
+
+// Records the chunks which reset_to_baseline() needs to revert (only on the thread which owns the state)
+static void s_track_baseline_change(state_t *state, chunk_t *chunk) {
+    if (state->baseline && state->baseline->track_changes && !chunk->flags.changed_since_baseline) {
+        chunk->flags.changed_since_baseline = 1;
+        state->baseline->add_changed_chunk(chunk->chunk_coord);
+    }
+}
+
 void state_t::clear_chunks() {
+    cancel_map_stream();
+    s_drop_baseline(this);
+    streamed_chunk_count = 0;
+
+    flags.chunks_match_map_file = 0;
+
     if (chunks.data_count) {
+        // Histories need to go back to the pool before the chunks get destroyed
+        reset_modification_tracker();
+
+        for (uint32_t i = 0; i < chunks.data_count; ++i) {
+            if (chunks[i]) {
+                chunks[i]->destroy();
+            }
+        }
+
+        LOG_INFOV("Cleared %d chunks (chunk allocator: %d pages, high water mark: %d chunks, %llu allocations)\n",
+                  chunk_allocator.used_count,
+                  chunk_allocator.page_count,
+                  chunk_allocator.high_water_mark,
+                  (unsigned long long)chunk_allocator.total_allocation_count);
+
+        chunk_allocator.reset();
         chunks.clear();
         chunk_indices.clear();
     }
 }
 
+static void s_link_chunk_neighbours(state_t *state, chunk_t *chunk) {
+    for (int32_t z = -1; z <= 1; ++z) {
+        for (int32_t y = -1; y <= 1; ++y) {
+            for (int32_t x = -1; x <= 1; ++x) {
+                uint32_t neighbour_index = get_neighbour_index(x, y, z);
+
+                if (neighbour_index != CHUNK_NEIGHBOUR_SELF) {
+                    chunk_t *neighbour = state->access_chunk(chunk->chunk_coord + ivector3_t(x, y, z));
+
+                    if (neighbour) {
+                        chunk->neighbours[neighbour_index] = neighbour;
+                        neighbour->neighbours[get_opposite_neighbour_index(neighbour_index)] = chunk;
+                    }
+                }
+            }
+        }
+    }
+}
+
 chunk_t *state_t::get_chunk(
     const ivector3_t &coord) {
-    uint32_t hash = hash_chunk_coord(coord);
-    uint32_t *index = chunk_indices.get(hash);
+    uint32_t *index = chunk_indices.get(coord);
     
     if (index) {
         // Chunk was already added
         return chunks[*index];
     }
     else {
+        chunks.grow_if_full();
+
         uint32_t i = chunks.add();
         chunk_t *&chunk = chunks[i];
-        chunk = flmalloc<chunk_t>(1);
+        chunk = chunk_allocator.allocate();
         chunk->init(i, coord);
 
-        chunk_indices.insert(hash, i);
+        chunk_indices.insert(coord, i);
+
+        s_link_chunk_neighbours(this, chunk);
 
         return chunk;
     }
 }
 
 chunk_t *state_t::access_chunk(const ivector3_t &coord) {
-    uint32_t hash = hash_chunk_coord(coord);
-    uint32_t *index = chunk_indices.get(hash);
+    uint32_t *index = chunk_indices.get(coord);
 
     if (index) {
         // Chunk was already added
@@ -275,8 +386,7 @@ chunk_t *state_t::access_chunk(const ivector3_t &coord) {
 }
 
 const chunk_t *state_t::access_chunk(const ivector3_t &coord) const {
-    uint32_t hash = hash_chunk_coord(coord);
-    const uint32_t *index = chunk_indices.get(hash);
+    const uint32_t *index = chunk_indices.get(coord);
 
     if (index) {
         // Chunk was already added
@@ -287,6 +397,89 @@ const chunk_t *state_t::access_chunk(const ivector3_t &coord) const {
     }
 }
 
+const chunk_t *state_t::access_chunk(const ivector3_t &coord, const chunk_t *hint) const {
+    if (hint) {
+        ivector3_t diff = coord - hint->chunk_coord;
+
+        if (diff.x >= -1 && diff.x <= 1 &&
+            diff.y >= -1 && diff.y <= 1 &&
+            diff.z >= -1 && diff.z <= 1) {
+            return hint->get_neighbour(diff.x, diff.y, diff.z);
+        }
+    }
+
+    return access_chunk(coord);
+}
+
+uint8_t state_t::sample_density(const ivector3_t &vs_position, uint32_t level) const {
+    const chunk_t *chunk = access_chunk(space_voxel_to_chunk(vs_position));
+
+    if (!chunk) {
+        return 0;
+    }
+
+    ivector3_t cell = space_voxel_to_local_chunk(vs_position) / (1 << level);
+    return chunk->get_mip_average(level, cell.x, cell.y, cell.z);
+}
+
+/*
+  Goes through the cells of the level which overlap the box (local
+  coordinates, inclusive), and only goes down to the finer level for the
+  cells which aren't air.
+*/
+static bool s_is_chunk_region_air(const chunk_t *chunk, uint32_t level, const ivector3_t &local_min, const ivector3_t &local_max) {
+    int32_t cell_edge_length = 1 << level;
+    ivector3_t cell_start = local_min / cell_edge_length;
+    ivector3_t cell_end = local_max / cell_edge_length;
+
+    for (int32_t z = cell_start.z; z <= cell_end.z; ++z) {
+        for (int32_t y = cell_start.y; y <= cell_end.y; ++y) {
+            for (int32_t x = cell_start.x; x <= cell_end.x; ++x) {
+                if (chunk->get_mip_maximum(level, x, y, z) <= CHUNK_SURFACE_LEVEL) {
+                    continue;
+                }
+
+                if (level == 0) {
+                    return 0;
+                }
+
+                ivector3_t cell_min = ivector3_t(x, y, z) * cell_edge_length;
+                ivector3_t cell_max = cell_min + ivector3_t(cell_edge_length - 1);
+
+                if (!s_is_chunk_region_air(chunk, level - 1, glm::max(local_min, cell_min), glm::min(local_max, cell_max))) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+bool state_t::is_region_air(const ivector3_t &vs_min, const ivector3_t &vs_max) const {
+    bool air = 1;
+    const chunk_t *previous_chunk = NULL;
+
+    for_each_chunk_span(vs_min, vs_max, [this, &air, &previous_chunk] (const chunk_span_t &span) {
+        if (!air) {
+            return;
+        }
+
+        const chunk_t *chunk = access_chunk(span.chunk_coord, previous_chunk);
+
+        // Chunks which aren't loaded are air
+        if (chunk) {
+            previous_chunk = chunk;
+
+            if (chunk->occupancy.max_value > CHUNK_SURFACE_LEVEL) {
+                air = s_is_chunk_region_air(chunk, CHUNK_MIP_LEVEL_COUNT, span.local_min, span.local_max);
+            }
+        }
+    });
+
+    return air;
+}
+
 chunk_t **state_t::get_active_chunks(uint32_t *count) {
     *count = chunks.data_count;
     return chunks.data;
@@ -308,17 +501,28 @@ const chunk_t **state_t::get_modified_chunks(uint32_t *count) const {
 }
  
 void state_t::reset_modification_tracker() {
+    uint32_t voxel_count = 0;
+
     for (uint32_t i = 0; i < modified_chunk_count; ++i) {
         chunk_t *c = modified_chunks[i];
         c->flags.made_modification = 0;
 
-        for (int32_t v = 0; v < c->history.modification_count; ++v) {
-            c->history.modification_pool[c->history.modification_stack[v]] = CHUNK_SPECIAL_VALUE;
-        }
+        modified_chunk_bits[c->chunk_stack_index / 64] &= ~(1ull << (c->chunk_stack_index % 64));
 
-        c->history.modification_count = 0;
+        voxel_count += c->history->modification_count;
+        history_pool.release(c->history);
+        c->history = NULL;
     }
 
+    modification_stats_t *stats = &modification_stats;
+    stats->chunk_count = modified_chunk_count;
+    stats->voxel_count = voxel_count;
+    stats->max_chunk_count = MAX(stats->max_chunk_count, modified_chunk_count);
+    stats->max_voxel_count = MAX(stats->max_voxel_count, voxel_count);
+    stats->interval_count++;
+    stats->total_chunk_count += modified_chunk_count;
+    stats->total_voxel_count += voxel_count;
+
     modified_chunk_count = 0;
 }
 
@@ -340,162 +544,403 @@ void state_t::unflag_modified_chunks(net::chunk_modifications_t *modifications,
     }
 }
 
-map_t *state_t::load_map(const char *path) {
-    current_map_data.path = path;
+// Chunk which contains a 16x16x16 map block (chunks can be bigger than map blocks), and where the block is in it
+static chunk_t *s_get_map_block_chunk(state_t *state, const map_block_entry_t *entry, ivector3_t *offset) {
+    ivector3_t vs_block_origin = ivector3_t(entry->x, entry->y, entry->z) * MAP_CHUNK_EDGE_LENGTH;
+    chunk_t *chunk = state->get_chunk(space_voxel_to_chunk(vs_block_origin));
+    chunk->flags.has_to_update_vertices = 1;
 
-    char full_path[50] = {};
-    sprintf(full_path, "assets/maps/%s", path);
+    *offset = space_voxel_to_local_chunk(vs_block_origin);
 
-    file_handle_t map_file = create_file(full_path, FLF_BINARY);
-    if (does_file_exist(map_file)) {
-        file_contents_t contents = read_file(map_file);
+    return chunk;
+}
 
-        // Deserialise stuff
-        serialiser_t serialiser = {};
-        serialiser.data_buffer = contents.data;
-        serialiser.data_buffer_head = 0;
-        serialiser.data_buffer_size = contents.size;
+static void s_finish_map_block(state_t *state, chunk_t *chunk, const map_block_entry_t *entry, const ivector3_t &offset, bool valid) {
+    if (!valid) {
+        LOG_ERRORV("Map block (%d %d %d) is corrupted, it was left empty\n", entry->x, entry->y, entry->z);
+    }
 
-        current_map_data.name = serialiser.deserialise_fl_string();
+    chunk->update_occupancy(offset, offset + ivector3_t(MAP_CHUNK_EDGE_LENGTH - 1));
 
-        current_map_data.view_info.pos = serialiser.deserialise_vector3();
-        current_map_data.view_info.dir = serialiser.deserialise_vector3();
-        current_map_data.view_info.up = serialiser.deserialise_vector3();
+    if (CHUNK_EDGE_LENGTH == MAP_CHUNK_EDGE_LENGTH) {
+        chunk->compact();
+    }
 
-        current_map_data.chunk_count = serialiser.deserialise_uint32();
+    // Blocks which get streamed in after the baseline got captured
+    if (state->baseline) {
+        state->baseline->set_chunk(chunk);
+    }
+}
 
-        for (uint32_t i = 0; i < current_map_data.chunk_count; ++i) {
-            int16_t x = serialiser.deserialise_int16();
-            int16_t y = serialiser.deserialise_int16();
-            int16_t z = serialiser.deserialise_int16();
+// Chunks are made of several blocks, so they can only get compacted once they are all loaded
+static void s_compact_map_chunks(state_t *state) {
+    if (CHUNK_EDGE_LENGTH != MAP_CHUNK_EDGE_LENGTH) {
+        uint32_t chunk_count = 0;
+        chunk_t **loaded_chunks = state->get_active_chunks(&chunk_count);
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            if (loaded_chunks[i]) {
+                loaded_chunks[i]->compact();
+            }
+        }
+    }
+}
 
-            chunk_t *chunk = get_chunk(ivector3_t(x, y, z));
-            chunk->flags.has_to_update_vertices = 1;
+// Decompresses a map block into the chunk which contains it
+static void s_load_map_block(state_t *state, const map_file_t *file, uint32_t block_index) {
+    const map_block_entry_t *entry = &file->blocks[block_index];
 
-            for (uint32_t v = 0; v < CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH * CHUNK_EDGE_LENGTH;) {
-                uint8_t current_value = serialiser.deserialise_uint8();
-                uint8_t current_color = serialiser.deserialise_uint8();
+    ivector3_t offset;
+    chunk_t *chunk = s_get_map_block_chunk(state, entry, &offset);
 
-                if (current_value == CHUNK_SPECIAL_VALUE) {
-                    chunk->voxels[v].value = 0;
-                    chunk->voxels[v].color = 0;
-                    ++v;
+    bool valid;
 
-                    // Repeating zeros
-                    uint32_t zero_count = serialiser.deserialise_uint32();
-                    chunk->voxels[v + 1].value = 0;
-                    chunk->voxels[v + 1].color = 0;
-                    chunk->voxels[v + 2].value = 0;
-                    chunk->voxels[v + 2].color = 0;
+    if (CHUNK_EDGE_LENGTH == MAP_CHUNK_EDGE_LENGTH && VOXEL_LAYOUT == VL_LINEAR) {
+        // Blocks are the same as the chunks, so they get decompressed straight into them
+        uint8_t *values = chunk->get_writable_values();
+        voxel_color_t *colors = chunk->get_writable_colors();
 
-                    v += 2;
+        valid = file->read_block(block_index, values, colors);
 
-                    uint32_t previous_v = v;
-                    for (; v < previous_v + zero_count - 3; ++v) {
-                        chunk->voxels[v].value = 0;
-                        chunk->voxels[v].color = 0;
-                    }
-                }
-                else {
-                    chunk->voxels[v].value = current_value;
-                    chunk->voxels[v].color = current_color;
-                    ++v;
-                }
-            }
+        if (!valid) {
+            memset(values, 0, CHUNK_VOXEL_COUNT);
+            memset(colors, 0, CHUNK_VOXEL_COUNT);
         }
+    }
+    else {
+        uint8_t values[MAP_CHUNK_VOXEL_COUNT];
+        voxel_color_t colors[MAP_CHUNK_VOXEL_COUNT];
 
-        current_map_data.is_new = 0;
+        valid = file->read_block(block_index, values, colors);
+
+        if (valid) {
+            copy_voxels_from_linear(
+                values, colors,
+                offset, MAP_CHUNK_EDGE_LENGTH,
+                chunk->get_writable_values(), chunk->get_writable_colors());
+        }
+    }
+
+    s_finish_map_block(state, chunk, entry, offset, valid);
+}
+
+// Copies the header of the map file to the map data, and gets the chunk allocator ready for the blocks
+static void s_begin_map_load(state_t *state, const map_file_t *file) {
+    // It's another match
+    s_drop_baseline(state);
+    state->streamed_chunk_count = 0;
+
+    uint32_t name_length = (uint32_t)strlen(file->name);
+    char *name = flmalloc<char>(name_length + 1);
+    memcpy(name, file->name, name_length + 1);
+
+    state->current_map_data.name = name;
+    state->current_map_data.view_info = file->view_info;
+    state->current_map_data.chunk_count = file->block_count;
+    state->current_map_data.is_new = 0;
+
+    // Unless the map got loaded on top of other chunks
+    state->flags.chunks_match_map_file = (state->chunks.data_count == 0);
+
+    // Avoids allocating pages one by one while loading
+    uint32_t blocks_per_chunk = CHUNK_VOXEL_COUNT / MAP_CHUNK_VOXEL_COUNT;
+    state->chunk_allocator.reserve(state->chunks.data_count + file->block_count / blocks_per_chunk + 1);
+}
+
+map_t *state_t::load_map(const char *path) {
+    cancel_map_stream();
+    // The file may be getting written
+    finish_map_snapshot();
+
+    current_map_data.path = path;
+
+    map_file_t file = {};
+    if (file.open(path)) {
+        s_begin_map_load(this, &file);
+
+        for (uint32_t i = 0; i < file.block_count; ++i) {
+            s_load_map_block(this, &file, i);
+        }
+
+        s_compact_map_chunks(this);
+
+        file.close();
     }
     else {
         current_map_data.is_new = 1;
+        flags.chunks_match_map_file = 0;
     }
 
-    free_file(map_file);
+    current_map_path = path;
+
+    return &current_map_data;
+}
+
+map_t *state_t::stream_map(
+    const char *path,
+    const vector3_t *ws_focus,
+    job_progress_proc_t progress,
+    void *progress_data) {
+    cancel_map_stream();
+    finish_map_snapshot();
 
+    current_map_data.path = path;
     current_map_path = path;
 
+    map_stream = flmalloc<map_stream_t>();
+    if (!map_stream->init(path, ws_focus)) {
+        flfree(map_stream);
+        map_stream = NULL;
+
+        current_map_data.is_new = 1;
+        flags.chunks_match_map_file = 0;
+        return &current_map_data;
+    }
+
+    map_stream->progress = progress;
+    map_stream->progress_data = progress_data;
+
+    s_begin_map_load(this, &map_stream->file);
+
+    LOG_INFOV("Streaming map %s (%d blocks)\n", path, map_stream->file.block_count);
+
     return &current_map_data;
 }
 
-void state_t::save_map(map_t *map) {
-    if (!map) {
-        map = &current_map_data;
+bool state_t::is_streaming_map() const {
+    return map_stream != NULL;
+}
+
+const ivector3_t *state_t::get_streamed_chunks(uint32_t *count) const {
+    *count = streamed_chunk_count;
+    return streamed_chunks;
+}
+
+static void s_add_streamed_chunk(state_t *state, const ivector3_t &chunk_coord) {
+    if (state->streamed_chunk_count == state->streamed_chunk_capacity) {
+        uint32_t new_capacity = MAX(state->streamed_chunk_capacity * 2, 256u);
+        ivector3_t *new_chunks = flmalloc<ivector3_t>(new_capacity);
+
+        if (state->streamed_chunks) {
+            memcpy(new_chunks, state->streamed_chunks, sizeof(ivector3_t) * state->streamed_chunk_count);
+            flfree(state->streamed_chunks);
+        }
+
+        state->streamed_chunks = new_chunks;
+        state->streamed_chunk_capacity = new_capacity;
     }
 
-    // Serialise stuff
-    char full_path[50] = {};
-    sprintf(full_path, "assets/maps/%s", map->path);
-    file_handle_t map_file = create_file(full_path, FLF_BINARY | FLF_WRITEABLE | FLF_OVERWRITE);
+    state->streamed_chunks[state->streamed_chunk_count++] = chunk_coord;
+}
 
-    serialiser_t serialiser = {};
-    serialiser.data_buffer = lnmalloc<uint8_t>(1024 * 128);
-    serialiser.data_buffer_head = 0;
-    serialiser.data_buffer_size = 1024 * 128;
+void state_t::publish_map_stream(uint32_t max_block_count) {
+    if (!map_stream) {
+        return;
+    }
 
-    uint32_t chunk_count = 0;
-    chunk_t **chunks = get_active_chunks(&chunk_count);
+    uint32_t count = MIN(map_stream->ready_block_count(), max_block_count);
 
-    serialiser.serialise_string(map->name);
-    serialiser.serialise_vector3(map->view_info.pos);
-    serialiser.serialise_vector3(map->view_info.dir);
-    serialiser.serialise_vector3(map->view_info.up);
+    for (uint32_t i = 0; i < count; ++i) {
+        const map_stream_block_t *block = map_stream->get_ready_block(i);
+        const map_block_entry_t *entry = &map_stream->file.blocks[block->block_index];
 
-    uint32_t pointer_to_chunk_count = serialiser.data_buffer_head;
-    serialiser.serialise_uint32(0);
+        ivector3_t offset;
+        chunk_t *chunk = s_get_map_block_chunk(this, entry, &offset);
 
-    uint32_t saved_chunk_count = 0;
-    for (uint32_t i = 0; i < chunk_count; ++i) {
-        ++saved_chunk_count;
+        if (block->valid) {
+            copy_voxels_from_linear(
+                block->voxels, block->voxels + MAP_CHUNK_VOXEL_COUNT,
+                offset, MAP_CHUNK_EDGE_LENGTH,
+                chunk->get_writable_values(), chunk->get_writable_colors());
+        }
 
-        uint32_t before_chunk_ptr = serialiser.data_buffer_head;
+        s_finish_map_block(this, chunk, entry, offset, block->valid);
+        s_add_streamed_chunk(this, chunk->chunk_coord);
+        map_stream->remove_pending_block(entry);
+    }
 
-        serialiser.serialise_int16(chunks[i]->chunk_coord.x);
-        serialiser.serialise_int16(chunks[i]->chunk_coord.y);
-        serialiser.serialise_int16(chunks[i]->chunk_coord.z);
+    map_stream->release_ready_blocks(count);
 
-        for (uint32_t v_index = 0; v_index < CHUNK_VOXEL_COUNT; ++v_index) {
-            voxel_t current_voxel = chunks[i]->voxels[v_index];
-            if (current_voxel.value == 0) {
-                uint32_t before_head = serialiser.data_buffer_head;
+    if (count && map_stream->progress) {
+        map_stream->progress(map_stream->published_count, map_stream->file.block_count, map_stream->progress_data);
+    }
 
-                static constexpr uint32_t MAX_ZERO_COUNT_BEFORE_COMPRESSION = 3;
+    if (map_stream->is_finished()) {
+        s_compact_map_chunks(this);
 
-                uint32_t zero_count = 0;
-                for (; chunks[i]->voxels[v_index].value == 0 && zero_count < MAX_ZERO_COUNT_BEFORE_COMPRESSION; ++v_index, ++zero_count) {
-                    serialiser.serialise_uint8(0);
-                    serialiser.serialise_uint8(0);
-                }
+        LOG_INFOV("Finished streaming map %s\n", current_map_data.path);
 
-                if (zero_count == MAX_ZERO_COUNT_BEFORE_COMPRESSION) {
-                    for (; chunks[i]->voxels[v_index].value == 0; ++v_index, ++zero_count) {}
+        map_stream->destroy();
+        flfree(map_stream);
+        map_stream = NULL;
+    }
+}
 
-                    if (zero_count >= CHUNK_VOXEL_COUNT) {
-                        serialiser.data_buffer_head = before_chunk_ptr;
-                        --saved_chunk_count;
-                        break;
-                    }
+void state_t::finish_map_stream() {
+    while (map_stream) {
+        map_stream->wait_for_ready_block();
+        publish_map_stream(MAP_STREAM_SLOT_COUNT);
+    }
+}
 
-                    serialiser.data_buffer_head = before_head;
-                    serialiser.serialise_uint8(CHUNK_SPECIAL_VALUE);
-                    serialiser.serialise_uint8(CHUNK_SPECIAL_VALUE);
-                    serialiser.serialise_uint32(zero_count);
-                }
+void state_t::finish_map_stream_around(const vector3_t &ws_center, float radius) {
+    if (!map_stream) {
+        return;
+    }
 
-                v_index -= 1;
-            }
-            else {
-                serialiser.serialise_uint8(current_voxel.value);
-                serialiser.serialise_uint8(current_voxel.color);
+    uint32_t block_count = map_stream->get_block_count_around(ws_center, radius);
+
+    // The stream gets destroyed once all the blocks are published
+    while (map_stream && map_stream->published_count < block_count) {
+        map_stream->wait_for_ready_block();
+        publish_map_stream(block_count - map_stream->published_count);
+    }
+}
+
+bool state_t::is_region_streaming(const ivector3_t &vs_min, const ivector3_t &vs_max) const {
+    if (!map_stream) {
+        return 0;
+    }
+
+    ivector3_t chunk_min = space_voxel_to_chunk(vs_min);
+    ivector3_t chunk_max = space_voxel_to_chunk(vs_max);
+
+    for (int32_t z = chunk_min.z; z <= chunk_max.z; ++z) {
+        for (int32_t y = chunk_min.y; y <= chunk_max.y; ++y) {
+            for (int32_t x = chunk_min.x; x <= chunk_max.x; ++x) {
+                if (map_stream->is_chunk_pending(ivector3_t(x, y, z))) {
+                    return 1;
+                }
             }
         }
     }
 
-    serialiser.serialise_uint32(saved_chunk_count, &serialiser.data_buffer[pointer_to_chunk_count]);
+    return 0;
+}
+
+void state_t::cancel_map_stream() {
+    if (map_stream) {
+        map_stream->destroy();
+        flfree(map_stream);
+        map_stream = NULL;
+
+        // Only some of the blocks got loaded
+        flags.chunks_match_map_file = 0;
+    }
+}
+
+static bool s_is_current_map(const state_t *state, const map_t *map) {
+    return map == &state->current_map_data ||
+        (state->current_map_data.path && !strcmp(map->path, state->current_map_data.path));
+}
+
+/*
+  If the chunks are the map file's, only the unsaved chunks need to get
+  written (to the journal), otherwise all of them.
+ */
+static void s_freeze_map(state_t *state, const map_t *map, map_snapshot_t *snapshot, bool copy_on_write) {
+    bool current_map = s_is_current_map(state, map);
+    bool changes = state->flags.chunks_match_map_file && current_map;
+
+    uint32_t chunk_count = 0;
+    chunk_t **chunks = state->get_active_chunks(&chunk_count);
+
+    snapshot->init(map, changes, chunk_count, copy_on_write);
+
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        chunk_t *chunk = chunks[i];
+
+        if (!chunk) {
+            continue;
+        }
+
+        if (changes ? chunk->flags.unsaved : chunk->occupancy.max_value != 0) {
+            // Empty chunks don't get saved (unless their blocks need to get removed from the map file)
+            snapshot->add_chunk(chunk);
+        }
+
+        if (current_map) {
+            chunk->flags.unsaved = 0;
+        }
+    }
+
+    if (current_map) {
+        state->flags.chunks_match_map_file = 1;
+    }
+}
+
+static void s_end_map_snapshot(state_t *state, map_snapshot_t *snapshot) {
+    bool current_map = state->current_map_data.path && !strcmp(snapshot->path, state->current_map_data.path);
+
+    snapshot->wait();
+
+    if (snapshot->failed && current_map) {
+        // The chunks of the snapshot may not be in the file, so the next save writes everything
+        state->flags.chunks_match_map_file = 0;
+    }
+
+    snapshot->destroy();
+}
+
+void state_t::save_map(map_t *map) {
+    if (!map) {
+        map = &current_map_data;
+    }
+
+    // Blocks which haven't been loaded yet would be missing from the file
+    finish_map_stream();
+    finish_map_snapshot();
+
+    // The chunks don't change while the snapshot gets written
+    map_snapshot_t snapshot;
+    s_freeze_map(this, map, &snapshot, 0);
 
-    LOG_INFOV("Saved map (%d chunks) - byte size: %d\n", saved_chunk_count, serialiser.data_buffer_head);
-    write_file(map_file, serialiser.data_buffer, serialiser.data_buffer_head);
+    bool retry = !snapshot.write() && snapshot.changes;
 
-    free_file(map_file);
+    s_end_map_snapshot(this, &snapshot);
+
+    if (retry) {
+        // With all the chunks this time
+        s_freeze_map(this, map, &snapshot, 0);
+        snapshot.write();
+        s_end_map_snapshot(this, &snapshot);
+    }
+}
+
+bool state_t::save_map_in_background(map_t *map) {
+    if (!map) {
+        map = &current_map_data;
+    }
+
+    if (map_snapshot) {
+        return 0;
+    }
+
+    finish_map_stream();
+
+    map_snapshot = flmalloc<map_snapshot_t>();
+    s_freeze_map(this, map, map_snapshot, 1);
+
+    if (map_snapshot->epoch) {
+        map_snapshot->start_writing_in_background();
+    }
+    else {
+        // The chunks can't be copied on write
+        map_snapshot->write();
+    }
+
+    return 1;
+}
+
+bool state_t::is_saving_map() const {
+    return map_snapshot != NULL;
+}
+
+void state_t::finish_map_snapshot() {
+    if (map_snapshot) {
+        s_end_map_snapshot(this, map_snapshot);
+        flfree(map_snapshot);
+        map_snapshot = NULL;
+    }
 }
 
 void state_t::add_map_name(const char *map_name, const char *path) {
@@ -510,24 +955,133 @@ void state_t::add_map_name(const char *map_name, const char *path) {
     }
 }
 
-template <typename T>
-static void s_iterate_3d(const ivector3_t &center, uint32_t radius, T to_apply) {
-    int32_t start_z = center.z - (int32_t)radius;
-    int32_t start_y = center.y - (int32_t)radius;
-    int32_t start_x = center.x - (int32_t)radius;
+void state_t::capture_baseline() {
+    s_drop_baseline(this);
+
+    baseline = flmalloc<map_baseline_t>();
+    baseline->init(1);
+
+    for (uint32_t i = 0; i < chunks.data_count; ++i) {
+        if (chunks[i]) {
+            baseline->set_chunk(chunks[i]);
+            chunks[i]->flags.changed_since_baseline = 0;
+        }
+    }
+}
+
+void state_t::set_baseline_chunk(chunk_t *chunk) {
+    if (!baseline) {
+        baseline = flmalloc<map_baseline_t>();
+        baseline->init(0);
+    }
+
+    baseline->set_chunk(chunk);
+}
+
+const ivector3_t *state_t::get_changed_baseline_chunks(uint32_t *count) const {
+    if (!baseline) {
+        *count = 0;
+        return NULL;
+    }
+
+    *count = baseline->changed_count;
+    return baseline->changed_chunks;
+}
+
+void state_t::revert_chunks_to_baseline(const ivector3_t *chunk_coords, uint32_t count) {
+    if (!baseline) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *voxels = baseline->get_voxels(chunk_coords[i]);
+        chunk_t *chunk = voxels ? get_chunk(chunk_coords[i]) : access_chunk(chunk_coords[i]);
+
+        if (!chunk) {
+            continue;
+        }
+
+        // Values and colors are in the same block
+        uint8_t *block = chunk->get_writable_values();
+
+        if (voxels) {
+            memcpy(block, voxels, CHUNK_BYTE_SIZE);
+        }
+        else {
+            memset(block, 0, CHUNK_BYTE_SIZE);
+        }
+
+        chunk->update_occupancy();
+        chunk->compact();
 
-    int32_t diameter = (int32_t)radius * 2 + 1;
+        chunk->flags.unsaved = 1;
+        chunk->flags.changed_since_baseline = 0;
 
-    for (int32_t z = start_z; z < start_z + diameter; ++z) {
-        for (int32_t y = start_y; y < start_y + diameter; ++y) {
-            for (int32_t x = start_x; x < start_x + diameter; ++x) {
-                to_apply(x, y, z);
+        // The neighbours' meshes sample the chunk's voxels too
+        for (uint32_t n = 0; n < CHUNK_NEIGHBOUR_COUNT; ++n) {
+            if (chunk->neighbours[n]) {
+                chunk->neighbours[n]->flags.has_to_update_vertices = 1;
             }
         }
     }
 }
 
+uint32_t state_t::reset_to_baseline() {
+    uint32_t count = 0;
+    const ivector3_t *changed_chunks = get_changed_baseline_chunks(&count);
+
+    revert_chunks_to_baseline(changed_chunks, count);
+
+    if (baseline) {
+        baseline->changed_count = 0;
+    }
+
+    return count;
+}
+
+/*
+  The generators gather (and create) the chunks on the calling thread, in
+  the same order as edit_sphere_region() / edit_region() would, and then
+  fill them on the worker pool, a job per chunk.
+*/
+struct chunk_job_t {
+    chunk_t *chunk;
+    chunk_span_t span;
+    // Voxels of chunks which didn't exist yet (see generate_math_equation)
+    uint8_t *block;
+    // Set by the job if it wrote to the chunk
+    bool changed;
+};
+
+static chunk_job_t *s_allocate_chunk_jobs(const ivector3_t &vs_min, const ivector3_t &vs_max) {
+    ivector3_t chunk_count = space_voxel_to_chunk(vs_max) - space_voxel_to_chunk(vs_min) + ivector3_t(1);
+    return flmalloc<chunk_job_t>(MAX(chunk_count.x * chunk_count.y * chunk_count.z, 1));
+}
+
+static chunk_job_t *s_gather_sphere_jobs(state_t *state, const ivector3_t &vs_center, float radius, uint32_t *job_count) {
+    chunk_job_t *jobs = s_allocate_chunk_jobs(
+        vs_center - ivector3_t((int32_t)radius),
+        vs_center + ivector3_t((int32_t)radius));
+
+    *job_count = 0;
+
+    state->edit_sphere_region(vs_center, radius, [state, jobs, job_count] (chunk_t *chunk, const chunk_span_t &span) {
+        chunk_job_t *job = &jobs[(*job_count)++];
+        job->chunk = chunk;
+        job->span = span;
+        job->block = NULL;
+        job->changed = 1;
+
+        // All of these get written
+        s_track_baseline_change(state, chunk);
+    });
+
+    return jobs;
+}
+
 void state_t::generate_hollow_sphere(sphere_create_info_t *info) {
+    finish_map_stream();
+
     float (* generation_proc)(float distance_squared, float radius_squared);
     switch(info->type) {
     case GT_ADDITIVE: {
@@ -547,77 +1101,49 @@ void state_t::generate_hollow_sphere(sphere_create_info_t *info) {
     ivector3_t vs_center = space_world_to_voxel(info->ws_center);
     vector3_t vs_float_center = (vector3_t)(vs_center);
 
-    ivector3_t current_chunk_coord = space_voxel_to_chunk(vs_center);
-
-    chunk_t *current_chunk = get_chunk(
-        current_chunk_coord);
-
-    current_chunk->flags.has_to_update_vertices = 1;
-
-    int32_t diameter = (int32_t)info->ws_radius * 2 + 1;
-
-    int32_t start_z = vs_center.z - (int32_t)info->ws_radius;
-    int32_t start_y = vs_center.y - (int32_t)info->ws_radius;
-    int32_t start_x = vs_center.x - (int32_t)info->ws_radius;
-
     float radius_squared = info->ws_radius * info->ws_radius;
     float smaller_radius_squared = (info->ws_radius - 10) * (info->ws_radius - 10);
 
-    for (int32_t z = start_z; z < start_z + diameter; ++z) {
-        for (int32_t y = start_y; y < start_y + diameter; ++y) {
-            for (int32_t x = start_x; x < start_x + diameter; ++x) {
-                ivector3_t vs_position = ivector3_t(x, y, z);
-                vector3_t vs_float = vector3_t((float)x, (float)y, (float)z);
-                vector3_t vs_diff_float = vs_float - vs_float_center;
-
-                float distance_squared = glm::dot(vs_diff_float, vs_diff_float);
-
-                if (distance_squared <= radius_squared) {
-                    ivector3_t c = space_voxel_to_chunk(vs_position);
+    uint32_t job_count = 0;
+    chunk_job_t *jobs = s_gather_sphere_jobs(this, vs_center, info->ws_radius, &job_count);
 
-                    ivector3_t chunk_origin_diff = vs_position - current_chunk_coord * (int32_t)CHUNK_EDGE_LENGTH;
-                    if (chunk_origin_diff.x >= 0 && chunk_origin_diff.x < 16 &&
-                        chunk_origin_diff.y >= 0 && chunk_origin_diff.y < 16 &&
-                        chunk_origin_diff.z >= 0 && chunk_origin_diff.z < 16) {
-                        // Is within current chunk boundaries
-                        float proportion = generation_proc(distance_squared, smaller_radius_squared);
-
-                        ivector3_t voxel_coord = chunk_origin_diff;
+    get_worker_pool()->run(job_count, [&] (uint32_t job_index) {
+        chunk_t *chunk = jobs[job_index].chunk;
+        const chunk_span_t &span = jobs[job_index].span;
 
-                        voxel_t *v = &current_chunk->voxels[get_voxel_index(voxel_coord.x, voxel_coord.y, voxel_coord.z)];
-                        uint8_t new_value = (uint32_t)((proportion) * info->max_value);
-                        if (v->value < new_value) {
-                            v->value = new_value;
-                            v->color = info->color;
-                        }
-                    }
-                    else {
-                        ivector3_t c = space_voxel_to_chunk(vs_position);
+        chunk->flags.has_to_update_vertices = 1;
+        chunk->flags.unsaved = 1;
 
-                        // In another chunk, need to switch current_chunk pointer
-                        current_chunk = get_chunk(c);
-                        current_chunk_coord = c;
+        for (int32_t z = span.local_min.z; z <= span.local_max.z; ++z) {
+            for (int32_t y = span.local_min.y; y <= span.local_max.y; ++y) {
+                for (int32_t x = span.local_min.x; x <= span.local_max.x; ++x) {
+                    vector3_t vs_float = (vector3_t)(span.vs_origin + ivector3_t(x, y, z));
+                    vector3_t vs_diff_float = vs_float - vs_float_center;
 
-                        current_chunk->flags.has_to_update_vertices = 1;
+                    float distance_squared = glm::dot(vs_diff_float, vs_diff_float);
 
+                    if (distance_squared <= radius_squared) {
                         float proportion = generation_proc(distance_squared, smaller_radius_squared);
 
-                        ivector3_t voxel_coord = vs_position - current_chunk_coord * CHUNK_EDGE_LENGTH;
-
-                        voxel_t *v = &current_chunk->voxels[get_voxel_index(voxel_coord.x, voxel_coord.y, voxel_coord.z)];
+                        uint32_t index = get_voxel_index(x, y, z);
                         uint8_t new_value = (uint32_t)((proportion) * info->max_value);
-                        if (v->value < new_value) {
-                            v->value = new_value;
-                            v->color = info->color;
+                        if (chunk->values[index] < new_value) {
+                            chunk->set_voxel(index, new_value, info->color);
                         }
                     }
                 }
             }
         }
-    }
+
+        chunk->update_occupancy(span.local_min, span.local_max);
+    }, info->progress, info->progress_data);
+
+    flfree(jobs);
 }
 
 void state_t::generate_sphere(sphere_create_info_t *info) {
+    finish_map_stream();
+
     float (* generation_proc)(float distance_squared, float radius_squared);
     switch(info->type) {
     case GT_ADDITIVE: generation_proc = [] (float dsqu, float rsqu) {return 1.0f - (dsqu / rsqu);}; break;
@@ -627,75 +1153,45 @@ void state_t::generate_sphere(sphere_create_info_t *info) {
     ivector3_t vs_center = space_world_to_voxel(info->ws_center);
     vector3_t vs_float_center = (vector3_t)(vs_center);
 
-    ivector3_t current_chunk_coord = space_voxel_to_chunk(vs_center);
-
-    chunk_t *current_chunk = get_chunk(
-        current_chunk_coord);
-
-    current_chunk->flags.has_to_update_vertices = 1;
-
-    int32_t diameter = (int32_t)info->ws_radius * 2 + 1;
-
-    int32_t start_z = vs_center.z - (int32_t)info->ws_radius;
-    int32_t start_y = vs_center.y - (int32_t)info->ws_radius;
-    int32_t start_x = vs_center.x - (int32_t)info->ws_radius;
-
     float radius_squared = info->ws_radius * info->ws_radius;
 
-    for (int32_t z = start_z; z < start_z + diameter; ++z) {
-        for (int32_t y = start_y; y < start_y + diameter; ++y) {
-            for (int32_t x = start_x; x < start_x + diameter; ++x) {
-                ivector3_t vs_position = ivector3_t(x, y, z);
-                vector3_t vs_float = vector3_t((float)x, (float)y, (float)z);
-                vector3_t vs_diff_float = vs_float - vs_float_center;
-
-                float distance_squared = glm::dot(vs_diff_float, vs_diff_float);
-
-                if (distance_squared <= radius_squared) {
-                    ivector3_t c = space_voxel_to_chunk(vs_position);
-
-                    ivector3_t chunk_origin_diff = vs_position - current_chunk_coord * (int32_t)CHUNK_EDGE_LENGTH;
-                    //if (c.x == current_chunk_coord.x && c.y == current_chunk_coord.y && c.z == current_chunk_coord.z) {
-                    if (chunk_origin_diff.x >= 0 && chunk_origin_diff.x < 16 &&
-                        chunk_origin_diff.y >= 0 && chunk_origin_diff.y < 16 &&
-                        chunk_origin_diff.z >= 0 && chunk_origin_diff.z < 16) {
-                        // Is within current chunk boundaries
-                        float proportion = generation_proc(distance_squared, radius_squared);
-
-                        ivector3_t voxel_coord = chunk_origin_diff;
+    uint32_t job_count = 0;
+    chunk_job_t *jobs = s_gather_sphere_jobs(this, vs_center, info->ws_radius, &job_count);
 
-                        //current_chunk->voxels[get_voxel_index(voxel_coord.x, voxel_coord.y, voxel_coord.z)] = (uint32_t)((proportion) * (float)MAX_VOXEL_VALUE_I);
+    get_worker_pool()->run(job_count, [&] (uint32_t job_index) {
+        chunk_t *chunk = jobs[job_index].chunk;
+        const chunk_span_t &span = jobs[job_index].span;
 
-                        voxel_t *v = &current_chunk->voxels[get_voxel_index(voxel_coord.x, voxel_coord.y, voxel_coord.z)];
-                        uint8_t new_value = (uint32_t)((proportion) * info->max_value);
-                        v->value = new_value;
-                        v->color = info->color;
-                    }
-                    else {
-                        ivector3_t c = space_voxel_to_chunk(vs_position);
+        chunk->flags.has_to_update_vertices = 1;
+        chunk->flags.unsaved = 1;
 
-                        // In another chunk, need to switch current_chunk pointer
-                        current_chunk = get_chunk(c);
-                        current_chunk_coord = c;
+        for (int32_t z = span.local_min.z; z <= span.local_max.z; ++z) {
+            for (int32_t y = span.local_min.y; y <= span.local_max.y; ++y) {
+                for (int32_t x = span.local_min.x; x <= span.local_max.x; ++x) {
+                    vector3_t vs_float = (vector3_t)(span.vs_origin + ivector3_t(x, y, z));
+                    vector3_t vs_diff_float = vs_float - vs_float_center;
 
-                        current_chunk->flags.has_to_update_vertices = 1;
+                    float distance_squared = glm::dot(vs_diff_float, vs_diff_float);
 
+                    if (distance_squared <= radius_squared) {
                         float proportion = generation_proc(distance_squared, radius_squared);
 
-                        ivector3_t voxel_coord = vs_position - current_chunk_coord * CHUNK_EDGE_LENGTH;
-
-                        voxel_t *v = &current_chunk->voxels[get_voxel_index(voxel_coord.x, voxel_coord.y, voxel_coord.z)];
                         uint8_t new_value = (uint32_t)((proportion) * info->max_value);
-                        v->value = new_value;
-                        v->color = info->color;
+                        chunk->set_voxel(get_voxel_index(x, y, z), new_value, info->color);
                     }
                 }
             }
         }
-    }
+
+        chunk->update_occupancy(span.local_min, span.local_max);
+    }, info->progress, info->progress_data);
+
+    flfree(jobs);
 }
 
 void state_t::generate_platform(platform_create_info_t *info) {
+    finish_map_stream();
+
     uint8_t (* generation_proc)();
     switch (info->type) {
     case GT_ADDITIVE: generation_proc = [] () -> uint8_t {return 80;}; break;
@@ -704,21 +1200,27 @@ void state_t::generate_platform(platform_create_info_t *info) {
 
     ivector3_t centeriv3 = (ivector3_t)(info->position);
 
-    for (int32_t z = centeriv3.z - (int32_t)info->depth / 2; z < centeriv3.z + (int32_t)info->depth / 2; ++z) {
-        for (int32_t x = centeriv3.x - (int32_t)info->width / 2; x < centeriv3.x + (int32_t)info->width / 2; ++x) {
-            ivector3_t voxel_coord = ivector3_t((float)x, -2.0f, (float)z);
-            ivector3_t chunk_coord = space_voxel_to_chunk(voxel_coord);
-            chunk_t *chunk = get_chunk(chunk_coord);
-            chunk->flags.has_to_update_vertices = 1;
-            ivector3_t local_coord = space_voxel_to_local_chunk(voxel_coord);
-            uint32_t index = get_voxel_index(local_coord.x, local_coord.y, local_coord.z);
-            chunk->voxels[index].value = generation_proc();
-            chunk->voxels[index].color = info->color;
+    ivector3_t vs_min = ivector3_t(centeriv3.x - (int32_t)info->width / 2, -2, centeriv3.z - (int32_t)info->depth / 2);
+    ivector3_t vs_max = ivector3_t(centeriv3.x + (int32_t)info->width / 2 - 1, -2, centeriv3.z + (int32_t)info->depth / 2 - 1);
+
+    edit_region(vs_min, vs_max, [&] (chunk_t *chunk, const chunk_span_t &span) {
+        chunk->flags.has_to_update_vertices = 1;
+        chunk->flags.unsaved = 1;
+        s_track_baseline_change(this, chunk);
+
+        for (int32_t z = span.local_min.z; z <= span.local_max.z; ++z) {
+            for (int32_t x = span.local_min.x; x <= span.local_max.x; ++x) {
+                chunk->set_voxel(get_voxel_index(x, span.local_min.y, z), generation_proc(), info->color);
+            }
         }
-    }
+
+        chunk->update_occupancy(span.local_min, span.local_max);
+    });
 }
 
 void state_t::generate_math_equation(math_equation_create_info_t *info) {
+    finish_map_stream();
+
     uint8_t (* generation_proc)(float equation_result);
     switch (info->type) {
     case GT_ADDITIVE: generation_proc = [] (float equation_result) {return (uint8_t)(150.0f * equation_result);}; break;
@@ -728,114 +1230,234 @@ void state_t::generate_math_equation(math_equation_create_info_t *info) {
     ivector3_t centeriv3 = (ivector3_t)(info->ws_center);
     ivector3_t extentiv3 = (ivector3_t)(info->ws_extent);
 
-    for (int32_t z = centeriv3.z - extentiv3.z / 2; z < centeriv3.z + extentiv3.z / 2; ++z) {
-        for (int32_t y = centeriv3.y - extentiv3.y / 2; y < centeriv3.y + extentiv3.y / 2; ++y) {
-            for (int32_t x = centeriv3.x - extentiv3.x / 2; x < centeriv3.x + extentiv3.x / 2; ++x) {
-                float c = info->equation((float)(x - centeriv3.x), (float)(y - centeriv3.y), (float)(z - centeriv3.z));
+    ivector3_t vs_min = centeriv3 - extentiv3 / 2;
+    ivector3_t vs_max = centeriv3 + extentiv3 / 2 - ivector3_t(1);
+
+    chunk_job_t *jobs = s_allocate_chunk_jobs(vs_min, vs_max);
+    uint32_t job_count = 0;
+
+    for_each_chunk_span(vs_min, vs_max, [this, jobs, &job_count] (const chunk_span_t &span) {
+        chunk_job_t *job = &jobs[job_count++];
+        job->chunk = access_chunk(span.chunk_coord);
+        job->span = span;
+        job->block = NULL;
+        job->changed = 0;
+    });
+
+    get_worker_pool()->run(job_count, [&] (uint32_t job_index) {
+        chunk_job_t *job = &jobs[job_index];
+        const chunk_span_t &span = job->span;
+
+        uint8_t *values = NULL;
+        voxel_color_t *colors = NULL;
+
+        for (int32_t z = span.local_min.z; z <= span.local_max.z; ++z) {
+            for (int32_t y = span.local_min.y; y <= span.local_max.y; ++y) {
+                for (int32_t x = span.local_min.x; x <= span.local_max.x; ++x) {
+                    ivector3_t vs_position = span.vs_origin + ivector3_t(x, y, z);
+
+                    float c = info->equation(
+                        (float)(vs_position.x - centeriv3.x),
+                        (float)(vs_position.y - centeriv3.y),
+                        (float)(vs_position.z - centeriv3.z));
+
+                    if (c > 0.0f) {
+                        if (!values) {
+                            if (job->chunk) {
+                                job->chunk->flags.has_to_update_vertices = 1;
+                                job->chunk->flags.unsaved = 1;
+                                job->changed = 1;
+                                values = job->chunk->get_writable_values();
+                                colors = job->chunk->get_writable_colors();
+                            }
+                            else {
+                                // Chunks can't get created from the workers: new chunks are all air, so fill an air block instead
+                                job->block = flmalloc<uint8_t>(CHUNK_BYTE_SIZE);
+                                values = job->block;
+                                colors = job->block + CHUNK_VOXEL_COUNT;
+                            }
+                        }
 
-                if (c > 0.0f) {
-                    ivector3_t voxel_coord = ivector3_t((float)x, (float)y, (float)z);
-                    ivector3_t chunk_coord = space_voxel_to_chunk(voxel_coord);
-                    chunk_t *chunk = get_chunk(chunk_coord);
-                    chunk->flags.has_to_update_vertices = 1;
-                    ivector3_t local_coord = space_voxel_to_local_chunk(voxel_coord);
-                    uint32_t index = get_voxel_index(local_coord.x, local_coord.y, local_coord.z);
-                    chunk->voxels[index].value = generation_proc(c);
-                    chunk->voxels[index].color = info->color;
+                        uint32_t index = get_voxel_index(x, y, z);
+                        values[index] = generation_proc(c);
+                        colors[index] = info->color;
+                    }
                 }
             }
         }
+
+        if (job->chunk && values) {
+            job->chunk->update_occupancy(span.local_min, span.local_max);
+        }
+    }, info->progress, info->progress_data);
+
+    // Only creates the chunks in which the equation is positive somewhere (in the same order as before)
+    for (uint32_t i = 0; i < job_count; ++i) {
+        chunk_job_t *job = &jobs[i];
+
+        if (job->changed) {
+            s_track_baseline_change(this, job->chunk);
+        }
+
+        if (job->block) {
+            chunk_t *chunk = get_chunk(job->span.chunk_coord);
+            chunk->flags.has_to_update_vertices = 1;
+            chunk->flags.unsaved = 1;
+            s_track_baseline_change(this, chunk);
+
+            memcpy(chunk->get_writable_values(), job->block, CHUNK_VOXEL_COUNT);
+            memcpy(chunk->get_writable_colors(), job->block + CHUNK_VOXEL_COUNT, CHUNK_VOXEL_COUNT);
+            chunk->update_occupancy(job->span.local_min, job->span.local_max);
+
+            flfree(job->block);
+        }
     }
+
+    flfree(jobs);
 }
 
-bool state_t::terraform_with_history(terraform_info_t *info) {
-    if (info->package->ray_hit_terrain) {
-        ivector3_t voxel = space_world_to_voxel(info->package->ws_position);
-        ivector3_t chunk_coord = space_voxel_to_chunk(voxel);
-        chunk_t *chunk = access_chunk(chunk_coord);
+void state_t::generate_terrain(const terrain_create_info_t *info) {
+    finish_map_stream();
+
+    ivector3_t centeriv3 = (ivector3_t)(info->ws_center);
+    ivector3_t extentiv3 = (ivector3_t)(info->ws_extent);
+
+    ivector3_t vs_min = centeriv3 - extentiv3 / 2;
+    ivector3_t vs_max = centeriv3 + extentiv3 / 2 - ivector3_t(1);
 
-        if (!chunk->flags.made_modification) {
-            // Push this chunk onto list of modified chunks
-            modified_chunks[modified_chunk_count++] = chunk;
+    chunk_job_t *jobs = s_allocate_chunk_jobs(vs_min, vs_max);
+    uint32_t job_count = 0;
+
+    for_each_chunk_span(vs_min, vs_max, [this, jobs, &job_count] (const chunk_span_t &span) {
+        chunk_job_t *job = &jobs[job_count++];
+        job->chunk = access_chunk(span.chunk_coord);
+        job->span = span;
+        job->block = NULL;
+        job->changed = 0;
+    });
+
+    // The workers can't pick it themselves (the first call writes it)
+    terraform_kernel_t kernel = get_terrain_kernel();
+
+    // Each voxel only depends on info and on its position, so this is the same whatever the amount of workers is
+    get_worker_pool()->run(job_count, [&] (uint32_t job_index) {
+        chunk_job_t *job = &jobs[job_index];
+        const chunk_span_t &span = job->span;
+
+        if (job->chunk) {
+            // Whatever was there gets replaced
+            job->chunk->flags.has_to_update_vertices = 1;
+            job->chunk->flags.unsaved = 1;
+            job->changed = 1;
+
+            generate_terrain_span(info, kernel, job->chunk->get_writable_values(), job->chunk->get_writable_colors(), span);
+            job->chunk->update_occupancy(span.local_min, span.local_max);
         }
-                    
-        chunk->flags.made_modification = 1;
-        chunk->flags.has_to_update_vertices = 1;
+        else if (!is_terrain_span_air(info, span)) {
+            job->block = flmalloc<uint8_t>(CHUNK_BYTE_SIZE);
 
-        float coeff = 0.0f;
-        switch(info->type) {
-        case TT_DESTROY: {coeff = -1.0f;} break;
-        case TT_BUILD: {coeff = +1.0f;} break;
+            if (!generate_terrain_span(info, kernel, job->block, job->block + CHUNK_VOXEL_COUNT, span)) {
+                flfree(job->block);
+                job->block = NULL;
+            }
         }
+    }, info->progress, info->progress_data);
 
-        float radius_squared = info->radius * info->radius;
-        ivector3_t bottom_corner = voxel - ivector3_t((int32_t)info->radius);
-        int32_t diameter = (int32_t)info->radius * 2 + 1;
+    for (uint32_t i = 0; i < job_count; ++i) {
+        chunk_job_t *job = &jobs[i];
 
-        for (int32_t z = bottom_corner.z; z < bottom_corner.z + diameter; ++z) {
-            for (int32_t y = bottom_corner.y; y < bottom_corner.y + diameter; ++y) {
-                for (int32_t x = bottom_corner.x; x < bottom_corner.x + diameter; ++x) {
-                    vector3_t current_voxel = vector3_t((float)x, (float)y, (float)z);
-                    vector3_t diff = current_voxel - (vector3_t)voxel;
-                    float distance_squared = glm::dot(diff, diff);
+        if (job->changed) {
+            s_track_baseline_change(this, job->chunk);
+        }
 
-                    if (distance_squared <= radius_squared) {
-                        ivector3_t current_local_coord = (ivector3_t)current_voxel - chunk->xs_bottom_corner;
-                                
-                        if (current_local_coord.x < 0 || current_local_coord.x >= 16 ||
-                            current_local_coord.y < 0 || current_local_coord.y >= 16 ||
-                            current_local_coord.z < 0 || current_local_coord.z >= 16) {
-                            // If the current voxel coord is out of bounds, switch chunks
-                            ivector3_t chunk_coord = space_voxel_to_chunk(current_voxel);
-                            chunk_t *new_chunk = get_chunk(chunk_coord);
-
-                            chunk = new_chunk;
-
-                            if (!chunk->flags.made_modification) {
-                                // Push this chunk onto list of modified chunks
-                                modified_chunks[modified_chunk_count++] = chunk;
-                            }
-                                        
-                            chunk->flags.made_modification = 1;
-                            chunk->flags.has_to_update_vertices = 1;
+        if (job->block) {
+            chunk_t *chunk = get_chunk(job->span.chunk_coord);
+            chunk->flags.has_to_update_vertices = 1;
+            chunk->flags.unsaved = 1;
+            s_track_baseline_change(this, chunk);
 
-                            current_local_coord = (ivector3_t)current_voxel - chunk->xs_bottom_corner;
-                        }
+            memcpy(chunk->get_writable_values(), job->block, CHUNK_VOXEL_COUNT);
+            memcpy(chunk->get_writable_colors(), job->block + CHUNK_VOXEL_COUNT, CHUNK_VOXEL_COUNT);
+            chunk->update_occupancy(job->span.local_min, job->span.local_max);
+            // Deep down, chunks can be all rock
+            chunk->compact();
 
-                        uint32_t voxel_index = get_voxel_index(current_local_coord.x, current_local_coord.y, current_local_coord.z);
-                        voxel_t *voxel = &chunk->voxels[voxel_index];
-                        uint8_t voxel_value = voxel->value;
-                        float proportion = 1.0f - (distance_squared / radius_squared);
+            flfree(job->block);
+        }
+    }
 
-                        int32_t current_voxel_value = (int32_t)voxel->value;
+    flfree(jobs);
+}
 
-                        int32_t new_value = (int32_t)(proportion * coeff * info->dt * info->speed) + current_voxel_value;
+/*
+  The history records the initial values of the voxels, which the netcode
+  needs (see net::fill_chunk_modification_array_with_initial_values).
+*/
+static void s_track_modified_chunk(state_t *state, chunk_t *chunk) {
+    uint32_t word = chunk->chunk_stack_index / 64;
+    uint64_t bit = 1ull << (chunk->chunk_stack_index % 64);
+
+    if (word >= state->modified_bit_word_count) {
+        // There are more chunk slots than when the bits were allocated
+        uint32_t new_word_count = MAX((state->chunks.max_size + 63) / 64, word + 1);
+        uint64_t *new_bits = flmalloc<uint64_t>(new_word_count);
+        memcpy(new_bits, state->modified_chunk_bits, sizeof(uint64_t) * state->modified_bit_word_count);
+        flfree(state->modified_chunk_bits);
+
+        state->modified_chunk_bits = new_bits;
+        state->modified_bit_word_count = new_word_count;
+    }
 
-                        uint8_t *vh = &chunk->history.modification_pool[voxel_index];
-                                    
-                        if (new_value > (int32_t)CHUNK_MAX_VOXEL_VALUE_I) {
-                            voxel_value = (int32_t)CHUNK_MAX_VOXEL_VALUE_I;
-                        }
-                        else if (new_value < 0) {
-                            voxel_value = 0;
-                        }
-                        else {
-                            voxel_value = (uint8_t)new_value;
-                        }
+    if (!(state->modified_chunk_bits[word] & bit)) {
+        // First modification since the last reset_modification_tracker()
+        state->modified_chunk_bits[word] |= bit;
 
-                        // Didn't add to the history yet
-                        if (*vh == CHUNK_SPECIAL_VALUE && voxel_value != voxel->value) {
-                            *vh = voxel->value;
-                            chunk->history.modification_stack[chunk->history.modification_count++] = voxel_index;
-                        }
-                                    
-                        voxel->value = voxel_value;
-                        voxel->color = info->package->color;
-                    }
-                }
-            }
+        if (state->modified_chunk_count == state->max_modified_chunks) {
+            uint32_t new_max = state->max_modified_chunks * 2;
+            chunk_t **new_modified_chunks = flmalloc<chunk_t *>(new_max);
+            memcpy(new_modified_chunks, state->modified_chunks, sizeof(chunk_t *) * state->modified_chunk_count);
+            flfree(state->modified_chunks);
+
+            state->modified_chunks = new_modified_chunks;
+            state->max_modified_chunks = new_max;
+        }
+
+        state->modified_chunks[state->modified_chunk_count++] = chunk;
+        chunk->history = state->history_pool.attach();
+    }
+
+    chunk->flags.made_modification = 1;
+}
+
+bool state_t::terraform_with_history(terraform_info_t *info) {
+    if (info->package->ray_hit_terrain) {
+        ivector3_t voxel = space_world_to_voxel(info->package->ws_position);
+
+        float coeff = 0.0f;
+        switch(info->type) {
+        case TT_DESTROY: {coeff = -1.0f;} break;
+        case TT_BUILD: {coeff = +1.0f;} break;
         }
 
+        terraform_brush_t brush = {};
+        brush.vs_center = (vector3_t)voxel;
+        brush.radius_squared = info->radius * info->radius;
+        brush.coeff = coeff;
+        brush.dt = info->dt;
+        brush.speed = info->speed;
+        brush.color = info->package->color;
+
+        edit_sphere_region(voxel, info->radius, [&] (chunk_t *chunk, const chunk_span_t &span) {
+            s_track_modified_chunk(this, chunk);
+            chunk->flags.has_to_update_vertices = 1;
+            chunk->flags.unsaved = 1;
+            s_track_baseline_change(this, chunk);
+
+            apply_terraform_brush(&brush, chunk, span, chunk->history);
+
+            chunk->update_occupancy(span.local_min, span.local_max);
+        });
+
         return 1;
     }
 
@@ -850,13 +1472,10 @@ bool state_t::terraform_without_history(terraform_info_t *info) {
 
         if (chunk) {
             ivector3_t local_voxel_coord = space_voxel_to_local_chunk(voxel);
-            voxel_t *voxel_ptr = &chunk->voxels[get_voxel_index(local_voxel_coord.x, local_voxel_coord.y, local_voxel_coord.z)];
-            if (voxel_ptr->value > CHUNK_SURFACE_LEVEL) {
+            uint8_t voxel_value = chunk->values[get_voxel_index(local_voxel_coord.x, local_voxel_coord.y, local_voxel_coord.z)];
+            if (voxel_value > CHUNK_SURFACE_LEVEL) {
                 info->package->ray_hit_terrain = 1;
 
-                chunk->flags.made_modification = 1;
-                chunk->flags.has_to_update_vertices = 1;
-
                 float coeff = 0.0f;
                 switch(info->type) {
                         
@@ -870,61 +1489,24 @@ bool state_t::terraform_without_history(terraform_info_t *info) {
                         
                 }
 
-                float radius_squared = info->radius * info->radius;
-                ivector3_t bottom_corner = voxel - ivector3_t((int32_t)info->radius);
-                int32_t diameter = (int32_t)info->radius * 2 + 1;
-
-                for (int32_t z = bottom_corner.z; z < bottom_corner.z + diameter; ++z) {
-                    for (int32_t y = bottom_corner.y; y < bottom_corner.y + diameter; ++y) {
-                        for (int32_t x = bottom_corner.x; x < bottom_corner.x + diameter; ++x) {
-                            vector3_t current_voxel = vector3_t((float)x, (float)y, (float)z);
-                            vector3_t diff = current_voxel - (vector3_t)voxel;
-                            float distance_squared = glm::dot(diff, diff);
-
-                            if (distance_squared <= radius_squared) {
-                                ivector3_t current_local_coord = (ivector3_t)current_voxel - chunk->xs_bottom_corner;
-                                
-                                if (current_local_coord.x < 0 || current_local_coord.x >= 16 ||
-                                    current_local_coord.y < 0 || current_local_coord.y >= 16 ||
-                                    current_local_coord.z < 0 || current_local_coord.z >= 16) {
-                                    // If the current voxel coord is out of bounds, switch chunks
-                                    ivector3_t chunk_coord = space_voxel_to_chunk(current_voxel);
-                                    chunk_t *new_chunk = get_chunk(chunk_coord);
-
-                                    chunk = new_chunk;
-                                    chunk->flags.made_modification = 1;
-                                    chunk->flags.has_to_update_vertices = 1;
-
-                                    current_local_coord = (ivector3_t)current_voxel - chunk->xs_bottom_corner;
-                                }
-
-                                uint32_t voxel_index = get_voxel_index(current_local_coord.x, current_local_coord.y, current_local_coord.z);
-
-                                voxel_t *voxel = &chunk->voxels[voxel_index];
-                                float proportion = 1.0f - (distance_squared / radius_squared);
-
-                                int32_t current_voxel_value = (int32_t)voxel->value;
-
-                                int32_t new_value = (int32_t)(proportion * coeff * info->dt * info->speed) + current_voxel_value;
-
-                                uint8_t voxel_value = 0;
-                                    
-                                if (new_value > (int32_t)CHUNK_MAX_VOXEL_VALUE_I) {
-                                    voxel_value = (int32_t)CHUNK_MAX_VOXEL_VALUE_I;
-                                }
-                                else if (new_value < 0) {
-                                    voxel_value = 0;
-                                }
-                                else {
-                                    voxel_value = (uint8_t)new_value;
-                                }
-
-                                voxel->value = voxel_value;
-                                voxel->color = info->package->color;
-                            }
-                        }
-                    }
-                }
+                terraform_brush_t brush = {};
+                brush.vs_center = (vector3_t)voxel;
+                brush.radius_squared = info->radius * info->radius;
+                brush.coeff = coeff;
+                brush.dt = info->dt;
+                brush.speed = info->speed;
+                brush.color = info->package->color;
+
+                edit_sphere_region(voxel, info->radius, [&] (chunk_t *chunk, const chunk_span_t &span) {
+                    chunk->flags.made_modification = 1;
+                    chunk->flags.has_to_update_vertices = 1;
+                    chunk->flags.unsaved = 1;
+                    s_track_baseline_change(this, chunk);
+
+                    apply_terraform_brush(&brush, chunk, span, NULL);
+
+                    chunk->update_occupancy(span.local_min, span.local_max);
+                });
             }
         }
 
@@ -935,6 +1517,15 @@ bool state_t::terraform_without_history(terraform_info_t *info) {
 }
 
 bool state_t::terraform(terraform_info_t *info) {
+    if (map_stream && info->package->ray_hit_terrain) {
+        // The blocks which are still getting loaded would overwrite the changes (same box as edit_sphere_region())
+        ivector3_t voxel = space_world_to_voxel(info->package->ws_position);
+        ivector3_t radius = ivector3_t((int32_t)info->radius);
+
+        if (is_region_streaming(voxel - radius, voxel + radius))
+            return 0;
+    }
+
     if (flags.track_history)
         return terraform_with_history(info);
     else
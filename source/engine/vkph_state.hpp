@@ -3,14 +3,18 @@
 #include "vkph_map.hpp"
 #include "vkph_team.hpp"
 #include "vkph_player.hpp"
+#include "vkph_chunk.hpp"
 #include "vkph_weapon.hpp"
 #include "vkph_constant.hpp"
 #include "vkph_terraform.hpp"
 #include "vkph_projectile.hpp"
+#include "vkph_terrain_generator.hpp"
+#include "vkph_chunk_index.hpp"
 #include "vkph_projectile_tracker.hpp"
 
 #include <stdint.h>
 #include <files.hpp>
+#include <allocators.hpp>
 #include <containers.hpp>
 
 #include <net_chunk_tracker.hpp>
@@ -21,6 +25,53 @@ enum class game_mode_t { DEATHMATCH, CAPTURE_THE_FLAG, INVALID };
 
 struct chunk_t;
 
+/*
+  Amount of chunks / voxels which got modified between two calls to
+  state_t::reset_modification_tracker() (on the server, between two game
+  state snapshots), for monitoring.
+*/
+struct modification_stats_t {
+    // Last interval
+    uint32_t chunk_count;
+    uint32_t voxel_count;
+
+    // Highest of all the intervals
+    uint32_t max_chunk_count;
+    uint32_t max_voxel_count;
+
+    uint64_t interval_count;
+    uint64_t total_chunk_count;
+    uint64_t total_voxel_count;
+};
+
+/*
+  Counters of the terrain collision queries (see vkph_physics.hpp), for
+  monitoring. The queries only get a const state, so these are mutable.
+*/
+struct collision_stats_t {
+    // collide_and_slide() calls (not counting the recursions) and their recursions
+    uint64_t sweep_count;
+    uint64_t sweep_recursion_count;
+    // check_ray_terrain_collision() calls (rocks), and cast_terrain_ray() calls / cast_terrain_rays() rays
+    uint64_t ray_test_count;
+    uint64_t terrain_ray_count;
+    // Cells the terrain rays went through, and the ones whose triangles they had to test
+    uint64_t terrain_ray_cell_count;
+    uint64_t terrain_ray_surface_cell_count;
+
+    // Triangles in the boxes around the queries, and the ones left after culling against the swept spheres
+    uint64_t gathered_triangle_count;
+    uint64_t tested_triangle_count;
+
+    // Total / longest time spent in each kind of query (not counting cast_terrain_rays(), its rays run on several threads)
+    uint64_t sweep_ns;
+    uint64_t max_sweep_ns;
+    uint64_t ray_test_ns;
+    uint64_t max_ray_test_ns;
+    uint64_t terrain_ray_ns;
+    uint64_t max_terrain_ray_ns;
+};
+
 /*
   Most of these members need to be public simply because the
   client and server code need to have a lot of control over this
@@ -47,16 +98,54 @@ struct state_t {
     // Map ////////////////////////////////////////////////////////////////////
     const char *current_map_path;
     map_t current_map_data;
+    // What start_session() streams the map around if flags.has_map_focus is set (see configure_map())
+    vector3_t map_focus;
+    // What start_session() generates if flags.generate_terrain is set (instead of loading current_map_path)
+    terrain_create_info_t terrain_info;
+    // Not NULL while a map is getting loaded in the background (see stream_map())
+    struct map_stream_t *map_stream;
+    // Chunks which the map stream published, in order (see get_streamed_chunks())
+    ivector3_t *streamed_chunks;
+    uint32_t streamed_chunk_count;
+    uint32_t streamed_chunk_capacity;
+    // Not NULL while a map is getting saved in the background (see save_map_in_background())
+    struct map_snapshot_t *map_snapshot;
+    // Not NULL once a baseline got captured / received (see capture_baseline())
+    struct map_baseline_t *baseline;
 
     // Chunks /////////////////////////////////////////////////////////////////
     stack_container_t<chunk_t *> chunks;
-    hash_table_t<uint32_t, 1500, 30, 10> chunk_indices;
+    chunk_index_t chunk_indices;
+    // All chunks get allocated from here (and get recycled in clear_chunks())
+    slab_allocator_t<chunk_t> chunk_allocator;
+    /*
+      Chunks modified since the last reset_modification_tracker(). A bit per
+      chunk slot (chunk_t::chunk_stack_index) tells whether a chunk is in the
+      list already, and the list grows when it needs to, so resetting only
+      goes through the chunks which were modified.
+    */
+    uint32_t modified_bit_word_count;
+    uint64_t *modified_chunk_bits;
     uint32_t max_modified_chunks;
     uint32_t modified_chunk_count;
     chunk_t **modified_chunks;
+    modification_stats_t modification_stats;
+    mutable collision_stats_t collision_stats;
+    // Modified chunks get their history from here
+    chunk_history_pool_t history_pool;
 
     struct {
         uint8_t track_history: 1;
+        /*
+          The chunks are what is in the file of current_map_data (apart from
+          the ones flagged as unsaved), so save_map() only needs to write the
+          unsaved chunks to the map's journal.
+        */
+        uint8_t chunks_match_map_file: 1;
+        // See configure_terrain()
+        uint8_t generate_terrain: 1;
+        // See configure_map()
+        uint8_t has_map_focus: 1;
     } flags;
 
     // Projectiles ////////////////////////////////////////////////////////////
@@ -73,7 +162,16 @@ struct state_t {
 
     // Configure a game that will start (for the server)
     void configure_game_mode(game_mode_t mode);
-    void configure_map(const char *path);
+    /*
+      start_session() streams the map in closest to ws_focus first (or to the
+      map's view position if it's NULL) - the server uses the spawn area.
+    */
+    void configure_map(const char *path, const vector3_t *ws_focus = NULL);
+    /*
+      The map gets generated (see vkph_terrain_generator.hpp) instead of
+      loaded. current_map_path (if configured) is where it gets saved.
+    */
+    void configure_terrain(const terrain_create_info_t *info);
     void configure_team_count(uint32_t count);
     void configure_team(uint32_t team_d, team_color_t color, uint32_t player_count);
 
@@ -98,6 +196,7 @@ struct state_t {
     player_t *get_player(int32_t local_id);
     const player_t *get_player(int32_t local_id) const;
 
+    // Destroys all the chunks (client code needs to free the chunks' render data before)
     void clear_chunks();
 
     // If chunk doesn't exist, create one
@@ -105,6 +204,17 @@ struct state_t {
     // If chunk doesn't exist, return NULL
     chunk_t *access_chunk(const ivector3_t &coord);
     const chunk_t *access_chunk(const ivector3_t &coord) const;
+    // If the chunk is next to hint (or is hint), follows hint's neighbour links instead of doing a lookup
+    const chunk_t *access_chunk(const ivector3_t &coord, const chunk_t *hint) const;
+    /*
+      Queries which use the mip levels of the chunks (see chunk_mips_t), so
+      that the ones which cover a lot of space don't have to read every voxel.
+    */
+    // Average of the voxels in the cell of the mip level which contains vs_position (0 if the chunk isn't loaded)
+    uint8_t sample_density(const ivector3_t &vs_position, uint32_t level) const;
+    // True if none of the voxels in the box (voxel space, inclusive) is above CHUNK_SURFACE_LEVEL
+    bool is_region_air(const ivector3_t &vs_min, const ivector3_t &vs_max) const;
+
     chunk_t **get_active_chunks(uint32_t *count);
     const chunk_t **get_active_chunks(uint32_t *count) const;
     chunk_t **get_modified_chunks(uint32_t *count);
@@ -113,17 +223,126 @@ struct state_t {
     void flag_modified_chunks(net::chunk_modifications_t *modifications, uint32_t count);
     void unflag_modified_chunks(net::chunk_modifications_t *modifications, uint32_t count);
 
+    /*
+      Calls edit(chunk, span) once for each chunk which overlaps the box
+      (voxel space, inclusive), creating the chunks which don't exist yet.
+      The kernels then work on chunk local coordinates, so there is only
+      one chunk lookup per chunk instead of one per voxel.
+    */
+    template <typename T>
+    void edit_region(const ivector3_t &vs_min, const ivector3_t &vs_max, T edit) {
+        for_each_chunk_span(vs_min, vs_max, [this, &edit] (const chunk_span_t &span) {
+            edit(get_chunk(span.chunk_coord), span);
+        });
+    }
+
+    /*
+      Same as edit_region(), for the box around a sphere, but skips (and
+      doesn't create) the chunks which don't have any voxel within radius of
+      vs_center.
+    */
+    template <typename T>
+    void edit_sphere_region(const ivector3_t &vs_center, float radius, T edit) {
+        ivector3_t vs_min = vs_center - ivector3_t((int32_t)radius);
+        ivector3_t vs_max = vs_center + ivector3_t((int32_t)radius);
+        float radius_squared = radius * radius;
+
+        for_each_chunk_span(vs_min, vs_max, [this, &edit, &vs_center, radius_squared] (const chunk_span_t &span) {
+            // Voxel of the span which is closest to the center
+            ivector3_t closest = glm::clamp(vs_center, span.vs_origin + span.local_min, span.vs_origin + span.local_max);
+            vector3_t diff = (vector3_t)closest - (vector3_t)vs_center;
+
+            if (glm::dot(diff, diff) <= radius_squared) {
+                edit(get_chunk(span.chunk_coord), span);
+            }
+        });
+    }
+
     // Some terrain modification stuff
     void generate_sphere(sphere_create_info_t *info);
     void generate_hollow_sphere(sphere_create_info_t *info);
     void generate_platform(platform_create_info_t *info);
     void generate_math_equation(math_equation_create_info_t *info);
+    // Replaces the voxels in the box (chunks which would be all air don't get created)
+    void generate_terrain(const terrain_create_info_t *info);
     bool terraform(terraform_info_t *info);
 
     map_t *load_map(const char *path);
+
+    /*
+      Like load_map(), but returns as soon as the map file's header has been
+      read: the blocks get decompressed in the background, closest to
+      ws_focus first (the map's view position if ws_focus is NULL), and the
+      chunks get created by publish_map_stream(), which timestep_begin()
+      calls. progress gets called (on this thread) with the amount of blocks
+      which have been published.
+      The chunks which still have blocks to come can't be terraformed while
+      the map is streaming, and anything which needs the whole map (saving
+      it, the generators...) waits for the stream to finish first.
+    */
+    map_t *stream_map(
+        const char *path,
+        const vector3_t *ws_focus = NULL,
+        job_progress_proc_t progress = NULL,
+        void *progress_data = NULL);
+    bool is_streaming_map() const;
+    // Creates the chunks of (at most max_block_count) blocks which have been decoded
+    void publish_map_stream(uint32_t max_block_count);
+    // Publishes all the remaining blocks
+    void finish_map_stream();
+    // Publishes blocks (in order) until the ones within radius of ws_center are all published
+    void finish_map_stream_around(const vector3_t &ws_center, float radius);
+    // Whether some of the chunks which the box touches still have blocks to come
+    bool is_region_streaming(const ivector3_t &vs_min, const ivector3_t &vs_max) const;
+    // Stops the stream, the blocks which haven't been published don't get loaded
+    void cancel_map_stream();
+    /*
+      Chunks which publish_map_stream() created / filled since the map
+      started streaming, in that order (a chunk is in there once for each of
+      its blocks). The server sends these to the players who joined while
+      the map was streaming. Stays there until another map gets loaded.
+    */
+    const ivector3_t *get_streamed_chunks(uint32_t *count) const;
+
+    /*
+      If the map is the one that got loaded, only appends the chunks which
+      changed since it was loaded / saved to the map's journal (see
+      vkph_map.hpp). Otherwise, or if the journal got too big, writes the
+      whole map file.
+    */
     void save_map(map_t *map = NULL);
+    /*
+      Same as save_map(), but only freezes a copy-on-write snapshot of the
+      chunks (see vkph_map_snapshot.hpp), which gets written on another
+      thread while the chunks keep getting modified. timestep_begin()
+      cleans up once it has been written. Returns 0 (and doesn't save
+      anything) if the last one is still getting written.
+    */
+    bool save_map_in_background(map_t *map = NULL);
+    bool is_saving_map() const;
+    // Waits for the map to be saved
+    void finish_map_snapshot();
     void add_map_name(const char *map_name, const char *path);
 
+    /*
+      The baseline is a copy of the chunks at the start of the match.
+      capture_baseline() (server) copies the chunks which are there (and the
+      ones which get published by the map stream after), and from then on,
+      every chunk which gets changed is recorded, so reset_to_baseline()
+      only needs to copy back these chunks. Clients build their baseline
+      from the chunks they get when joining (set_baseline_chunk()), and get
+      told which chunks to revert (revert_chunks_to_baseline()).
+      clear_chunks() and loading another map get rid of the baseline.
+    */
+    void capture_baseline();
+    void set_baseline_chunk(chunk_t *chunk);
+    // In the order in which they first changed
+    const ivector3_t *get_changed_baseline_chunks(uint32_t *count) const;
+    // Chunks which aren't in the baseline become air
+    void revert_chunks_to_baseline(const ivector3_t *chunk_coords, uint32_t count);
+    // Reverts all the chunks which changed since the baseline got captured, returns how many there were
+    uint32_t reset_to_baseline();
+
 private:
 
     file_handle_t map_names_file_;
@@ -0,0 +1,404 @@
+#include "vkph_terraform.hpp"
+#include "vkph_constant.hpp"
+#include "vkph_chunk.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <tools.hpp>
+
+// SSE2 is always there on x86-64
+#if defined(__x86_64__) || defined(_M_X64)
+#define VKPH_TERRAFORM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC lets any function use AVX2 intrinsics
+#define VKPH_TARGET_AVX2
+#else
+#define VKPH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace vkph {
+
+/*
+  Reference kernel - the SIMD ones need to produce the exact same voxels and
+  history as this.
+ */
+static void s_apply_brush_scalar(
+    const terraform_brush_t *brush,
+    uint8_t *values,
+    voxel_color_t *colors,
+    const chunk_span_t &span,
+    chunk_history_t *history) {
+    for (int32_t z = span.local_min.z; z <= span.local_max.z; ++z) {
+        for (int32_t y = span.local_min.y; y <= span.local_max.y; ++y) {
+            for (int32_t x = span.local_min.x; x <= span.local_max.x; ++x) {
+                vector3_t current_voxel = (vector3_t)(span.vs_origin + ivector3_t(x, y, z));
+                vector3_t diff = current_voxel - brush->vs_center;
+                float distance_squared = glm::dot(diff, diff);
+
+                if (distance_squared <= brush->radius_squared) {
+                    uint32_t voxel_index = get_voxel_index(x, y, z);
+                    uint8_t *value = &values[voxel_index];
+                    uint8_t voxel_value = *value;
+                    float proportion = 1.0f - (distance_squared / brush->radius_squared);
+
+                    int32_t current_voxel_value = (int32_t)*value;
+
+                    int32_t new_value = (int32_t)(proportion * brush->coeff * brush->dt * brush->speed) + current_voxel_value;
+
+                    if (new_value > (int32_t)CHUNK_MAX_VOXEL_VALUE_I) {
+                        voxel_value = (int32_t)CHUNK_MAX_VOXEL_VALUE_I;
+                    }
+                    else if (new_value < 0) {
+                        voxel_value = 0;
+                    }
+                    else {
+                        voxel_value = (uint8_t)new_value;
+                    }
+
+                    if (history) {
+                        uint8_t *vh = &history->modification_pool[voxel_index];
+
+                        // Didn't add to the history yet
+                        if (*vh == CHUNK_SPECIAL_VALUE && voxel_value != *value) {
+                            *vh = *value;
+                            history->modification_stack[history->modification_count++] = voxel_index;
+                        }
+                    }
+
+                    *value = voxel_value;
+                    colors[voxel_index] = brush->color;
+                }
+            }
+        }
+    }
+}
+
+#if defined(VKPH_TERRAFORM_X86)
+
+/*
+  The SIMD kernels work on a row (fixed y and z) of the span at a time. When
+  they can't work on the row in place, it gets copied to a padded buffer, so
+  that they never read or write past the chunk, whatever the voxel layout is.
+ */
+static constexpr uint32_t ROW_PADDING = 8;
+
+struct brush_row_t {
+    // Either point into the chunk, or to the buffers
+    uint8_t *values;
+    voxel_color_t *colors;
+    bool in_place;
+
+    uint8_t value_buffer[CHUNK_EDGE_LENGTH + ROW_PADDING];
+    voxel_color_t color_buffer[CHUNK_EDGE_LENGTH + ROW_PADDING];
+
+    // Local x coordinate of the first voxel of the row
+    int32_t x;
+    uint32_t count;
+};
+
+/*
+  Narrows the row down to the voxels the sphere might overlap (a voxel more
+  on each side, the masks in the kernels decide which voxels are actually in
+  the sphere). Returns 0 if the sphere doesn't overlap the row at all.
+ */
+static bool s_clip_row(brush_row_t *row, const terraform_brush_t *brush, const chunk_span_t &span, float dyz_squared) {
+    float remaining = brush->radius_squared - dyz_squared;
+    if (remaining < 0.0f) {
+        return 0;
+    }
+
+    float half_chord = sqrtf(remaining);
+    int32_t x_min = (int32_t)floorf(brush->vs_center.x - half_chord) - 1 - span.vs_origin.x;
+    int32_t x_max = (int32_t)ceilf(brush->vs_center.x + half_chord) + 1 - span.vs_origin.x;
+
+    x_min = MAX(x_min, span.local_min.x);
+    x_max = MIN(x_max, span.local_max.x);
+
+    if (x_min > x_max) {
+        return 0;
+    }
+
+    row->x = x_min;
+    row->count = x_max - x_min + 1;
+
+    return 1;
+}
+
+/*
+  With the linear layout the row is contiguous, so it can be worked on in
+  place if the last vector stays in the chunk (the lanes past the end of the
+  row keep their values, even if they are in the next row).
+ */
+static void s_load_row(brush_row_t *row, uint8_t *values, voxel_color_t *colors, int32_t y, int32_t z, uint32_t lane_count) {
+    uint32_t vector_count = (row->count + lane_count - 1) / lane_count;
+    uint32_t first = get_voxel_index(row->x, y, z);
+    row->in_place = (VOXEL_LAYOUT == VL_LINEAR && first + vector_count * lane_count <= CHUNK_VOXEL_COUNT);
+
+    if (row->in_place) {
+        row->values = values + first;
+        row->colors = colors + first;
+    }
+    else {
+        row->values = row->value_buffer;
+        row->colors = row->color_buffer;
+
+        for (uint32_t i = 0; i < row->count; ++i) {
+            uint32_t index = get_voxel_index(row->x + i, y, z);
+            row->values[i] = values[index];
+            row->colors[i] = colors[index];
+        }
+    }
+}
+
+static void s_store_row(const brush_row_t *row, uint8_t *values, voxel_color_t *colors, int32_t y, int32_t z) {
+    if (!row->in_place) {
+        for (uint32_t i = 0; i < row->count; ++i) {
+            uint32_t index = get_voxel_index(row->x + i, y, z);
+            values[index] = row->values[i];
+            colors[index] = row->colors[i];
+        }
+    }
+}
+
+// Lanes of changed_bits are voxels of the row (starting at row_x) whose value changed
+static void s_record_history(
+    chunk_history_t *history,
+    uint32_t changed_bits,
+    const uint8_t *old_values,
+    int32_t row_x,
+    int32_t y,
+    int32_t z) {
+    while (changed_bits) {
+        uint32_t lane = lowest_bit_index(changed_bits);
+        changed_bits &= changed_bits - 1;
+
+        uint32_t voxel_index = get_voxel_index(row_x + lane, y, z);
+        uint8_t *vh = &history->modification_pool[voxel_index];
+
+        if (*vh == CHUNK_SPECIAL_VALUE) {
+            *vh = old_values[lane];
+            history->modification_stack[history->modification_count++] = voxel_index;
+        }
+    }
+}
+
+static void s_apply_brush_sse2(
+    const terraform_brush_t *brush,
+    uint8_t *values,
+    voxel_color_t *colors,
+    const chunk_span_t &span,
+    chunk_history_t *history) {
+    const __m128 lane_offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128i lane_indices = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128 radius_squared = _mm_set1_ps(brush->radius_squared);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 coeff = _mm_set1_ps(brush->coeff);
+    const __m128 dt = _mm_set1_ps(brush->dt);
+    const __m128 speed = _mm_set1_ps(brush->speed);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max_value = _mm_set1_epi32((int32_t)CHUNK_MAX_VOXEL_VALUE_I);
+    const __m128i color = _mm_set1_epi8((char)brush->color);
+
+    brush_row_t row;
+
+    for (int32_t z = span.local_min.z; z <= span.local_max.z; ++z) {
+        for (int32_t y = span.local_min.y; y <= span.local_max.y; ++y) {
+            float dy = (float)(span.vs_origin.y + y) - brush->vs_center.y;
+            float dz = (float)(span.vs_origin.z + z) - brush->vs_center.z;
+            // These are all whole numbers, so the order of the additions doesn't change the result
+            float dyz_squared_scalar = dy * dy + dz * dz;
+
+            if (!s_clip_row(&row, brush, span, dyz_squared_scalar)) {
+                continue;
+            }
+
+            __m128 dyz_squared = _mm_set1_ps(dyz_squared_scalar);
+
+            s_load_row(&row, values, colors, y, z, 4);
+
+            for (uint32_t i = 0; i < row.count; i += 4) {
+                __m128 xs = _mm_add_ps(_mm_set1_ps((float)(span.vs_origin.x + row.x + (int32_t)i)), lane_offsets);
+                __m128 dx = _mm_sub_ps(xs, _mm_set1_ps(brush->vs_center.x));
+                __m128 distance_squared = _mm_add_ps(_mm_mul_ps(dx, dx), dyz_squared);
+
+                __m128i in_row = _mm_cmplt_epi32(lane_indices, _mm_set1_epi32((int32_t)(row.count - i)));
+                __m128i in_sphere = _mm_and_si128(_mm_castps_si128(_mm_cmple_ps(distance_squared, radius_squared)), in_row);
+
+                // Same operations (and order) as the scalar kernel
+                __m128 proportion = _mm_sub_ps(one, _mm_div_ps(distance_squared, radius_squared));
+                __m128 amount = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(proportion, coeff), dt), speed);
+
+                int32_t packed_old;
+                memcpy(&packed_old, &row.values[i], sizeof(packed_old));
+                __m128i old_values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed_old), zero), zero);
+
+                __m128i new_values = _mm_add_epi32(_mm_cvttps_epi32(amount), old_values);
+
+                // Clamp to [0, CHUNK_MAX_VOXEL_VALUE_I] (SSE2 doesn't have _mm_max_epi32 / _mm_min_epi32)
+                new_values = _mm_and_si128(new_values, _mm_cmpgt_epi32(new_values, zero));
+                __m128i too_big = _mm_cmpgt_epi32(new_values, max_value);
+                new_values = _mm_or_si128(_mm_andnot_si128(too_big, new_values), _mm_and_si128(too_big, max_value));
+
+                new_values = _mm_or_si128(_mm_and_si128(in_sphere, new_values), _mm_andnot_si128(in_sphere, old_values));
+
+                if (history) {
+                    __m128i changed = _mm_andnot_si128(_mm_cmpeq_epi32(new_values, old_values), in_sphere);
+                    uint32_t changed_bits = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(changed));
+
+                    s_record_history(history, changed_bits, &row.values[i], row.x + i, y, z);
+                }
+
+                int32_t packed_new = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(new_values, new_values), zero));
+                memcpy(&row.values[i], &packed_new, sizeof(packed_new));
+
+                // 0xFF in the bytes of the voxels in the sphere
+                __m128i color_mask = _mm_packs_epi16(_mm_packs_epi32(in_sphere, in_sphere), zero);
+                int32_t packed_colors;
+                memcpy(&packed_colors, &row.colors[i], sizeof(packed_colors));
+                __m128i old_colors = _mm_cvtsi32_si128(packed_colors);
+                __m128i new_colors = _mm_or_si128(_mm_and_si128(color_mask, color), _mm_andnot_si128(color_mask, old_colors));
+                packed_colors = _mm_cvtsi128_si32(new_colors);
+                memcpy(&row.colors[i], &packed_colors, sizeof(packed_colors));
+            }
+
+            s_store_row(&row, values, colors, y, z);
+        }
+    }
+}
+
+VKPH_TARGET_AVX2 static void s_apply_brush_avx2(
+    const terraform_brush_t *brush,
+    uint8_t *values,
+    voxel_color_t *colors,
+    const chunk_span_t &span,
+    chunk_history_t *history) {
+    const __m256 lane_offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256i lane_indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 radius_squared = _mm256_set1_ps(brush->radius_squared);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 coeff = _mm256_set1_ps(brush->coeff);
+    const __m256 dt = _mm256_set1_ps(brush->dt);
+    const __m256 speed = _mm256_set1_ps(brush->speed);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max_value = _mm256_set1_epi32((int32_t)CHUNK_MAX_VOXEL_VALUE_I);
+    const __m128i color = _mm_set1_epi8((char)brush->color);
+
+    brush_row_t row;
+
+    for (int32_t z = span.local_min.z; z <= span.local_max.z; ++z) {
+        for (int32_t y = span.local_min.y; y <= span.local_max.y; ++y) {
+            float dy = (float)(span.vs_origin.y + y) - brush->vs_center.y;
+            float dz = (float)(span.vs_origin.z + z) - brush->vs_center.z;
+            float dyz_squared_scalar = dy * dy + dz * dz;
+
+            if (!s_clip_row(&row, brush, span, dyz_squared_scalar)) {
+                continue;
+            }
+
+            __m256 dyz_squared = _mm256_set1_ps(dyz_squared_scalar);
+
+            s_load_row(&row, values, colors, y, z, 8);
+
+            for (uint32_t i = 0; i < row.count; i += 8) {
+                __m256 xs = _mm256_add_ps(_mm256_set1_ps((float)(span.vs_origin.x + row.x + (int32_t)i)), lane_offsets);
+                __m256 dx = _mm256_sub_ps(xs, _mm256_set1_ps(brush->vs_center.x));
+                // No FMA here: the rounding has to be the same as in the scalar kernel
+                __m256 distance_squared = _mm256_add_ps(_mm256_mul_ps(dx, dx), dyz_squared);
+
+                __m256i in_row = _mm256_cmpgt_epi32(_mm256_set1_epi32((int32_t)(row.count - i)), lane_indices);
+                __m256i in_sphere = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(distance_squared, radius_squared, _CMP_LE_OQ)), in_row);
+
+                __m256 proportion = _mm256_sub_ps(one, _mm256_div_ps(distance_squared, radius_squared));
+                __m256 amount = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(proportion, coeff), dt), speed);
+
+                __m256i old_values = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&row.values[i]));
+                __m256i new_values = _mm256_add_epi32(_mm256_cvttps_epi32(amount), old_values);
+                new_values = _mm256_min_epi32(_mm256_max_epi32(new_values, zero), max_value);
+                new_values = _mm256_blendv_epi8(old_values, new_values, in_sphere);
+
+                if (history) {
+                    __m256i changed = _mm256_andnot_si256(_mm256_cmpeq_epi32(new_values, old_values), in_sphere);
+                    uint32_t changed_bits = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(changed));
+
+                    s_record_history(history, changed_bits, &row.values[i], row.x + i, y, z);
+                }
+
+                __m128i new_values_16 = _mm_packus_epi32(_mm256_castsi256_si128(new_values), _mm256_extracti128_si256(new_values, 1));
+                _mm_storel_epi64((__m128i *)&row.values[i], _mm_packus_epi16(new_values_16, new_values_16));
+
+                __m128i mask_16 = _mm_packs_epi32(_mm256_castsi256_si128(in_sphere), _mm256_extracti128_si256(in_sphere, 1));
+                __m128i color_mask = _mm_packs_epi16(mask_16, mask_16);
+                __m128i old_colors = _mm_loadl_epi64((const __m128i *)&row.colors[i]);
+                _mm_storel_epi64((__m128i *)&row.colors[i], _mm_blendv_epi8(old_colors, color, color_mask));
+            }
+
+            s_store_row(&row, values, colors, y, z);
+        }
+    }
+}
+
+static bool s_cpu_supports_avx2() {
+#if defined(_MSC_VER)
+    int32_t info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return 0;
+    }
+
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6);
+
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5));
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+terraform_kernel_t get_best_terraform_kernel() {
+#if defined(VKPH_TERRAFORM_X86)
+    return s_cpu_supports_avx2() ? TK_AVX2 : TK_SSE2;
+#else
+    return TK_SCALAR;
+#endif
+}
+
+static terraform_kernel_t s_kernel = TK_INVALID;
+
+void set_terraform_kernel(terraform_kernel_t kernel) {
+    terraform_kernel_t best = get_best_terraform_kernel();
+    s_kernel = (kernel > best) ? best : kernel;
+}
+
+terraform_kernel_t get_terraform_kernel() {
+    if (s_kernel == TK_INVALID) {
+        s_kernel = get_best_terraform_kernel();
+    }
+
+    return s_kernel;
+}
+
+void apply_terraform_brush(
+    const terraform_brush_t *brush,
+    chunk_t *chunk,
+    const chunk_span_t &span,
+    chunk_history_t *history) {
+    uint8_t *values = chunk->get_writable_values();
+    voxel_color_t *colors = chunk->get_writable_colors();
+
+    switch (get_terraform_kernel()) {
+#if defined(VKPH_TERRAFORM_X86)
+    case TK_AVX2: s_apply_brush_avx2(brush, values, colors, span, history); break;
+    case TK_SSE2: s_apply_brush_sse2(brush, values, colors, span, history); break;
+#endif
+    default: s_apply_brush_scalar(brush, values, colors, span, history); break;
+    }
+}
+
+}
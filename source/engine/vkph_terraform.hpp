@@ -3,10 +3,14 @@
 #include "vkph_voxel.hpp"
 
 #include <math.hpp>
+#include <worker_pool.hpp>
 
 namespace vkph {
 
 struct state_t;
+struct chunk_t;
+struct chunk_span_t;
+struct chunk_history_t;
 
 /*
   Some functions to help in terraform (especially in the terrain editor).
@@ -23,6 +27,10 @@ struct sphere_create_info_t {
     float max_value;
     generation_type_t type;
     voxel_color_t color;
+
+    // Optional: gets called with the amount of chunks generated so far
+    job_progress_proc_t progress;
+    void *progress_data;
 };
 
 struct platform_create_info_t {
@@ -33,12 +41,20 @@ struct platform_create_info_t {
     voxel_color_t color;
 };
 
+/*
+  The chunks get generated on the worker pool, so equation gets called from
+  several threads at once.
+ */
 struct math_equation_create_info_t {
     vector3_t ws_center;
     vector3_t ws_extent;
     float(*equation)(float x, float y, float z);
     generation_type_t type;
     voxel_color_t color;
+
+    // Optional: gets called with the amount of chunks generated so far
+    job_progress_proc_t progress;
+    void *progress_data;
 };
 
 enum terraform_type_t { TT_DESTROY, TT_BUILD };
@@ -60,4 +76,45 @@ struct terraform_info_t {
     float dt;
 };
 
+/*
+  The terraforming brush, which terraform() applies to each chunk the sphere
+  overlaps (chunk_span_t).
+  There are SIMD versions of the kernel (picked at runtime depending on what
+  the CPU supports), which give exactly the same results as the scalar one:
+  the client predicts terraforming and the server replays it, so they need
+  to agree on every voxel.
+ */
+struct terraform_brush_t {
+    /*
+      Voxel space. Has to be a whole voxel coordinate: the SIMD kernels sum
+      the squared distances in a different order than the scalar one, which
+      only gives the same result with whole numbers.
+     */
+    vector3_t vs_center;
+    float radius_squared;
+    // -1 (TT_DESTROY) or +1 (TT_BUILD)
+    float coeff;
+    float dt;
+    float speed;
+    voxel_color_t color;
+};
+
+enum terraform_kernel_t { TK_SCALAR, TK_SSE2, TK_AVX2, TK_INVALID };
+
+// Best kernel the CPU supports
+terraform_kernel_t get_best_terraform_kernel();
+// Changes the kernel which apply_terraform_brush() uses (for tests / benchmarks)
+void set_terraform_kernel(terraform_kernel_t kernel);
+terraform_kernel_t get_terraform_kernel();
+
+/*
+  If history isn't NULL, the initial values of the voxels which change get
+  recorded in it (in the same order as the scalar loop would).
+ */
+void apply_terraform_brush(
+    const terraform_brush_t *brush,
+    chunk_t *chunk,
+    const chunk_span_t &span,
+    chunk_history_t *history);
+
 }
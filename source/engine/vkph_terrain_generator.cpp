@@ -0,0 +1,639 @@
+#include "vkph_terrain_generator.hpp"
+#include "vkph_constant.hpp"
+#include "vkph_chunk.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <tools.hpp>
+
+// Same as in vkph_terraform.cpp
+#if defined(__x86_64__) || defined(_M_X64)
+#define VKPH_TERRAIN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define VKPH_TARGET_AVX2
+#else
+#define VKPH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace vkph {
+
+terrain_create_info_t get_default_terrain_info(uint32_t seed) {
+    terrain_create_info_t info = {};
+    info.seed = seed;
+    info.ws_center = vector3_t(0.0f);
+    info.ws_extent = vector3_t(512.0f, 128.0f, 512.0f);
+    info.ground_height = 0.0f;
+    info.hill_height = 24.0f;
+    info.feature_size = 96.0f;
+    info.octave_count = 4;
+    info.warp_strength = 24.0f;
+    info.snow_height = 12.0f;
+    // RRRGGGBB
+    info.ground_color = 0x31;
+    info.rock_color = 0x6D;
+    info.snow_color = 0xFF;
+
+    return info;
+}
+
+static constexpr uint32_t MAX_OCTAVE_COUNT = 8;
+
+/*
+  Value of a voxel is CHUNK_SURFACE_LEVEL + density * DENSITY_SCALE, and
+  voxels whose density is higher than ROCK_DENSITY are rock.
+ */
+static constexpr float DENSITY_SCALE = 140.0f;
+static constexpr float ROCK_DENSITY = 0.3f;
+
+// Multipliers of the lattice coordinates in the hash
+static constexpr uint32_t HASH_X = 0x8DA6B343u;
+static constexpr uint32_t HASH_Y = 0xD8163841u;
+static constexpr uint32_t HASH_Z = 0xCB1AB31Fu;
+static constexpr uint32_t MIX_0 = 0x2C1B3C6Du;
+static constexpr uint32_t MIX_1 = 0x297A2D39u;
+
+/*
+  Everything the kernels need, worked out once from the create info (the
+  SIMD kernels broadcast these, so they use the exact same numbers as the
+  scalar kernel).
+ */
+struct terrain_params_t {
+    uint32_t warp_seeds[3];
+    float warp_frequency;
+    float warp_strength;
+
+    uint32_t octave_count;
+    uint32_t octave_seeds[MAX_OCTAVE_COUNT];
+    float frequencies[MAX_OCTAVE_COUNT];
+    float amplitudes[MAX_OCTAVE_COUNT];
+
+    float ground_height;
+    float inverse_hill_height;
+    float snow_height;
+
+    voxel_color_t ground_color;
+    voxel_color_t rock_color;
+    voxel_color_t snow_color;
+};
+
+static uint32_t s_mix(uint32_t h) {
+    h ^= h >> 15;
+    h *= MIX_0;
+    h ^= h >> 12;
+    h *= MIX_1;
+    h ^= h >> 15;
+    return h;
+}
+
+static void s_prepare_params(const terrain_create_info_t *info, terrain_params_t *params) {
+    for (uint32_t i = 0; i < 3; ++i) {
+        params->warp_seeds[i] = s_mix(info->seed + 0x9E3779B9u * (i + 1));
+    }
+
+    params->warp_frequency = 1.0f / info->feature_size;
+    params->warp_strength = info->warp_strength;
+
+    params->octave_count = MIN(MAX(info->octave_count, 1u), MAX_OCTAVE_COUNT);
+
+    float frequency = 1.0f / info->feature_size;
+    float amplitude = 1.0f;
+
+    for (uint32_t i = 0; i < params->octave_count; ++i) {
+        params->octave_seeds[i] = s_mix(info->seed ^ (0x85EBCA6Bu * (i + 1)));
+        params->frequencies[i] = frequency;
+        params->amplitudes[i] = amplitude;
+
+        frequency *= 2.0f;
+        amplitude *= 0.5f;
+    }
+
+    params->ground_height = info->ground_height;
+    params->inverse_hill_height = 1.0f / info->hill_height;
+    params->snow_height = info->snow_height;
+
+    params->ground_color = info->ground_color;
+    params->rock_color = info->rock_color;
+    params->snow_color = info->snow_color;
+}
+
+/*
+  Everything which is the same for a whole row (fixed y and z). The noise
+  gets clamped to [-1, 1], so the density of the row is within one of
+  base_density, which is enough to tell that a row is all air / all rock
+  without generating it.
+ */
+struct terrain_row_t {
+    float y;
+    float z;
+    float base_density;
+    voxel_color_t surface_color;
+};
+
+static terrain_row_t s_prepare_row(const terrain_params_t *params, int32_t vs_y, int32_t vs_z) {
+    terrain_row_t row;
+    row.y = (float)vs_y;
+    row.z = (float)vs_z;
+    row.base_density = (params->ground_height - row.y) * params->inverse_hill_height;
+    row.surface_color = (row.y > params->snow_height) ? params->snow_color : params->ground_color;
+    return row;
+}
+
+// The margins are way bigger than the rounding errors
+static bool s_is_row_air(const terrain_row_t *row) {
+    return (float)CHUNK_SURFACE_LEVEL + (row->base_density + 1.0f) * DENSITY_SCALE < 0.5f;
+}
+
+static bool s_is_row_rock(const terrain_row_t *row) {
+    return
+        (float)CHUNK_SURFACE_LEVEL + (row->base_density - 1.0f) * DENSITY_SCALE > CHUNK_MAX_VOXEL_VALUE_F + 0.5f &&
+        row->base_density - 1.0f > ROCK_DENSITY + 0.01f;
+}
+
+/*
+  Reference kernel - the SIMD ones need to produce the exact same voxels as
+  this. Gradient noise with the 12 (+4 repeated) edge gradients of improved
+  Perlin noise, and a hash of the lattice coordinates instead of a
+  permutation table (so that the seed can be anything).
+  None of the expressions may get turned into FMAs, the SIMD kernels don't
+  use them.
+ */
+static float s_gradient(uint32_t h, float x, float y, float z) {
+    uint32_t g = h & 15;
+    float u = g < 8 ? x : y;
+    float v = g < 4 ? y : ((g == 12 || g == 14) ? x : z);
+    return ((g & 1) ? -u : u) + ((g & 2) ? -v : v);
+}
+
+static float s_fade(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static float s_lerp(float a, float b, float t) {
+    return a + t * (b - a);
+}
+
+static float s_noise(float x, float y, float z, uint32_t seed) {
+    float x_floor = floorf(x), y_floor = floorf(y), z_floor = floorf(z);
+
+    uint32_t hx0 = (uint32_t)(int32_t)x_floor * HASH_X, hx1 = hx0 + HASH_X;
+    uint32_t hy0 = (uint32_t)(int32_t)y_floor * HASH_Y, hy1 = hy0 + HASH_Y;
+    uint32_t hz0 = (uint32_t)(int32_t)z_floor * HASH_Z, hz1 = hz0 + HASH_Z;
+
+    float fx0 = x - x_floor, fx1 = fx0 - 1.0f;
+    float fy0 = y - y_floor, fy1 = fy0 - 1.0f;
+    float fz0 = z - z_floor, fz1 = fz0 - 1.0f;
+
+    float n000 = s_gradient(s_mix(seed ^ hx0 ^ hy0 ^ hz0), fx0, fy0, fz0);
+    float n100 = s_gradient(s_mix(seed ^ hx1 ^ hy0 ^ hz0), fx1, fy0, fz0);
+    float n010 = s_gradient(s_mix(seed ^ hx0 ^ hy1 ^ hz0), fx0, fy1, fz0);
+    float n110 = s_gradient(s_mix(seed ^ hx1 ^ hy1 ^ hz0), fx1, fy1, fz0);
+    float n001 = s_gradient(s_mix(seed ^ hx0 ^ hy0 ^ hz1), fx0, fy0, fz1);
+    float n101 = s_gradient(s_mix(seed ^ hx1 ^ hy0 ^ hz1), fx1, fy0, fz1);
+    float n011 = s_gradient(s_mix(seed ^ hx0 ^ hy1 ^ hz1), fx0, fy1, fz1);
+    float n111 = s_gradient(s_mix(seed ^ hx1 ^ hy1 ^ hz1), fx1, fy1, fz1);
+
+    float u = s_fade(fx0), v = s_fade(fy0), w = s_fade(fz0);
+
+    float x00 = s_lerp(n000, n100, u);
+    float x10 = s_lerp(n010, n110, u);
+    float x01 = s_lerp(n001, n101, u);
+    float x11 = s_lerp(n011, n111, u);
+
+    float y0 = s_lerp(x00, x10, v);
+    float y1 = s_lerp(x01, x11, v);
+
+    return s_lerp(y0, y1, w);
+}
+
+static void s_generate_row_scalar(
+    const terrain_params_t *params,
+    const terrain_row_t *row,
+    int32_t vs_x,
+    uint32_t count,
+    uint8_t *values,
+    voxel_color_t *colors) {
+    for (uint32_t i = 0; i < count; ++i) {
+        float x = (float)(vs_x + (int32_t)i);
+        float y = row->y, z = row->z;
+
+        float wx = x * params->warp_frequency, wy = y * params->warp_frequency, wz = z * params->warp_frequency;
+        float qx = x + params->warp_strength * s_noise(wx, wy, wz, params->warp_seeds[0]);
+        float qy = y + params->warp_strength * s_noise(wx, wy, wz, params->warp_seeds[1]);
+        float qz = z + params->warp_strength * s_noise(wx, wy, wz, params->warp_seeds[2]);
+
+        float total = 0.0f;
+        for (uint32_t o = 0; o < params->octave_count; ++o) {
+            float frequency = params->frequencies[o];
+            total = total + params->amplitudes[o] * s_noise(qx * frequency, qy * frequency, qz * frequency, params->octave_seeds[o]);
+        }
+
+        float noise = MIN(MAX(total, -1.0f), 1.0f);
+
+        float density = row->base_density + noise;
+        float value = (float)CHUNK_SURFACE_LEVEL + density * DENSITY_SCALE;
+        value = MIN(MAX(value, 0.0f), CHUNK_MAX_VOXEL_VALUE_F);
+
+        values[i] = (uint8_t)(int32_t)value;
+
+        if (values[i]) {
+            colors[i] = (density > ROCK_DENSITY) ? params->rock_color : row->surface_color;
+        }
+        else {
+            colors[i] = 0;
+        }
+    }
+}
+
+#if defined(VKPH_TERRAIN_X86)
+
+/*
+  The SIMD kernels do a whole vector at a time, so they write up to
+  ROW_PADDING entries past the end of the row (to buffers with room for it).
+ */
+static constexpr uint32_t ROW_PADDING = 8;
+
+// SSE2 has no 32 bit multiply (low half)
+static inline __m128i s_mullo_sse2(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(
+        _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+        _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i s_mix_sse2(__m128i h) {
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    h = s_mullo_sse2(h, _mm_set1_epi32((int32_t)MIX_0));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 12));
+    h = s_mullo_sse2(h, _mm_set1_epi32((int32_t)MIX_1));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    return h;
+}
+
+static inline __m128 s_select_sse2(__m128i mask, __m128 a, __m128 b) {
+    __m128 m = _mm_castsi128_ps(mask);
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+
+// Negating is flipping the sign bit, so this is the same as the scalar version
+static inline __m128 s_gradient_sse2(__m128i h, __m128 x, __m128 y, __m128 z) {
+    __m128i g = _mm_and_si128(h, _mm_set1_epi32(15));
+
+    __m128 u = s_select_sse2(_mm_cmplt_epi32(g, _mm_set1_epi32(8)), x, y);
+    __m128i x_instead_of_z = _mm_or_si128(_mm_cmpeq_epi32(g, _mm_set1_epi32(12)), _mm_cmpeq_epi32(g, _mm_set1_epi32(14)));
+    __m128 v = s_select_sse2(_mm_cmplt_epi32(g, _mm_set1_epi32(4)), y, s_select_sse2(x_instead_of_z, x, z));
+
+    u = _mm_xor_ps(u, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(g, _mm_set1_epi32(1)), 31)));
+    v = _mm_xor_ps(v, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(g, _mm_set1_epi32(2)), 30)));
+
+    return _mm_add_ps(u, v);
+}
+
+static inline __m128 s_fade_sse2(__m128 t) {
+    __m128 t3 = _mm_mul_ps(_mm_mul_ps(t, t), t);
+    __m128 inner = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+    inner = _mm_add_ps(_mm_mul_ps(t, inner), _mm_set1_ps(10.0f));
+    return _mm_mul_ps(t3, inner);
+}
+
+static inline __m128 s_lerp_sse2(__m128 a, __m128 b, __m128 t) {
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+// floorf() for the numbers the noise gets (way smaller than 2^31)
+static inline __m128i s_floor_sse2(__m128 x, __m128 *x_floor) {
+    __m128i i = _mm_cvttps_epi32(x);
+    __m128 f = _mm_cvtepi32_ps(i);
+    __m128 too_big = _mm_cmpgt_ps(f, x);
+    *x_floor = _mm_sub_ps(f, _mm_and_ps(too_big, _mm_set1_ps(1.0f)));
+    // -1 where too_big
+    return _mm_add_epi32(i, _mm_castps_si128(too_big));
+}
+
+static __m128 s_noise_sse2(__m128 x, __m128 y, __m128 z, uint32_t seed) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i hash_x = _mm_set1_epi32((int32_t)HASH_X);
+    const __m128i hash_y = _mm_set1_epi32((int32_t)HASH_Y);
+    const __m128i hash_z = _mm_set1_epi32((int32_t)HASH_Z);
+
+    __m128 x_floor, y_floor, z_floor;
+    __m128i hx0 = s_mullo_sse2(s_floor_sse2(x, &x_floor), hash_x), hx1 = _mm_add_epi32(hx0, hash_x);
+    __m128i hy0 = s_mullo_sse2(s_floor_sse2(y, &y_floor), hash_y), hy1 = _mm_add_epi32(hy0, hash_y);
+    __m128i hz0 = s_mullo_sse2(s_floor_sse2(z, &z_floor), hash_z), hz1 = _mm_add_epi32(hz0, hash_z);
+
+    __m128 fx0 = _mm_sub_ps(x, x_floor), fx1 = _mm_sub_ps(fx0, one);
+    __m128 fy0 = _mm_sub_ps(y, y_floor), fy1 = _mm_sub_ps(fy0, one);
+    __m128 fz0 = _mm_sub_ps(z, z_floor), fz1 = _mm_sub_ps(fz0, one);
+
+    __m128i s = _mm_set1_epi32((int32_t)seed);
+    __m128i s00 = _mm_xor_si128(s, _mm_xor_si128(hy0, hz0));
+    __m128i s10 = _mm_xor_si128(s, _mm_xor_si128(hy1, hz0));
+    __m128i s01 = _mm_xor_si128(s, _mm_xor_si128(hy0, hz1));
+    __m128i s11 = _mm_xor_si128(s, _mm_xor_si128(hy1, hz1));
+
+    __m128 n000 = s_gradient_sse2(s_mix_sse2(_mm_xor_si128(s00, hx0)), fx0, fy0, fz0);
+    __m128 n100 = s_gradient_sse2(s_mix_sse2(_mm_xor_si128(s00, hx1)), fx1, fy0, fz0);
+    __m128 n010 = s_gradient_sse2(s_mix_sse2(_mm_xor_si128(s10, hx0)), fx0, fy1, fz0);
+    __m128 n110 = s_gradient_sse2(s_mix_sse2(_mm_xor_si128(s10, hx1)), fx1, fy1, fz0);
+    __m128 n001 = s_gradient_sse2(s_mix_sse2(_mm_xor_si128(s01, hx0)), fx0, fy0, fz1);
+    __m128 n101 = s_gradient_sse2(s_mix_sse2(_mm_xor_si128(s01, hx1)), fx1, fy0, fz1);
+    __m128 n011 = s_gradient_sse2(s_mix_sse2(_mm_xor_si128(s11, hx0)), fx0, fy1, fz1);
+    __m128 n111 = s_gradient_sse2(s_mix_sse2(_mm_xor_si128(s11, hx1)), fx1, fy1, fz1);
+
+    __m128 u = s_fade_sse2(fx0), v = s_fade_sse2(fy0), w = s_fade_sse2(fz0);
+
+    __m128 x00 = s_lerp_sse2(n000, n100, u);
+    __m128 x10 = s_lerp_sse2(n010, n110, u);
+    __m128 x01 = s_lerp_sse2(n001, n101, u);
+    __m128 x11 = s_lerp_sse2(n011, n111, u);
+
+    __m128 y0 = s_lerp_sse2(x00, x10, v);
+    __m128 y1 = s_lerp_sse2(x01, x11, v);
+
+    return s_lerp_sse2(y0, y1, w);
+}
+
+static void s_generate_row_sse2(
+    const terrain_params_t *params,
+    const terrain_row_t *row,
+    int32_t vs_x,
+    uint32_t count,
+    uint8_t *values,
+    voxel_color_t *colors) {
+    const __m128 lane_offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 warp_frequency = _mm_set1_ps(params->warp_frequency);
+    const __m128 warp_strength = _mm_set1_ps(params->warp_strength);
+    const __m128 y = _mm_set1_ps(row->y);
+    const __m128 z = _mm_set1_ps(row->z);
+    const __m128 wy = _mm_mul_ps(y, warp_frequency);
+    const __m128 wz = _mm_mul_ps(z, warp_frequency);
+    const __m128i rock_color = _mm_set1_epi32(params->rock_color);
+    const __m128i surface_color = _mm_set1_epi32(row->surface_color);
+
+    for (uint32_t i = 0; i < count; i += 4) {
+        // Exact: the coordinates are small integers
+        __m128 x = _mm_add_ps(_mm_set1_ps((float)(vs_x + (int32_t)i)), lane_offsets);
+
+        __m128 wx = _mm_mul_ps(x, warp_frequency);
+        __m128 qx = _mm_add_ps(x, _mm_mul_ps(warp_strength, s_noise_sse2(wx, wy, wz, params->warp_seeds[0])));
+        __m128 qy = _mm_add_ps(y, _mm_mul_ps(warp_strength, s_noise_sse2(wx, wy, wz, params->warp_seeds[1])));
+        __m128 qz = _mm_add_ps(z, _mm_mul_ps(warp_strength, s_noise_sse2(wx, wy, wz, params->warp_seeds[2])));
+
+        __m128 total = _mm_setzero_ps();
+        for (uint32_t o = 0; o < params->octave_count; ++o) {
+            __m128 frequency = _mm_set1_ps(params->frequencies[o]);
+            __m128 noise = s_noise_sse2(
+                _mm_mul_ps(qx, frequency),
+                _mm_mul_ps(qy, frequency),
+                _mm_mul_ps(qz, frequency),
+                params->octave_seeds[o]);
+            total = _mm_add_ps(total, _mm_mul_ps(_mm_set1_ps(params->amplitudes[o]), noise));
+        }
+
+        // Same operand order as MIN / MAX
+        __m128 noise = _mm_min_ps(_mm_max_ps(total, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+
+        __m128 density = _mm_add_ps(_mm_set1_ps(row->base_density), noise);
+        __m128 value = _mm_add_ps(_mm_set1_ps((float)CHUNK_SURFACE_LEVEL), _mm_mul_ps(density, _mm_set1_ps(DENSITY_SCALE)));
+        value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(CHUNK_MAX_VOXEL_VALUE_F));
+
+        __m128i value_i = _mm_cvttps_epi32(value);
+        __m128i is_rock = _mm_castps_si128(_mm_cmpgt_ps(density, _mm_set1_ps(ROCK_DENSITY)));
+        __m128i color = _mm_or_si128(_mm_and_si128(is_rock, rock_color), _mm_andnot_si128(is_rock, surface_color));
+        color = _mm_andnot_si128(_mm_cmpeq_epi32(value_i, _mm_setzero_si128()), color);
+
+        __m128i value_16 = _mm_packs_epi32(value_i, value_i);
+        __m128i color_16 = _mm_packs_epi32(color, color);
+        int32_t packed_values = _mm_cvtsi128_si32(_mm_packus_epi16(value_16, value_16));
+        int32_t packed_colors = _mm_cvtsi128_si32(_mm_packus_epi16(color_16, color_16));
+        memcpy(&values[i], &packed_values, 4);
+        memcpy(&colors[i], &packed_colors, 4);
+    }
+}
+
+VKPH_TARGET_AVX2 static inline __m256i s_mix_avx2(__m256i h) {
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int32_t)MIX_0));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 12));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int32_t)MIX_1));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    return h;
+}
+
+VKPH_TARGET_AVX2 static inline __m256 s_select_avx2(__m256i mask, __m256 a, __m256 b) {
+    return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask));
+}
+
+VKPH_TARGET_AVX2 static inline __m256 s_gradient_avx2(__m256i h, __m256 x, __m256 y, __m256 z) {
+    __m256i g = _mm256_and_si256(h, _mm256_set1_epi32(15));
+
+    __m256 u = s_select_avx2(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), g), x, y);
+    __m256i x_instead_of_z = _mm256_or_si256(_mm256_cmpeq_epi32(g, _mm256_set1_epi32(12)), _mm256_cmpeq_epi32(g, _mm256_set1_epi32(14)));
+    __m256 v = s_select_avx2(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), g), y, s_select_avx2(x_instead_of_z, x, z));
+
+    u = _mm256_xor_ps(u, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(g, _mm256_set1_epi32(1)), 31)));
+    v = _mm256_xor_ps(v, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(g, _mm256_set1_epi32(2)), 30)));
+
+    return _mm256_add_ps(u, v);
+}
+
+// No FMA here: the rounding has to be the same as in the scalar kernel
+VKPH_TARGET_AVX2 static inline __m256 s_fade_avx2(__m256 t) {
+    __m256 t3 = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+    __m256 inner = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f));
+    inner = _mm256_add_ps(_mm256_mul_ps(t, inner), _mm256_set1_ps(10.0f));
+    return _mm256_mul_ps(t3, inner);
+}
+
+VKPH_TARGET_AVX2 static inline __m256 s_lerp_avx2(__m256 a, __m256 b, __m256 t) {
+    return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+VKPH_TARGET_AVX2 static inline __m256i s_floor_avx2(__m256 x, __m256 *x_floor) {
+    __m256 f = _mm256_floor_ps(x);
+    *x_floor = f;
+    return _mm256_cvttps_epi32(f);
+}
+
+VKPH_TARGET_AVX2 static __m256 s_noise_avx2(__m256 x, __m256 y, __m256 z, uint32_t seed) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i hash_x = _mm256_set1_epi32((int32_t)HASH_X);
+    const __m256i hash_y = _mm256_set1_epi32((int32_t)HASH_Y);
+    const __m256i hash_z = _mm256_set1_epi32((int32_t)HASH_Z);
+
+    __m256 x_floor, y_floor, z_floor;
+    __m256i hx0 = _mm256_mullo_epi32(s_floor_avx2(x, &x_floor), hash_x), hx1 = _mm256_add_epi32(hx0, hash_x);
+    __m256i hy0 = _mm256_mullo_epi32(s_floor_avx2(y, &y_floor), hash_y), hy1 = _mm256_add_epi32(hy0, hash_y);
+    __m256i hz0 = _mm256_mullo_epi32(s_floor_avx2(z, &z_floor), hash_z), hz1 = _mm256_add_epi32(hz0, hash_z);
+
+    __m256 fx0 = _mm256_sub_ps(x, x_floor), fx1 = _mm256_sub_ps(fx0, one);
+    __m256 fy0 = _mm256_sub_ps(y, y_floor), fy1 = _mm256_sub_ps(fy0, one);
+    __m256 fz0 = _mm256_sub_ps(z, z_floor), fz1 = _mm256_sub_ps(fz0, one);
+
+    __m256i s = _mm256_set1_epi32((int32_t)seed);
+    __m256i s00 = _mm256_xor_si256(s, _mm256_xor_si256(hy0, hz0));
+    __m256i s10 = _mm256_xor_si256(s, _mm256_xor_si256(hy1, hz0));
+    __m256i s01 = _mm256_xor_si256(s, _mm256_xor_si256(hy0, hz1));
+    __m256i s11 = _mm256_xor_si256(s, _mm256_xor_si256(hy1, hz1));
+
+    __m256 n000 = s_gradient_avx2(s_mix_avx2(_mm256_xor_si256(s00, hx0)), fx0, fy0, fz0);
+    __m256 n100 = s_gradient_avx2(s_mix_avx2(_mm256_xor_si256(s00, hx1)), fx1, fy0, fz0);
+    __m256 n010 = s_gradient_avx2(s_mix_avx2(_mm256_xor_si256(s10, hx0)), fx0, fy1, fz0);
+    __m256 n110 = s_gradient_avx2(s_mix_avx2(_mm256_xor_si256(s10, hx1)), fx1, fy1, fz0);
+    __m256 n001 = s_gradient_avx2(s_mix_avx2(_mm256_xor_si256(s01, hx0)), fx0, fy0, fz1);
+    __m256 n101 = s_gradient_avx2(s_mix_avx2(_mm256_xor_si256(s01, hx1)), fx1, fy0, fz1);
+    __m256 n011 = s_gradient_avx2(s_mix_avx2(_mm256_xor_si256(s11, hx0)), fx0, fy1, fz1);
+    __m256 n111 = s_gradient_avx2(s_mix_avx2(_mm256_xor_si256(s11, hx1)), fx1, fy1, fz1);
+
+    __m256 u = s_fade_avx2(fx0), v = s_fade_avx2(fy0), w = s_fade_avx2(fz0);
+
+    __m256 x00 = s_lerp_avx2(n000, n100, u);
+    __m256 x10 = s_lerp_avx2(n010, n110, u);
+    __m256 x01 = s_lerp_avx2(n001, n101, u);
+    __m256 x11 = s_lerp_avx2(n011, n111, u);
+
+    __m256 y0 = s_lerp_avx2(x00, x10, v);
+    __m256 y1 = s_lerp_avx2(x01, x11, v);
+
+    return s_lerp_avx2(y0, y1, w);
+}
+
+VKPH_TARGET_AVX2 static void s_generate_row_avx2(
+    const terrain_params_t *params,
+    const terrain_row_t *row,
+    int32_t vs_x,
+    uint32_t count,
+    uint8_t *values,
+    voxel_color_t *colors) {
+    const __m256 lane_offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 warp_frequency = _mm256_set1_ps(params->warp_frequency);
+    const __m256 warp_strength = _mm256_set1_ps(params->warp_strength);
+    const __m256 y = _mm256_set1_ps(row->y);
+    const __m256 z = _mm256_set1_ps(row->z);
+    const __m256 wy = _mm256_mul_ps(y, warp_frequency);
+    const __m256 wz = _mm256_mul_ps(z, warp_frequency);
+    const __m256i rock_color = _mm256_set1_epi32(params->rock_color);
+    const __m256i surface_color = _mm256_set1_epi32(row->surface_color);
+
+    for (uint32_t i = 0; i < count; i += 8) {
+        __m256 x = _mm256_add_ps(_mm256_set1_ps((float)(vs_x + (int32_t)i)), lane_offsets);
+
+        __m256 wx = _mm256_mul_ps(x, warp_frequency);
+        __m256 qx = _mm256_add_ps(x, _mm256_mul_ps(warp_strength, s_noise_avx2(wx, wy, wz, params->warp_seeds[0])));
+        __m256 qy = _mm256_add_ps(y, _mm256_mul_ps(warp_strength, s_noise_avx2(wx, wy, wz, params->warp_seeds[1])));
+        __m256 qz = _mm256_add_ps(z, _mm256_mul_ps(warp_strength, s_noise_avx2(wx, wy, wz, params->warp_seeds[2])));
+
+        __m256 total = _mm256_setzero_ps();
+        for (uint32_t o = 0; o < params->octave_count; ++o) {
+            __m256 frequency = _mm256_set1_ps(params->frequencies[o]);
+            __m256 noise = s_noise_avx2(
+                _mm256_mul_ps(qx, frequency),
+                _mm256_mul_ps(qy, frequency),
+                _mm256_mul_ps(qz, frequency),
+                params->octave_seeds[o]);
+            total = _mm256_add_ps(total, _mm256_mul_ps(_mm256_set1_ps(params->amplitudes[o]), noise));
+        }
+
+        __m256 noise = _mm256_min_ps(_mm256_max_ps(total, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+
+        __m256 density = _mm256_add_ps(_mm256_set1_ps(row->base_density), noise);
+        __m256 value = _mm256_add_ps(_mm256_set1_ps((float)CHUNK_SURFACE_LEVEL), _mm256_mul_ps(density, _mm256_set1_ps(DENSITY_SCALE)));
+        value = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(CHUNK_MAX_VOXEL_VALUE_F));
+
+        __m256i value_i = _mm256_cvttps_epi32(value);
+        __m256i is_rock = _mm256_castps_si256(_mm256_cmp_ps(density, _mm256_set1_ps(ROCK_DENSITY), _CMP_GT_OQ));
+        __m256i color = _mm256_blendv_epi8(surface_color, rock_color, is_rock);
+        color = _mm256_andnot_si256(_mm256_cmpeq_epi32(value_i, _mm256_setzero_si256()), color);
+
+        __m128i value_16 = _mm_packs_epi32(_mm256_castsi256_si128(value_i), _mm256_extracti128_si256(value_i, 1));
+        __m128i color_16 = _mm_packs_epi32(_mm256_castsi256_si128(color), _mm256_extracti128_si256(color, 1));
+        _mm_storel_epi64((__m128i *)&values[i], _mm_packus_epi16(value_16, value_16));
+        _mm_storel_epi64((__m128i *)&colors[i], _mm_packus_epi16(color_16, color_16));
+    }
+}
+
+#else
+
+static constexpr uint32_t ROW_PADDING = 0;
+
+#endif
+
+static terraform_kernel_t s_kernel = TK_INVALID;
+
+void set_terrain_kernel(terraform_kernel_t kernel) {
+    terraform_kernel_t best = get_best_terraform_kernel();
+    s_kernel = (kernel > best) ? best : kernel;
+}
+
+terraform_kernel_t get_terrain_kernel() {
+    if (s_kernel == TK_INVALID) {
+        s_kernel = get_best_terraform_kernel();
+    }
+
+    return s_kernel;
+}
+
+bool generate_terrain_span(
+    const terrain_create_info_t *info,
+    terraform_kernel_t kernel,
+    uint8_t *values,
+    voxel_color_t *colors,
+    const chunk_span_t &span) {
+    terrain_params_t params;
+    s_prepare_params(info, &params);
+
+    int32_t vs_x = span.vs_origin.x + span.local_min.x;
+    uint32_t count = span.local_max.x - span.local_min.x + 1;
+
+    uint8_t value_row[CHUNK_EDGE_LENGTH + ROW_PADDING];
+    voxel_color_t color_row[CHUNK_EDGE_LENGTH + ROW_PADDING];
+
+    bool has_solid = 0;
+
+    for (int32_t z = span.local_min.z; z <= span.local_max.z; ++z) {
+        for (int32_t y = span.local_min.y; y <= span.local_max.y; ++y) {
+            terrain_row_t row = s_prepare_row(&params, span.vs_origin.y + y, span.vs_origin.z + z);
+
+            // Same as what the kernels would give
+            if (s_is_row_air(&row)) {
+                memset(value_row, 0, count);
+                memset(color_row, 0, count);
+            }
+            else if (s_is_row_rock(&row)) {
+                memset(value_row, CHUNK_MAX_VOXEL_VALUE_I, count);
+                memset(color_row, params.rock_color, count);
+            }
+            else {
+                switch (kernel) {
+#if defined(VKPH_TERRAIN_X86)
+                case TK_AVX2: s_generate_row_avx2(&params, &row, vs_x, count, value_row, color_row); break;
+                case TK_SSE2: s_generate_row_sse2(&params, &row, vs_x, count, value_row, color_row); break;
+#endif
+                default: s_generate_row_scalar(&params, &row, vs_x, count, value_row, color_row); break;
+                }
+            }
+
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t index = get_voxel_index(span.local_min.x + (int32_t)i, y, z);
+                values[index] = value_row[i];
+                colors[index] = color_row[i];
+                has_solid |= (value_row[i] != 0);
+            }
+        }
+    }
+
+    return has_solid;
+}
+
+bool is_terrain_span_air(const terrain_create_info_t *info, const chunk_span_t &span) {
+    terrain_params_t params;
+    s_prepare_params(info, &params);
+
+    // The density goes down with y
+    terrain_row_t row = s_prepare_row(&params, span.vs_origin.y + span.local_min.y, 0);
+    return s_is_row_air(&row);
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "vkph_voxel.hpp"
+#include "vkph_terraform.hpp"
+
+#include <math.hpp>
+#include <worker_pool.hpp>
+
+namespace vkph {
+
+struct chunk_span_t;
+
+/*
+  Procedural terrain: a ground plane plus a few octaves of 3D gradient noise
+  (whose sample positions get moved around by more noise - domain warping)
+  gives the density of the voxels, and the color depends on how deep under
+  the surface / how high up they are.
+
+  A voxel only depends on the create info (and its seed) and on where the
+  voxel is, so chunks can get generated in any order, on any amount of
+  threads and with any kernel, and always come out the same. A client which
+  knows the create info could generate the chunks itself.
+ */
+struct terrain_create_info_t {
+    uint32_t seed;
+
+    // Box of voxels which gets generated (like math_equation_create_info_t)
+    vector3_t ws_center;
+    vector3_t ws_extent;
+
+    // Height of the ground plane (before the noise moves the surface around)
+    float ground_height;
+    // Roughly how far up / down the noise moves the surface
+    float hill_height;
+    // Wave length (in voxels) of the first octave, each octave halves it
+    float feature_size;
+    uint32_t octave_count;
+    // How far (in voxels) the domain warp moves the sample positions
+    float warp_strength;
+    // Surface voxels above this are snow
+    float snow_height;
+
+    voxel_color_t ground_color;
+    voxel_color_t rock_color;
+    voxel_color_t snow_color;
+
+    // Optional: gets called with the amount of chunks generated so far
+    job_progress_proc_t progress;
+    void *progress_data;
+};
+
+// Hills with snow on the peaks, in a 512x128x512 box around the origin
+terrain_create_info_t get_default_terrain_info(uint32_t seed);
+
+// Same kernels as terraforming - changes the kernel which state_t::generate_terrain() uses (for tests / benchmarks)
+void set_terrain_kernel(terraform_kernel_t kernel);
+// Not thread safe (picks the best kernel the first time) - call it before handing the work to the workers
+terraform_kernel_t get_terrain_kernel();
+
+/*
+  Writes the voxels of the span (values and colors of the chunk, which can
+  be a block which isn't in a chunk yet) with the kernel. Returns 0 if they
+  are all air.
+ */
+bool generate_terrain_span(
+    const terrain_create_info_t *info,
+    terraform_kernel_t kernel,
+    uint8_t *values,
+    voxel_color_t *colors,
+    const chunk_span_t &span);
+
+/*
+  Whether all the voxels of the span would be air (without generating them).
+  Can say 0 even if they are all air.
+ */
+bool is_terrain_span_air(const terrain_create_info_t *info, const chunk_span_t &span);
+
+}
@@ -20,7 +20,7 @@ static void s_serialise_chunk_modification_values_without_colors(
     chunk_modifications_t *c) {
     for (uint32_t v = 0; v < c->modified_voxels_count; ++v) {
         voxel_modification_t *v_ptr =  &c->modifications[v];
-        serialiser->serialise_uint16(v_ptr->index);
+        serialiser->serialise_uint16((uint16_t)vkph::voxel_index_to_linear(v_ptr->index));
         serialiser->serialise_uint8(v_ptr->final_value);
     }
 }
@@ -30,7 +30,7 @@ static void s_serialise_chunk_modification_values_with_colors(
     chunk_modifications_t *c) {
     for (uint32_t v = 0; v < c->modified_voxels_count; ++v) {
         voxel_modification_t *v_ptr =  &c->modifications[v];
-        serialiser->serialise_uint16(v_ptr->index);
+        serialiser->serialise_uint16((uint16_t)vkph::voxel_index_to_linear(v_ptr->index));
         serialiser->serialise_uint8(v_ptr->color);
         serialiser->serialise_uint8(v_ptr->final_value);
     }
@@ -41,7 +41,7 @@ void serialise_chunk_modification_values_with_initial_values(
     chunk_modifications_t *c) {
     for (uint32_t v = 0; v < c->modified_voxels_count; ++v) {
         voxel_modification_t *v_ptr =  &c->modifications[v];
-        serialiser->serialise_uint16(v_ptr->index);
+        serialiser->serialise_uint16((uint16_t)vkph::voxel_index_to_linear(v_ptr->index));
         serialiser->serialise_uint8(v_ptr->initial_value);
         serialiser->serialise_uint8(v_ptr->final_value);
     }
@@ -94,7 +94,7 @@ static void s_deserialise_chunk_modification_values_without_colors(
     chunk_modifications_t *c) {
     for (uint32_t v = 0; v < c->modified_voxels_count; ++v) {
         voxel_modification_t *v_ptr =  &c->modifications[v];
-        v_ptr->index = serialiser->deserialise_uint16();
+        v_ptr->index = (uint16_t)vkph::voxel_index_from_linear(serialiser->deserialise_uint16());
         v_ptr->final_value = serialiser->deserialise_uint8();
     }
 }
@@ -104,7 +104,7 @@ static void s_deserialise_chunk_modification_values_with_colors(
     chunk_modifications_t *c) {
     for (uint32_t v = 0; v < c->modified_voxels_count; ++v) {
         voxel_modification_t *v_ptr =  &c->modifications[v];
-        v_ptr->index = serialiser->deserialise_uint16();
+        v_ptr->index = (uint16_t)vkph::voxel_index_from_linear(serialiser->deserialise_uint16());
         v_ptr->color = serialiser->deserialise_uint8();
         v_ptr->final_value = serialiser->deserialise_uint8();
     }
@@ -115,7 +115,7 @@ void deserialise_chunk_modification_values_with_initial_values(
     chunk_modifications_t *c) {
     for (uint32_t v = 0; v < c->modified_voxels_count; ++v) {
         voxel_modification_t *v_ptr =  &c->modifications[v];
-        v_ptr->index = serialiser->deserialise_uint16();
+        v_ptr->index = (uint16_t)vkph::voxel_index_from_linear(serialiser->deserialise_uint16());
         v_ptr->initial_value = serialiser->deserialise_uint8();
         v_ptr->final_value = serialiser->deserialise_uint8();
     }
@@ -164,9 +164,9 @@ uint32_t fill_chunk_modification_array_with_initial_values(chunk_modifications_t
     for (uint32_t c_index = 0; c_index < modified_chunk_count; ++c_index) {
         chunk_modifications_t *cm_ptr = &modifications[current];
         const vkph::chunk_t *c_ptr = chunks[c_index];
-        const vkph::chunk_history_t *h_ptr = &chunks[c_index]->history;
+        const vkph::chunk_history_t *h_ptr = chunks[c_index]->history;
 
-        if (h_ptr->modification_count == 0) {
+        if (!h_ptr || h_ptr->modification_count == 0) {
             // Chunk doesn't actually have modifications, it was just flagged
         }
         else {
@@ -177,8 +177,8 @@ uint32_t fill_chunk_modification_array_with_initial_values(chunk_modifications_t
             for (uint32_t v_index = 0; v_index < cm_ptr->modified_voxels_count; ++v_index) {
                 cm_ptr->modifications[v_index].index = (uint16_t)h_ptr->modification_stack[v_index];
                 cm_ptr->modifications[v_index].initial_value = h_ptr->modification_pool[cm_ptr->modifications[v_index].index];
-                cm_ptr->modifications[v_index].final_value = c_ptr->voxels[cm_ptr->modifications[v_index].index].value;
-                cm_ptr->colors[v_index] = c_ptr->voxels[cm_ptr->modifications[v_index].index].color;
+                cm_ptr->modifications[v_index].final_value = c_ptr->values[cm_ptr->modifications[v_index].index];
+                cm_ptr->colors[v_index] = c_ptr->colors[cm_ptr->modifications[v_index].index];
             }
 
             ++current;
@@ -197,9 +197,9 @@ uint32_t fill_chunk_modification_array_with_colors(chunk_modifications_t *modifi
     for (uint32_t c_index = 0; c_index < modified_chunk_count; ++c_index) {
         chunk_modifications_t *cm_ptr = &modifications[current];
         const vkph::chunk_t *c_ptr = chunks[c_index];
-        const vkph::chunk_history_t *h_ptr = &chunks[c_index]->history;
+        const vkph::chunk_history_t *h_ptr = chunks[c_index]->history;
 
-        if (h_ptr->modification_count == 0) {
+        if (!h_ptr || h_ptr->modification_count == 0) {
             // Chunk doesn't actually have modifications, it was just flagged
         }
         else {
@@ -210,9 +210,9 @@ uint32_t fill_chunk_modification_array_with_colors(chunk_modifications_t *modifi
             for (uint32_t v_index = 0; v_index < cm_ptr->modified_voxels_count; ++v_index) {
                 cm_ptr->modifications[v_index].index = (uint16_t)h_ptr->modification_stack[v_index];
                 // Difference is here because the server will just send the voxel values array, not the colors array
-                cm_ptr->modifications[v_index].color = c_ptr->voxels[cm_ptr->modifications[v_index].index].color;
-                cm_ptr->modifications[v_index].final_value = c_ptr->voxels[cm_ptr->modifications[v_index].index].value;
-                cm_ptr->colors[v_index] = c_ptr->voxels[cm_ptr->modifications[v_index].index].color;
+                cm_ptr->modifications[v_index].color = c_ptr->colors[cm_ptr->modifications[v_index].index];
+                cm_ptr->modifications[v_index].final_value = c_ptr->values[cm_ptr->modifications[v_index].index];
+                cm_ptr->colors[v_index] = c_ptr->colors[cm_ptr->modifications[v_index].index];
             }
 
             ++current;
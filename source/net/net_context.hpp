@@ -6,7 +6,9 @@
 #include "net_game_client.hpp"
 #include "net_game_server.hpp"
 
+#include <tools.hpp>
 #include <containers.hpp>
+#include <vkph_constant.hpp>
 
 namespace net {
 
@@ -14,6 +16,16 @@ constexpr uint32_t NET_MAX_CLIENT_COUNT = 50;
 constexpr uint32_t NET_MAX_ACCUMULATED_PREDICTED_CHUNK_MODIFICATIONS_PACK_COUNT = 60;
 constexpr uint32_t NET_MAX_ACCUMULATED_PREDICTED_CHUNK_MODIFICATIONS_PER_PACK = MAX_PREDICTED_CHUNK_MODIFICATIONS * 5;
 constexpr uint32_t NET_MAX_MESSAGE_SIZE = 65507;
+// Header and chunk count of PT_CHUNK_VOXELS packets
+constexpr uint32_t NET_CHUNK_PACKET_OVERHEAD = 64;
+/*
+  PT_CHUNK_VOXELS packets (sent over TCP) always have room for at least one
+  uncompressed chunk, which with 32x32x32 chunks doesn't fit in
+  NET_MAX_MESSAGE_SIZE. The message buffers need to be able to hold them.
+*/
+constexpr uint32_t NET_MESSAGE_BUFFER_SIZE = MAX(
+    NET_MAX_MESSAGE_SIZE,
+    NET_CHUNK_PACKET_OVERHEAD + 3 * sizeof(int16_t) + vkph::CHUNK_BYTE_SIZE);
 constexpr uint32_t NET_MAX_AVAILABLE_SERVER_COUNT = 1000;
 
 /*
@@ -41,6 +41,8 @@ struct client_t {
 
             // For the server: if the server receives the ping response: flip this bit
             uint32_t received_ping: 1;
+            // For the server: the client joined while the map was streaming, and still needs some of the chunks
+            uint32_t syncing_map_stream: 1;
             // Will use other bits in future
         };
 
@@ -79,6 +81,22 @@ struct client_t {
     uint32_t current_chunk_sending;
     packet_chunk_voxels_t chunk_packets[20];
 
+    /*
+      How many chunks had changed since the server's baseline got captured
+      when the client joined (the first ones of
+      state_t::get_changed_baseline_chunks()). The client's baseline is the
+      chunks it got when it joined, so these need to be sent in full when
+      the map gets reset.
+    */
+    uint32_t changed_chunks_at_join;
+
+    /*
+      If the client joined while the map was streaming: how many of
+      state_t::get_streamed_chunks() the client has been sent (the ones
+      published before it joined were there when it got the chunks).
+    */
+    uint32_t streamed_chunks_sent;
+
     // The amount of time it takes for the client to receive a message from the server (vice versa)
     float ping;
     float ping_in_progress;
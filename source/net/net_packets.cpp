@@ -18,6 +18,7 @@ const char *packet_type_to_str(packet_type_t type) {
     case PT_CLIENT_COMMANDS: return "CLIENT_COMMANDS";
     case PT_GAME_STATE_SNAPSHOT: return "GAME_STATE_SNAPSHOT";
     case PT_CHUNK_VOXELS: return "CHUNK_VOXELS";
+    case PT_REVERT_CHUNKS: return "REVERT_CHUNKS";
     default: return "INVALID";
     }
 }
@@ -405,7 +406,7 @@ packet_t get_next_packet_udp(context_t *ctx) {
 
     packet.from = {};
     packet.bytes_received = ctx->main_udp_recv_from(
-        ctx->message_buffer, sizeof(char) * net::NET_MAX_MESSAGE_SIZE,
+        ctx->message_buffer, sizeof(char) * net::NET_MESSAGE_BUFFER_SIZE,
         &packet.from);
 
     packet.serialiser.data_buffer = (uint8_t *)ctx->message_buffer;
@@ -423,7 +424,7 @@ packet_t get_next_packet_tcp(socket_t sock, context_t *ctx) {
     packet.bytes_received = receive_from_bound_address(
         sock,
         ctx->message_buffer,
-        sizeof(char) * net::NET_MAX_MESSAGE_SIZE);
+        sizeof(char) * net::NET_MESSAGE_BUFFER_SIZE);
 
     packet.serialiser.data_buffer = (uint8_t *)ctx->message_buffer;
     packet.serialiser.data_buffer_size = packet.bytes_received;
@@ -37,6 +37,8 @@ enum packet_type_t {
     PT_GAME_STATE_SNAPSHOT,
     // Server sends this to the clients when they join at the beginning
     PT_CHUNK_VOXELS,
+    // Server sends this to the clients when the map gets reset (chunks to put back the way they were)
+    PT_REVERT_CHUNKS,
 };
 
 const char *packet_type_to_str(packet_type_t type);
@@ -160,7 +162,8 @@ struct packet_game_state_snapshot_t {
 struct voxel_chunk_values_t {
     // Chunk coord
     int16_t x, y, z;
-    const vkph::voxel_t *voxel_values;
+    const uint8_t *values;
+    const vkph::voxel_color_t *colors;
 };
 
 struct packet_chunk_voxels_t {
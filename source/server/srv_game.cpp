@@ -1,5 +1,6 @@
 #include "srv_net.hpp"
 #include "srv_main.hpp"
+#include "srv_game.hpp"
 #include <vkph_chunk.hpp>
 #include <vkph_state.hpp>
 #include <vkph_events.hpp>
@@ -12,11 +13,22 @@ namespace srv {
 
 static vkph::listener_t game_listener;
 
+// How far from the spawn position the terrain has to be there when the player spawns
+static constexpr float SPAWN_AREA_RADIUS = 64.0f;
+
+void load_spawn_area(const vector3_t &ws_spawn_position, vkph::state_t *state) {
+    if (state->is_streaming_map()) {
+        state->finish_map_stream_around(ws_spawn_position, SPAWN_AREA_RADIUS);
+    }
+}
+
 void spawn_player(uint32_t client_id, vkph::state_t *state) {
     LOG_INFOV("Client %i spawned\n", client_id);
 
     int32_t local_id = state->get_local_id(client_id);
     vkph::player_t *p = state->get_player(local_id);
+
+    load_spawn_area(p->next_random_spawn_position, state);
     p->health = 200;
     p->ws_position = p->next_random_spawn_position;
     p->ws_view_direction = glm::normalize(-p->ws_position);
@@ -110,7 +122,7 @@ static float s_tube(float x, float y, float z) {
     }
 }
 
-void init_game(vkph::state_t *state) {
+void init_game(vkph::state_t *state, const game_config_t *config) {
     game_listener = set_listener_callback(&s_game_listener, state);
 
     vkph::subscribe_to_event(vkph::ET_NEW_PLAYER, game_listener);
@@ -120,11 +132,30 @@ void init_game(vkph::state_t *state) {
     state->prepare();
 
     state->configure_game_mode(vkph::game_mode_t::DEATHMATCH);
-    state->configure_map("ice.map");
+    // Where the players spawn around (see load_spawn_area())
+    vector3_t spawn_area_center = vector3_t(0.0f);
+    state->configure_map(config->map_path, &spawn_area_center);
+
+    if (config->generate_terrain) {
+        vkph::terrain_create_info_t terrain_info = vkph::get_default_terrain_info(config->terrain_seed);
+        state->configure_terrain(&terrain_info);
+    }
+
     state->configure_team_count(2);
     state->configure_team(0, vkph::team_color_t::BLUE, 10);
     state->configure_team(1, vkph::team_color_t::RED, 10);
     state->start_session();
+
+    // The chunks which are still streaming in get added when they get published
+    state->capture_baseline();
+}
+
+void reset_map(vkph::state_t *state) {
+    send_chunk_reverts(state);
+
+    uint32_t reverted_count = state->reset_to_baseline();
+
+    LOG_INFOV("Reset the map (%d chunks changed)\n", reverted_count);
 }
 
 // Compensate for lag
@@ -4,8 +4,29 @@
 
 namespace srv {
 
-void init_game(vkph::state_t *state);
+struct game_config_t {
+    // In assets/maps: the map which gets loaded, or where the generated terrain gets saved
+    const char *map_path;
+    // Generates the map (vkph::get_default_terrain_info(terrain_seed)) instead of loading it
+    bool generate_terrain;
+    uint32_t terrain_seed;
+};
+
+void init_game(vkph::state_t *state, const game_config_t *config);
 void tick_game(vkph::state_t *state);
 void spawn_player(uint32_t client_id, vkph::state_t *state);
+/*
+  Players spawn at random positions around the origin and fly towards it
+  (as meteorites), so the map streams in from the origin. While it's still
+  streaming, this publishes the blocks around a spawn position, and with
+  them all the ones between it and the origin.
+*/
+void load_spawn_area(const vector3_t &ws_spawn_position, vkph::state_t *state);
+/*
+  Puts the chunks which changed during the match back the way they were
+  when the map got loaded (only these get copied), and tells the clients
+  to do the same.
+*/
+void reset_map(vkph::state_t *state);
 
 }
@@ -7,6 +7,7 @@
 #include <files.hpp>
 #include <allocators.hpp>
 
+#include <vkph_map.hpp>
 #include <vkph_state.hpp>
 #include <vkph_events.hpp>
 
@@ -24,6 +25,33 @@ static float dt;
 static time_stamp_t tick_start;
 static time_stamp_t tick_end;
 
+/*
+  vkPhysics_server --save-interval <seconds>
+  Saves the map (in the background) every so often, so that the changes
+  players made to it survive the server getting stopped. 0 (default) if
+  the map doesn't get saved.
+*/
+static float save_interval;
+static float time_since_save;
+
+/*
+  vkPhysics_server --reset-interval <seconds>
+  Puts the map back the way it was when the server started every so often
+  (see reset_map()). 0 (default) if the map doesn't get reset.
+*/
+static float reset_interval;
+static float time_since_reset;
+
+/*
+  vkPhysics_server --map <file>
+  Map (in assets/maps) which gets played, ice.map by default.
+  vkPhysics_server --generate-terrain <seed>
+  Generates the map from the seed instead of loading it (see
+  vkph_terrain_generator.hpp). It only gets saved (to --map, generated.map by
+  default) with --save-interval.
+*/
+static game_config_t game_config;
+
 static void s_begin_time() {
     tick_start = current_time();
 }
@@ -35,6 +63,33 @@ static void s_end_time() {
     state->delta_time = dt;
 }
 
+static void s_tick_map_saving() {
+    if (save_interval <= 0.0f) {
+        return;
+    }
+
+    time_since_save += dt;
+
+    // Only the chunks which changed since the last save get written (to the map's journal)
+    if (time_since_save >= save_interval && !state->is_saving_map()) {
+        state->save_map_in_background();
+        time_since_save = 0.0f;
+    }
+}
+
+static void s_tick_map_reset() {
+    if (reset_interval <= 0.0f) {
+        return;
+    }
+
+    time_since_reset += dt;
+
+    if (time_since_reset >= reset_interval) {
+        reset_map(state);
+        time_since_reset = 0.0f;
+    }
+}
+
 static void s_loop() {
     while (running) {
         s_begin_time();
@@ -50,6 +105,9 @@ static void s_loop() {
 
         state->timestep_end();
 
+        s_tick_map_reset();
+        s_tick_map_saving();
+
         // Sleep to not kill CPU usage
         time_stamp_t current = current_time();
         float dt = time_difference(current, tick_start);
@@ -61,7 +119,32 @@ static void s_loop() {
     }
 }
 
+/*
+  vkPhysics_server --convert-maps <path>...
+  Rewrites the given map files (in assets/maps) to the latest map file format.
+*/
+static int32_t s_convert_maps(
+    int32_t argc,
+    char *argv[]) {
+    int32_t failed_count = 0;
+
+    for (int32_t i = 2; i < argc; ++i) {
+        if (!vkph::convert_map_file(argv[i], argv[i])) {
+            LOG_ERRORV("Failed to convert map %s\n", argv[i]);
+            ++failed_count;
+        }
+    }
+
+    return failed_count ? 1 : 0;
+}
+
 static void s_handle_interrupt(int signum) {
+    if (save_interval > 0.0f) {
+        // The loop stops at the end of the tick, and the last save gets finished
+        running = 0;
+        return;
+    }
+
     deactivate_server();
 
     LOG_INFO("Stopped running server\n");
@@ -79,15 +162,44 @@ int32_t run(
     running = 1;
     files_init();
 
+    if (argc > 1 && !strcmp(argv[1], "--convert-maps")) {
+        return s_convert_maps(argc, argv);
+    }
+
+    for (int32_t i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--save-interval") && i + 1 < argc) {
+            save_interval = (float)atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--reset-interval") && i + 1 < argc) {
+            reset_interval = (float)atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--map") && i + 1 < argc) {
+            game_config.map_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--generate-terrain") && i + 1 < argc) {
+            game_config.generate_terrain = 1;
+            game_config.terrain_seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }
+    }
+
+    if (!game_config.map_path) {
+        game_config.map_path = game_config.generate_terrain ? "generated.map" : "ice.map";
+    }
+
     state = flmalloc<vkph::state_t>();
 
     init_net(state);
-    init_game(state);
+    init_game(state, &game_config);
 
     lnclear();
 
     s_loop();
 
+    if (save_interval > 0.0f) {
+        // Finishes the save which is in progress, and writes the last changes
+        state->save_map();
+    }
+
     deactivate_server();
 
     vkph::dispatch_events();
@@ -16,6 +16,8 @@
 #include <vkph_event_data.hpp>
 #include <vkph_chunk.hpp>
 #include <vkph_physics.hpp>
+#include <vkph_map_baseline.hpp>
+#include <vkph_chunk_index.hpp>
 
 #include <net_context.hpp>
 #include <net_packets.hpp>
@@ -182,7 +184,8 @@ static bool s_send_packet_connection_handshake(
 }
 
 static constexpr uint32_t s_maximum_chunks_per_packet() {
-    return ((65507 - sizeof(uint32_t)) / (sizeof(int16_t) * 3 + vkph::CHUNK_BYTE_SIZE));
+    // Big chunks (32x32x32) don't fit in a UDP sized message, but at least one needs to go in each packet
+    return MAX(1u, (uint32_t)((net::NET_MAX_MESSAGE_SIZE - net::NET_CHUNK_PACKET_OVERHEAD) / (sizeof(int16_t) * 3 + vkph::CHUNK_BYTE_SIZE)));
 }
 
 static bool s_serialise_chunk(
@@ -199,45 +202,44 @@ static bool s_serialise_chunk(
     serialiser->serialise_int16(current_values->z);
 
     // Do a compression of the chunk values
-    for (uint32_t v_index = 0; v_index < vkph::CHUNK_VOXEL_COUNT; ++v_index) {
-        uint32_t debug = v_index;
+    if (!vkph::serialise_chunk_voxels(serialiser, current_values->values, current_values->colors)) {
+        serialiser->data_buffer_head = before_chunk_ptr;
+        return 0;
+    }
 
-        vkph::voxel_t current_voxel = current_values->voxel_values[v_index];
-        if (current_voxel.value == 0) {
-            uint32_t before_head = serialiser->data_buffer_head;
+    *chunks_in_packet = *chunks_in_packet + 1;
 
-            static constexpr uint32_t MAX_ZERO_COUNT_BEFORE_COMPRESSION = 3;
+    return 1;
+}
 
-            uint32_t zero_count = 0;
-            for (; current_values->voxel_values[v_index].value == 0 && zero_count < MAX_ZERO_COUNT_BEFORE_COMPRESSION; ++v_index, ++zero_count) {
-                serialiser->serialise_uint8(0);
-                serialiser->serialise_uint8(0);
-            }
+static constexpr uint32_t MAX_CHUNK_PACKET_COUNT = sizeof(net::client_t::chunk_packets) / sizeof(net::client_t::chunk_packets[0]);
 
-            if (zero_count == MAX_ZERO_COUNT_BEFORE_COMPRESSION) {
-                for (; current_values->voxel_values[v_index].value == 0; ++v_index, ++zero_count) {}
+// The chunk packets get sent one per tick (see s_send_pending_chunks), after the ones which are already queued
+static bool s_queue_chunk_packet(net::client_t *client, const serialiser_t *serialiser) {
+    if (client->current_chunk_sending == client->chunk_packet_count) {
+        // All of them got sent
+        client->chunk_packet_count = 0;
+        client->current_chunk_sending = 0;
+    }
 
-                if (zero_count >= vkph::CHUNK_VOXEL_COUNT) {
-                    serialiser->data_buffer_head = before_chunk_ptr;
-                    
-                    return 0;
-                }
+    if (client->chunk_packet_count == MAX_CHUNK_PACKET_COUNT) {
+        LOG_ERRORV("Too many chunk packets are queued for client %s\n", client->name);
+        return 0;
+    }
 
-                serialiser->data_buffer_head = before_head;
-                serialiser->serialise_uint8(vkph::CHUNK_SPECIAL_VALUE);
-                serialiser->serialise_uint8(vkph::CHUNK_SPECIAL_VALUE);
-                serialiser->serialise_uint32(zero_count);
-            }
+    net::packet_chunk_voxels_t *packet_to_save = &client->chunk_packets[client->chunk_packet_count++];
+    packet_to_save->chunk_data = flmalloc<vkph::voxel_t>(serialiser->data_buffer_head);
+    memcpy(packet_to_save->chunk_data, serialiser->data_buffer, serialiser->data_buffer_head);
+    packet_to_save->size = serialiser->data_buffer_head;
 
-            v_index -= 1;
-        }
-        else {
-            serialiser->serialise_uint8(current_voxel.value);
-            serialiser->serialise_uint8(current_voxel.color);
+    for (uint32_t i = 0; i < clients_to_send_chunks_to.data_count; ++i) {
+        if (clients_to_send_chunks_to[i] == client->client_id) {
+            return 1;
         }
     }
 
-    *chunks_in_packet = *chunks_in_packet + 1;
+    uint32_t index = clients_to_send_chunks_to.add();
+    clients_to_send_chunks_to[index] = client->client_id;
 
     return 1;
 }
@@ -250,7 +252,7 @@ static uint32_t s_prepare_packet_chunk_voxels(
     const vkph::state_t *state) {
     net::packet_header_t header = {};
     header.flags.packet_type = net::PT_CHUNK_VOXELS;
-    header.flags.total_packet_size = s_maximum_chunks_per_packet() * (3 * sizeof(int16_t) + vkph::CHUNK_BYTE_SIZE);
+    header.flags.total_packet_size = net::NET_CHUNK_PACKET_OVERHEAD + s_maximum_chunks_per_packet() * (3 * sizeof(int16_t) + vkph::CHUNK_BYTE_SIZE);
     header.current_tick = state->current_tick;
     header.current_packet_count = ctx->current_packet;
     header.tag = ctx->tag;
@@ -268,9 +270,6 @@ static uint32_t s_prepare_packet_chunk_voxels(
     serialiser.serialise_uint32(0);
 
     uint32_t chunk_values_start = serialiser.data_buffer_head;
-    
-    uint32_t index = clients_to_send_chunks_to.add();
-    clients_to_send_chunks_to[index] = client->client_id;
 
     uint32_t total_chunks_to_send = 0;
 
@@ -291,11 +290,7 @@ static uint32_t s_prepare_packet_chunk_voxels(
             header.serialise(&serialiser);
             serialiser.data_buffer_head = actual_packet_size;
 
-            net::packet_chunk_voxels_t *packet_to_save = &client->chunk_packets[client->chunk_packet_count++];
-            packet_to_save->chunk_data = flmalloc<vkph::voxel_t>(serialiser.data_buffer_head);
-            memcpy(packet_to_save->chunk_data, serialiser.data_buffer, serialiser.data_buffer_head);
-            //packet_to_save->chunk_data = serialiser.data_buffer;
-            packet_to_save->size = serialiser.data_buffer_head;
+            s_queue_chunk_packet(client, &serialiser);
 
             serialiser.data_buffer_head = chunk_values_start;
 
@@ -304,11 +299,100 @@ static uint32_t s_prepare_packet_chunk_voxels(
         }
     }
 
-    client->current_chunk_sending = 0;
-
     return total_chunks_to_send;
 }
 
+// PT_REVERT_CHUNKS
+static void s_prepare_packet_revert_chunks(
+    net::client_t *client,
+    const vkph::state_t *state) {
+    uint32_t changed_count = 0;
+    const ivector3_t *changed_chunks = state->get_changed_baseline_chunks(&changed_count);
+
+    // The client can revert the other ones itself
+    uint32_t full_count = MIN(client->changed_chunks_at_join, changed_count);
+    client->changed_chunks_at_join = 0;
+
+    net::packet_header_t header = {};
+    header.flags.packet_type = net::PT_REVERT_CHUNKS;
+    header.current_tick = state->current_tick;
+    header.current_packet_count = ctx->current_packet;
+    header.tag = ctx->tag;
+
+    serialiser_t serialiser = {};
+    // Needs to fit a whole uncompressed chunk, even with 32x32x32 chunks
+    serialiser.init(net::NET_MESSAGE_BUFFER_SIZE);
+
+    static const uint32_t COORD_SIZE = 3 * sizeof(int16_t);
+    static const uint32_t MAX_COORDS_PER_PACKET = (net::NET_MAX_MESSAGE_SIZE - net::NET_CHUNK_PACKET_OVERHEAD) / COORD_SIZE;
+
+    uint32_t reverted = full_count;
+    uint32_t sent = 0;
+
+    while (reverted < changed_count || sent < full_count) {
+        serialiser.data_buffer_head = 0;
+        header.serialise(&serialiser);
+
+        uint32_t revert_count = MIN(changed_count - reverted, MAX_COORDS_PER_PACKET);
+        serialiser.serialise_uint32(revert_count);
+
+        for (uint32_t i = reverted; i < reverted + revert_count; ++i) {
+            serialiser.serialise_int16((int16_t)changed_chunks[i].x);
+            serialiser.serialise_int16((int16_t)changed_chunks[i].y);
+            serialiser.serialise_int16((int16_t)changed_chunks[i].z);
+        }
+
+        reverted += revert_count;
+
+        // Then as many chunks with their voxels as there is space for
+        uint8_t *chunk_count_byte = &serialiser.data_buffer[serialiser.data_buffer_head];
+        serialiser.serialise_uint32(0);
+
+        uint32_t chunks_in_packet = 0;
+
+        while (sent < full_count &&
+               serialiser.data_buffer_head + COORD_SIZE + vkph::CHUNK_BYTE_SIZE <= serialiser.data_buffer_size) {
+            net::voxel_chunk_values_t values = {};
+            values.x = (int16_t)changed_chunks[sent].x;
+            values.y = (int16_t)changed_chunks[sent].y;
+            values.z = (int16_t)changed_chunks[sent].z;
+
+            // Air if it isn't in the baseline
+            static const uint8_t AIR[vkph::CHUNK_BYTE_SIZE] = {};
+            const uint8_t *voxels = state->baseline->get_voxels(changed_chunks[sent]);
+            values.values = voxels ? voxels : AIR;
+            values.colors = (const vkph::voxel_color_t *)(values.values + vkph::CHUNK_VOXEL_COUNT);
+
+            if (!s_serialise_chunk(&serialiser, &chunks_in_packet, &values, 0)) {
+                // serialise_voxels() doesn't encode chunks which are only air, but the client needs to make this one air
+                serialiser.serialise_int16(values.x);
+                serialiser.serialise_int16(values.y);
+                serialiser.serialise_int16(values.z);
+                serialiser.serialise_uint8(vkph::CHUNK_SPECIAL_VALUE);
+                serialiser.serialise_uint8(vkph::CHUNK_SPECIAL_VALUE);
+                serialiser.serialise_uint32(vkph::CHUNK_VOXEL_COUNT);
+
+                ++chunks_in_packet;
+            }
+
+            ++sent;
+        }
+
+        serialiser.serialise_uint32(chunks_in_packet, chunk_count_byte);
+
+        // Serialise the header with the actual packet size
+        uint32_t actual_packet_size = serialiser.data_buffer_head;
+        header.flags.total_packet_size = actual_packet_size;
+        serialiser.data_buffer_head = 0;
+        header.serialise(&serialiser);
+        serialiser.data_buffer_head = actual_packet_size;
+
+        if (!s_queue_chunk_packet(client, &serialiser)) {
+            break;
+        }
+    }
+}
+
 // Sends handshake, and starts sending voxels
 static void s_send_game_state_to_new_client(
     uint16_t client_id,
@@ -319,6 +403,13 @@ static void s_send_game_state_to_new_client(
 
     net::client_t *client = ctx->clients.get(client_id);
 
+    // The chunks which get sent become the client's baseline
+    state->get_changed_baseline_chunks(&client->changed_chunks_at_join);
+
+    // The chunks which the map stream publishes from now on get sent later (see s_send_streamed_chunks())
+    client->syncing_map_stream = state->is_streaming_map();
+    state->get_streamed_chunks(&client->streamed_chunks_sent);
+
     // Send chunk information
     uint32_t max_chunks_per_packet = s_maximum_chunks_per_packet();
     LOG_INFOV("Maximum chunks per packet: %i\n", max_chunks_per_packet);
@@ -328,19 +419,22 @@ static void s_send_game_state_to_new_client(
     uint32_t count = 0;
     for (uint32_t i = 0; i < loaded_chunk_count; ++i) {
         const vkph::chunk_t *c = chunks[i];
-        if (c) {
+
+        // Empty chunks never get sent (saves having to scan through their voxels)
+        if (c && c->occupancy.max_value > 0) {
             voxel_chunks[count].x = c->chunk_coord.x;
             voxel_chunks[count].y = c->chunk_coord.y;
             voxel_chunks[count].z = c->chunk_coord.z;
 
-            voxel_chunks[count].voxel_values = c->voxels;
+            voxel_chunks[count].values = c->values;
+            voxel_chunks[count].colors = c->colors;
 
             ++count;
         }
     }
 
     // Cannot send all of these at the same bloody time
-    uint32_t chunks_to_send = s_prepare_packet_chunk_voxels(client, voxel_chunks, loaded_chunk_count, state);
+    uint32_t chunks_to_send = s_prepare_packet_chunk_voxels(client, voxel_chunks, count, state);
 
     if (s_send_packet_connection_handshake(
         client_id,
@@ -396,7 +490,7 @@ static void s_send_packet_player_joined(
 static net::client_t *s_receive_packet_connection_request(
     serialiser_t *serialiser,
     net::address_t address,
-    const vkph::state_t *state,
+    vkph::state_t *state,
     net::socket_t tcp_s) {
     net::packet_connection_request_t request = {};
     request.deserialise(serialiser);
@@ -449,6 +543,9 @@ static net::client_t *s_receive_packet_connection_request(
     float y_rand = (float)(rand() % 100 + 100) * (rand() % 2 == 0 ? -1 : 1);
     float z_rand = (float)(rand() % 100 + 100) * (rand() % 2 == 0 ? -1 : 1);
     event_data->info.next_random_spawn_position = vector3_t(x_rand, y_rand, z_rand);
+
+    // If the map is still streaming, the player doesn't get simulated in an empty world
+    load_spawn_area(event_data->info.next_random_spawn_position, state);
     
     submit_event(vkph::ET_NEW_PLAYER, event_data);
 
@@ -610,9 +707,9 @@ static void s_receive_packet_client_commands(
                                 commands.prediction.chunk_modifications[i].z));
 
                         for (uint32_t v = 0; v < commands.prediction.chunk_modifications[i].modified_voxels_count; ++v) {
-                            uint8_t initial_value = c_ptr->voxels[commands.prediction.chunk_modifications[i].modifications[v].index].value;
-                            if (c_ptr->history.modification_pool[commands.prediction.chunk_modifications[i].modifications[v].index] != vkph::CHUNK_SPECIAL_VALUE) {
-                                //initial_value = c_ptr->history.modification_pool[commands.chunk_modifications[i].modifications[v].index];
+                            uint8_t initial_value = c_ptr->values[commands.prediction.chunk_modifications[i].modifications[v].index];
+                            if (c_ptr->history && c_ptr->history->modification_pool[commands.prediction.chunk_modifications[i].modifications[v].index] != vkph::CHUNK_SPECIAL_VALUE) {
+                                //initial_value = c_ptr->history->modification_pool[commands.chunk_modifications[i].modifications[v].index];
                             }
                             if (initial_value != commands.prediction.chunk_modifications[i].modifications[v].initial_value) {
                                 LOG_INFOV(
@@ -789,11 +886,10 @@ static bool s_check_if_client_has_to_correct_terrain(net::client_t *c, vkph::sta
         for (uint32_t vm_index = 0; vm_index < cm_ptr->modified_voxels_count; ++vm_index) {
             net::voxel_modification_t *vm_ptr = &cm_ptr->modifications[vm_index];
 
-            vkph::voxel_t *voxel_ptr = &c_ptr->voxels[vm_ptr->index];
-            uint8_t actual_value = voxel_ptr->value;
+            uint8_t actual_value = c_ptr->values[vm_ptr->index];
             uint8_t predicted_value = vm_ptr->final_value;
 
-            vkph::voxel_color_t color = voxel_ptr->color;
+            vkph::voxel_color_t color = c_ptr->colors[vm_ptr->index];
 
             // Just one mistake can completely mess stuff up between the client and server
             if (actual_value != predicted_value) {
@@ -827,8 +923,10 @@ static bool s_check_if_client_has_to_correct_terrain(net::client_t *c, vkph::sta
 static void s_add_chunk_modifications_to_game_state_snapshot(
     net::packet_game_state_snapshot_t *snapshot,
     vkph::state_t *state) {
-    // Up to 300 chunks can be modified between game dispatches
-    net::chunk_modifications_t *modifications = lnmalloc<net::chunk_modifications_t>(net::NET_MAX_ACCUMULATED_PREDICTED_CHUNK_MODIFICATIONS_PER_PACK);
+    // There is at most one entry per modified chunk
+    uint32_t max_modification_count = 0;
+    state->get_modified_chunks(&max_modification_count);
+    net::chunk_modifications_t *modifications = lnmalloc<net::chunk_modifications_t>(MAX(max_modification_count, 1u));
 
     // Don't need the initial values - the client will use its values for voxels as the "initial" values
     uint32_t modification_count = fill_chunk_modification_array_with_colors(modifications, state);
@@ -1047,6 +1145,63 @@ static void s_send_pending_chunks() {
     }
 }
 
+/*
+  Clients who joined while the map was streaming got the chunks which had
+  been published. The ones which got published after get sent once all the
+  chunk packets which were queued for the client have gone out.
+*/
+static void s_send_streamed_chunks(const vkph::state_t *state) {
+    uint32_t streamed_count = 0;
+    const ivector3_t *streamed_chunks = state->get_streamed_chunks(&streamed_count);
+
+    // As many chunks as the queue can take
+    uint32_t max_chunk_count = MAX_CHUNK_PACKET_COUNT * s_maximum_chunks_per_packet();
+
+    for (uint32_t i = 0; i < ctx->clients.data_count; ++i) {
+        net::client_t *c = &ctx->clients[i];
+
+        if (!c->initialised || !c->syncing_map_stream || c->current_chunk_sending != c->chunk_packet_count) {
+            continue;
+        }
+
+        net::voxel_chunk_values_t *voxel_chunks = lnmalloc<net::voxel_chunk_values_t>(max_chunk_count);
+        uint32_t count = 0;
+
+        // Chunks which are made of several blocks are in there several times
+        vkph::chunk_index_t added;
+        added.init(max_chunk_count * 2);
+
+        for (; c->streamed_chunks_sent < streamed_count && count < max_chunk_count; ++c->streamed_chunks_sent) {
+            const ivector3_t &coord = streamed_chunks[c->streamed_chunks_sent];
+            const vkph::chunk_t *chunk = state->access_chunk(coord);
+
+            // Air doesn't need to be sent (the client doesn't have the chunk yet)
+            if (chunk && chunk->occupancy.max_value > 0 && !added.get(coord)) {
+                added.insert(coord, count);
+
+                voxel_chunks[count].x = coord.x;
+                voxel_chunks[count].y = coord.y;
+                voxel_chunks[count].z = coord.z;
+                voxel_chunks[count].values = chunk->values;
+                voxel_chunks[count].colors = chunk->colors;
+
+                ++count;
+            }
+        }
+
+        added.destroy();
+
+        if (count) {
+            s_prepare_packet_chunk_voxels(c, voxel_chunks, count, state);
+        }
+
+        if (c->streamed_chunks_sent == streamed_count && !state->is_streaming_map()) {
+            c->syncing_map_stream = 0;
+            LOG_INFOV("Client %s got all the chunks of the map\n", c->name);
+        }
+    }
+}
+
 static void s_ping_clients(const vkph::state_t *state) {
     // Send a ping
     serialiser_t serialiser = {};
@@ -1156,7 +1311,7 @@ static void s_check_pending_connections(vkph::state_t *state) {
         auto *pconn = &pending_conns[i];
 
         if (pconn->pending) {
-            int32_t byte_count = net::receive_from_bound_address(pconn->s, ctx->message_buffer, sizeof(char) * net::NET_MAX_MESSAGE_SIZE);
+            int32_t byte_count = net::receive_from_bound_address(pconn->s, ctx->message_buffer, sizeof(char) * net::NET_MESSAGE_BUFFER_SIZE);
 
             if (byte_count > 0) {
                 serialiser_t in_serialiser = {};
@@ -1173,7 +1328,7 @@ static void s_check_pending_connections(vkph::state_t *state) {
 
                         net::client_t *new_client = s_receive_packet_connection_request(&in_serialiser, addr, state, pconn->s);
 
-                        net::set_socket_send_buffer_size(new_client->tcp_socket, net::NET_MAX_MESSAGE_SIZE * 2);
+                        net::set_socket_send_buffer_size(new_client->tcp_socket, net::NET_MESSAGE_BUFFER_SIZE * 2);
 
                         pconn->pending = 0;
                         pending_conns.remove(i);
@@ -1222,6 +1377,7 @@ static void s_tick_server(vkph::state_t *state) {
     world_elapsed += delta_time();
 
     if (world_elapsed >= net::NET_SERVER_CHUNK_WORLD_OUTPUT_INTERVAL) {
+        s_send_streamed_chunks(state);
         s_send_pending_chunks();
 
         world_elapsed = 0.0f;
@@ -1231,7 +1387,7 @@ static void s_tick_server(vkph::state_t *state) {
         net::address_t received_address = {};
         int32_t received = ctx->main_udp_recv_from(
             ctx->message_buffer,
-            sizeof(char) * net::NET_MAX_MESSAGE_SIZE,
+            sizeof(char) * net::NET_MESSAGE_BUFFER_SIZE,
             &received_address);
 
         if (received > 0) {
@@ -1303,7 +1459,7 @@ void init_net(vkph::state_t *state) {
 
     net::init_socket_api();
 
-    ctx->message_buffer = flmalloc<char>(net::NET_MAX_MESSAGE_SIZE);
+    ctx->message_buffer = flmalloc<char>(net::NET_MESSAGE_BUFFER_SIZE);
 
     // meta_socket_init();
     init_meta_connection();
@@ -1314,6 +1470,16 @@ void tick_net(vkph::state_t *state) {
     s_tick_server(state);
 }
 
+void send_chunk_reverts(const vkph::state_t *state) {
+    for (uint32_t i = 0; i < ctx->clients.data_count; ++i) {
+        net::client_t *c = &ctx->clients[i];
+
+        if (c->initialised) {
+            s_prepare_packet_revert_chunks(c, state);
+        }
+    }
+}
+
 const net::client_t *get_client(uint32_t i) {
     return &ctx->clients[i];
 }
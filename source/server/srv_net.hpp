@@ -17,6 +17,8 @@ namespace srv {
 
 void init_net(vkph::state_t *state);
 void tick_net(vkph::state_t *state);
+// Before the chunks get reverted (see reset_map())
+void send_chunk_reverts(const vkph::state_t *state);
 const net::client_t *get_client(uint32_t i);
 
 }